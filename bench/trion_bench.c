@@ -0,0 +1,651 @@
+// trion_bench.c
+// Micro-benchmarks for the runtime's hot paths: channels, quarantines, base-12 conversion,
+// syscall dispatch, capsule lifecycle, the NASM JIT bridge and precompiled module startup.
+//
+// The runtime is compiled into this translation unit so internal entry points are reachable.
+// Every result is printed as one JSON object per line:
+//   {"bench":"channel.pingpong","params":{"kind":"spsc"},"iters":N,"ns_per_op":x,"ops_per_sec":y}
+// followed by extra fields some benchmarks add (e.g. "mb_per_sec"). Lines starting with '#'
+// are human-readable notes.
+//
+// Usage: trion_bench [--filter SUBSTR] [--min-ms N] [--threads N]
+//   --filter   run only benchmarks whose name contains SUBSTR
+//   --min-ms   minimum measured time per result (default 200)
+//   --threads  largest thread count for multi-threaded benchmarks (default: online CPUs, >= 2)
+
+#include "../trion_runtime.c"
+
+/* ---------------------------
+   Harness
+   - each benchmark is a function running `iters` operations and returning elapsed ns
+   - the iteration count grows until a run takes at least --min-ms; the best of three runs at
+     that count is reported, which filters out scheduler noise better than the mean
+   --------------------------- */
+
+typedef uint64_t (*bench_fn_t)(void *ctx, uint64_t iters);
+
+static const char *g_bench_filter = NULL;
+static uint64_t g_bench_min_ns = 200ull * 1000000ull;
+static size_t g_bench_threads = 0;
+
+static uint64_t bench_now_ns(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static int bench_selected(const char *name)
+{
+    return !g_bench_filter || strstr(name, g_bench_filter) != NULL;
+}
+
+/* params: pre-rendered JSON object body, e.g. "\"kind\":\"spsc\""; extra: trailing fields or "" */
+static void bench_report(const char *name, const char *params, uint64_t iters, uint64_t ns, const char *extra)
+{
+    double per = iters ? (double)ns / (double)iters : 0.0;
+    double rate = ns ? (double)iters * 1e9 / (double)ns : 0.0;
+    printf("{\"bench\":\"%s\",\"params\":{%s},\"iters\":%llu,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f%s%s}\n",
+           name, params, (unsigned long long)iters, per, rate, extra[0] ? "," : "", extra);
+    fflush(stdout);
+}
+
+/* returns the best elapsed time and stores the iteration count it was measured at */
+static uint64_t bench_measure(bench_fn_t fn, void *ctx, uint64_t *iters_out)
+{
+    uint64_t iters = 1, ns = 0;
+    for (;;) {
+        ns = fn(ctx, iters);
+        if (ns >= g_bench_min_ns || iters >= (1ull << 40)) break;
+        /* jump close to the target instead of doubling from 1 every time */
+        uint64_t next = ns ? (uint64_t)((double)iters * (double)g_bench_min_ns * 1.2 / (double)ns) : iters * 100;
+        if (next <= iters) next = iters * 2;
+        if (next > iters * 100) next = iters * 100;
+        iters = next;
+    }
+    for (int rep = 0; rep < 2; ++rep) {
+        uint64_t again = fn(ctx, iters);
+        if (again < ns) ns = again;
+    }
+    *iters_out = iters;
+    return ns;
+}
+
+static void bench_run(const char *name, const char *params, bench_fn_t fn, void *ctx)
+{
+    if (!bench_selected(name)) return;
+    uint64_t iters;
+    uint64_t ns = bench_measure(fn, ctx, &iters);
+    bench_report(name, params, iters, ns, "");
+}
+
+static const char *bench_kind_name(int kind)
+{
+    return kind == TR_CHANNEL_SPSC ? "spsc" : kind == TR_CHANNEL_MPSC ? "mpsc" : "locked";
+}
+
+/* ---------------------------
+   Channels
+   - ping-pong: one round trip (two sends, two blocking receives) between two threads
+   - fan-in: P producers into one consumer; one op = one item delivered
+   --------------------------- */
+
+typedef struct {
+    int kind;
+    Channel *ping;
+    Channel *pong;
+    uint64_t iters;
+} PingPongCtx;
+
+static void *bench_pong_thread(void *arg)
+{
+    PingPongCtx *p = (PingPongCtx*)arg;
+    void *m;
+    for (uint64_t i = 0; i < p->iters; ++i) {
+        if (channel_recv(p->ping, &m, 1, 0) != 1) break;
+        channel_send(p->pong, m, 1, 0);
+    }
+    return NULL;
+}
+
+static uint64_t bench_channel_pingpong(void *ctx, uint64_t iters)
+{
+    PingPongCtx *p = (PingPongCtx*)ctx;
+    p->ping = channel_create_ex(16, p->kind);
+    p->pong = channel_create_ex(16, p->kind);
+    p->iters = iters;
+    tr_thread_t t;
+    tr_thread_create(&t, bench_pong_thread, p);
+    void *m;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        channel_send(p->ping, (void*)(uintptr_t)(i + 1), 1, 0);
+        channel_recv(p->pong, &m, 1, 0);
+    }
+    uint64_t ns = bench_now_ns() - t0;
+    tr_thread_join(t);
+    channel_destroy(p->ping);
+    channel_destroy(p->pong);
+    return ns;
+}
+
+typedef struct {
+    int kind;
+    size_t producers;
+    Channel *ch;
+    uint64_t per_producer;
+} FanInCtx;
+
+static void *bench_fanin_producer(void *arg)
+{
+    FanInCtx *f = (FanInCtx*)arg;
+    for (uint64_t i = 0; i < f->per_producer; ++i) channel_send(f->ch, (void*)(uintptr_t)(i + 1), 1, 0);
+    return NULL;
+}
+
+static uint64_t bench_channel_fanin(void *ctx, uint64_t iters)
+{
+    FanInCtx *f = (FanInCtx*)ctx;
+    f->per_producer = iters / f->producers ? iters / f->producers : 1;
+    uint64_t total = f->per_producer * f->producers;
+    f->ch = channel_create_ex(256, f->kind);
+    tr_thread_t t[64];
+    uint64_t t0 = bench_now_ns();
+    for (size_t i = 0; i < f->producers; ++i) tr_thread_create(&t[i], bench_fanin_producer, f);
+    void *batch[64];
+    uint64_t got = 0;
+    while (got < total) {
+        int n = channel_recv_many(f->ch, batch, 64, 1, 0);
+        if (n <= 0) break;
+        got += (uint64_t)n;
+    }
+    uint64_t ns = bench_now_ns() - t0;
+    for (size_t i = 0; i < f->producers; ++i) tr_thread_join(t[i]);
+    channel_destroy(f->ch);
+    /* report per delivered item even when iters was not a multiple of the producer count */
+    return total == iters ? ns : (uint64_t)((double)ns * (double)iters / (double)total);
+}
+
+static void bench_channels(void)
+{
+    static const int kinds[] = { TR_CHANNEL_LOCKED, TR_CHANNEL_SPSC, TR_CHANNEL_MPSC };
+    char params[128];
+    for (size_t k = 0; k < 3; ++k) {
+        PingPongCtx p;
+        memset(&p, 0, sizeof(p));
+        p.kind = kinds[k];
+        snprintf(params, sizeof(params), "\"kind\":\"%s\"", bench_kind_name(p.kind));
+        bench_run("channel.pingpong", params, bench_channel_pingpong, &p);
+    }
+    /* SPSC only allows one producer, so fan-in compares the locked and MPSC kinds */
+    static const int fan_kinds[] = { TR_CHANNEL_LOCKED, TR_CHANNEL_MPSC };
+    for (size_t k = 0; k < 2; ++k) {
+        for (size_t np = 1; np <= g_bench_threads && np <= 64; np *= 2) {
+            FanInCtx f;
+            memset(&f, 0, sizeof(f));
+            f.kind = fan_kinds[k];
+            f.producers = np;
+            snprintf(params, sizeof(params), "\"kind\":\"%s\",\"producers\":%zu", bench_kind_name(f.kind), np);
+            bench_run("channel.fanin", params, bench_channel_fanin, &f);
+        }
+    }
+}
+
+/* ---------------------------
+   Quarantine
+   - one op = one alloc + one free; `live` objects are allocated, then freed, per round
+   - frees go in reverse allocation order; tracked mode's free is a linear scan of its table,
+     so its cost grows with `live`
+   --------------------------- */
+
+typedef struct {
+    int mode;
+    size_t live;
+    size_t size;
+    void **ptrs;
+} QuarantineCtx;
+
+static Quarantine *bench_quarantine_new(int mode)
+{
+    if (mode == TR_QUARANTINE_ARENA) return quarantine_create_arena(0);
+    if (mode == TR_QUARANTINE_SLAB) return quarantine_create_slab();
+    return quarantine_create(16);
+}
+
+static uint64_t bench_quarantine(void *ctx, uint64_t iters)
+{
+    QuarantineCtx *b = (QuarantineCtx*)ctx;
+    Quarantine *q = bench_quarantine_new(b->mode);
+    uint64_t rounds = (iters + b->live - 1) / b->live;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < b->live; ++i) b->ptrs[i] = quarantine_alloc(q, b->size);
+        for (size_t i = b->live; i-- > 0;) quarantine_free(q, b->ptrs[i]);
+    }
+    uint64_t ns = bench_now_ns() - t0;
+    quarantine_destroy(q);
+    return (uint64_t)((double)ns * (double)iters / (double)(rounds * b->live));
+}
+
+static void bench_quarantines(void)
+{
+    static const int modes[] = { TR_QUARANTINE_TRACKED, TR_QUARANTINE_ARENA, TR_QUARANTINE_SLAB };
+    static const char *names[] = { "tracked", "arena", "slab" };
+    static const size_t lives[] = { 1, 64, 1024, 16384 };
+    char params[128];
+    for (size_t m = 0; m < 3; ++m) {
+        for (size_t l = 0; l < sizeof(lives) / sizeof(lives[0]); ++l) {
+            QuarantineCtx b;
+            b.mode = modes[m];
+            b.live = lives[l];
+            b.size = 64;
+            b.ptrs = (void**)malloc(b.live * sizeof(void*));
+            if (!b.ptrs) continue;
+            snprintf(params, sizeof(params), "\"mode\":\"%s\",\"live\":%zu,\"size\":%zu", names[m], b.live, b.size);
+            bench_run("quarantine.alloc_free", params, bench_quarantine, &b);
+            free(b.ptrs);
+        }
+    }
+}
+
+/* ---------------------------
+   Base-12 conversion (big-number bytes <-> digit string)
+   --------------------------- */
+
+typedef struct {
+    size_t len;
+    uint8_t *bytes;
+    char *digits;
+    size_t digits_cap;
+} Base12Ctx;
+
+static uint64_t bench_base12_encode(void *ctx, uint64_t iters)
+{
+    Base12Ctx *b = (Base12Ctx*)ctx;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) bytes_to_base12(b->bytes, b->len, b->digits, b->digits_cap);
+    return bench_now_ns() - t0;
+}
+
+static uint64_t bench_base12_decode(void *ctx, uint64_t iters)
+{
+    Base12Ctx *b = (Base12Ctx*)ctx;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint8_t *out = NULL;
+        size_t n = 0;
+        base12_to_bytes(b->digits, &out, &n);
+        free(out);
+    }
+    return bench_now_ns() - t0;
+}
+
+static void bench_base12(void)
+{
+    static const size_t lens[] = { 8, 64, 512, 4096, 65536 };
+    char params[64], extra[64];
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+        Base12Ctx b;
+        b.len = lens[l];
+        b.bytes = (uint8_t*)malloc(b.len);
+        b.digits_cap = b.len * 3 + 32;
+        b.digits = (char*)malloc(b.digits_cap);
+        if (!b.bytes || !b.digits) { free(b.bytes); free(b.digits); continue; }
+        uint32_t x = 2463534242u;
+        for (size_t i = 0; i < b.len; ++i) { x ^= x << 13; x ^= x >> 17; x ^= x << 5; b.bytes[i] = (uint8_t)x; }
+        b.bytes[0] |= 0x80;     /* keep the full width significant */
+        if (bytes_to_base12(b.bytes, b.len, b.digits, b.digits_cap) != 0) {
+            printf("# base12: encode of %zu bytes failed: %s\n", b.len, tr_get_last_error());
+            free(b.bytes); free(b.digits);
+            continue;
+        }
+        snprintf(params, sizeof(params), "\"bytes\":%zu", b.len);
+        static const char *names[] = { "base12.encode", "base12.decode" };
+        bench_fn_t fns[] = { bench_base12_encode, bench_base12_decode };
+        for (int d = 0; d < 2; ++d) {
+            if (!bench_selected(names[d])) continue;
+            uint64_t iters;
+            uint64_t ns = bench_measure(fns[d], &b, &iters);
+            snprintf(extra, sizeof(extra), "\"mb_per_sec\":%.2f", ns ? (double)b.len * (double)iters * 1e3 / (double)ns : 0.0);
+            bench_report(names[d], params, iters, ns, extra);
+        }
+        free(b.bytes);
+        free(b.digits);
+    }
+}
+
+/* ---------------------------
+   Syscall dispatch with 10/100/1000 registered entries (by name and by resolved handle), and a
+   "read counter" call through the JSON and the binary convention
+   --------------------------- */
+
+static int bench_syscall_handler(const char *args_json, char **out_json, void *ctx)
+{
+    (void)args_json; (void)ctx;
+    if (out_json) *out_json = NULL;
+    return 0;
+}
+
+typedef struct {
+    char name[32];
+    tr_syscall_handle_t handle;
+} SyscallCtx;
+
+static uint64_t bench_syscall_by_name(void *ctx, uint64_t iters)
+{
+    SyscallCtx *s = (SyscallCtx*)ctx;
+    char *out = NULL;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) tr_invoke_syscall(s->name, "{}", &out);
+    return bench_now_ns() - t0;
+}
+
+static uint64_t bench_syscall_by_handle(void *ctx, uint64_t iters)
+{
+    SyscallCtx *s = (SyscallCtx*)ctx;
+    char *out = NULL;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) tr_invoke_syscall_handle(s->handle, "{}", NULL, &out);
+    return bench_now_ns() - t0;
+}
+
+static uint64_t g_bench_counter = 0;
+static volatile uint64_t g_bench_counter_seen;   /* keeps the callers' result handling live */
+
+static int bench_counter_json(const char *args_json, char **out_json, void *ctx)
+{
+    (void)args_json; (void)ctx;
+    char tmp[48];
+    int n = snprintf(tmp, sizeof(tmp), "{\"value\":%llu}", (unsigned long long)++g_bench_counter);
+    *out_json = (char*)malloc((size_t)n + 1);
+    if (!*out_json) return -1;
+    memcpy(*out_json, tmp, (size_t)n + 1);
+    return 0;
+}
+
+static int bench_counter_bin(const void *args, size_t args_len, void *out, size_t *out_len, void *ctx)
+{
+    (void)args; (void)args_len; (void)ctx;
+    if (*out_len < sizeof(uint64_t)) { *out_len = sizeof(uint64_t); return 1; }
+    ++g_bench_counter;
+    memcpy(out, &g_bench_counter, sizeof(uint64_t));
+    *out_len = sizeof(uint64_t);
+    return 0;
+}
+
+static uint64_t bench_counter_via_json(void *ctx, uint64_t iters)
+{
+    tr_syscall_handle_t h = *(tr_syscall_handle_t*)ctx;
+    uint64_t sum = 0;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        char *out = NULL;
+        if (tr_invoke_syscall_handle(h, "{}", NULL, &out) == 0 && out) {
+            const char *v = strchr(out, ':');
+            if (v) sum += strtoull(v + 1, NULL, 10);
+        }
+        free(out);
+    }
+    uint64_t dt = bench_now_ns() - t0;
+    g_bench_counter_seen = sum;
+    return dt;
+}
+
+static uint64_t bench_counter_via_bin(void *ctx, uint64_t iters)
+{
+    tr_syscall_handle_t h = *(tr_syscall_handle_t*)ctx;
+    uint64_t sum = 0;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        uint64_t v = 0;
+        size_t n = sizeof(v);
+        if (tr_invoke_syscall_handle_bin(h, NULL, 0, NULL, &v, &n) == 0) sum += v;
+    }
+    uint64_t dt = bench_now_ns() - t0;
+    g_bench_counter_seen = sum;
+    return dt;
+}
+
+static void bench_syscalls(void)
+{
+    static const size_t counts[] = { 10, 100, 1000 };
+    char name[32], params[64];
+    size_t registered = 0;
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (; registered < counts[c]; ++registered) {
+            snprintf(name, sizeof(name), "bench.sys%zu", registered);
+            if (tr_register_syscall(name, bench_syscall_handler, NULL) != 0) {
+                printf("# syscall: register failed: %s\n", tr_get_last_error());
+                return;
+            }
+        }
+        SyscallCtx s;
+        snprintf(s.name, sizeof(s.name), "bench.sys%zu", counts[c] / 2);
+        s.handle = tr_resolve_syscall(s.name);
+        snprintf(params, sizeof(params), "\"registered\":%zu", counts[c]);
+        bench_run("syscall.invoke_name", params, bench_syscall_by_name, &s);
+        bench_run("syscall.invoke_handle", params, bench_syscall_by_handle, &s);
+    }
+    if (tr_register_syscall("bench.counter_json", bench_counter_json, NULL) == 0 &&
+        tr_register_syscall_bin_ex("bench.counter_bin", bench_counter_bin, NULL, NULL, 0, NULL, NULL) == 0) {
+        tr_syscall_handle_t hj = tr_resolve_syscall("bench.counter_json");
+        tr_syscall_handle_t hb = tr_resolve_syscall("bench.counter_bin");
+        bench_run("syscall.counter_json", "\"abi\":\"json\"", bench_counter_via_json, &hj);
+        bench_run("syscall.counter_bin", "\"abi\":\"binary\"", bench_counter_via_bin, &hb);
+    } else {
+        printf("# syscall: counter register failed: %s\n", tr_get_last_error());
+    }
+    tr_unregister_syscall("bench.counter_json");
+    tr_unregister_syscall("bench.counter_bin");
+    for (size_t i = 0; i < registered; ++i) {
+        snprintf(name, sizeof(name), "bench.sys%zu", i);
+        tr_unregister_syscall(name);
+    }
+}
+
+/* ---------------------------
+   Capsule lifecycle: create + start + stop + join + destroy
+   --------------------------- */
+
+static int bench_capsule_entry(Capsule *c, void *ctx) { (void)c; (void)ctx; return 0; }
+static int bench_capsule_step(Capsule *c, void *ctx) { (void)c; (void)ctx; return TR_CAPSULE_DONE; }
+
+static uint64_t bench_capsule_thread(void *ctx, uint64_t iters)
+{
+    (void)ctx;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        Capsule *c = tr_capsule_create("bench", bench_capsule_entry, NULL);
+        tr_capsule_start(c);
+        tr_capsule_stop(c);
+        tr_capsule_join(c);
+        tr_capsule_destroy(c);
+    }
+    return bench_now_ns() - t0;
+}
+
+static uint64_t bench_capsule_task(void *ctx, uint64_t iters)
+{
+    (void)ctx;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        Capsule *c = tr_capsule_create_task("bench", bench_capsule_step, NULL);
+        tr_capsule_start(c);
+        tr_capsule_join(c);
+        tr_capsule_destroy(c);
+    }
+    return bench_now_ns() - t0;
+}
+
+static void bench_capsules(void)
+{
+    bench_run("capsule.lifecycle", "\"mode\":\"thread\"", bench_capsule_thread, NULL);
+    if (bench_selected("capsule.lifecycle")) tr_scheduler_start(0);   /* keep pool start-up out of the loop */
+    bench_run("capsule.lifecycle", "\"mode\":\"task\"", bench_capsule_task, NULL);
+}
+
+/* ---------------------------
+   NASM JIT
+   - cold: every iteration compiles a distinct block (unique label), then unloads it
+   - warm: the same block again, served from the in-process memo
+   - TRION_JIT_INPROC=0 in the environment measures the external toolchain path instead
+   --------------------------- */
+
+static uint64_t g_bench_jit_serial = 0;
+static int g_bench_jit_failed = 0;
+static const char *g_bench_jit_warm_src = "global bench_fn\nbench_fn:\n    mov eax, 42\n    ret\n";
+
+static uint64_t bench_jit_cold(void *ctx, uint64_t iters)
+{
+    (void)ctx;
+    char src[256];
+    uint64_t ns = 0;
+    for (uint64_t i = 0; i < iters; ++i) {
+        unsigned long long id = (unsigned long long)++g_bench_jit_serial;
+        snprintf(src, sizeof(src), "global bench_fn\nbench_fn:\n    mov eax, %llu\n    ret\n", id & 0x7fffffffull);
+        void *fn = NULL;
+        char *err = NULL;
+        uint64_t t0 = bench_now_ns();
+        int rc = tr_nasm_compile_and_load(src, "bench_fn", &fn, &err);
+        ns += bench_now_ns() - t0;
+        if (rc != 0) {
+            /* end the measurement; bench_jit drops the result */
+            free(err);
+            g_bench_jit_failed = 1;
+            return g_bench_min_ns;
+        }
+        tr_nasm_unload(fn);
+    }
+    return ns;
+}
+
+static uint64_t bench_jit_warm(void *ctx, uint64_t iters)
+{
+    (void)ctx;
+    void *fn = NULL;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) tr_nasm_compile_and_load(g_bench_jit_warm_src, "bench_fn", &fn, NULL);
+    return bench_now_ns() - t0;
+}
+
+static void bench_jit(void)
+{
+    const char *ip = getenv("TRION_JIT_INPROC");
+    const char *path = ip && ip[0] == '0' ? "toolchain" : "inproc";
+    if (!bench_selected("jit.compile_")) return;
+    char params[64];
+    snprintf(params, sizeof(params), "\"path\":\"%s\"", path);
+    /* also primes the memo for the warm run */
+    void *fn = NULL;
+    char *err = NULL;
+    if (tr_nasm_compile_and_load(g_bench_jit_warm_src, "bench_fn", &fn, &err) != 0) {
+        printf("# jit: skipped, build failed (%s path): %s\n", path, tr_get_last_error());
+        free(err);
+        return;
+    }
+    /* a toolchain build is milliseconds; cap its run so the suite stays quick */
+    uint64_t saved = g_bench_min_ns;
+    if (path[0] == 't' && g_bench_min_ns > 50ull * 1000000ull) g_bench_min_ns = 50ull * 1000000ull;
+    if (bench_selected("jit.compile_cold")) {
+        uint64_t iters;
+        uint64_t ns = bench_measure(bench_jit_cold, NULL, &iters);
+        if (g_bench_jit_failed) printf("# jit: cold build failed: %s\n", tr_get_last_error());
+        else bench_report("jit.compile_cold", params, iters, ns, "");
+    }
+    g_bench_min_ns = saved;
+    bench_run("jit.compile_warm", params, bench_jit_warm, NULL);
+}
+
+#ifndef _WIN32
+/* ---------------------------
+   Precompiled modules
+   - open_symbol: map an image of prebuilt NASM blocks, resolve and call one entry, close it;
+     the per-iteration cost is what a precompiled program pays at startup
+   --------------------------- */
+
+#define BENCH_MODULE_FUNCS 64
+
+static int g_bench_module_failed = 0;
+
+static uint64_t bench_module_open(void *ctx, uint64_t iters)
+{
+    const char *path = (const char*)ctx;
+    uint64_t t0 = bench_now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        TrionModule *m = tr_module_open(path);
+        int (*fn)(void) = m ? (int (*)(void))tr_module_symbol(m, "bench_fn_0") : NULL;
+        if (!fn || fn() != 0) { g_bench_module_failed = 1; tr_module_close(m); break; }
+        tr_module_close(m);
+    }
+    return bench_now_ns() - t0;
+}
+
+static void bench_modules(void)
+{
+    if (!bench_selected("module.open_symbol")) return;
+    const char *dir = getenv("TMPDIR");
+    char path[512], src[128], sym[32];
+    snprintf(path, sizeof(path), "%s/trion_bench.%ld.tmod", dir && *dir ? dir : "/tmp", (long)getpid());
+    TrionModuleBuilder *b = tr_module_builder_create();
+    int ok = b != NULL;
+    for (int i = 0; ok && i < BENCH_MODULE_FUNCS; ++i) {
+        snprintf(sym, sizeof(sym), "bench_fn_%d", i);
+        snprintf(src, sizeof(src), "global %s\n%s:\n    mov eax, %d\n    ret\n", sym, sym, i);
+        ok = tr_module_add_nasm(b, src, sym) >= 0;
+    }
+    ok = ok && tr_module_write(b, path) == 0;
+    tr_module_builder_destroy(b);
+    if (!ok) { printf("# module: skipped, image build failed: %s\n", tr_get_last_error()); return; }
+    char params[64];
+    snprintf(params, sizeof(params), "\"functions\":%d", BENCH_MODULE_FUNCS);
+    uint64_t iters;
+    uint64_t ns = bench_measure(bench_module_open, path, &iters);
+    if (g_bench_module_failed) printf("# module: open failed: %s\n", tr_get_last_error());
+    else bench_report("module.open_symbol", params, iters, ns, "");
+    unlink(path);
+}
+#endif
+
+int main(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) g_bench_filter = argv[++i];
+        else if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) g_bench_min_ns = strtoull(argv[++i], NULL, 10) * 1000000ull;
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) g_bench_threads = (size_t)strtoul(argv[++i], NULL, 10);
+        else {
+            fprintf(stderr, "usage: %s [--filter SUBSTR] [--min-ms N] [--threads N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!g_bench_min_ns) g_bench_min_ns = 1;
+    if (!g_bench_threads) g_bench_threads = tr_cpu_count() < 2 ? 2 : tr_cpu_count();
+    printf("# trion_bench cpus=%zu threads=%zu min_ms=%llu\n", tr_cpu_count(), g_bench_threads,
+           (unsigned long long)(g_bench_min_ns / 1000000ull));
+    /* the syscall registry audits every registration; keep that out of the output */
+    tr_audit_open(
+#ifdef _WIN32
+        "NUL"
+#else
+        "/dev/null"
+#endif
+    );
+    bench_channels();
+    bench_quarantines();
+    bench_base12();
+    bench_syscalls();
+    bench_capsules();
+    bench_jit();
+#ifndef _WIN32
+    bench_modules();
+#endif
+    tr_audit_close();
+    return 0;
+}
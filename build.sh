@@ -1,5 +1,15 @@
 #!/bin/bash
+if [ "$1" = "bench" ]; then
+    # runtime micro-benchmarks; remaining arguments go to trion_bench (see bench/trion_bench.c)
+    shift
+    echo "⏱️  Building runtime benchmarks" >&2
+    ${CC:-clang} -O2 -o trion_bench bench/trion_bench.c -lpthread -ldl || exit 1
+    ./trion_bench "$@"
+    exit $?
+fi
 echo "🔧 Building Trion to LLVM → EXE"
 python3 main.py tests/hello_world.trn
 llc output.ll -filetype=obj -o output.o
-clang output.o -o hello.exe
+# generated code calls into the runtime for dynamically delivered capsule messages
+clang -O2 -c trion_runtime.c -o trion_runtime.o
+clang output.o trion_runtime.o -o hello.exe -lpthread -ldl
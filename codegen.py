@@ -5,15 +5,42 @@ Simple LLVM IR code generator for Trion AST using llvmlite.
 - Emits a `main` function that calls capsule functions in AST order
 - Recognizes simple `Print` statements in capsule bodies and lowers them to `puts` calls
 - Interns string constants as LLVM global constant arrays
+- Can emit each top-level node as a standalone IR fragment and link fragments back into
+  one module, so an incremental build only re-emits the capsules that changed
+- Lowers capsule messaging (`Send <Capsule>: <payload>`, `Receive <var>`) after a
+  whole-program wiring pass (`plan_wiring`), see "Capsule messaging" below
+
+Capsule messaging:
+  A capsule with a `Receive <var>` statement is a receiver: statements before it run when
+  the capsule is called from main, statements after it run once per message with <var>
+  bound to the message (an i8* string; `Print: <var>` prints it, `Send X: <var>` forwards
+  it). `plan_wiring` picks the cheapest delivery that keeps main's call order semantics:
+  - "fused": B's only producer A sends to it only from A's run-once part, as the last
+    statements there; A receives nothing itself, B has no run-once part and is called right
+    after A. Each send becomes a direct call of B's handler and B's call from main goes away.
+  - "ring":  B's only producer A sends to it only from its run-once part, A and B are each
+    called once and A before B. Sends store into a fixed-size SPSC ring of i8* sized to the
+    statically known number of sends; B drains it inline when called.
+  - "dynamic": anything else. B becomes a runtime capsule (tr_capsule_create) that is fed with
+    tr_capsule_try_send and drained with tr_capsule_try_recv_batch when B is called and once
+    more before main returns; a send that finds the inbox full drains it inline first.
+  Sends to a capsule without `Receive` are dropped.
 
 This stays intentionally small and easy to extend (expressions, types, externs, etc).
 """
 
 from llvmlite import ir
-from typing import Dict, Any
+from typing import Dict, Any, List, Optional, Tuple
 import re
 
 _VALID_NAME = re.compile(r'[^0-9A-Za-z_]')
+_SEND_RE = re.compile(r'^Send\s+([A-Za-z_][A-Za-z0-9_]*)\s*(?::\s*(.*))?$', re.S)
+_RECEIVE_RE = re.compile(r'^Receive(?:\s+([A-Za-z_][A-Za-z0-9_]*))?\s*$')
+
+_I8P = ir.PointerType(ir.IntType(8))
+_I32 = ir.IntType(32)
+_VOID_FN = ir.FunctionType(ir.VoidType(), [])
+_DRAIN_BATCH = 16          # messages per tr_capsule_try_recv_batch call
 
 
 def _sanitize_name(name: str) -> str:
@@ -22,13 +49,65 @@ def _sanitize_name(name: str) -> str:
     return _VALID_NAME.sub('_', name)
 
 
+def _strip_quotes(content: str) -> str:
+    if len(content) >= 2 and ((content[0] == '"' and content[-1] == '"') or (content[0] == "'" and content[-1] == "'")):
+        return content[1:-1]
+    return content
+
+
+def _split_capsule(capsule: Any) -> Tuple[List[str], Optional[str], Optional[List[str]]]:
+    """
+    Split a capsule body at its first `Receive`: (run-once statements, message variable,
+    per-message statements). The last two are None for a capsule that receives nothing.
+    """
+    prelude: List[str] = []
+    for i, stmt in enumerate(getattr(capsule, "body", [])):
+        if not isinstance(stmt, str):
+            continue
+        m = _RECEIVE_RE.match(stmt.strip())
+        if m:
+            rest = [s for s in capsule.body[i + 1:] if isinstance(s, str)]
+            return prelude, m.group(1) or "", rest
+        prelude.append(stmt)
+    return prelude, None, None
+
+
+def _send_target(stmt: str) -> Optional[Tuple[str, str]]:
+    """(receiver symbol, payload text) for a `Send` statement, else None."""
+    m = _SEND_RE.match(stmt.strip())
+    if not m:
+        return None
+    return f"capsule_{_sanitize_name(m.group(1))}", (m.group(2) or "").strip()
+
+
+class WiringPlan:
+    """
+    Result of `Codegen.plan_wiring`: how each receiving capsule gets its messages.
+      modes[symbol] = (mode, ring capacity) with mode "fused", "ring" or "dynamic"
+      fused         = receivers whose call from main is dropped
+    """
+
+    def __init__(self):
+        self.modes: Dict[str, Tuple[str, int]] = {}
+        self.fused: Dict[str, bool] = {}
+
+    def mode(self, symbol: str) -> Tuple[str, int]:
+        return self.modes.get(symbol, ("none", 0))
+
+    def dynamic(self) -> List[str]:
+        return [s for s, (m, _) in self.modes.items() if m == "dynamic"]
+
+
 class Codegen:
-    def __init__(self, module_name: str = "trion"):
+    def __init__(self, module_name: str = "trion", str_prefix: str = ".str"):
         self.module = ir.Module(name=module_name)
+        self._str_prefix = str_prefix
         self.builder: ir.IRBuilder = None  # set when emitting function bodies
         self._str_constants: Dict[str, ir.GlobalVariable] = {}
         self._capsule_funcs: Dict[str, ir.Function] = {}
+        self._externs: Dict[str, ir.Function] = {}
         self._puts = None  # declared puts function
+        self.plan = WiringPlan()
 
     # --- helpers for externs and string constants ---
 
@@ -37,7 +116,15 @@ class Codegen:
             return
         # declare: int puts(i8*)
         puts_ty = ir.FunctionType(ir.IntType(32), [ir.PointerType(ir.IntType(8))])
-        self._puts = ir.Function(self.module, puts_ty, name="puts")
+        self._puts = self._extern("puts", puts_ty)
+
+    def _extern(self, name: str, fn_ty: ir.FunctionType) -> ir.Function:
+        """
+        Return (and declare if needed) an external runtime function.
+        """
+        if name not in self._externs:
+            self._externs[name] = ir.Function(self.module, fn_ty, name=name)
+        return self._externs[name]
 
     def _intern_string(self, text: str) -> ir.GlobalVariable:
         """
@@ -49,7 +136,7 @@ class Codegen:
         arr_ty = ir.ArrayType(ir.IntType(8), len(data))
         # initializer expects a bytes-like or list of ints
         init = ir.Constant(arr_ty, bytearray(data))
-        gv_name = f".str{len(self._str_constants)}"
+        gv_name = f"{self._str_prefix}{len(self._str_constants)}"
         gv = ir.GlobalVariable(self.module, arr_ty, name=gv_name)
         gv.global_constant = True
         gv.linkage = "internal"
@@ -66,32 +153,80 @@ class Codegen:
         gep = gv.gep([zero, zero])
         return gep.bitcast(ptr_ty)
 
-    # --- emission routines ---
+    # --- messaging helpers ---
+    # Per-receiver symbols hang off the capsule name with a '.', which sanitized capsule
+    # names never contain: <sym>.on (handler), <sym>.drain, <sym>.ring/.head/.tail, <sym>.cap
 
-    def emit_capsule(self, capsule: Any) -> ir.Function:
+    def _function(self, name: str, fn_ty: ir.FunctionType) -> ir.Function:
         """
-        Emit a void function for the given Capsule AST node.
-        Capsule.body is expected to be an iterable of simple statements (strings or nodes).
-        Returns the created Function.
+        Return the module's function `name`, declaring it when it is not emitted (yet).
         """
-        name = _sanitize_name(getattr(capsule, "name", "capsule"))
-        func_name = f"capsule_{name}"
-        if func_name in self._capsule_funcs:
-            return self._capsule_funcs[func_name]
+        fn = self.module.globals.get(name)
+        if fn is None:
+            fn = ir.Function(self.module, fn_ty, name=name)
+        return fn
 
-        func_ty = ir.FunctionType(ir.VoidType(), [])
-        func = ir.Function(self.module, func_ty, name=func_name)
-        block = func.append_basic_block("entry")
-        builder = ir.IRBuilder(block)
+    def _global(self, name: str, ty: ir.Type, init: Any) -> ir.GlobalVariable:
+        gv = self.module.globals.get(name)
+        if gv is None:
+            gv = ir.GlobalVariable(self.module, ty, name=name)
+            gv.linkage = "internal"
+            gv.initializer = ir.Constant(ty, init)
+        return gv
 
-        # ensure puts is declared if we will use prints
-        self._ensure_puts()
+    def _ring(self, symbol: str, capacity: int) -> Tuple[ir.GlobalVariable, ir.GlobalVariable, ir.GlobalVariable]:
+        size = 1
+        while size < capacity:
+            size <<= 1
+        buf = self._global(f"{symbol}.ring", ir.ArrayType(_I8P, size), None)
+        head = self._global(f"{symbol}.head", _I32, 0)
+        tail = self._global(f"{symbol}.tail", _I32, 0)
+        return buf, head, tail
 
-        # naive lowering for string-style statements "Print: ...", "Print ..."
-        for stmt in getattr(capsule, "body", []):
-            if not isinstance(stmt, str):
-                continue
+    def _ring_mask(self, buf: ir.GlobalVariable) -> ir.Constant:
+        return ir.Constant(_I32, buf.type.pointee.count - 1)
+
+    def _capsule_handle(self, symbol: str) -> ir.GlobalVariable:
+        return self._global(f"{symbol}.cap", _I8P, None)
+
+    def _rt_try_send(self) -> ir.Function:
+        return self._extern("tr_capsule_try_send", ir.FunctionType(_I32, [_I8P, _I8P]))
+
+    def _emit_send(self, builder: ir.IRBuilder, target: str, value: ir.Value) -> None:
+        mode, capacity = self.plan.mode(target)
+        if mode == "fused":
+            builder.call(self._function(f"{target}.on", ir.FunctionType(ir.VoidType(), [_I8P])), [value])
+        elif mode == "ring":
+            buf, _, tail = self._ring(target, capacity)
+            t = builder.load(tail)
+            slot = builder.gep(buf, [ir.Constant(_I32, 0), builder.and_(t, self._ring_mask(buf))], inbounds=True)
+            builder.store(value, slot)
+            builder.store(builder.add(t, ir.Constant(_I32, 1)), tail)
+        elif mode == "dynamic":
+            cap = builder.load(self._capsule_handle(target))
+            rc = builder.call(self._rt_try_send(), [cap, value])
+            # inbox full: nothing else drains it while we run, so deliver what is queued first
+            with builder.if_then(builder.icmp_signed("!=", rc, ir.Constant(_I32, 0))):
+                builder.call(self._function(f"{target}.drain", ir.FunctionType(_I32, [])), [])
+                builder.call(self._rt_try_send(), [cap, value])
+        # else: the target receives nothing; the message is dropped
+
+    def _emit_statements(self, builder: ir.IRBuilder, stmts: List[str], var: Optional[str] = None,
+                         msg: Optional[ir.Value] = None) -> None:
+        """
+        Lower capsule statements; inside a handler `var` names the current message `msg`.
+        """
+        for stmt in stmts:
             text = stmt.strip()
+            send = _send_target(text)
+            if send is not None:
+                target, payload = send
+                if var and payload == var:
+                    value = msg
+                else:
+                    value = self._cstr_ptr(self._intern_string(_strip_quotes(payload)))
+                self._emit_send(builder, target, value)
+                continue
             # support "Print:" or "Print"
             if text.lower().startswith("print"):
                 # find content after colon if present
@@ -102,9 +237,11 @@ class Codegen:
                     # "Print foo" -> content after whitespace
                     parts = text.split(None, 1)
                     content = parts[1].strip() if len(parts) > 1 else ""
+                if var and content == var:
+                    builder.call(self._puts, [msg])
+                    continue
                 # strip matching surrounding quotes
-                if len(content) >= 2 and ((content[0] == '"' and content[-1] == '"') or (content[0] == "'" and content[-1] == "'")):
-                    content = content[1:-1]
+                content = _strip_quotes(content)
                 # fallback for empty prints
                 if content == "":
                     content = "\n"
@@ -113,50 +250,244 @@ class Codegen:
                 builder.call(self._puts, [ptr])
             # other stmt kinds may be extended here
 
+    def _emit_ring_drain(self, func: ir.Function, builder: ir.IRBuilder, symbol: str, capacity: int,
+                         on_fn: ir.Function) -> ir.IRBuilder:
+        buf, head, tail = self._ring(symbol, capacity)
+        loop = func.append_basic_block("drain")
+        body = func.append_basic_block("drain.msg")
+        done = func.append_basic_block("drain.done")
+        builder.branch(loop)
+        b = ir.IRBuilder(loop)
+        h = b.load(head)
+        b.cbranch(b.icmp_unsigned("==", h, b.load(tail)), done, body)
+        b = ir.IRBuilder(body)
+        slot = b.gep(buf, [ir.Constant(_I32, 0), b.and_(h, self._ring_mask(buf))], inbounds=True)
+        m = b.load(slot)
+        b.store(b.add(h, ir.Constant(_I32, 1)), head)
+        b.call(on_fn, [m])
+        b.branch(loop)
+        return ir.IRBuilder(done)
+
+    def _emit_dynamic_drain(self, symbol: str, on_fn: ir.Function) -> ir.Function:
+        """
+        i32 <symbol>.drain(): hand every queued inbox message to the handler; returns the count.
+        """
+        i64 = ir.IntType(64)
+        recv = self._extern("tr_capsule_try_recv_batch", ir.FunctionType(_I32, [_I8P, ir.PointerType(_I8P), i64]))
+        fn = self._function(f"{symbol}.drain", ir.FunctionType(_I32, []))
+        b = ir.IRBuilder(fn.append_basic_block("entry"))
+        batch = b.alloca(ir.ArrayType(_I8P, _DRAIN_BATCH), name="batch")
+        total = b.alloca(_I32, name="total")
+        idx = b.alloca(_I32, name="i")
+        b.store(ir.Constant(_I32, 0), total)
+        first = b.gep(batch, [ir.Constant(_I32, 0), ir.Constant(_I32, 0)], inbounds=True)
+        fill = fn.append_basic_block("fill")
+        each = fn.append_basic_block("each")
+        body = fn.append_basic_block("each.msg")
+        done = fn.append_basic_block("done")
+        b.branch(fill)
+
+        b = ir.IRBuilder(fill)
+        n = b.call(recv, [b.load(self._capsule_handle(symbol)), first, ir.Constant(i64, _DRAIN_BATCH)])
+        b.store(ir.Constant(_I32, 0), idx)
+        # > 0 messages; 0 = closed, -2 = empty, -1 = error all end the drain
+        b.cbranch(b.icmp_signed(">", n, ir.Constant(_I32, 0)), each, done)
+
+        b = ir.IRBuilder(each)
+        i = b.load(idx)
+        b.cbranch(b.icmp_signed("<", i, n), body, fill)
+
+        b = ir.IRBuilder(body)
+        m = b.load(b.gep(batch, [ir.Constant(_I32, 0), i], inbounds=True))
+        b.call(on_fn, [m])
+        b.store(b.add(i, ir.Constant(_I32, 1)), idx)
+        b.store(b.add(b.load(total), ir.Constant(_I32, 1)), total)
+        b.branch(each)
+
+        b = ir.IRBuilder(done)
+        b.ret(b.load(total))
+        return fn
+
+    # --- whole-program wiring ---
+
+    def plan_wiring(self, program: Any) -> WiringPlan:
+        """
+        Whole-program pass over the top-level nodes of `program`: find each receiver's
+        producers and pick fused / ring / dynamic delivery (see the module docstring).
+        """
+        order: List[str] = []
+        capsules: Dict[str, Any] = {}
+        for node in getattr(program, "body", []):
+            symbol = self.fragment_symbol(node)
+            if not symbol:
+                continue
+            order.append(symbol)
+            # as in emit_capsule, the first definition of a name is the one that runs
+            if symbol != "main_block" and symbol not in capsules:
+                capsules[symbol] = node
+        parts = {symbol: _split_capsule(node) for symbol, node in capsules.items()}
+
+        # producers[target][producer] = [sends from the run-once part, sends from the handler]
+        producers: Dict[str, Dict[str, List[int]]] = {}
+        for symbol, (prelude, _, handler) in parts.items():
+            for which, stmts in ((0, prelude), (1, handler or [])):
+                for stmt in stmts:
+                    send = _send_target(stmt)
+                    if send is not None:
+                        counts = producers.setdefault(send[0], {}).setdefault(symbol, [0, 0])
+                        counts[which] += 1
+
+        plan = WiringPlan()
+        for symbol, (prelude, _, handler) in parts.items():
+            if handler is None:
+                continue
+            mode, capacity = "dynamic", 0
+            srcs = producers.get(symbol, {})
+            if len(srcs) == 1:
+                src, (once, per_msg) = next(iter(srcs.items()))
+                if (src != symbol and per_msg == 0 and order.count(src) == 1 and order.count(symbol) == 1
+                        and order.index(src) < order.index(symbol)):
+                    mode, capacity = "ring", once
+                    src_prelude, _, src_handler = parts[src]
+                    tail = src_prelude[len(src_prelude) - once:]
+                    if (src_handler is None and not prelude and order.index(symbol) == order.index(src) + 1
+                            and all((_send_target(s) or ("",))[0] == symbol for s in tail)):
+                        mode = "fused"
+                        plan.fused[symbol] = True
+            plan.modes[symbol] = (mode, capacity)
+        return plan
+
+    def fragment_signature(self, node: Any, plan: WiringPlan) -> str:
+        """
+        The part of `plan` that `node`'s emitted code depends on (its own delivery mode and
+        those of the capsules it sends to), for caching fragments across builds.
+        """
+        symbol = self.fragment_symbol(node)
+        if not symbol or symbol == "main_block":
+            return ""
+        prelude, _, handler = _split_capsule(node)
+        targets = {symbol}
+        for stmt in prelude + (handler or []):
+            send = _send_target(stmt)
+            if send is not None:
+                targets.add(send[0])
+        return ";".join(f"{t}={plan.mode(t)[0]}/{plan.mode(t)[1]}" for t in sorted(targets))
+
+    # --- emission routines ---
+
+    def emit_capsule(self, capsule: Any) -> ir.Function:
+        """
+        Emit a void function for the given Capsule AST node.
+        Capsule.body is expected to be an iterable of simple statements (strings or nodes).
+        A receiver also gets its per-message handler `<name>.on(i8*)` and, depending on
+        its wiring, an inline ring drain or a runtime inbox drain.
+        Returns the created Function.
+        """
+        name = _sanitize_name(getattr(capsule, "name", "capsule"))
+        func_name = f"capsule_{name}"
+        if func_name in self._capsule_funcs:
+            return self._capsule_funcs[func_name]
+
+        func = self._function(func_name, _VOID_FN)
+        block = func.append_basic_block("entry")
+        builder = ir.IRBuilder(block)
+
+        # ensure puts is declared if we will use prints
+        self._ensure_puts()
+
+        # naive lowering for string-style statements "Print: ...", "Print ...", "Send ..."
+        prelude, var, handler = _split_capsule(capsule)
+        self._emit_statements(builder, prelude)
+
+        if handler is not None:
+            on_fn = self._function(f"{func_name}.on", ir.FunctionType(ir.VoidType(), [_I8P]))
+            hb = ir.IRBuilder(on_fn.append_basic_block("entry"))
+            self._emit_statements(hb, handler, var, on_fn.args[0])
+            hb.ret_void()
+            mode, capacity = self.plan.mode(func_name)
+            if mode == "ring":
+                builder = self._emit_ring_drain(func, builder, func_name, capacity, on_fn)
+            elif mode == "dynamic":
+                builder.call(self._emit_dynamic_drain(func_name, on_fn), [])
+
         builder.ret_void()
         self._capsule_funcs[func_name] = func
         return func
 
-    def emit_main(self, program: Any):
+    def emit_main_block(self) -> ir.Function:
         """
-        Emit a `main` function that calls capsule functions in the order they appear
-        in program.body. If a MainBlock node exists it will be emitted as an empty function
-        and called as well to maintain ordering.
+        Emit (once) the empty `main_block` helper that stands in for a MainBlock node.
+        """
+        mainblk_name = "main_block"
+        if mainblk_name not in self._capsule_funcs:
+            fb = ir.Function(self.module, ir.FunctionType(ir.VoidType(), []), name=mainblk_name)
+            b = fb.append_basic_block("entry")
+            ir.IRBuilder(b).ret_void()
+            self._capsule_funcs[mainblk_name] = fb
+        return self._capsule_funcs[mainblk_name]
+
+    def _emit_main_fn(self, calls: List[str]) -> ir.Function:
+        """
+        Emit `main`: create the runtime capsules of dynamic receivers, call `calls` in order
+        (except fused receivers), drain dynamic inboxes until quiet, destroy the capsules.
         """
         func_ty = ir.FunctionType(ir.IntType(32), [])
         main_fn = ir.Function(self.module, func_ty, name="main")
         block = main_fn.append_basic_block("entry")
         self.builder = ir.IRBuilder(block)
 
+        dynamic = self.plan.dynamic()
+        if dynamic:
+            create = self._extern("tr_capsule_create", ir.FunctionType(_I8P, [_I8P, _I8P, _I8P]))
+            null = ir.Constant(_I8P, None)
+            for symbol in dynamic:
+                name = self._cstr_ptr(self._intern_string(symbol[len("capsule_"):]))
+                self.builder.store(self.builder.call(create, [name, null, null]), self._capsule_handle(symbol))
+
+        # Call each capsule/function in order
+        for symbol in calls:
+            if symbol not in self.plan.fused:
+                self.builder.call(self._function(symbol, _VOID_FN), [])
+
+        if dynamic:
+            # messages sent after their receiver ran (or by another drain) are still delivered
+            settle = main_fn.append_basic_block("settle")
+            exit_blk = main_fn.append_basic_block("exit")
+            self.builder.branch(settle)
+            self.builder = ir.IRBuilder(settle)
+            n = ir.Constant(_I32, 0)
+            for symbol in dynamic:
+                n = self.builder.add(n, self.builder.call(self._function(f"{symbol}.drain", ir.FunctionType(_I32, [])), []))
+            self.builder.cbranch(self.builder.icmp_signed("!=", n, ir.Constant(_I32, 0)), settle, exit_blk)
+            self.builder = ir.IRBuilder(exit_blk)
+            destroy = self._extern("tr_capsule_destroy", ir.FunctionType(ir.VoidType(), [_I8P]))
+            for symbol in dynamic:
+                self.builder.call(destroy, [self.builder.load(self._capsule_handle(symbol))])
+
+        # return 0
+        self.builder.ret(ir.Constant(ir.IntType(32), 0))
+        self.builder = None
+        return main_fn
+
+    def emit_main(self, program: Any):
+        """
+        Emit a `main` function that calls capsule functions in the order they appear
+        in program.body. If a MainBlock node exists it will be emitted as an empty function
+        and called as well to maintain ordering.
+        """
         # Emit all capsule functions first
         calls = []
         for node in getattr(program, "body", []):
             tname = type(node).__name__
             if tname == "Capsule":
-                fn = self.emit_capsule(node)
-                calls.append(fn)
+                calls.append(self.emit_capsule(node).name)
             elif tname == "Main" or tname == "MainBlock":
-                # create an empty helper function for MainBlock for symmetry
-                mainblk_name = "main_block"
-                if mainblk_name not in self._capsule_funcs:
-                    fb = ir.Function(self.module, ir.FunctionType(ir.VoidType(), []), name=mainblk_name)
-                    b = fb.append_basic_block("entry")
-                    ir.IRBuilder(b).ret_void()
-                    self._capsule_funcs[mainblk_name] = fb
-                calls.append(self._capsule_funcs[mainblk_name])
+                calls.append(self.emit_main_block().name)
             else:
                 # unknown top-level node: attempt to emit if it has a `name` attr and body
                 if hasattr(node, "name") and hasattr(node, "body"):
-                    calls.append(self.emit_capsule(node))
-
-        # Call each capsule/function in order
-        for fn in calls:
-            self.builder.call(fn, [])
-
-        # return 0
-        self.builder.ret(ir.Constant(ir.IntType(32), 0))
-        self.builder = None
-        return main_fn
+                    calls.append(self.emit_capsule(node).name)
+        return self._emit_main_fn(calls)
 
     def generate(self, program: Any):
         """
@@ -165,12 +496,94 @@ class Codegen:
         # clear any previously interned constants to keep names stable per run
         self._str_constants.clear()
         self._capsule_funcs.clear()
+        self.plan = self.plan_wiring(program)
         # Produce capsules and main
         for node in getattr(program, "body", []):
             if type(node).__name__ == "Capsule":
                 self.emit_capsule(node)
         self.emit_main(program)
 
+    # --- fragments (incremental builds) ---
+
+    @staticmethod
+    def fragment_symbol(node: Any) -> str:
+        """
+        Name of the function `emit_main` would call for a top-level node, or "" when the
+        node produces no function (e.g. a statement left behind by capsule inlining).
+        """
+        tname = type(node).__name__
+        if tname == "Main" or tname == "MainBlock":
+            return "main_block"
+        if tname == "Capsule" or (hasattr(node, "name") and hasattr(node, "body")):
+            return f"capsule_{_sanitize_name(getattr(node, 'name', 'capsule'))}"
+        return ""
+
+    def _fragment_text(self, symbol: str) -> Tuple[str, Dict[str, str]]:
+        # what this scratch module defines for `symbol`: its string constants, its own
+        # functions/globals (<symbol> and <symbol>.*); references to other capsules stay
+        # symbolic and are resolved when the fragments are linked
+        strs = set(id(gv) for gv in self._str_constants.values())
+        parts = [str(gv) for gv in self._str_constants.values()]
+        for name, gv in self.module.globals.items():
+            if id(gv) in strs or name in self._externs:
+                continue
+            if name == symbol or name.startswith(symbol + "."):
+                if not (isinstance(gv, ir.Function) and not gv.blocks):
+                    parts.append(str(gv))
+        externs = {name: str(fn) for name, fn in self._externs.items()}
+        return "\n".join(parts), externs
+
+    def emit_fragment(self, node: Any, plan: Optional[WiringPlan] = None) -> Dict[str, Any]:
+        """
+        Emit one top-level node into a scratch module and return it as a text fragment:
+        { "symbol": function name, "ir": definitions, "externs": {name: declaration} }.
+        String constants are prefixed with the function name so fragments emitted in
+        separate runs never clash once `link_fragments` puts them in one module.
+        `plan` is the whole-program wiring (see plan_wiring); without it sends are dropped.
+        """
+        symbol = self.fragment_symbol(node)
+        if not symbol:
+            return {"symbol": "", "ir": "", "externs": {}}
+        scratch = Codegen(self.module.name, str_prefix=f".str.{symbol}.")
+        scratch.plan = plan if plan is not None else WiringPlan()
+        if symbol == "main_block":
+            scratch.emit_main_block()
+        else:
+            scratch.emit_capsule(node)
+        text, externs = scratch._fragment_text(symbol)
+        return {"symbol": symbol, "ir": text, "externs": externs}
+
+    def link_fragments(self, fragments: List[Dict[str, Any]], calls: List[str],
+                       plan: Optional[WiringPlan] = None) -> str:
+        """
+        Stitch fragments (from `emit_fragment`) into module text with a `main` that calls
+        `calls` in order. As in `emit_capsule`, the first definition of a symbol wins.
+        `plan` must be the one the fragments were emitted with.
+        """
+        seen: Dict[str, bool] = {}
+        externs: Dict[str, str] = {}
+        bodies: List[str] = []
+        for frag in fragments:
+            if not frag["symbol"] or frag["symbol"] in seen:
+                continue
+            seen[frag["symbol"]] = True
+            externs.update(frag["externs"])
+            bodies.append(frag["ir"])
+
+        # main references the fragment functions through declarations in a scratch module;
+        # only what main itself owns is kept since the stitched module defines the callees
+        scratch = Codegen(self.module.name, str_prefix=".str.main.")
+        scratch.plan = plan if plan is not None else WiringPlan()
+        main_fn = scratch._emit_main_fn(calls)
+        externs.update((name, str(fn)) for name, fn in scratch._externs.items())
+
+        lines = [str(ir.Module(name=self.module.name))]
+        lines += [externs[name] for name in sorted(externs)]
+        lines += bodies
+        lines += [str(gv) for gv in scratch._str_constants.values()]
+        lines.append(str(main_fn))
+        return "\n".join(lines) + "\n"
+
     def save(self, path: str = "output.ll"):
         """
         Write the textual IR to `path`.
@@ -178,4 +591,3 @@ class Codegen:
         with open(path, "w", encoding="utf-8") as f:
             f.write(str(self.module))
             print(f"LLVM IR written to {path}")
-
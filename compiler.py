@@ -3,19 +3,28 @@ lexer.py
 
 Tokenizer for Trion language.
 
-Produces a list of (type, value) tuples suitable for the simple parser.
-Ignores whitespace, comments and newlines. Keywords are matched before identifiers.
+`lex()` produces a compact TokenArray: one kind code per token plus [start, end)
+offsets into the source string, with no per-token substrings or tuples. The parser
+walks it with an integer cursor and only slices text for tokens it keeps.
+`tokenize()` still returns the legacy list of (type, value) tuples.
+
+Whitespace, comments and newlines are dropped. Keywords are matched before
+identifiers. Scanning is table driven: the first character of a token selects its
+class from a 128-entry table (non-ASCII characters are classified on the fly), and
+multi-character tokens are finished by one precompiled run pattern per class.
 """
 
 import re
+from array import array
 from typing import List, Tuple
 
-# Ordered token specs: order matters (KEYWORD before IDENT)
+# Token grammar, in match order (KEYWORD before IDENT). The scanner below implements
+# exactly these rules, including the \b word-boundary checks on KEYWORD and NUMBER.
 TOKEN_SPECS = [
     ("SKIP",     r"[ \t\r]+"),                             # spaces and tabs
     ("COMMENT",  r"--[^\n]*"),                             # -- comment to end of line
     ("NEWLINE",  r"\n"),                                   # newline
-    ("KEYWORD",  r"\b(?:Main|Capsule|If|Then|Else|Elseif|While|For|EndCapsule|Print|Isolate|Try|Execute|Fail|True|False)\b"),
+    ("KEYWORD",  r"\b(?:Main|Capsule|If|Then|Else|Elseif|While|For|EndCapsule|Print|Isolate|Try|Execute|Fail|True|False|Send|Receive)\b"),
     ("IDENT",    r"[A-Za-z_][A-Za-z0-9_]*"),               # identifiers
     ("NUMBER",   r"\b\d+\b"),                              # integers
     ("STRING",   r'"(?:\\.|[^"\\])*"'),                    # double-quoted strings with escapes
@@ -23,38 +32,198 @@ TOKEN_SPECS = [
     ("MISMATCH", r"."),                                    # any other single char
 ]
 
-# Precompile regexes for performance
-_TOKEN_REGEXES = [(typ, re.compile(pattern)) for typ, pattern in TOKEN_SPECS]
+KEYWORDS = ("Main", "Capsule", "If", "Then", "Else", "Elseif", "While", "For", "EndCapsule",
+            "Print", "Isolate", "Try", "Execute", "Fail", "True", "False", "Send", "Receive")
+
+# Token kind codes (one byte per token). Every keyword has its own code so the parser
+# can test for `Capsule` or `EndCapsule` with an integer compare.
+T_IDENT = 1
+T_NUMBER = 2
+T_STRING = 3
+T_OP = 4
+T_MISMATCH = 5
+T_KEYWORD = 16                      # T_KEYWORD + KEYWORDS.index(word); any kind >= T_KEYWORD is a keyword
+KEYWORD_KIND = {w: T_KEYWORD + i for i, w in enumerate(KEYWORDS)}
+K_MAIN = KEYWORD_KIND["Main"]
+K_CAPSULE = KEYWORD_KIND["Capsule"]
+K_ENDCAPSULE = KEYWORD_KIND["EndCapsule"]
+_T_KEYWORD_OTHER = T_KEYWORD + len(KEYWORDS)   # legacy KEYWORD tuples with an unknown value
+
+_KIND_NAMES = {T_IDENT: "IDENT", T_NUMBER: "NUMBER", T_STRING: "STRING", T_OP: "OP", T_MISMATCH: "MISMATCH"}
+_NAME_KINDS = {v: k for k, v in _KIND_NAMES.items()}
+
+
+def kind_name(kind: int) -> str:
+    return "KEYWORD" if kind >= T_KEYWORD else _KIND_NAMES.get(kind, "MISMATCH")
+
+
+# Character classes for the dispatch table
+C_OTHER, C_SPACE, C_NEWLINE, C_DASH, C_ALPHA, C_DIGIT, C_QUOTE, C_OP = range(8)
+
+_CLASS = bytearray(128)             # C_OTHER by default
+_WORD = bytearray(128)              # 1 for ASCII \w characters
+for _c in " \t\r":
+    _CLASS[ord(_c)] = C_SPACE
+_CLASS[ord("\n")] = C_NEWLINE
+for _c in "+*/<>=,:":
+    _CLASS[ord(_c)] = C_OP
+_CLASS[ord("-")] = C_DASH
+_CLASS[ord('"')] = C_QUOTE
+for _o in range(128):
+    _c = chr(_o)
+    if _c.isalpha() or _c == "_":
+        _CLASS[_o] = C_ALPHA
+        _WORD[_o] = 1
+    elif _c.isdigit():
+        _CLASS[_o] = C_DIGIT
+        _WORD[_o] = 1
+
+# keyword candidates by first character: (word, length, kind)
+_KW_BY_FIRST = {}
+for _w in KEYWORDS:
+    _KW_BY_FIRST.setdefault(_w[0], []).append((_w, len(_w), KEYWORD_KIND[_w]))
+
+# run patterns that finish a token once its class is known
+_SPACE_RUN = re.compile(r"[ \t\r]*")
+_IDENT_RUN = re.compile(r"[A-Za-z0-9_]*")
+_DIGIT_RUN = re.compile(r"\d*")
+_STRING_TAIL = re.compile(r'(?:\\.|[^"\\])*"')
+
+
+def _is_word(code: str, i: int) -> bool:
+    """\\w at code[i] as `re` sees it (Unicode alphanumerics and underscore)."""
+    o = ord(code[i])
+    if o < 128:
+        return _WORD[o] == 1
+    ch = code[i]
+    return ch.isalnum() or ch == "_"
+
+
+class TokenArray:
+    """
+    Parallel arrays describing a token stream over `source`:
+      kinds[i]  - kind code (T_* / keyword code)
+      starts[i] - offset of the first character
+      ends[i]   - offset one past the last character
+    """
 
+    __slots__ = ("source", "kinds", "starts", "ends")
 
-def tokenize(code: str) -> List[Tuple[str, str]]:
-    """
-    Tokenize Trion source `code` and return list of (type, value) tuples.
+    def __init__(self, source: str = ""):
+        self.source = source
+        self.kinds = array("B")
+        self.starts = array("L")
+        self.ends = array("L")
 
-    Whitespace, comments and newline tokens are ignored (not returned).
+    def __len__(self) -> int:
+        return len(self.kinds)
+
+    def text(self, i: int) -> str:
+        return self.source[self.starts[i]:self.ends[i]]
+
+    def type_name(self, i: int) -> str:
+        return kind_name(self.kinds[i])
+
+    def to_tuples(self) -> List[Tuple[str, str]]:
+        src = self.source
+        return [(kind_name(k), src[s:e]) for k, s, e in zip(self.kinds, self.starts, self.ends)]
+
+    @classmethod
+    def from_tuples(cls, tokens: List[Tuple[str, str]]) -> "TokenArray":
+        """
+        Build a TokenArray from legacy (type, value) tuples; the values are laid out
+        in a synthetic source string separated by single spaces.
+        """
+        values = [v if v is not None else "" for _, v in tokens]
+        ta = cls(" ".join(values))
+        pos = 0
+        for (typ, _), val in zip(tokens, values):
+            if typ == "KEYWORD":
+                kind = KEYWORD_KIND.get(val, _T_KEYWORD_OTHER)
+            else:
+                kind = _NAME_KINDS.get(typ, T_MISMATCH)
+            ta.kinds.append(kind)
+            ta.starts.append(pos)
+            ta.ends.append(pos + len(val))
+            pos += len(val) + 1
+        return ta
+
+
+def lex(code: str) -> TokenArray:
+    """
+    Tokenize Trion source `code` into a TokenArray (see module docstring).
     """
-    tokens: List[Tuple[str, str]] = []
+    ta = TokenArray(code)
+    # bound methods as locals: this loop runs once per token
+    add_kind, add_start, add_end = ta.kinds.append, ta.starts.append, ta.ends.append
+    space_run, ident_run, digit_run, string_tail = (_SPACE_RUN.match, _IDENT_RUN.match,
+                                                    _DIGIT_RUN.match, _STRING_TAIL.match)
+    classes = _CLASS
+    n = len(code)
     pos = 0
-    length = len(code)
 
-    while pos < length:
-        for typ, regex in _TOKEN_REGEXES:
-            m = regex.match(code, pos)
-            if not m:
-                continue
-            text = m.group(0)
-            pos = m.end()
-            # skip these token types
-            if typ in ("SKIP", "COMMENT", "NEWLINE"):
-                break
-            tokens.append((typ, text))
-            break
+    while pos < n:
+        o = ord(code[pos])
+        if o < 128:
+            c = classes[o]
         else:
-            # Should not happen because MISMATCH will always match; safety fallback
-            tokens.append(("MISMATCH", code[pos]))
+            c = C_DIGIT if code[pos].isdecimal() else C_OTHER
+
+        if c == C_SPACE:
+            pos = space_run(code, pos + 1).end()
+            continue
+        if c == C_NEWLINE:
             pos += 1
+            continue
+
+        start = pos
+        kind = T_MISMATCH
+        end = pos + 1
+        if c == C_ALPHA:
+            end = ident_run(code, end).end()
+            kind = T_IDENT
+            cands = _KW_BY_FIRST.get(code[pos])
+            if cands and (pos == 0 or not _is_word(code, pos - 1)) and (end == n or not _is_word(code, end)):
+                length = end - pos
+                for word, wlen, wkind in cands:
+                    if wlen == length and code.startswith(word, pos):
+                        kind = wkind
+                        break
+        elif c == C_DASH:
+            if end < n and code[end] == "-":
+                nl = code.find("\n", end)
+                pos = n if nl < 0 else nl
+                continue
+            kind = T_OP
+        elif c == C_DIGIT:
+            # \b\d+\b: the whole digit run, and only when neither side touches a word char
+            run_end = digit_run(code, end).end()
+            if (pos == 0 or not _is_word(code, pos - 1)) and (run_end == n or not _is_word(code, run_end)):
+                kind = T_NUMBER
+                end = run_end
+        elif c == C_QUOTE:
+            m = string_tail(code, end)
+            if m:
+                kind = T_STRING
+                end = m.end()
+        elif c == C_OP:
+            kind = T_OP
+
+        add_kind(kind)
+        add_start(start)
+        add_end(end)
+        pos = end
+
+    return ta
 
-    return tokens
+
+def tokenize(code: str) -> List[Tuple[str, str]]:
+    """
+    Tokenize Trion source `code` and return list of (type, value) tuples.
+
+    Whitespace, comments and newline tokens are ignored (not returned).
+    """
+    return lex(code).to_tuples()
 
 
 if __name__ == "__main__":
@@ -69,7 +238,8 @@ if __name__ == "__main__":
     for t in tokenize(sample):
         print(t)
 
-from typing import Any, List, Optional, Tuple
+from typing import Any, List, Optional, Tuple, Union
+from lexer import TokenArray, T_IDENT, T_KEYWORD, K_MAIN, K_CAPSULE, K_ENDCAPSULE
 from ast import (
     Program as AstProgram,
     MainBlock as AstMainBlock,
@@ -243,72 +413,76 @@ def _parse_statement_to_node(s: str):
 # Parser implementation
 # -------------------------
 
+# keywords that end a Main block
+_TOP_LEVEL_KINDS = (K_MAIN, K_CAPSULE, K_ENDCAPSULE)
+
 
 class Parser:
-    def __init__(self, tokens: List[Tuple[str, str]]):
-        self.tokens = list(tokens)
+    def __init__(self, tokens: Union[TokenArray, List[Tuple[str, str]]]):
+        """
+        `tokens` is a TokenArray from lexer.lex() or a legacy list of (type, value) tuples.
+        The parser walks the kind array with an integer cursor and slices token text
+        out of the source only for tokens that end up in the AST.
+        """
+        if not isinstance(tokens, TokenArray):
+            tokens = TokenArray.from_tuples(list(tokens))
+        self.tokens = tokens
+        self._kinds = tokens.kinds
+        self._n = len(tokens.kinds)
         self.pos = 0
 
     # Main parse loop: walks through all tokens and constructs AST nodes
     def parse(self) -> Program:
         nodes: List[Any] = []
-        while not self._eof():
-            if self._match("KEYWORD", "Main"):
+        kinds, n = self._kinds, self._n
+        while self.pos < n:
+            k = kinds[self.pos]
+            if k == K_MAIN:
                 nodes.append(self._parse_main())
-            elif self._match("KEYWORD", "Capsule"):
+            elif k == K_CAPSULE:
                 nodes.append(self._parse_capsule())
             else:
                 # skip unknown or stray tokens
-                self._advance()
+                self.pos += 1
         return Program(nodes)
 
     # Utility helpers
     def _eof(self) -> bool:
-        return self.pos >= len(self.tokens)
+        return self.pos >= self._n
 
-    def _peek(self) -> Tuple[Optional[str], Optional[str]]:
-        if self._eof():
-            return (None, None)
-        return self.tokens[self.pos]
+    def _kind(self) -> int:
+        return self._kinds[self.pos] if self.pos < self._n else 0
 
-    def _advance(self) -> Tuple[Optional[str], Optional[str]]:
-        if self._eof():
-            return (None, None)
-        t = self.tokens[self.pos]
-        self.pos += 1
-        return t
-
-    # Utility to match current token type and optional value
-    def _match(self, typ: str, val: Optional[str] = None) -> bool:
-        if self._eof():
-            return False
-        t_type, t_val = self._peek()
-        if t_type == typ and (val is None or t_val == val):
-            return True
-        return False
+    def _skip_to_keyword(self) -> None:
+        # advance past the current run of non-keyword tokens
+        kinds, n, i = self._kinds, self._n, self.pos
+        while i < n and kinds[i] < T_KEYWORD:
+            i += 1
+        self.pos = i
+
+    def _join(self, start: int, end: int) -> str:
+        # token texts in [start, end) joined by single spaces
+        toks = self.tokens
+        src, starts, ends = toks.source, toks.starts, toks.ends
+        return " ".join(src[starts[i]:ends[i]] for i in range(start, end))
 
     # Parse a Main block definition
     def _parse_main(self) -> MainBlock:
         # consume 'Main'
-        self._advance()
+        self.pos += 1
         # Create MainBlock and collect any following statements until a top-level keyword.
         mb = MainBlock()
         # Collect tokens until we encounter a top-level KEYWORD (Main/Capsule/EndCapsule) or EOF
         while not self._eof():
-            t_type, t_val = self._peek()
-            if t_type == "KEYWORD" and t_val in ("Main", "Capsule", "EndCapsule"):
+            if self._kind() in _TOP_LEVEL_KINDS:
                 break
-            # gather fragments into a single string per line-like statement
-            if t_type is None:
-                self._advance()
-                continue
-            # consume contiguous non-KEYWORD tokens as one fragment
-            parts: List[str] = []
-            while not self._eof() and self._peek()[0] != "KEYWORD":
-                tok = self._advance()[1]
-                if tok is not None:
-                    parts.append(tok)
-            frag = " ".join(parts).strip()
+            # gather fragments into a single string per line-like statement: the current
+            # token (a statement keyword such as Print, or a plain token) plus the
+            # non-KEYWORD tokens that follow it
+            start = self.pos
+            self.pos += 1
+            self._skip_to_keyword()
+            frag = self._join(start, self.pos).strip()
             if frag:
                 mb.add(frag)
             # if next token is KEYWORD we will break on next loop iteration
@@ -317,13 +491,14 @@ class Parser:
     # Parse a Capsule declaration with name and a simple list of statements
     def _parse_capsule(self) -> Capsule:
         # consume 'Capsule'
-        self._advance()
+        self.pos += 1
         # expect identifier for capsule name
-        if not self._match("IDENT"):
+        if self._kind() != T_IDENT:
             # fallback: use a placeholder name and continue
             name = "<anonymous>"
         else:
-            _, name = self._advance()
+            name = self.tokens.text(self.pos)
+            self.pos += 1
 
         capsule = Capsule(name)
 
@@ -331,28 +506,20 @@ class Parser:
         # A statement is heuristically started by a KEYWORD and continues until the next KEYWORD
         # or until EndCapsule. This is intentionally simple and tolerant; more precise parsing
         # can be added later.
-        while not self._eof() and not self._match("KEYWORD", "EndCapsule"):
-            t_type, t_val = self._peek()
-            if t_type == "KEYWORD":
-                # start a new statement
-                stmt_parts: List[str] = []
-                # include the starting keyword (e.g. Print, Rule, Isolate)
-                first = self._advance()[1]
-                if first is not None:
-                    stmt_parts.append(first)
-                # consume following non-KEYWORD tokens as part of this statement
-                while not self._eof() and self._peek()[0] != "KEYWORD":
-                    next_tok = self._advance()[1]
-                    if next_tok is not None:
-                        stmt_parts.append(next_tok)
-                stmt = " ".join(part for part in stmt_parts if part is not None).strip()
+        while not self._eof() and self._kind() != K_ENDCAPSULE:
+            if self._kind() >= T_KEYWORD:
+                # start a new statement: the starting keyword (e.g. Print, Rule, Isolate)
+                # plus the non-KEYWORD tokens that follow it
+                start = self.pos
+                self.pos += 1
+                self._skip_to_keyword()
+                stmt = self._join(start, self.pos).strip()
                 if stmt:
                     capsule.add(stmt)
             else:
                 # For non-keyword stray tokens, consume and append as a raw fragment
-                frag = self._advance()[1]
-                if frag is None:
-                    continue
+                frag = self.tokens.text(self.pos)
+                self.pos += 1
                 if len(capsule.body) == 0:
                     capsule.add(frag)
                 else:
@@ -364,8 +531,8 @@ class Parser:
                         capsule.add(frag)
 
         # consume EndCapsule if present
-        if self._match("KEYWORD", "EndCapsule"):
-            self._advance()
+        if self._kind() == K_ENDCAPSULE:
+            self.pos += 1
 
         return capsule
 
@@ -374,7 +541,7 @@ class Parser:
 # Minimal self-test / example
 # -------------------------
 if __name__ == "__main__":
-    from lexer import tokenize
+    from lexer import lex
     sample_code = """
     Main
         Print: "Hello, World!"
@@ -386,7 +553,7 @@ if __name__ == "__main__":
     Capsule EmptyCapsule
     EndCapsule
     """
-    tokens = tokenize(sample_code)
+    tokens = lex(sample_code)
     parser = Parser(tokens)
     ast = parser.parse()
     print(ast)
@@ -1176,15 +1343,42 @@ Simple LLVM IR code generator for Trion AST using llvmlite.
 - Emits a `main` function that calls capsule functions in AST order
 - Recognizes simple `Print` statements in capsule bodies and lowers them to `puts` calls
 - Interns string constants as LLVM global constant arrays
+- Can emit each top-level node as a standalone IR fragment and link fragments back into
+  one module, so an incremental build only re-emits the capsules that changed
+- Lowers capsule messaging (`Send <Capsule>: <payload>`, `Receive <var>`) after a
+  whole-program wiring pass (`plan_wiring`), see "Capsule messaging" below
+
+Capsule messaging:
+  A capsule with a `Receive <var>` statement is a receiver: statements before it run when
+  the capsule is called from main, statements after it run once per message with <var>
+  bound to the message (an i8* string; `Print: <var>` prints it, `Send X: <var>` forwards
+  it). `plan_wiring` picks the cheapest delivery that keeps main's call order semantics:
+  - "fused": B's only producer A sends to it only from A's run-once part, as the last
+    statements there; A receives nothing itself, B has no run-once part and is called right
+    after A. Each send becomes a direct call of B's handler and B's call from main goes away.
+  - "ring":  B's only producer A sends to it only from its run-once part, A and B are each
+    called once and A before B. Sends store into a fixed-size SPSC ring of i8* sized to the
+    statically known number of sends; B drains it inline when called.
+  - "dynamic": anything else. B becomes a runtime capsule (tr_capsule_create) that is fed with
+    tr_capsule_try_send and drained with tr_capsule_try_recv_batch when B is called and once
+    more before main returns; a send that finds the inbox full drains it inline first.
+  Sends to a capsule without `Receive` are dropped.
 
 This stays intentionally small and easy to extend (expressions, types, externs, etc).
 """
 
 from llvmlite import ir
-from typing import Dict, Any
+from typing import Dict, Any, List, Optional, Tuple
 import re
 
 _VALID_NAME = re.compile(r'[^0-9A-Za-z_]')
+_SEND_RE = re.compile(r'^Send\s+([A-Za-z_][A-Za-z0-9_]*)\s*(?::\s*(.*))?$', re.S)
+_RECEIVE_RE = re.compile(r'^Receive(?:\s+([A-Za-z_][A-Za-z0-9_]*))?\s*$')
+
+_I8P = ir.PointerType(ir.IntType(8))
+_I32 = ir.IntType(32)
+_VOID_FN = ir.FunctionType(ir.VoidType(), [])
+_DRAIN_BATCH = 16          # messages per tr_capsule_try_recv_batch call
 
 
 def _sanitize_name(name: str) -> str:
@@ -1193,13 +1387,65 @@ def _sanitize_name(name: str) -> str:
     return _VALID_NAME.sub('_', name)
 
 
+def _strip_quotes(content: str) -> str:
+    if len(content) >= 2 and ((content[0] == '"' and content[-1] == '"') or (content[0] == "'" and content[-1] == "'")):
+        return content[1:-1]
+    return content
+
+
+def _split_capsule(capsule: Any) -> Tuple[List[str], Optional[str], Optional[List[str]]]:
+    """
+    Split a capsule body at its first `Receive`: (run-once statements, message variable,
+    per-message statements). The last two are None for a capsule that receives nothing.
+    """
+    prelude: List[str] = []
+    for i, stmt in enumerate(getattr(capsule, "body", [])):
+        if not isinstance(stmt, str):
+            continue
+        m = _RECEIVE_RE.match(stmt.strip())
+        if m:
+            rest = [s for s in capsule.body[i + 1:] if isinstance(s, str)]
+            return prelude, m.group(1) or "", rest
+        prelude.append(stmt)
+    return prelude, None, None
+
+
+def _send_target(stmt: str) -> Optional[Tuple[str, str]]:
+    """(receiver symbol, payload text) for a `Send` statement, else None."""
+    m = _SEND_RE.match(stmt.strip())
+    if not m:
+        return None
+    return f"capsule_{_sanitize_name(m.group(1))}", (m.group(2) or "").strip()
+
+
+class WiringPlan:
+    """
+    Result of `Codegen.plan_wiring`: how each receiving capsule gets its messages.
+      modes[symbol] = (mode, ring capacity) with mode "fused", "ring" or "dynamic"
+      fused         = receivers whose call from main is dropped
+    """
+
+    def __init__(self):
+        self.modes: Dict[str, Tuple[str, int]] = {}
+        self.fused: Dict[str, bool] = {}
+
+    def mode(self, symbol: str) -> Tuple[str, int]:
+        return self.modes.get(symbol, ("none", 0))
+
+    def dynamic(self) -> List[str]:
+        return [s for s, (m, _) in self.modes.items() if m == "dynamic"]
+
+
 class Codegen:
-    def __init__(self, module_name: str = "trion"):
+    def __init__(self, module_name: str = "trion", str_prefix: str = ".str"):
         self.module = ir.Module(name=module_name)
+        self._str_prefix = str_prefix
         self.builder: ir.IRBuilder = None  # set when emitting function bodies
         self._str_constants: Dict[str, ir.GlobalVariable] = {}
         self._capsule_funcs: Dict[str, ir.Function] = {}
+        self._externs: Dict[str, ir.Function] = {}
         self._puts = None  # declared puts function
+        self.plan = WiringPlan()
 
     # --- helpers for externs and string constants ---
 
@@ -1208,7 +1454,15 @@ class Codegen:
             return
         # declare: int puts(i8*)
         puts_ty = ir.FunctionType(ir.IntType(32), [ir.PointerType(ir.IntType(8))])
-        self._puts = ir.Function(self.module, puts_ty, name="puts")
+        self._puts = self._extern("puts", puts_ty)
+
+    def _extern(self, name: str, fn_ty: ir.FunctionType) -> ir.Function:
+        """
+        Return (and declare if needed) an external runtime function.
+        """
+        if name not in self._externs:
+            self._externs[name] = ir.Function(self.module, fn_ty, name=name)
+        return self._externs[name]
 
     def _intern_string(self, text: str) -> ir.GlobalVariable:
         """
@@ -1220,7 +1474,7 @@ class Codegen:
         arr_ty = ir.ArrayType(ir.IntType(8), len(data))
         # initializer expects a bytes-like or list of ints
         init = ir.Constant(arr_ty, bytearray(data))
-        gv_name = f".str{len(self._str_constants)}"
+        gv_name = f"{self._str_prefix}{len(self._str_constants)}"
         gv = ir.GlobalVariable(self.module, arr_ty, name=gv_name)
         gv.global_constant = True
         gv.linkage = "internal"
@@ -1237,32 +1491,80 @@ class Codegen:
         gep = gv.gep([zero, zero])
         return gep.bitcast(ptr_ty)
 
-    # --- emission routines ---
+    # --- messaging helpers ---
+    # Per-receiver symbols hang off the capsule name with a '.', which sanitized capsule
+    # names never contain: <sym>.on (handler), <sym>.drain, <sym>.ring/.head/.tail, <sym>.cap
 
-    def emit_capsule(self, capsule: Any) -> ir.Function:
+    def _function(self, name: str, fn_ty: ir.FunctionType) -> ir.Function:
         """
-        Emit a void function for the given Capsule AST node.
-        Capsule.body is expected to be an iterable of simple statements (strings or nodes).
-        Returns the created Function.
+        Return the module's function `name`, declaring it when it is not emitted (yet).
         """
-        name = _sanitize_name(getattr(capsule, "name", "capsule"))
-        func_name = f"capsule_{name}"
-        if func_name in self._capsule_funcs:
-            return self._capsule_funcs[func_name]
-
-        func_ty = ir.FunctionType(ir.VoidType(), [])
-        func = ir.Function(self.module, func_ty, name=func_name)
-        block = func.append_basic_block("entry")
-        builder = ir.IRBuilder(block)
-
-        # ensure puts is declared if we will use prints
-        self._ensure_puts()
+        fn = self.module.globals.get(name)
+        if fn is None:
+            fn = ir.Function(self.module, fn_ty, name=name)
+        return fn
+
+    def _global(self, name: str, ty: ir.Type, init: Any) -> ir.GlobalVariable:
+        gv = self.module.globals.get(name)
+        if gv is None:
+            gv = ir.GlobalVariable(self.module, ty, name=name)
+            gv.linkage = "internal"
+            gv.initializer = ir.Constant(ty, init)
+        return gv
 
-        # naive lowering for string-style statements "Print: ...", "Print ..."
-        for stmt in getattr(capsule, "body", []):
-            if not isinstance(stmt, str):
-                continue
+    def _ring(self, symbol: str, capacity: int) -> Tuple[ir.GlobalVariable, ir.GlobalVariable, ir.GlobalVariable]:
+        size = 1
+        while size < capacity:
+            size <<= 1
+        buf = self._global(f"{symbol}.ring", ir.ArrayType(_I8P, size), None)
+        head = self._global(f"{symbol}.head", _I32, 0)
+        tail = self._global(f"{symbol}.tail", _I32, 0)
+        return buf, head, tail
+
+    def _ring_mask(self, buf: ir.GlobalVariable) -> ir.Constant:
+        return ir.Constant(_I32, buf.type.pointee.count - 1)
+
+    def _capsule_handle(self, symbol: str) -> ir.GlobalVariable:
+        return self._global(f"{symbol}.cap", _I8P, None)
+
+    def _rt_try_send(self) -> ir.Function:
+        return self._extern("tr_capsule_try_send", ir.FunctionType(_I32, [_I8P, _I8P]))
+
+    def _emit_send(self, builder: ir.IRBuilder, target: str, value: ir.Value) -> None:
+        mode, capacity = self.plan.mode(target)
+        if mode == "fused":
+            builder.call(self._function(f"{target}.on", ir.FunctionType(ir.VoidType(), [_I8P])), [value])
+        elif mode == "ring":
+            buf, _, tail = self._ring(target, capacity)
+            t = builder.load(tail)
+            slot = builder.gep(buf, [ir.Constant(_I32, 0), builder.and_(t, self._ring_mask(buf))], inbounds=True)
+            builder.store(value, slot)
+            builder.store(builder.add(t, ir.Constant(_I32, 1)), tail)
+        elif mode == "dynamic":
+            cap = builder.load(self._capsule_handle(target))
+            rc = builder.call(self._rt_try_send(), [cap, value])
+            # inbox full: nothing else drains it while we run, so deliver what is queued first
+            with builder.if_then(builder.icmp_signed("!=", rc, ir.Constant(_I32, 0))):
+                builder.call(self._function(f"{target}.drain", ir.FunctionType(_I32, [])), [])
+                builder.call(self._rt_try_send(), [cap, value])
+        # else: the target receives nothing; the message is dropped
+
+    def _emit_statements(self, builder: ir.IRBuilder, stmts: List[str], var: Optional[str] = None,
+                         msg: Optional[ir.Value] = None) -> None:
+        """
+        Lower capsule statements; inside a handler `var` names the current message `msg`.
+        """
+        for stmt in stmts:
             text = stmt.strip()
+            send = _send_target(text)
+            if send is not None:
+                target, payload = send
+                if var and payload == var:
+                    value = msg
+                else:
+                    value = self._cstr_ptr(self._intern_string(_strip_quotes(payload)))
+                self._emit_send(builder, target, value)
+                continue
             # support "Print:" or "Print"
             if text.lower().startswith("print"):
                 # find content after colon if present
@@ -1273,9 +1575,11 @@ class Codegen:
                     # "Print foo" -> content after whitespace
                     parts = text.split(None, 1)
                     content = parts[1].strip() if len(parts) > 1 else ""
+                if var and content == var:
+                    builder.call(self._puts, [msg])
+                    continue
                 # strip matching surrounding quotes
-                if len(content) >= 2 and ((content[0] == '"' and content[-1] == '"') or (content[0] == "'" and content[-1] == "'")):
-                    content = content[1:-1]
+                content = _strip_quotes(content)
                 # fallback for empty prints
                 if content == "":
                     content = "\n"
@@ -1284,50 +1588,244 @@ class Codegen:
                 builder.call(self._puts, [ptr])
             # other stmt kinds may be extended here
 
+    def _emit_ring_drain(self, func: ir.Function, builder: ir.IRBuilder, symbol: str, capacity: int,
+                         on_fn: ir.Function) -> ir.IRBuilder:
+        buf, head, tail = self._ring(symbol, capacity)
+        loop = func.append_basic_block("drain")
+        body = func.append_basic_block("drain.msg")
+        done = func.append_basic_block("drain.done")
+        builder.branch(loop)
+        b = ir.IRBuilder(loop)
+        h = b.load(head)
+        b.cbranch(b.icmp_unsigned("==", h, b.load(tail)), done, body)
+        b = ir.IRBuilder(body)
+        slot = b.gep(buf, [ir.Constant(_I32, 0), b.and_(h, self._ring_mask(buf))], inbounds=True)
+        m = b.load(slot)
+        b.store(b.add(h, ir.Constant(_I32, 1)), head)
+        b.call(on_fn, [m])
+        b.branch(loop)
+        return ir.IRBuilder(done)
+
+    def _emit_dynamic_drain(self, symbol: str, on_fn: ir.Function) -> ir.Function:
+        """
+        i32 <symbol>.drain(): hand every queued inbox message to the handler; returns the count.
+        """
+        i64 = ir.IntType(64)
+        recv = self._extern("tr_capsule_try_recv_batch", ir.FunctionType(_I32, [_I8P, ir.PointerType(_I8P), i64]))
+        fn = self._function(f"{symbol}.drain", ir.FunctionType(_I32, []))
+        b = ir.IRBuilder(fn.append_basic_block("entry"))
+        batch = b.alloca(ir.ArrayType(_I8P, _DRAIN_BATCH), name="batch")
+        total = b.alloca(_I32, name="total")
+        idx = b.alloca(_I32, name="i")
+        b.store(ir.Constant(_I32, 0), total)
+        first = b.gep(batch, [ir.Constant(_I32, 0), ir.Constant(_I32, 0)], inbounds=True)
+        fill = fn.append_basic_block("fill")
+        each = fn.append_basic_block("each")
+        body = fn.append_basic_block("each.msg")
+        done = fn.append_basic_block("done")
+        b.branch(fill)
+
+        b = ir.IRBuilder(fill)
+        n = b.call(recv, [b.load(self._capsule_handle(symbol)), first, ir.Constant(i64, _DRAIN_BATCH)])
+        b.store(ir.Constant(_I32, 0), idx)
+        # > 0 messages; 0 = closed, -2 = empty, -1 = error all end the drain
+        b.cbranch(b.icmp_signed(">", n, ir.Constant(_I32, 0)), each, done)
+
+        b = ir.IRBuilder(each)
+        i = b.load(idx)
+        b.cbranch(b.icmp_signed("<", i, n), body, fill)
+
+        b = ir.IRBuilder(body)
+        m = b.load(b.gep(batch, [ir.Constant(_I32, 0), i], inbounds=True))
+        b.call(on_fn, [m])
+        b.store(b.add(i, ir.Constant(_I32, 1)), idx)
+        b.store(b.add(b.load(total), ir.Constant(_I32, 1)), total)
+        b.branch(each)
+
+        b = ir.IRBuilder(done)
+        b.ret(b.load(total))
+        return fn
+
+    # --- whole-program wiring ---
+
+    def plan_wiring(self, program: Any) -> WiringPlan:
+        """
+        Whole-program pass over the top-level nodes of `program`: find each receiver's
+        producers and pick fused / ring / dynamic delivery (see the module docstring).
+        """
+        order: List[str] = []
+        capsules: Dict[str, Any] = {}
+        for node in getattr(program, "body", []):
+            symbol = self.fragment_symbol(node)
+            if not symbol:
+                continue
+            order.append(symbol)
+            # as in emit_capsule, the first definition of a name is the one that runs
+            if symbol != "main_block" and symbol not in capsules:
+                capsules[symbol] = node
+        parts = {symbol: _split_capsule(node) for symbol, node in capsules.items()}
+
+        # producers[target][producer] = [sends from the run-once part, sends from the handler]
+        producers: Dict[str, Dict[str, List[int]]] = {}
+        for symbol, (prelude, _, handler) in parts.items():
+            for which, stmts in ((0, prelude), (1, handler or [])):
+                for stmt in stmts:
+                    send = _send_target(stmt)
+                    if send is not None:
+                        counts = producers.setdefault(send[0], {}).setdefault(symbol, [0, 0])
+                        counts[which] += 1
+
+        plan = WiringPlan()
+        for symbol, (prelude, _, handler) in parts.items():
+            if handler is None:
+                continue
+            mode, capacity = "dynamic", 0
+            srcs = producers.get(symbol, {})
+            if len(srcs) == 1:
+                src, (once, per_msg) = next(iter(srcs.items()))
+                if (src != symbol and per_msg == 0 and order.count(src) == 1 and order.count(symbol) == 1
+                        and order.index(src) < order.index(symbol)):
+                    mode, capacity = "ring", once
+                    src_prelude, _, src_handler = parts[src]
+                    tail = src_prelude[len(src_prelude) - once:]
+                    if (src_handler is None and not prelude and order.index(symbol) == order.index(src) + 1
+                            and all((_send_target(s) or ("",))[0] == symbol for s in tail)):
+                        mode = "fused"
+                        plan.fused[symbol] = True
+            plan.modes[symbol] = (mode, capacity)
+        return plan
+
+    def fragment_signature(self, node: Any, plan: WiringPlan) -> str:
+        """
+        The part of `plan` that `node`'s emitted code depends on (its own delivery mode and
+        those of the capsules it sends to), for caching fragments across builds.
+        """
+        symbol = self.fragment_symbol(node)
+        if not symbol or symbol == "main_block":
+            return ""
+        prelude, _, handler = _split_capsule(node)
+        targets = {symbol}
+        for stmt in prelude + (handler or []):
+            send = _send_target(stmt)
+            if send is not None:
+                targets.add(send[0])
+        return ";".join(f"{t}={plan.mode(t)[0]}/{plan.mode(t)[1]}" for t in sorted(targets))
+
+    # --- emission routines ---
+
+    def emit_capsule(self, capsule: Any) -> ir.Function:
+        """
+        Emit a void function for the given Capsule AST node.
+        Capsule.body is expected to be an iterable of simple statements (strings or nodes).
+        A receiver also gets its per-message handler `<name>.on(i8*)` and, depending on
+        its wiring, an inline ring drain or a runtime inbox drain.
+        Returns the created Function.
+        """
+        name = _sanitize_name(getattr(capsule, "name", "capsule"))
+        func_name = f"capsule_{name}"
+        if func_name in self._capsule_funcs:
+            return self._capsule_funcs[func_name]
+
+        func = self._function(func_name, _VOID_FN)
+        block = func.append_basic_block("entry")
+        builder = ir.IRBuilder(block)
+
+        # ensure puts is declared if we will use prints
+        self._ensure_puts()
+
+        # naive lowering for string-style statements "Print: ...", "Print ...", "Send ..."
+        prelude, var, handler = _split_capsule(capsule)
+        self._emit_statements(builder, prelude)
+
+        if handler is not None:
+            on_fn = self._function(f"{func_name}.on", ir.FunctionType(ir.VoidType(), [_I8P]))
+            hb = ir.IRBuilder(on_fn.append_basic_block("entry"))
+            self._emit_statements(hb, handler, var, on_fn.args[0])
+            hb.ret_void()
+            mode, capacity = self.plan.mode(func_name)
+            if mode == "ring":
+                builder = self._emit_ring_drain(func, builder, func_name, capacity, on_fn)
+            elif mode == "dynamic":
+                builder.call(self._emit_dynamic_drain(func_name, on_fn), [])
+
         builder.ret_void()
         self._capsule_funcs[func_name] = func
         return func
 
-    def emit_main(self, program: Any):
+    def emit_main_block(self) -> ir.Function:
         """
-        Emit a `main` function that calls capsule functions in the order they appear
-        in program.body. If a MainBlock node exists it will be emitted as an empty function
-        and called as well to maintain ordering.
+        Emit (once) the empty `main_block` helper that stands in for a MainBlock node.
+        """
+        mainblk_name = "main_block"
+        if mainblk_name not in self._capsule_funcs:
+            fb = ir.Function(self.module, ir.FunctionType(ir.VoidType(), []), name=mainblk_name)
+            b = fb.append_basic_block("entry")
+            ir.IRBuilder(b).ret_void()
+            self._capsule_funcs[mainblk_name] = fb
+        return self._capsule_funcs[mainblk_name]
+
+    def _emit_main_fn(self, calls: List[str]) -> ir.Function:
+        """
+        Emit `main`: create the runtime capsules of dynamic receivers, call `calls` in order
+        (except fused receivers), drain dynamic inboxes until quiet, destroy the capsules.
         """
         func_ty = ir.FunctionType(ir.IntType(32), [])
         main_fn = ir.Function(self.module, func_ty, name="main")
         block = main_fn.append_basic_block("entry")
         self.builder = ir.IRBuilder(block)
 
+        dynamic = self.plan.dynamic()
+        if dynamic:
+            create = self._extern("tr_capsule_create", ir.FunctionType(_I8P, [_I8P, _I8P, _I8P]))
+            null = ir.Constant(_I8P, None)
+            for symbol in dynamic:
+                name = self._cstr_ptr(self._intern_string(symbol[len("capsule_"):]))
+                self.builder.store(self.builder.call(create, [name, null, null]), self._capsule_handle(symbol))
+
+        # Call each capsule/function in order
+        for symbol in calls:
+            if symbol not in self.plan.fused:
+                self.builder.call(self._function(symbol, _VOID_FN), [])
+
+        if dynamic:
+            # messages sent after their receiver ran (or by another drain) are still delivered
+            settle = main_fn.append_basic_block("settle")
+            exit_blk = main_fn.append_basic_block("exit")
+            self.builder.branch(settle)
+            self.builder = ir.IRBuilder(settle)
+            n = ir.Constant(_I32, 0)
+            for symbol in dynamic:
+                n = self.builder.add(n, self.builder.call(self._function(f"{symbol}.drain", ir.FunctionType(_I32, [])), []))
+            self.builder.cbranch(self.builder.icmp_signed("!=", n, ir.Constant(_I32, 0)), settle, exit_blk)
+            self.builder = ir.IRBuilder(exit_blk)
+            destroy = self._extern("tr_capsule_destroy", ir.FunctionType(ir.VoidType(), [_I8P]))
+            for symbol in dynamic:
+                self.builder.call(destroy, [self.builder.load(self._capsule_handle(symbol))])
+
+        # return 0
+        self.builder.ret(ir.Constant(ir.IntType(32), 0))
+        self.builder = None
+        return main_fn
+
+    def emit_main(self, program: Any):
+        """
+        Emit a `main` function that calls capsule functions in the order they appear
+        in program.body. If a MainBlock node exists it will be emitted as an empty function
+        and called as well to maintain ordering.
+        """
         # Emit all capsule functions first
         calls = []
         for node in getattr(program, "body", []):
             tname = type(node).__name__
             if tname == "Capsule":
-                fn = self.emit_capsule(node)
-                calls.append(fn)
+                calls.append(self.emit_capsule(node).name)
             elif tname == "Main" or tname == "MainBlock":
-                # create an empty helper function for MainBlock for symmetry
-                mainblk_name = "main_block"
-                if mainblk_name not in self._capsule_funcs:
-                    fb = ir.Function(self.module, ir.FunctionType(ir.VoidType(), []), name=mainblk_name)
-                    b = fb.append_basic_block("entry")
-                    ir.IRBuilder(b).ret_void()
-                    self._capsule_funcs[mainblk_name] = fb
-                calls.append(self._capsule_funcs[mainblk_name])
+                calls.append(self.emit_main_block().name)
             else:
                 # unknown top-level node: attempt to emit if it has a `name` attr and body
                 if hasattr(node, "name") and hasattr(node, "body"):
-                    calls.append(self.emit_capsule(node))
-
-        # Call each capsule/function in order
-        for fn in calls:
-            self.builder.call(fn, [])
-
-        # return 0
-        self.builder.ret(ir.Constant(ir.IntType(32), 0))
-        self.builder = None
-        return main_fn
+                    calls.append(self.emit_capsule(node).name)
+        return self._emit_main_fn(calls)
 
     def generate(self, program: Any):
         """
@@ -1336,12 +1834,94 @@ class Codegen:
         # clear any previously interned constants to keep names stable per run
         self._str_constants.clear()
         self._capsule_funcs.clear()
+        self.plan = self.plan_wiring(program)
         # Produce capsules and main
         for node in getattr(program, "body", []):
             if type(node).__name__ == "Capsule":
                 self.emit_capsule(node)
         self.emit_main(program)
 
+    # --- fragments (incremental builds) ---
+
+    @staticmethod
+    def fragment_symbol(node: Any) -> str:
+        """
+        Name of the function `emit_main` would call for a top-level node, or "" when the
+        node produces no function (e.g. a statement left behind by capsule inlining).
+        """
+        tname = type(node).__name__
+        if tname == "Main" or tname == "MainBlock":
+            return "main_block"
+        if tname == "Capsule" or (hasattr(node, "name") and hasattr(node, "body")):
+            return f"capsule_{_sanitize_name(getattr(node, 'name', 'capsule'))}"
+        return ""
+
+    def _fragment_text(self, symbol: str) -> Tuple[str, Dict[str, str]]:
+        # what this scratch module defines for `symbol`: its string constants, its own
+        # functions/globals (<symbol> and <symbol>.*); references to other capsules stay
+        # symbolic and are resolved when the fragments are linked
+        strs = set(id(gv) for gv in self._str_constants.values())
+        parts = [str(gv) for gv in self._str_constants.values()]
+        for name, gv in self.module.globals.items():
+            if id(gv) in strs or name in self._externs:
+                continue
+            if name == symbol or name.startswith(symbol + "."):
+                if not (isinstance(gv, ir.Function) and not gv.blocks):
+                    parts.append(str(gv))
+        externs = {name: str(fn) for name, fn in self._externs.items()}
+        return "\n".join(parts), externs
+
+    def emit_fragment(self, node: Any, plan: Optional[WiringPlan] = None) -> Dict[str, Any]:
+        """
+        Emit one top-level node into a scratch module and return it as a text fragment:
+        { "symbol": function name, "ir": definitions, "externs": {name: declaration} }.
+        String constants are prefixed with the function name so fragments emitted in
+        separate runs never clash once `link_fragments` puts them in one module.
+        `plan` is the whole-program wiring (see plan_wiring); without it sends are dropped.
+        """
+        symbol = self.fragment_symbol(node)
+        if not symbol:
+            return {"symbol": "", "ir": "", "externs": {}}
+        scratch = Codegen(self.module.name, str_prefix=f".str.{symbol}.")
+        scratch.plan = plan if plan is not None else WiringPlan()
+        if symbol == "main_block":
+            scratch.emit_main_block()
+        else:
+            scratch.emit_capsule(node)
+        text, externs = scratch._fragment_text(symbol)
+        return {"symbol": symbol, "ir": text, "externs": externs}
+
+    def link_fragments(self, fragments: List[Dict[str, Any]], calls: List[str],
+                       plan: Optional[WiringPlan] = None) -> str:
+        """
+        Stitch fragments (from `emit_fragment`) into module text with a `main` that calls
+        `calls` in order. As in `emit_capsule`, the first definition of a symbol wins.
+        `plan` must be the one the fragments were emitted with.
+        """
+        seen: Dict[str, bool] = {}
+        externs: Dict[str, str] = {}
+        bodies: List[str] = []
+        for frag in fragments:
+            if not frag["symbol"] or frag["symbol"] in seen:
+                continue
+            seen[frag["symbol"]] = True
+            externs.update(frag["externs"])
+            bodies.append(frag["ir"])
+
+        # main references the fragment functions through declarations in a scratch module;
+        # only what main itself owns is kept since the stitched module defines the callees
+        scratch = Codegen(self.module.name, str_prefix=".str.main.")
+        scratch.plan = plan if plan is not None else WiringPlan()
+        main_fn = scratch._emit_main_fn(calls)
+        externs.update((name, str(fn)) for name, fn in scratch._externs.items())
+
+        lines = [str(ir.Module(name=self.module.name))]
+        lines += [externs[name] for name in sorted(externs)]
+        lines += bodies
+        lines += [str(gv) for gv in scratch._str_constants.values()]
+        lines.append(str(main_fn))
+        return "\n".join(lines) + "\n"
+
     def save(self, path: str = "output.ll"):
         """
         Write the textual IR to `path`.
@@ -1349,7 +1929,6 @@ class Codegen:
         with open(path, "w", encoding="utf-8") as f:
             f.write(str(self.module))
             print(f"LLVM IR written to {path}")
-
 """
 TrionPatternAI.py
 Pattern matching and deduction helpers for the Trion compiler.
@@ -2341,3 +2920,334 @@ def tr_log(fmt: str, *args) -> None:
     print(fmt % args if args else fmt)
 
 # End of trion_runtime.py
+
+"""
+incremental.py
+
+Incremental build driver for the Trion front-end
+(tokenize -> Parser -> PatternEngine -> Codegen).
+
+The source is split into top-level units (one Capsule or Main block each, cut at
+line starts). Each unit is keyed by a content hash; the cache maps that key to the
+unit's transformed AST, its LLVM IR fragments and its embedded NASM/HTML blocks. A
+rebuild re-lexes, re-parses, re-optimizes and re-emits only the units whose text
+changed, then `Codegen.link_fragments` stitches output.ll from the cached pieces.
+
+Capsule messaging is wired over the whole program (`Codegen.plan_wiring`), so the plan
+is recomputed from all units' ASTs on every build. Each cached fragment records the part
+of the plan it was emitted against (`Codegen.fragment_signature`); a unit whose text is
+unchanged is still re-emitted (but not re-parsed) when that part changed, e.g. when a
+capsule it sends to gained a second producer.
+
+Units never change meaning when cut out of the file: a cut is only made at a line
+that starts with `Capsule` or `Main`, outside any string, open capsule or embedded
+NASM/HTML region, which is exactly where the parser would start a new node anyway.
+
+Cache keys also cover the source of every front-end stage (lexer, parser, pattern
+engine, codegen, the embed extractors and this file), so editing any of them
+invalidates the whole cache instead of reusing output built by the old code.
+
+Cached units live in memory for the life of a build object and on disk in
+$TRION_BUILD_CACHE, else $XDG_CACHE_HOME/trion/build, else ~/.cache/trion/build.
+Cache files are pickles, so the directory is created 0700 and, on POSIX, the disk cache
+is skipped when it is owned by another user or writable by group or others.
+"""
+
+from typing import Any, Dict, List, Optional, Tuple
+import argparse
+import hashlib
+import os
+import pickle
+import re
+import stat
+import sys
+import tempfile
+
+from lexer import lex
+from parser import Parser, Program
+from ai.TrionPatternAI import PatternEngine, default_engine_with_examples
+from nasm_embed import extract_nasm_blocks
+from html_embed import extract_html_blocks
+from codegen import Codegen
+
+# bump when the layout of a cached unit or the meaning of a stage changes
+CACHE_FORMAT = "trion-unit-2"
+
+# lexer-visible pieces that decide where a unit may end: strings and comments hide
+# keywords and newlines, block keywords open/close capsules
+_SCAN_RE = re.compile(r'"(?:\\.|[^"\\])*"|--[^\n]*|\b(?:Capsule|EndCapsule)\b|\n')
+_UNIT_START_RE = re.compile(r'[ \t\r]*(?:Main|Capsule)\b')
+
+# embedded block markers, matched on raw lines exactly as the extractors do
+_NASM_START_RE = re.compile(r'--\s*nasm-start(?::|\s+)?(.*)$')
+_NASM_END_RE = re.compile(r'--\s*nasm-end\b')
+_HTML_START_RE = re.compile(r'--\s*html-start(?::|\s+)?(.*)$')
+_HTML_END_RE = re.compile(r'--\s*html-end\b')
+_HTML_TAG_RE = re.compile(r'<html\b[^>]*>|</html>', flags=re.IGNORECASE)
+
+
+def default_cache_dir() -> str:
+    d = os.environ.get("TRION_BUILD_CACHE")
+    if d:
+        return d
+    d = os.environ.get("XDG_CACHE_HOME")
+    if d:
+        return os.path.join(d, "trion", "build")
+    return os.path.join(os.path.expanduser("~"), ".cache", "trion", "build")
+
+
+_source_digest_cache: Optional[bytes] = None
+
+
+def _source_digest() -> bytes:
+    # hash of the modules whose code decides what a unit compiles to; when one cannot be
+    # read there is no way to tell stale entries apart, so the disk cache is never hit
+    global _source_digest_cache
+    if _source_digest_cache is None:
+        h = hashlib.sha256()
+        for fn in (lex, Parser, PatternEngine, extract_nasm_blocks, extract_html_blocks, Codegen, split_units):
+            mod = sys.modules.get(fn.__module__)
+            try:
+                with open(mod.__file__, "rb") as f:
+                    h.update(f.read())
+            except (AttributeError, TypeError, OSError):
+                h.update(os.urandom(32))
+        _source_digest_cache = h.digest()
+    return _source_digest_cache
+
+
+def _cache_dir_usable(d: str) -> bool:
+    # cache files are unpickled, so only trust a directory nobody else can write to
+    try:
+        os.makedirs(d, mode=0o700, exist_ok=True)
+        st = os.stat(d)
+    except OSError:
+        return False
+    if not stat.S_ISDIR(st.st_mode):
+        return False
+    if hasattr(os, "getuid") and (st.st_uid != os.getuid() or st.st_mode & (stat.S_IWGRP | stat.S_IWOTH)):
+        return False
+    return True
+
+
+def _marker_state(line: str, inside: bool, start_re, end_re) -> bool:
+    # same precedence as extract_nasm_blocks / extract_html_blocks: a start wins over an end
+    if start_re.search(line):
+        return True
+    if end_re.search(line):
+        return False
+    return inside
+
+
+def _tag_state(line: str, inside: bool) -> bool:
+    # a <html> tag pairs with the first </html> after it; strays on either side are ignored
+    for m in _HTML_TAG_RE.finditer(line):
+        closing = m.group(0).startswith("</")
+        if inside == closing:
+            inside = not closing
+    return inside
+
+
+def split_units(code: str) -> List[Tuple[int, str]]:
+    """
+    Split `code` into top-level units. Returns (start_line, text) pairs whose texts
+    concatenate back to `code`; start_line is 1-based.
+    """
+    code = code.replace('\r\n', '\n').replace('\r', '\n')
+    units: List[Tuple[int, str]] = []
+    unit_pos, unit_line = 0, 1
+    line_pos, line_no = 0, 1
+    in_capsule = False
+    in_nasm = in_html = in_tag = False
+    for m in _SCAN_RE.finditer(code):
+        tok = m.group(0)
+        if tok == "Capsule":
+            in_capsule = True
+            continue
+        if tok == "EndCapsule":
+            in_capsule = False
+            continue
+        # newlines inside strings are consumed by the string match, so this one is real
+        line_no += tok.count("\n")
+        if tok != "\n":
+            continue
+        raw = code[line_pos:m.start()]
+        in_nasm = _marker_state(raw, in_nasm, _NASM_START_RE, _NASM_END_RE)
+        in_html = _marker_state(raw, in_html, _HTML_START_RE, _HTML_END_RE)
+        in_tag = _tag_state(raw, in_tag)
+        line_pos = m.end()
+        if in_capsule or in_nasm or in_html or in_tag:
+            continue
+        if line_pos > unit_pos and _UNIT_START_RE.match(code, line_pos):
+            units.append((unit_line, code[unit_pos:line_pos]))
+            unit_pos, unit_line = line_pos, line_no
+    if unit_pos < len(code) or not units:
+        units.append((unit_line, code[unit_pos:]))
+    return units
+
+
+class IncrementalBuild:
+    """
+    Content-addressed front-end cache. Typical use:
+
+        build = IncrementalBuild()
+        build.compile_file("prog.trn", "output.ll")
+        print(build.stats)   # {"units": N, "hits": H, "misses": M, "reemitted": R}
+    """
+
+    def __init__(self, cache_dir: Optional[str] = None, module_name: str = "trion",
+                 engine: Optional[PatternEngine] = None, persist: bool = True):
+        self.module_name = module_name
+        self.engine = engine if engine is not None else default_engine_with_examples()
+        self.cache_dir = (cache_dir or default_cache_dir()) if persist else None
+        self.codegen = Codegen(module_name)
+        self._memo: Dict[str, Dict[str, Any]] = {}
+        self.stats: Dict[str, int] = {"units": 0, "hits": 0, "misses": 0, "reemitted": 0}
+        # results of the last compile(), with line numbers relative to the whole file
+        self.program: Optional[Program] = None
+        self.nasm_blocks: List[Dict[str, Any]] = []
+        self.html_blocks: List[Dict[str, Any]] = []
+        # everything besides the unit text that changes what a unit compiles to
+        salt = "\0".join([CACHE_FORMAT, module_name] + [r.name for r in self.engine.rules])
+        self._salt = hashlib.sha256(_source_digest() + salt.encode("utf-8")).digest()
+        self._dir_ok: Optional[bool] = None
+
+    # --- cache storage ---
+
+    def _key(self, text: str) -> str:
+        h = hashlib.sha256(self._salt)
+        h.update(text.encode("utf-8"))
+        return h.hexdigest()
+
+    def _disk_cache(self) -> bool:
+        if self._dir_ok is None:
+            self._dir_ok = bool(self.cache_dir) and _cache_dir_usable(self.cache_dir)
+            if self.cache_dir and not self._dir_ok:
+                print(f"warning: not using build cache {self.cache_dir}: not a private directory of this user",
+                      file=sys.stderr)
+        return self._dir_ok
+
+    def _load(self, key: str) -> Optional[Dict[str, Any]]:
+        unit = self._memo.get(key)
+        if unit is not None or not self._disk_cache():
+            return unit
+        try:
+            with open(os.path.join(self.cache_dir, key + ".unit"), "rb") as f:
+                unit = pickle.load(f)
+        except (OSError, EOFError, pickle.UnpicklingError, AttributeError, ImportError):
+            return None
+        if not isinstance(unit, dict) or unit.get("format") != CACHE_FORMAT:
+            return None
+        self._memo[key] = unit
+        return unit
+
+    def _store(self, key: str, unit: Dict[str, Any]) -> None:
+        self._memo[key] = unit
+        if not self._disk_cache():
+            return
+        # write-then-rename so a concurrent or interrupted build never sees half a file
+        try:
+            fd, tmp = tempfile.mkstemp(dir=self.cache_dir, suffix=".tmp")
+            with os.fdopen(fd, "wb") as f:
+                pickle.dump(unit, f, protocol=pickle.HIGHEST_PROTOCOL)
+            os.replace(tmp, os.path.join(self.cache_dir, key + ".unit"))
+        except OSError:
+            pass  # the cache is an accelerator; a read-only cache dir just means slower builds
+
+    # --- per-unit pipeline ---
+
+    def _compile_unit(self, text: str) -> Dict[str, Any]:
+        # front half only: fragments need the whole-program plan, see _emit_unit
+        program = Parser(lex(text)).parse()
+        program, _ = self.engine.apply_transforms(program)
+        return {
+            "format": CACHE_FORMAT,
+            "nodes": list(getattr(program, "body", [])),
+            "signatures": None,
+            "fragments": [],
+            "nasm": extract_nasm_blocks(text),
+            "html": extract_html_blocks(text),
+        }
+
+    def _emit_unit(self, unit: Dict[str, Any], plan: Any) -> None:
+        fragments = []
+        for node in unit["nodes"]:
+            frag = self.codegen.emit_fragment(node, plan)
+            if frag["symbol"]:
+                fragments.append(frag)
+        unit["fragments"] = fragments
+
+    @staticmethod
+    def _rebase(blocks: List[Dict[str, Any]], first_line: int) -> List[Dict[str, Any]]:
+        out = []
+        for b in blocks:
+            b = dict(b)
+            b["start_line"] += first_line - 1
+            b["end_line"] += first_line - 1
+            out.append(b)
+        return out
+
+    # --- entry points ---
+
+    def compile(self, code: str) -> str:
+        """
+        Compile Trion source to LLVM IR text, reusing cached units where the text is unchanged.
+        """
+        self.stats = {"units": 0, "hits": 0, "misses": 0, "reemitted": 0}
+        nodes: List[Any] = []
+        units: List[Tuple[str, Dict[str, Any], bool]] = []
+        self.nasm_blocks, self.html_blocks = [], []
+        for first_line, text in split_units(code):
+            key = self._key(text)
+            unit = self._load(key)
+            self.stats["units"] += 1
+            fresh = unit is None
+            if fresh:
+                unit = self._compile_unit(text)
+                self.stats["misses"] += 1
+            else:
+                self.stats["hits"] += 1
+            units.append((key, unit, fresh))
+            nodes.extend(unit["nodes"])
+            self.nasm_blocks.extend(self._rebase(unit["nasm"], first_line))
+            self.html_blocks.extend(self._rebase(unit["html"], first_line))
+        # extract_html_blocks lists every marker block before any tag block
+        self.html_blocks.sort(key=lambda b: b["type"] != "marker")
+        self.program = Program(nodes)
+
+        plan = self.codegen.plan_wiring(self.program)
+        fragments: List[Dict[str, Any]] = []
+        for key, unit, fresh in units:
+            signatures = [self.codegen.fragment_signature(n, plan) for n in unit["nodes"]]
+            if fresh or unit["signatures"] != signatures:
+                if not fresh:
+                    self.stats["reemitted"] += 1
+                self._emit_unit(unit, plan)
+                unit["signatures"] = signatures
+                self._store(key, unit)
+            fragments.extend(unit["fragments"])
+        calls = [s for s in (Codegen.fragment_symbol(n) for n in nodes) if s]
+        return self.codegen.link_fragments(fragments, calls, plan)
+
+    def compile_file(self, path: str, out_path: str = "output.ll") -> str:
+        with open(path, "r", encoding="utf-8") as fh:
+            code = fh.read()
+        text = self.compile(code)
+        with open(out_path, "w", encoding="utf-8") as f:
+            f.write(text)
+        print(f"LLVM IR written to {out_path}")
+        return text
+
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="Incrementally compile a Trion source file to LLVM IR.")
+    ap.add_argument("path", help="Trion source file (.trn)")
+    ap.add_argument("-o", "--output", default="output.ll", help="LLVM IR output path")
+    ap.add_argument("--cache-dir", default=None, help="unit cache directory (default: see module doc)")
+    ap.add_argument("--no-cache", action="store_true", help="cache in memory only for this run")
+    args = ap.parse_args()
+
+    build = IncrementalBuild(cache_dir=args.cache_dir, persist=not args.no_cache)
+    build.compile_file(args.path, args.output)
+    s = build.stats
+    print(f"units={s['units']} reused={s['hits']} rebuilt={s['misses']} re-emitted={s['reemitted']}")
@@ -0,0 +1,330 @@
+"""
+incremental.py
+
+Incremental build driver for the Trion front-end
+(tokenize -> Parser -> PatternEngine -> Codegen).
+
+The source is split into top-level units (one Capsule or Main block each, cut at
+line starts). Each unit is keyed by a content hash; the cache maps that key to the
+unit's transformed AST, its LLVM IR fragments and its embedded NASM/HTML blocks. A
+rebuild re-lexes, re-parses, re-optimizes and re-emits only the units whose text
+changed, then `Codegen.link_fragments` stitches output.ll from the cached pieces.
+
+Capsule messaging is wired over the whole program (`Codegen.plan_wiring`), so the plan
+is recomputed from all units' ASTs on every build. Each cached fragment records the part
+of the plan it was emitted against (`Codegen.fragment_signature`); a unit whose text is
+unchanged is still re-emitted (but not re-parsed) when that part changed, e.g. when a
+capsule it sends to gained a second producer.
+
+Units never change meaning when cut out of the file: a cut is only made at a line
+that starts with `Capsule` or `Main`, outside any string, open capsule or embedded
+NASM/HTML region, which is exactly where the parser would start a new node anyway.
+
+Cache keys also cover the source of every front-end stage (lexer, parser, pattern
+engine, codegen, the embed extractors and this file), so editing any of them
+invalidates the whole cache instead of reusing output built by the old code.
+
+Cached units live in memory for the life of a build object and on disk in
+$TRION_BUILD_CACHE, else $XDG_CACHE_HOME/trion/build, else ~/.cache/trion/build.
+Cache files are pickles, so the directory is created 0700 and, on POSIX, the disk cache
+is skipped when it is owned by another user or writable by group or others.
+"""
+
+from typing import Any, Dict, List, Optional, Tuple
+import argparse
+import hashlib
+import os
+import pickle
+import re
+import stat
+import sys
+import tempfile
+
+from lexer import lex
+from parser import Parser, Program
+from ai.TrionPatternAI import PatternEngine, default_engine_with_examples
+from nasm_embed import extract_nasm_blocks
+from html_embed import extract_html_blocks
+from codegen import Codegen
+
+# bump when the layout of a cached unit or the meaning of a stage changes
+CACHE_FORMAT = "trion-unit-2"
+
+# lexer-visible pieces that decide where a unit may end: strings and comments hide
+# keywords and newlines, block keywords open/close capsules
+_SCAN_RE = re.compile(r'"(?:\\.|[^"\\])*"|--[^\n]*|\b(?:Capsule|EndCapsule)\b|\n')
+_UNIT_START_RE = re.compile(r'[ \t\r]*(?:Main|Capsule)\b')
+
+# embedded block markers, matched on raw lines exactly as the extractors do
+_NASM_START_RE = re.compile(r'--\s*nasm-start(?::|\s+)?(.*)$')
+_NASM_END_RE = re.compile(r'--\s*nasm-end\b')
+_HTML_START_RE = re.compile(r'--\s*html-start(?::|\s+)?(.*)$')
+_HTML_END_RE = re.compile(r'--\s*html-end\b')
+_HTML_TAG_RE = re.compile(r'<html\b[^>]*>|</html>', flags=re.IGNORECASE)
+
+
+def default_cache_dir() -> str:
+    d = os.environ.get("TRION_BUILD_CACHE")
+    if d:
+        return d
+    d = os.environ.get("XDG_CACHE_HOME")
+    if d:
+        return os.path.join(d, "trion", "build")
+    return os.path.join(os.path.expanduser("~"), ".cache", "trion", "build")
+
+
+_source_digest_cache: Optional[bytes] = None
+
+
+def _source_digest() -> bytes:
+    # hash of the modules whose code decides what a unit compiles to; when one cannot be
+    # read there is no way to tell stale entries apart, so the disk cache is never hit
+    global _source_digest_cache
+    if _source_digest_cache is None:
+        h = hashlib.sha256()
+        for fn in (lex, Parser, PatternEngine, extract_nasm_blocks, extract_html_blocks, Codegen, split_units):
+            mod = sys.modules.get(fn.__module__)
+            try:
+                with open(mod.__file__, "rb") as f:
+                    h.update(f.read())
+            except (AttributeError, TypeError, OSError):
+                h.update(os.urandom(32))
+        _source_digest_cache = h.digest()
+    return _source_digest_cache
+
+
+def _cache_dir_usable(d: str) -> bool:
+    # cache files are unpickled, so only trust a directory nobody else can write to
+    try:
+        os.makedirs(d, mode=0o700, exist_ok=True)
+        st = os.stat(d)
+    except OSError:
+        return False
+    if not stat.S_ISDIR(st.st_mode):
+        return False
+    if hasattr(os, "getuid") and (st.st_uid != os.getuid() or st.st_mode & (stat.S_IWGRP | stat.S_IWOTH)):
+        return False
+    return True
+
+
+def _marker_state(line: str, inside: bool, start_re, end_re) -> bool:
+    # same precedence as extract_nasm_blocks / extract_html_blocks: a start wins over an end
+    if start_re.search(line):
+        return True
+    if end_re.search(line):
+        return False
+    return inside
+
+
+def _tag_state(line: str, inside: bool) -> bool:
+    # a <html> tag pairs with the first </html> after it; strays on either side are ignored
+    for m in _HTML_TAG_RE.finditer(line):
+        closing = m.group(0).startswith("</")
+        if inside == closing:
+            inside = not closing
+    return inside
+
+
+def split_units(code: str) -> List[Tuple[int, str]]:
+    """
+    Split `code` into top-level units. Returns (start_line, text) pairs whose texts
+    concatenate back to `code`; start_line is 1-based.
+    """
+    code = code.replace('\r\n', '\n').replace('\r', '\n')
+    units: List[Tuple[int, str]] = []
+    unit_pos, unit_line = 0, 1
+    line_pos, line_no = 0, 1
+    in_capsule = False
+    in_nasm = in_html = in_tag = False
+    for m in _SCAN_RE.finditer(code):
+        tok = m.group(0)
+        if tok == "Capsule":
+            in_capsule = True
+            continue
+        if tok == "EndCapsule":
+            in_capsule = False
+            continue
+        # newlines inside strings are consumed by the string match, so this one is real
+        line_no += tok.count("\n")
+        if tok != "\n":
+            continue
+        raw = code[line_pos:m.start()]
+        in_nasm = _marker_state(raw, in_nasm, _NASM_START_RE, _NASM_END_RE)
+        in_html = _marker_state(raw, in_html, _HTML_START_RE, _HTML_END_RE)
+        in_tag = _tag_state(raw, in_tag)
+        line_pos = m.end()
+        if in_capsule or in_nasm or in_html or in_tag:
+            continue
+        if line_pos > unit_pos and _UNIT_START_RE.match(code, line_pos):
+            units.append((unit_line, code[unit_pos:line_pos]))
+            unit_pos, unit_line = line_pos, line_no
+    if unit_pos < len(code) or not units:
+        units.append((unit_line, code[unit_pos:]))
+    return units
+
+
+class IncrementalBuild:
+    """
+    Content-addressed front-end cache. Typical use:
+
+        build = IncrementalBuild()
+        build.compile_file("prog.trn", "output.ll")
+        print(build.stats)   # {"units": N, "hits": H, "misses": M, "reemitted": R}
+    """
+
+    def __init__(self, cache_dir: Optional[str] = None, module_name: str = "trion",
+                 engine: Optional[PatternEngine] = None, persist: bool = True):
+        self.module_name = module_name
+        self.engine = engine if engine is not None else default_engine_with_examples()
+        self.cache_dir = (cache_dir or default_cache_dir()) if persist else None
+        self.codegen = Codegen(module_name)
+        self._memo: Dict[str, Dict[str, Any]] = {}
+        self.stats: Dict[str, int] = {"units": 0, "hits": 0, "misses": 0, "reemitted": 0}
+        # results of the last compile(), with line numbers relative to the whole file
+        self.program: Optional[Program] = None
+        self.nasm_blocks: List[Dict[str, Any]] = []
+        self.html_blocks: List[Dict[str, Any]] = []
+        # everything besides the unit text that changes what a unit compiles to
+        salt = "\0".join([CACHE_FORMAT, module_name] + [r.name for r in self.engine.rules])
+        self._salt = hashlib.sha256(_source_digest() + salt.encode("utf-8")).digest()
+        self._dir_ok: Optional[bool] = None
+
+    # --- cache storage ---
+
+    def _key(self, text: str) -> str:
+        h = hashlib.sha256(self._salt)
+        h.update(text.encode("utf-8"))
+        return h.hexdigest()
+
+    def _disk_cache(self) -> bool:
+        if self._dir_ok is None:
+            self._dir_ok = bool(self.cache_dir) and _cache_dir_usable(self.cache_dir)
+            if self.cache_dir and not self._dir_ok:
+                print(f"warning: not using build cache {self.cache_dir}: not a private directory of this user",
+                      file=sys.stderr)
+        return self._dir_ok
+
+    def _load(self, key: str) -> Optional[Dict[str, Any]]:
+        unit = self._memo.get(key)
+        if unit is not None or not self._disk_cache():
+            return unit
+        try:
+            with open(os.path.join(self.cache_dir, key + ".unit"), "rb") as f:
+                unit = pickle.load(f)
+        except (OSError, EOFError, pickle.UnpicklingError, AttributeError, ImportError):
+            return None
+        if not isinstance(unit, dict) or unit.get("format") != CACHE_FORMAT:
+            return None
+        self._memo[key] = unit
+        return unit
+
+    def _store(self, key: str, unit: Dict[str, Any]) -> None:
+        self._memo[key] = unit
+        if not self._disk_cache():
+            return
+        # write-then-rename so a concurrent or interrupted build never sees half a file
+        try:
+            fd, tmp = tempfile.mkstemp(dir=self.cache_dir, suffix=".tmp")
+            with os.fdopen(fd, "wb") as f:
+                pickle.dump(unit, f, protocol=pickle.HIGHEST_PROTOCOL)
+            os.replace(tmp, os.path.join(self.cache_dir, key + ".unit"))
+        except OSError:
+            pass  # the cache is an accelerator; a read-only cache dir just means slower builds
+
+    # --- per-unit pipeline ---
+
+    def _compile_unit(self, text: str) -> Dict[str, Any]:
+        # front half only: fragments need the whole-program plan, see _emit_unit
+        program = Parser(lex(text)).parse()
+        program, _ = self.engine.apply_transforms(program)
+        return {
+            "format": CACHE_FORMAT,
+            "nodes": list(getattr(program, "body", [])),
+            "signatures": None,
+            "fragments": [],
+            "nasm": extract_nasm_blocks(text),
+            "html": extract_html_blocks(text),
+        }
+
+    def _emit_unit(self, unit: Dict[str, Any], plan: Any) -> None:
+        fragments = []
+        for node in unit["nodes"]:
+            frag = self.codegen.emit_fragment(node, plan)
+            if frag["symbol"]:
+                fragments.append(frag)
+        unit["fragments"] = fragments
+
+    @staticmethod
+    def _rebase(blocks: List[Dict[str, Any]], first_line: int) -> List[Dict[str, Any]]:
+        out = []
+        for b in blocks:
+            b = dict(b)
+            b["start_line"] += first_line - 1
+            b["end_line"] += first_line - 1
+            out.append(b)
+        return out
+
+    # --- entry points ---
+
+    def compile(self, code: str) -> str:
+        """
+        Compile Trion source to LLVM IR text, reusing cached units where the text is unchanged.
+        """
+        self.stats = {"units": 0, "hits": 0, "misses": 0, "reemitted": 0}
+        nodes: List[Any] = []
+        units: List[Tuple[str, Dict[str, Any], bool]] = []
+        self.nasm_blocks, self.html_blocks = [], []
+        for first_line, text in split_units(code):
+            key = self._key(text)
+            unit = self._load(key)
+            self.stats["units"] += 1
+            fresh = unit is None
+            if fresh:
+                unit = self._compile_unit(text)
+                self.stats["misses"] += 1
+            else:
+                self.stats["hits"] += 1
+            units.append((key, unit, fresh))
+            nodes.extend(unit["nodes"])
+            self.nasm_blocks.extend(self._rebase(unit["nasm"], first_line))
+            self.html_blocks.extend(self._rebase(unit["html"], first_line))
+        # extract_html_blocks lists every marker block before any tag block
+        self.html_blocks.sort(key=lambda b: b["type"] != "marker")
+        self.program = Program(nodes)
+
+        plan = self.codegen.plan_wiring(self.program)
+        fragments: List[Dict[str, Any]] = []
+        for key, unit, fresh in units:
+            signatures = [self.codegen.fragment_signature(n, plan) for n in unit["nodes"]]
+            if fresh or unit["signatures"] != signatures:
+                if not fresh:
+                    self.stats["reemitted"] += 1
+                self._emit_unit(unit, plan)
+                unit["signatures"] = signatures
+                self._store(key, unit)
+            fragments.extend(unit["fragments"])
+        calls = [s for s in (Codegen.fragment_symbol(n) for n in nodes) if s]
+        return self.codegen.link_fragments(fragments, calls, plan)
+
+    def compile_file(self, path: str, out_path: str = "output.ll") -> str:
+        with open(path, "r", encoding="utf-8") as fh:
+            code = fh.read()
+        text = self.compile(code)
+        with open(out_path, "w", encoding="utf-8") as f:
+            f.write(text)
+        print(f"LLVM IR written to {out_path}")
+        return text
+
+
+if __name__ == "__main__":
+    ap = argparse.ArgumentParser(description="Incrementally compile a Trion source file to LLVM IR.")
+    ap.add_argument("path", help="Trion source file (.trn)")
+    ap.add_argument("-o", "--output", default="output.ll", help="LLVM IR output path")
+    ap.add_argument("--cache-dir", default=None, help="unit cache directory (default: see module doc)")
+    ap.add_argument("--no-cache", action="store_true", help="cache in memory only for this run")
+    args = ap.parse_args()
+
+    build = IncrementalBuild(cache_dir=args.cache_dir, persist=not args.no_cache)
+    build.compile_file(args.path, args.output)
+    s = build.stats
+    print(f"units={s['units']} reused={s['hits']} rebuilt={s['misses']} re-emitted={s['reemitted']}")
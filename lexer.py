@@ -3,19 +3,28 @@ lexer.py
 
 Tokenizer for Trion language.
 
-Produces a list of (type, value) tuples suitable for the simple parser.
-Ignores whitespace, comments and newlines. Keywords are matched before identifiers.
+`lex()` produces a compact TokenArray: one kind code per token plus [start, end)
+offsets into the source string, with no per-token substrings or tuples. The parser
+walks it with an integer cursor and only slices text for tokens it keeps.
+`tokenize()` still returns the legacy list of (type, value) tuples.
+
+Whitespace, comments and newlines are dropped. Keywords are matched before
+identifiers. Scanning is table driven: the first character of a token selects its
+class from a 128-entry table (non-ASCII characters are classified on the fly), and
+multi-character tokens are finished by one precompiled run pattern per class.
 """
 
 import re
+from array import array
 from typing import List, Tuple
 
-# Ordered token specs: order matters (KEYWORD before IDENT)
+# Token grammar, in match order (KEYWORD before IDENT). The scanner below implements
+# exactly these rules, including the \b word-boundary checks on KEYWORD and NUMBER.
 TOKEN_SPECS = [
     ("SKIP",     r"[ \t\r]+"),                             # spaces and tabs
     ("COMMENT",  r"--[^\n]*"),                             # -- comment to end of line
     ("NEWLINE",  r"\n"),                                   # newline
-    ("KEYWORD",  r"\b(?:Main|Capsule|If|Then|Else|Elseif|While|For|EndCapsule|Print|Isolate|Try|Execute|Fail|True|False)\b"),
+    ("KEYWORD",  r"\b(?:Main|Capsule|If|Then|Else|Elseif|While|For|EndCapsule|Print|Isolate|Try|Execute|Fail|True|False|Send|Receive)\b"),
     ("IDENT",    r"[A-Za-z_][A-Za-z0-9_]*"),               # identifiers
     ("NUMBER",   r"\b\d+\b"),                              # integers
     ("STRING",   r'"(?:\\.|[^"\\])*"'),                    # double-quoted strings with escapes
@@ -23,38 +32,198 @@ TOKEN_SPECS = [
     ("MISMATCH", r"."),                                    # any other single char
 ]
 
-# Precompile regexes for performance
-_TOKEN_REGEXES = [(typ, re.compile(pattern)) for typ, pattern in TOKEN_SPECS]
+KEYWORDS = ("Main", "Capsule", "If", "Then", "Else", "Elseif", "While", "For", "EndCapsule",
+            "Print", "Isolate", "Try", "Execute", "Fail", "True", "False", "Send", "Receive")
 
+# Token kind codes (one byte per token). Every keyword has its own code so the parser
+# can test for `Capsule` or `EndCapsule` with an integer compare.
+T_IDENT = 1
+T_NUMBER = 2
+T_STRING = 3
+T_OP = 4
+T_MISMATCH = 5
+T_KEYWORD = 16                      # T_KEYWORD + KEYWORDS.index(word); any kind >= T_KEYWORD is a keyword
+KEYWORD_KIND = {w: T_KEYWORD + i for i, w in enumerate(KEYWORDS)}
+K_MAIN = KEYWORD_KIND["Main"]
+K_CAPSULE = KEYWORD_KIND["Capsule"]
+K_ENDCAPSULE = KEYWORD_KIND["EndCapsule"]
+_T_KEYWORD_OTHER = T_KEYWORD + len(KEYWORDS)   # legacy KEYWORD tuples with an unknown value
 
-def tokenize(code: str) -> List[Tuple[str, str]]:
+_KIND_NAMES = {T_IDENT: "IDENT", T_NUMBER: "NUMBER", T_STRING: "STRING", T_OP: "OP", T_MISMATCH: "MISMATCH"}
+_NAME_KINDS = {v: k for k, v in _KIND_NAMES.items()}
+
+
+def kind_name(kind: int) -> str:
+    return "KEYWORD" if kind >= T_KEYWORD else _KIND_NAMES.get(kind, "MISMATCH")
+
+
+# Character classes for the dispatch table
+C_OTHER, C_SPACE, C_NEWLINE, C_DASH, C_ALPHA, C_DIGIT, C_QUOTE, C_OP = range(8)
+
+_CLASS = bytearray(128)             # C_OTHER by default
+_WORD = bytearray(128)              # 1 for ASCII \w characters
+for _c in " \t\r":
+    _CLASS[ord(_c)] = C_SPACE
+_CLASS[ord("\n")] = C_NEWLINE
+for _c in "+*/<>=,:":
+    _CLASS[ord(_c)] = C_OP
+_CLASS[ord("-")] = C_DASH
+_CLASS[ord('"')] = C_QUOTE
+for _o in range(128):
+    _c = chr(_o)
+    if _c.isalpha() or _c == "_":
+        _CLASS[_o] = C_ALPHA
+        _WORD[_o] = 1
+    elif _c.isdigit():
+        _CLASS[_o] = C_DIGIT
+        _WORD[_o] = 1
+
+# keyword candidates by first character: (word, length, kind)
+_KW_BY_FIRST = {}
+for _w in KEYWORDS:
+    _KW_BY_FIRST.setdefault(_w[0], []).append((_w, len(_w), KEYWORD_KIND[_w]))
+
+# run patterns that finish a token once its class is known
+_SPACE_RUN = re.compile(r"[ \t\r]*")
+_IDENT_RUN = re.compile(r"[A-Za-z0-9_]*")
+_DIGIT_RUN = re.compile(r"\d*")
+_STRING_TAIL = re.compile(r'(?:\\.|[^"\\])*"')
+
+
+def _is_word(code: str, i: int) -> bool:
+    """\\w at code[i] as `re` sees it (Unicode alphanumerics and underscore)."""
+    o = ord(code[i])
+    if o < 128:
+        return _WORD[o] == 1
+    ch = code[i]
+    return ch.isalnum() or ch == "_"
+
+
+class TokenArray:
+    """
+    Parallel arrays describing a token stream over `source`:
+      kinds[i]  - kind code (T_* / keyword code)
+      starts[i] - offset of the first character
+      ends[i]   - offset one past the last character
     """
-    Tokenize Trion source `code` and return list of (type, value) tuples.
 
-    Whitespace, comments and newline tokens are ignored (not returned).
+    __slots__ = ("source", "kinds", "starts", "ends")
+
+    def __init__(self, source: str = ""):
+        self.source = source
+        self.kinds = array("B")
+        self.starts = array("L")
+        self.ends = array("L")
+
+    def __len__(self) -> int:
+        return len(self.kinds)
+
+    def text(self, i: int) -> str:
+        return self.source[self.starts[i]:self.ends[i]]
+
+    def type_name(self, i: int) -> str:
+        return kind_name(self.kinds[i])
+
+    def to_tuples(self) -> List[Tuple[str, str]]:
+        src = self.source
+        return [(kind_name(k), src[s:e]) for k, s, e in zip(self.kinds, self.starts, self.ends)]
+
+    @classmethod
+    def from_tuples(cls, tokens: List[Tuple[str, str]]) -> "TokenArray":
+        """
+        Build a TokenArray from legacy (type, value) tuples; the values are laid out
+        in a synthetic source string separated by single spaces.
+        """
+        values = [v if v is not None else "" for _, v in tokens]
+        ta = cls(" ".join(values))
+        pos = 0
+        for (typ, _), val in zip(tokens, values):
+            if typ == "KEYWORD":
+                kind = KEYWORD_KIND.get(val, _T_KEYWORD_OTHER)
+            else:
+                kind = _NAME_KINDS.get(typ, T_MISMATCH)
+            ta.kinds.append(kind)
+            ta.starts.append(pos)
+            ta.ends.append(pos + len(val))
+            pos += len(val) + 1
+        return ta
+
+
+def lex(code: str) -> TokenArray:
+    """
+    Tokenize Trion source `code` into a TokenArray (see module docstring).
     """
-    tokens: List[Tuple[str, str]] = []
+    ta = TokenArray(code)
+    # bound methods as locals: this loop runs once per token
+    add_kind, add_start, add_end = ta.kinds.append, ta.starts.append, ta.ends.append
+    space_run, ident_run, digit_run, string_tail = (_SPACE_RUN.match, _IDENT_RUN.match,
+                                                    _DIGIT_RUN.match, _STRING_TAIL.match)
+    classes = _CLASS
+    n = len(code)
     pos = 0
-    length = len(code)
 
-    while pos < length:
-        for typ, regex in _TOKEN_REGEXES:
-            m = regex.match(code, pos)
-            if not m:
-                continue
-            text = m.group(0)
-            pos = m.end()
-            # skip these token types
-            if typ in ("SKIP", "COMMENT", "NEWLINE"):
-                break
-            tokens.append((typ, text))
-            break
+    while pos < n:
+        o = ord(code[pos])
+        if o < 128:
+            c = classes[o]
         else:
-            # Should not happen because MISMATCH will always match; safety fallback
-            tokens.append(("MISMATCH", code[pos]))
+            c = C_DIGIT if code[pos].isdecimal() else C_OTHER
+
+        if c == C_SPACE:
+            pos = space_run(code, pos + 1).end()
+            continue
+        if c == C_NEWLINE:
             pos += 1
+            continue
+
+        start = pos
+        kind = T_MISMATCH
+        end = pos + 1
+        if c == C_ALPHA:
+            end = ident_run(code, end).end()
+            kind = T_IDENT
+            cands = _KW_BY_FIRST.get(code[pos])
+            if cands and (pos == 0 or not _is_word(code, pos - 1)) and (end == n or not _is_word(code, end)):
+                length = end - pos
+                for word, wlen, wkind in cands:
+                    if wlen == length and code.startswith(word, pos):
+                        kind = wkind
+                        break
+        elif c == C_DASH:
+            if end < n and code[end] == "-":
+                nl = code.find("\n", end)
+                pos = n if nl < 0 else nl
+                continue
+            kind = T_OP
+        elif c == C_DIGIT:
+            # \b\d+\b: the whole digit run, and only when neither side touches a word char
+            run_end = digit_run(code, end).end()
+            if (pos == 0 or not _is_word(code, pos - 1)) and (run_end == n or not _is_word(code, run_end)):
+                kind = T_NUMBER
+                end = run_end
+        elif c == C_QUOTE:
+            m = string_tail(code, end)
+            if m:
+                kind = T_STRING
+                end = m.end()
+        elif c == C_OP:
+            kind = T_OP
+
+        add_kind(kind)
+        add_start(start)
+        add_end(end)
+        pos = end
 
-    return tokens
+    return ta
+
+
+def tokenize(code: str) -> List[Tuple[str, str]]:
+    """
+    Tokenize Trion source `code` and return list of (type, value) tuples.
+
+    Whitespace, comments and newline tokens are ignored (not returned).
+    """
+    return lex(code).to_tuples()
 
 
 if __name__ == "__main__":
@@ -68,4 +237,3 @@ if __name__ == "__main__":
     '''
     for t in tokenize(sample):
         print(t)
-
@@ -1,4 +1,5 @@
-from typing import Any, List, Optional, Tuple
+from typing import Any, List, Optional, Tuple, Union
+from lexer import TokenArray, T_IDENT, T_KEYWORD, K_MAIN, K_CAPSULE, K_ENDCAPSULE
 from ast import (
     Program as AstProgram,
     MainBlock as AstMainBlock,
@@ -172,72 +173,76 @@ def _parse_statement_to_node(s: str):
 # Parser implementation
 # -------------------------
 
+# keywords that end a Main block
+_TOP_LEVEL_KINDS = (K_MAIN, K_CAPSULE, K_ENDCAPSULE)
+
 
 class Parser:
-    def __init__(self, tokens: List[Tuple[str, str]]):
-        self.tokens = list(tokens)
+    def __init__(self, tokens: Union[TokenArray, List[Tuple[str, str]]]):
+        """
+        `tokens` is a TokenArray from lexer.lex() or a legacy list of (type, value) tuples.
+        The parser walks the kind array with an integer cursor and slices token text
+        out of the source only for tokens that end up in the AST.
+        """
+        if not isinstance(tokens, TokenArray):
+            tokens = TokenArray.from_tuples(list(tokens))
+        self.tokens = tokens
+        self._kinds = tokens.kinds
+        self._n = len(tokens.kinds)
         self.pos = 0
 
     # Main parse loop: walks through all tokens and constructs AST nodes
     def parse(self) -> Program:
         nodes: List[Any] = []
-        while not self._eof():
-            if self._match("KEYWORD", "Main"):
+        kinds, n = self._kinds, self._n
+        while self.pos < n:
+            k = kinds[self.pos]
+            if k == K_MAIN:
                 nodes.append(self._parse_main())
-            elif self._match("KEYWORD", "Capsule"):
+            elif k == K_CAPSULE:
                 nodes.append(self._parse_capsule())
             else:
                 # skip unknown or stray tokens
-                self._advance()
+                self.pos += 1
         return Program(nodes)
 
     # Utility helpers
     def _eof(self) -> bool:
-        return self.pos >= len(self.tokens)
+        return self.pos >= self._n
 
-    def _peek(self) -> Tuple[Optional[str], Optional[str]]:
-        if self._eof():
-            return (None, None)
-        return self.tokens[self.pos]
+    def _kind(self) -> int:
+        return self._kinds[self.pos] if self.pos < self._n else 0
 
-    def _advance(self) -> Tuple[Optional[str], Optional[str]]:
-        if self._eof():
-            return (None, None)
-        t = self.tokens[self.pos]
-        self.pos += 1
-        return t
+    def _skip_to_keyword(self) -> None:
+        # advance past the current run of non-keyword tokens
+        kinds, n, i = self._kinds, self._n, self.pos
+        while i < n and kinds[i] < T_KEYWORD:
+            i += 1
+        self.pos = i
 
-    # Utility to match current token type and optional value
-    def _match(self, typ: str, val: Optional[str] = None) -> bool:
-        if self._eof():
-            return False
-        t_type, t_val = self._peek()
-        if t_type == typ and (val is None or t_val == val):
-            return True
-        return False
+    def _join(self, start: int, end: int) -> str:
+        # token texts in [start, end) joined by single spaces
+        toks = self.tokens
+        src, starts, ends = toks.source, toks.starts, toks.ends
+        return " ".join(src[starts[i]:ends[i]] for i in range(start, end))
 
     # Parse a Main block definition
     def _parse_main(self) -> MainBlock:
         # consume 'Main'
-        self._advance()
+        self.pos += 1
         # Create MainBlock and collect any following statements until a top-level keyword.
         mb = MainBlock()
         # Collect tokens until we encounter a top-level KEYWORD (Main/Capsule/EndCapsule) or EOF
         while not self._eof():
-            t_type, t_val = self._peek()
-            if t_type == "KEYWORD" and t_val in ("Main", "Capsule", "EndCapsule"):
+            if self._kind() in _TOP_LEVEL_KINDS:
                 break
-            # gather fragments into a single string per line-like statement
-            if t_type is None:
-                self._advance()
-                continue
-            # consume contiguous non-KEYWORD tokens as one fragment
-            parts: List[str] = []
-            while not self._eof() and self._peek()[0] != "KEYWORD":
-                tok = self._advance()[1]
-                if tok is not None:
-                    parts.append(tok)
-            frag = " ".join(parts).strip()
+            # gather fragments into a single string per line-like statement: the current
+            # token (a statement keyword such as Print, or a plain token) plus the
+            # non-KEYWORD tokens that follow it
+            start = self.pos
+            self.pos += 1
+            self._skip_to_keyword()
+            frag = self._join(start, self.pos).strip()
             if frag:
                 mb.add(frag)
             # if next token is KEYWORD we will break on next loop iteration
@@ -246,13 +251,14 @@ class Parser:
     # Parse a Capsule declaration with name and a simple list of statements
     def _parse_capsule(self) -> Capsule:
         # consume 'Capsule'
-        self._advance()
+        self.pos += 1
         # expect identifier for capsule name
-        if not self._match("IDENT"):
+        if self._kind() != T_IDENT:
             # fallback: use a placeholder name and continue
             name = "<anonymous>"
         else:
-            _, name = self._advance()
+            name = self.tokens.text(self.pos)
+            self.pos += 1
 
         capsule = Capsule(name)
 
@@ -260,28 +266,20 @@ class Parser:
         # A statement is heuristically started by a KEYWORD and continues until the next KEYWORD
         # or until EndCapsule. This is intentionally simple and tolerant; more precise parsing
         # can be added later.
-        while not self._eof() and not self._match("KEYWORD", "EndCapsule"):
-            t_type, t_val = self._peek()
-            if t_type == "KEYWORD":
-                # start a new statement
-                stmt_parts: List[str] = []
-                # include the starting keyword (e.g. Print, Rule, Isolate)
-                first = self._advance()[1]
-                if first is not None:
-                    stmt_parts.append(first)
-                # consume following non-KEYWORD tokens as part of this statement
-                while not self._eof() and self._peek()[0] != "KEYWORD":
-                    next_tok = self._advance()[1]
-                    if next_tok is not None:
-                        stmt_parts.append(next_tok)
-                stmt = " ".join(part for part in stmt_parts if part is not None).strip()
+        while not self._eof() and self._kind() != K_ENDCAPSULE:
+            if self._kind() >= T_KEYWORD:
+                # start a new statement: the starting keyword (e.g. Print, Rule, Isolate)
+                # plus the non-KEYWORD tokens that follow it
+                start = self.pos
+                self.pos += 1
+                self._skip_to_keyword()
+                stmt = self._join(start, self.pos).strip()
                 if stmt:
                     capsule.add(stmt)
             else:
                 # For non-keyword stray tokens, consume and append as a raw fragment
-                frag = self._advance()[1]
-                if frag is None:
-                    continue
+                frag = self.tokens.text(self.pos)
+                self.pos += 1
                 if len(capsule.body) == 0:
                     capsule.add(frag)
                 else:
@@ -293,8 +291,8 @@ class Parser:
                         capsule.add(frag)
 
         # consume EndCapsule if present
-        if self._match("KEYWORD", "EndCapsule"):
-            self._advance()
+        if self._kind() == K_ENDCAPSULE:
+            self.pos += 1
 
         return capsule
 
@@ -303,7 +301,7 @@ class Parser:
 # Minimal self-test / example
 # -------------------------
 if __name__ == "__main__":
-    from lexer import tokenize
+    from lexer import lex
     sample_code = """
     Main
         Print: "Hello, World!"
@@ -315,7 +313,7 @@ if __name__ == "__main__":
     Capsule EmptyCapsule
     EndCapsule
     """
-    tokens = tokenize(sample_code)
+    tokens = lex(sample_code)
     parser = Parser(tokens)
     ast = parser.parse()
     print(ast)
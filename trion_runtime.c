@@ -12,6 +12,10 @@
 // Author: GitHub Copilot (extended)
 // License: MIT-style permissive (use per project license)
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE   /* recvmmsg/sendmmsg for packet ingestion; the sandbox's clone flags and the
+                         NUMA code's sched_getcpu/CPU_SET rely on it too */
+#endif
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -42,12 +46,17 @@ static int  tr_cond_timedwait(tr_cond_t *c, tr_mutex_t *m, uint32_t ms)
 static void tr_cond_notify_one(tr_cond_t *c) { WakeConditionVariable(c); }
 static void tr_cond_notify_all(tr_cond_t *c) { WakeAllConditionVariable(c); }
 static void tr_cond_destroy(tr_cond_t *c) { (void)c; /* no-op on Win32 */ }
+typedef INIT_ONCE tr_once_t;
+#define TR_ONCE_INIT INIT_ONCE_STATIC_INIT
+static BOOL CALLBACK tr_once_thunk(PINIT_ONCE o, PVOID fn, PVOID *ctx) { (void)o; (void)ctx; ((void (*)(void))fn)(); return TRUE; }
+static void tr_once(tr_once_t *o, void (*fn)(void)) { InitOnceExecuteOnce(o, tr_once_thunk, (PVOID)fn, NULL); }
 #else
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <sys/resource.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -82,55 +91,171 @@ static int  tr_cond_timedwait(tr_cond_t *c, tr_mutex_t *m, uint32_t ms)
 static void tr_cond_notify_one(tr_cond_t *c) { pthread_cond_signal(c); }
 static void tr_cond_notify_all(tr_cond_t *c) { pthread_cond_broadcast(c); }
 static void tr_cond_destroy(tr_cond_t *c) { pthread_cond_destroy(c); }
+typedef pthread_once_t tr_once_t;
+#define TR_ONCE_INIT PTHREAD_ONCE_INIT
+static void tr_once(tr_once_t *o, void (*fn)(void)) { pthread_once(o, fn); }
 #endif
 
 /* ---------------------------
-   Internal error / audit logging helpers
+   Atomics, thread-local storage and cache-line helpers
+   - GCC/Clang: __atomic builtins (usable from both C and C++ builds of this file)
+   - MSVC: Interlocked* on x86/x64, where plain aligned loads/stores already have acquire/release ordering
    --------------------------- */
 
-/* Thread-local last error message */
-#if defined(_MSC_VER)
-__declspec(thread) static char *g_last_error_msg = NULL;
+#define TR_CACHELINE 64
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TR_THREAD_LOCAL __declspec(thread)
+#define TR_ALIGNED(n) __declspec(align(n))
+static int tr_msvc_cas64(volatile void *p, void *expected, int64_t desired)
+{
+    int64_t exp = *(int64_t*)expected;
+    int64_t prev = InterlockedCompareExchange64((volatile LONG64*)p, desired, exp);
+    if (prev == exp) return 1;
+    *(int64_t*)expected = prev;
+    return 0;
+}
+static int tr_msvc_cas32(volatile void *p, void *expected, int32_t desired)
+{
+    int32_t exp = *(int32_t*)expected;
+    int32_t prev = (int32_t)InterlockedCompareExchange((volatile LONG*)p, desired, exp);
+    if (prev == exp) return 1;
+    *(int32_t*)expected = prev;
+    return 0;
+}
+#define tr_atomic_load_relaxed(p)     (_ReadWriteBarrier(), *(p))
+#define tr_atomic_load_acquire(p)     (_ReadWriteBarrier(), *(p))
+#define tr_atomic_store_relaxed(p, v) do { *(p) = (v); } while (0)
+#define tr_atomic_store_release(p, v) do { _ReadWriteBarrier(); *(p) = (v); } while (0)
+#define tr_atomic_fetch_add(p, v) (sizeof(*(p)) == 8 \
+    ? InterlockedExchangeAdd64((volatile LONG64*)(p), (LONG64)(v)) \
+    : InterlockedExchangeAdd((volatile LONG*)(p), (LONG)(v)))
+#define tr_atomic_fetch_sub(p, v) tr_atomic_fetch_add((p), -(int64_t)(v))
+#define tr_atomic_exchange(p, v) (sizeof(*(p)) == 8 \
+    ? InterlockedExchange64((volatile LONG64*)(p), (LONG64)(intptr_t)(v)) \
+    : InterlockedExchange((volatile LONG*)(p), (LONG)(intptr_t)(v)))
+#define tr_atomic_cas(p, expp, v) (sizeof(*(p)) == 8 \
+    ? tr_msvc_cas64((p), (expp), (int64_t)(intptr_t)(v)) \
+    : tr_msvc_cas32((p), (expp), (int32_t)(intptr_t)(v)))
+#define tr_atomic_fetch_or(p, v) (sizeof(*(p)) == 8 \
+    ? InterlockedOr64((volatile LONG64*)(p), (LONG64)(v)) \
+    : InterlockedOr((volatile LONG*)(p), (LONG)(v)))
+#define tr_atomic_fetch_and(p, v) (sizeof(*(p)) == 8 \
+    ? InterlockedAnd64((volatile LONG64*)(p), (LONG64)(v)) \
+    : InterlockedAnd((volatile LONG*)(p), (LONG)(v)))
+#define tr_atomic_fence() MemoryBarrier()
+#define tr_cpu_relax() YieldProcessor()
+#else
+#define TR_THREAD_LOCAL __thread
+#define TR_ALIGNED(n) __attribute__((aligned(n)))
+#define tr_atomic_load_relaxed(p)     __atomic_load_n((p), __ATOMIC_RELAXED)
+#define tr_atomic_load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define tr_atomic_store_relaxed(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define tr_atomic_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define tr_atomic_fetch_add(p, v)     __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+#define tr_atomic_fetch_sub(p, v)     __atomic_fetch_sub((p), (v), __ATOMIC_ACQ_REL)
+#define tr_atomic_exchange(p, v)      __atomic_exchange_n((p), (v), __ATOMIC_ACQ_REL)
+#define tr_atomic_cas(p, expp, v)     __atomic_compare_exchange_n((p), (expp), (v), 0, __ATOMIC_SEQ_CST, __ATOMIC_ACQUIRE)
+#define tr_atomic_fetch_or(p, v)      __atomic_fetch_or((p), (v), __ATOMIC_ACQ_REL)
+#define tr_atomic_fetch_and(p, v)     __atomic_fetch_and((p), (v), __ATOMIC_ACQ_REL)
+#define tr_atomic_fence()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#if defined(__x86_64__) || defined(__i386__)
+#define tr_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define tr_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define tr_cpu_relax() ((void)0)
+#endif
+#endif
+
+/* index of the lowest set bit; v must be nonzero */
+static unsigned tr_ctz64(uint64_t v)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long i;
+    _BitScanForward64(&i, v);
+    return (unsigned)i;
 #else
-static __thread char *g_last_error_msg = NULL;
+    return (unsigned)__builtin_ctzll(v);
 #endif
+}
 
-static tr_mutex_t g_error_lock;
-static int g_error_lock_inited = 0;
+/* ---------------------------
+   Internal error / audit logging helpers
+   --------------------------- */
+
+/* Thread-local last error
+   Each thread owns a fixed buffer, so setting and reading take no lock and never allocate.
+   Hot paths (would-block, timeout, closed) record only a numeric code plus a static site name with
+   tr_set_last_error_code; the "site: reason" text is formatted when tr_get_last_error reads it. */
+#define TR_ERR_NONE        0
+#define TR_ERR_FAILED      1    /* generic: message set by tr_set_last_error_fmt */
+#define TR_ERR_INVALID     2
+#define TR_ERR_WOULD_BLOCK 3
+#define TR_ERR_TIMEOUT     4
+#define TR_ERR_CLOSED      5
+#define TR_ERR_OOM         6
+#define TR_ERR_NOT_FOUND   7
 
-static void tr_init_error_lock_once(void)
+#define TR_ERROR_MSG_MAX 1024
+
+static TR_THREAD_LOCAL int g_last_error_code = TR_ERR_NONE;
+static TR_THREAD_LOCAL const char *g_last_error_site = NULL;   /* non-NULL: message not formatted yet */
+static TR_THREAD_LOCAL char g_last_error_msg[TR_ERROR_MSG_MAX];
+
+static const char *tr_error_code_string(int code)
 {
-    if (!g_error_lock_inited) {
-        tr_mutex_init(&g_error_lock);
-        g_error_lock_inited = 1;
+    switch (code) {
+    case TR_ERR_NONE: return "ok";
+    case TR_ERR_INVALID: return "invalid args";
+    case TR_ERR_WOULD_BLOCK: return "would block";
+    case TR_ERR_TIMEOUT: return "timeout";
+    case TR_ERR_CLOSED: return "closed";
+    case TR_ERR_OOM: return "OOM";
+    case TR_ERR_NOT_FOUND: return "not found";
+    default: return "failed";
     }
 }
 
 static void tr_set_last_error_fmt(const char *fmt, ...)
 {
-    tr_init_error_lock_once();
     va_list ap;
     va_start(ap, fmt);
-    char buf[1024];
-    vsnprintf(buf, sizeof(buf), fmt, ap);
+    vsnprintf(g_last_error_msg, sizeof(g_last_error_msg), fmt, ap);
     va_end(ap);
+    g_last_error_code = TR_ERR_FAILED;
+    g_last_error_site = NULL;
+}
 
-    tr_mutex_lock(&g_error_lock);
-    if (g_last_error_msg) { free(g_last_error_msg); g_last_error_msg = NULL; }
-    g_last_error_msg = strdup(buf);
-    tr_mutex_unlock(&g_error_lock);
+/* site must be a string literal (or otherwise outlive the next error on this thread) */
+static void tr_set_last_error_code(int code, const char *site)
+{
+    g_last_error_code = code;
+    g_last_error_site = site;
 }
 
 const char *tr_get_last_error(void)
 {
-    const char *res = NULL;
-    tr_mutex_lock(&g_error_lock);
-    res = g_last_error_msg ? g_last_error_msg : "";
-    tr_mutex_unlock(&g_error_lock);
-    return res;
+    if (g_last_error_site) {
+        snprintf(g_last_error_msg, sizeof(g_last_error_msg), "%s: %s", g_last_error_site, tr_error_code_string(g_last_error_code));
+        g_last_error_site = NULL;
+    }
+    return g_last_error_msg;
+}
+
+int tr_get_last_error_code(void) { return g_last_error_code; }
+
+void tr_clear_last_error(void)
+{
+    g_last_error_code = TR_ERR_NONE;
+    g_last_error_site = NULL;
+    g_last_error_msg[0] = '\0';
 }
 
-/* Audit log (optional file) */
+/* Audit log (optional file); async mode lives with the other background services below */
+static int audit_async_submit(const char *text, size_t len);
+void tr_audit_async_stop(void);
 static tr_mutex_t g_audit_lock;
 static int g_audit_lock_inited = 0;
 static FILE *g_audit_fp = NULL;
@@ -161,6 +286,7 @@ int tr_audit_open(const char *path)
 void tr_audit_close(void)
 {
     tr_init_audit_once();
+    tr_audit_async_stop();   /* land queued records in the file before closing it */
     tr_mutex_lock(&g_audit_lock);
     if (g_audit_fp) { fclose(g_audit_fp); g_audit_fp = NULL; }
     tr_mutex_unlock(&g_audit_lock);
@@ -172,8 +298,11 @@ void tr_audit_log(const char *fmt, ...)
     char buf[1024];
     va_list ap;
     va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
     va_end(ap);
+    if (n < 0) n = 0;
+    if ((size_t)n >= sizeof(buf)) n = (int)sizeof(buf) - 1;
+    if (audit_async_submit(buf, (size_t)n) == 0) return;
 
     tr_mutex_lock(&g_audit_lock);
     if (g_audit_fp) {
@@ -195,1231 +324,10300 @@ void tr_audit_log(const char *fmt, ...)
 }
 
 /* ---------------------------
-   Basic concurrency & primitives (Quarantine + Channel)
+   Runtime metrics
+   - global counters, gauges and latency histograms are sharded TR_METRIC_SHARDS ways; a thread
+     adopts a shard on first use (rotating, like the syscall reader stripes) so concurrent
+     updates almost never share a cache line
+   - histograms are log-linear (HDR-style) over nanoseconds: values below 16 are exact, above that
+     each power of two is split into 8 sub-buckets (<= 12.5% error) up to 2^36 ns (~69 s), plus
+     an overflow bucket
+   - channels, capsules and syscalls also keep their own counters next to their state; the
+     snapshot walks registries of the live ones. Fast paths only touch memory they already own:
+     channel totals come from ring indices or are bumped under the channel lock, and clock reads
+     happen on blocking paths, per capsule run and per syscall
+   - tr_metrics_snapshot renders everything as JSON or Prometheus text while the runtime keeps
+     running; readers see each value atomically, not the whole set at one instant
    --------------------------- */
 
+#define TR_METRICS_JSON       0
+#define TR_METRICS_PROMETHEUS 1
+
+#define TR_METRIC_SHARDS  16
+#define TR_HIST_SUB_BITS  3
+#define TR_HIST_LINEAR    16
+#define TR_HIST_MAX_EXP   36
+#define TR_HIST_BUCKETS   (TR_HIST_LINEAR + (TR_HIST_MAX_EXP - 4) * (1 << TR_HIST_SUB_BITS) + 1)
+
+/* global counters; TR_M_QUARANTINE_LIVE_BYTES is a gauge (signed deltas) */
+#define TR_M_CHANNEL_SEND_WAITS     0
+#define TR_M_CHANNEL_SEND_TIMEOUTS  1
+#define TR_M_CHANNEL_RECV_TIMEOUTS  2
+#define TR_M_CAPSULE_RUNS           3
+#define TR_M_SYSCALL_CALLS          4
+#define TR_M_SYSCALL_ERRORS         5
+#define TR_M_QUARANTINE_LIVE_BYTES  6
+#define TR_M_JIT_BUILDS             7
+#define TR_M_JIT_BUILD_FAILURES     8
+#define TR_M_JIT_CACHE_HITS         9
+#define TR_M_MODULE_OPENS           10
+#define TR_M_MODULE_SECTIONS_READY  11
+#define TR_M_COUNTERS               12
+
+/* global histograms */
+#define TR_H_CHANNEL_SEND_BLOCKED   0
+#define TR_H_CAPSULE_INBOX_LAG      1
+#define TR_H_CAPSULE_RUN            2
+#define TR_H_SYSCALL_LATENCY        3
+#define TR_H_JIT_COMPILE            4
+#define TR_H_MODULE_READY           5
+#define TR_H_COUNT                  6
+
 typedef struct {
-    void **items;
-    size_t count;
-    size_t capacity;
-    int sealed;     /* once sealed, new allocations are rejected */
-    tr_mutex_t lock;
-} Quarantine;
+    uint64_t count;
+    uint64_t sum;               /* ns */
+    uint64_t max;               /* ns */
+    uint64_t b[TR_HIST_BUCKETS];
+} TrHist;
 
-Quarantine *quarantine_create(size_t initial_capacity)
+typedef struct {
+    TR_ALIGNED(TR_CACHELINE) uint64_t c[TR_M_COUNTERS];
+    TrHist h[TR_H_COUNT];
+} TrMetricShard;
+
+static const struct { const char *key; const char *name; const char *help; int gauge; } g_metric_counter_defs[TR_M_COUNTERS] = {
+    { "channel_send_waits", "trion_channel_send_waits_total", "Sends that blocked on a full channel.", 0 },
+    { "channel_send_timeouts", "trion_channel_send_timeouts_total", "Sends that gave up after their timeout.", 0 },
+    { "channel_recv_timeouts", "trion_channel_recv_timeouts_total", "Receives that gave up after their timeout.", 0 },
+    { "capsule_runs", "trion_capsule_runs_total", "Capsule entry runs and task steps.", 0 },
+    { "syscall_calls", "trion_syscall_calls_total", "Syscall invocations dispatched to a handler.", 0 },
+    { "syscall_errors", "trion_syscall_errors_total", "Syscall invocations that failed auth or returned non-zero.", 0 },
+    { "quarantine_live_bytes", "trion_quarantine_live_bytes", "Bytes currently allocated from quarantines.", 1 },
+    { "jit_builds", "trion_jit_builds_total", "NASM blocks assembled (in-process or by the toolchain).", 0 },
+    { "jit_build_failures", "trion_jit_build_failures_total", "NASM blocks that failed to build.", 0 },
+    { "jit_cache_hits", "trion_jit_cache_hits_total", "NASM blocks served from the memo or the on-disk cache.", 0 },
+    { "module_opens", "trion_module_opens_total", "Precompiled module images mapped.", 0 },
+    { "module_sections_ready", "trion_module_sections_ready_total", "Module image sections relocated and protected on first use.", 0 },
+};
+
+static const struct { const char *key; const char *name; const char *help; } g_metric_hist_defs[TR_H_COUNT] = {
+    { "channel_send_blocked", "trion_channel_send_blocked_seconds", "Time a send spent blocked on a full channel." },
+    { "capsule_inbox_lag", "trion_capsule_inbox_lag_seconds", "Time from a task capsule becoming runnable to its step starting." },
+    { "capsule_run", "trion_capsule_run_seconds", "Duration of a capsule entry run or task step." },
+    { "syscall_latency", "trion_syscall_latency_seconds", "Syscall handler latency." },
+    { "jit_compile", "trion_jit_compile_seconds", "Time to build NASM blocks (per block, or per toolchain batch)." },
+    { "module_ready", "trion_module_ready_seconds", "Time to ready a module image section and the sections it references." },
+};
+
+static TrMetricShard g_metric_shards[TR_METRIC_SHARDS];
+static uint32_t g_metric_shard_next = 0;
+static TR_THREAD_LOCAL uint32_t g_metric_shard = 0;    /* shard + 1, 0 = unassigned */
+static int g_metrics_timing = 1;                        /* tr_metrics_set_timing(0) skips clock reads */
+
+static TrMetricShard *tr_metric_shard(void)
 {
-    Quarantine *q = (Quarantine*)malloc(sizeof(Quarantine));
-    if (!q) { tr_set_last_error_fmt("quarantine_create: OOM"); return NULL; }
-    q->capacity = initial_capacity ? initial_capacity : 16;
-    q->count = 0;
-    q->sealed = 0;
-    q->items = (void**)calloc(q->capacity, sizeof(void*));
-    if (!q->items) { free(q); tr_set_last_error_fmt("quarantine_create: calloc failed"); return NULL; }
-    tr_mutex_init(&q->lock);
-    return q;
+    if (!g_metric_shard) g_metric_shard = (tr_atomic_fetch_add(&g_metric_shard_next, 1u) % TR_METRIC_SHARDS) + 1;
+    return &g_metric_shards[g_metric_shard - 1];
 }
 
-static int quarantine_grow_if_needed(Quarantine *q)
+static void tr_metric_add(int id, int64_t delta)
 {
-    if (q->count < q->capacity) return 0;
-    size_t newcap = q->capacity * 2;
-    void **n = (void**)realloc(q->items, newcap * sizeof(void*));
-    if (!n) { tr_set_last_error_fmt("quarantine_grow_if_needed: realloc failed"); return -1; }
-    q->items = n;
-    q->capacity = newcap;
-    return 0;
+    tr_atomic_fetch_add(&tr_metric_shard()->c[id], (uint64_t)delta);
 }
 
-void *quarantine_alloc(Quarantine *q, size_t size)
+/* monotonic nanoseconds */
+static uint64_t tr_clock_ns(void)
 {
-    if (!q || size == 0) { tr_set_last_error_fmt("quarantine_alloc: invalid args"); return NULL; }
-    tr_mutex_lock(&q->lock);
-    if (q->sealed) {
-        tr_mutex_unlock(&q->lock);
-        tr_set_last_error_fmt("quarantine_alloc: quarantined sealed");
-        return NULL;
-    }
-    if (quarantine_grow_if_needed(q) != 0) {
-        tr_mutex_unlock(&q->lock);
-        return NULL;
-    }
-    void *p = malloc(size);
-    if (!p) { tr_mutex_unlock(&q->lock); tr_set_last_error_fmt("quarantine_alloc: malloc failed"); return NULL; }
-    q->items[q->count++] = p;
-    tr_mutex_unlock(&q->lock);
-    return p;
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
 }
 
-int quarantine_free(Quarantine *q, void *ptr)
+/* 0 when timing is off, so callers can skip the matching tr_metric_elapsed */
+static uint64_t tr_metric_clock(void)
 {
-    if (!q || !ptr) { tr_set_last_error_fmt("quarantine_free: invalid args"); return -1; }
-    tr_mutex_lock(&q->lock);
-    for (size_t i = 0; i < q->count; ++i) {
-        if (q->items[i] == ptr) {
-            free(ptr);
-            q->items[i] = q->items[q->count - 1];
-            q->items[q->count - 1] = NULL;
-            q->count--;
-            tr_mutex_unlock(&q->lock);
-            return 0;
-        }
-    }
-    tr_mutex_unlock(&q->lock);
-    tr_set_last_error_fmt("quarantine_free: pointer not found");
-    return -1;
+    if (!tr_atomic_load_relaxed(&g_metrics_timing)) return 0;
+    return tr_clock_ns() | 1u;
 }
 
-void quarantine_seal(Quarantine *q)
+static uint64_t tr_metric_elapsed(uint64_t t0)
 {
-    if (!q) return;
-    tr_mutex_lock(&q->lock);
-    q->sealed = 1;
-    tr_mutex_unlock(&q->lock);
+    uint64_t t1 = tr_metric_clock();
+    return t1 > t0 ? t1 - t0 : 0;
 }
 
-void quarantine_destroy(Quarantine *q)
+static unsigned tr_hist_bucket(uint64_t v)
 {
-    if (!q) return;
-    tr_mutex_lock(&q->lock);
-    for (size_t i = 0; i < q->count; ++i) {
-        if (q->items[i]) free(q->items[i]);
-    }
-    free(q->items);
-    q->items = NULL;
-    q->count = 0;
-    q->capacity = 0;
-    tr_mutex_unlock(&q->lock);
-    tr_mutex_destroy(&q->lock);
-    free(q);
+    if (v < TR_HIST_LINEAR) return (unsigned)v;
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long e;
+    _BitScanReverse64(&e, v);
+#else
+    unsigned e = 63u - (unsigned)__builtin_clzll(v);
+#endif
+    if (e >= TR_HIST_MAX_EXP) return TR_HIST_BUCKETS - 1;
+    return TR_HIST_LINEAR + ((unsigned)e - 4) * (1u << TR_HIST_SUB_BITS) + (unsigned)((v >> (e - TR_HIST_SUB_BITS)) & ((1u << TR_HIST_SUB_BITS) - 1));
 }
 
-/* Channel (same design as before) */
-typedef struct {
-    void **buffer;
-    size_t capacity;
-    size_t head;
-    size_t tail;
-    size_t count;
-    tr_mutex_t lock;
-    tr_cond_t not_empty;
-    tr_cond_t not_full;
-    int closed; /* once closed, recv returns 0 items and send fails */
-} Channel;
+/* largest value that lands in bucket i (UINT64_MAX for the overflow bucket) */
+static uint64_t tr_hist_upper(unsigned i)
+{
+    if (i < TR_HIST_LINEAR) return i;
+    if (i >= TR_HIST_BUCKETS - 1) return UINT64_MAX;
+    unsigned e = 4 + (i - TR_HIST_LINEAR) / (1u << TR_HIST_SUB_BITS);
+    uint64_t sub = (i - TR_HIST_LINEAR) % (1u << TR_HIST_SUB_BITS);
+    uint64_t width = (uint64_t)1 << (e - TR_HIST_SUB_BITS);
+    return (((uint64_t)1 << TR_HIST_SUB_BITS) + sub + 1) * width - 1;
+}
 
-Channel *channel_create(size_t capacity)
+static void tr_hist_record_into(TrHist *h, uint64_t v)
 {
-    if (capacity == 0) { tr_set_last_error_fmt("channel_create: invalid capacity"); return NULL; }
-    Channel *c = (Channel*)malloc(sizeof(Channel));
-    if (!c) { tr_set_last_error_fmt("channel_create: OOM"); return NULL; }
-    c->buffer = (void**)calloc(capacity, sizeof(void*));
-    if (!c->buffer) { free(c); tr_set_last_error_fmt("channel_create: calloc failed"); return NULL; }
-    c->capacity = capacity;
-    c->head = c->tail = c->count = 0;
-    c->closed = 0;
-    tr_mutex_init(&c->lock);
-    tr_cond_init(&c->not_empty);
-    tr_cond_init(&c->not_full);
-    return c;
+    tr_atomic_fetch_add(&h->b[tr_hist_bucket(v)], (uint64_t)1);
+    tr_atomic_fetch_add(&h->count, (uint64_t)1);
+    tr_atomic_fetch_add(&h->sum, v);
+    uint64_t m = tr_atomic_load_relaxed(&h->max);
+    while (v > m && !tr_atomic_cas(&h->max, &m, v)) {}
 }
 
-void channel_close(Channel *c)
+static void tr_hist_record(int id, uint64_t ns)
 {
-    if (!c) return;
-    tr_mutex_lock(&c->lock);
-    c->closed = 1;
-    tr_cond_notify_all(&c->not_empty);
-    tr_cond_notify_all(&c->not_full);
-    tr_mutex_unlock(&c->lock);
+    tr_hist_record_into(&tr_metric_shard()->h[id], ns);
 }
 
-void channel_destroy(Channel *c)
+static void tr_hist_merge(TrHist *dst, const TrHist *src)
 {
-    if (!c) return;
-    free(c->buffer);
-    tr_cond_destroy(&c->not_empty);
-    tr_cond_destroy(&c->not_full);
-    tr_mutex_destroy(&c->lock);
-    free(c);
+    dst->count += tr_atomic_load_relaxed(&src->count);
+    dst->sum += tr_atomic_load_relaxed(&src->sum);
+    uint64_t m = tr_atomic_load_relaxed(&src->max);
+    if (m > dst->max) dst->max = m;
+    for (unsigned i = 0; i < TR_HIST_BUCKETS; ++i) dst->b[i] += tr_atomic_load_relaxed(&src->b[i]);
 }
 
-int channel_send(Channel *c, void *item, int blocking, uint32_t timeout_ms)
+/* upper bound of the bucket holding quantile q, capped at the recorded max */
+static uint64_t tr_hist_quantile(const TrHist *h, double q)
 {
-    if (!c) { tr_set_last_error_fmt("channel_send: null channel"); return -1; }
-    tr_mutex_lock(&c->lock);
-    if (c->closed) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_send: closed"); return -1; }
-    while (c->count == c->capacity) {
-        if (!blocking) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_send: would block"); return -2; }
-        if (timeout_ms == 0) {
-            tr_cond_wait(&c->not_full, &c->lock);
-        } else {
-            int w = tr_cond_timedwait(&c->not_full, &c->lock, timeout_ms);
-            if (w != 0) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_send: timeout"); return -3; }
-        }
-        if (c->closed) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_send: closed during wait"); return -1; }
+    if (!h->count) return 0;
+    uint64_t total = 0;
+    for (unsigned i = 0; i < TR_HIST_BUCKETS; ++i) total += h->b[i];
+    uint64_t rank = (uint64_t)(q * (double)total);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < TR_HIST_BUCKETS; ++i) {
+        seen += h->b[i];
+        if (seen > rank) { uint64_t u = tr_hist_upper(i); return u < h->max ? u : h->max; }
     }
-    c->buffer[c->tail] = item;
-    c->tail = (c->tail + 1) % c->capacity;
-    c->count++;
-    tr_cond_notify_one(&c->not_empty);
-    tr_mutex_unlock(&c->lock);
-    return 0;
+    return h->max;
 }
 
-int channel_recv(Channel *c, void **out, int blocking, uint32_t timeout_ms)
+/* registries of live channels and capsules (and per-syscall stats, which outlive their entries),
+   walked only by tr_metrics_snapshot; objects join at create and leave at destroy */
+static tr_mutex_t g_metrics_lock;
+static uint32_t g_metrics_lock_state = 0;      /* 0 = uninit, 1 = initializing, 2 = ready */
+
+/* lock a static mutex, initializing it on first use */
+static void tr_lazy_mutex_lock(tr_mutex_t *m, uint32_t *state)
 {
-    if (!c || !out) { tr_set_last_error_fmt("channel_recv: invalid args"); return -1; }
-    tr_mutex_lock(&c->lock);
-    while (c->count == 0) {
-        if (c->closed) { tr_mutex_unlock(&c->lock); return 0; }
-        if (!blocking) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_recv: would block"); return -2; }
-        if (timeout_ms == 0) {
-            tr_cond_wait(&c->not_empty, &c->lock);
+    uint32_t st = tr_atomic_load_acquire(state);
+    if (st != 2) {
+        st = 0;
+        if (tr_atomic_cas(state, &st, 1u)) {
+            tr_mutex_init(m);
+            tr_atomic_store_release(state, 2u);
         } else {
-            int w = tr_cond_timedwait(&c->not_empty, &c->lock, timeout_ms);
-            if (w != 0) { tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_recv: timeout"); return -3; }
+            while (tr_atomic_load_acquire(state) != 2) tr_cpu_relax();
         }
     }
-    *out = c->buffer[c->head];
-    c->buffer[c->head] = NULL;
-    c->head = (c->head + 1) % c->capacity;
-    c->count--;
-    tr_cond_notify_one(&c->not_full);
-    tr_mutex_unlock(&c->lock);
-    return 1;
+    tr_mutex_lock(m);
 }
 
-/* ---------------------------
-   Thread wrappers (cross-platform)
-   --------------------------- */
+static void tr_metrics_lock(void) { tr_lazy_mutex_lock(&g_metrics_lock, &g_metrics_lock_state); }
 
-typedef void *(*tr_thread_fn_t)(void*);
+static void tr_metrics_unlock(void) { tr_mutex_unlock(&g_metrics_lock); }
 
-typedef struct {
-    tr_thread_fn_t fn;
-    void *arg;
-} thread_startup_t;
+struct Channel;
+struct Capsule;
+static struct Channel *g_metric_channels = NULL;
+static struct Capsule *g_metric_capsules = NULL;
+static uint64_t g_metric_channel_next_id = 0;
 
-#ifdef _WIN32
-static unsigned __stdcall _win_thread_start(void *ctx)
-{
-    thread_startup_t *s = (thread_startup_t*)ctx;
-    if (!s) _exit(1);
-    tr_thread_fn_t fn = s->fn;
-    void *arg = s->arg;
-    free(s);
-    void *ret = fn(arg);
-    (void)ret;
-    return 0;
-}
-static int tr_thread_create(tr_thread_t *out, tr_thread_fn_t fn, void *arg)
+/* Enable or disable latency timing (clock reads on capsule runs, syscalls, blocked sends);
+   counters are always maintained. */
+void tr_metrics_set_timing(int on)
 {
-    if (!out || !fn) { tr_set_last_error_fmt("tr_thread_create: invalid args"); return -1; }
-    thread_startup_t *s = (thread_startup_t*)malloc(sizeof(thread_startup_t));
-    if (!s) { tr_set_last_error_fmt("tr_thread_create: OOM"); return -1; }
-    s->fn = fn; s->arg = arg;
-    uintptr_t h = _beginthreadex(NULL, 0, _win_thread_start, s, 0, NULL);
-    if (h == 0) { free(s); tr_set_last_error_fmt("tr_thread_create: _beginthreadex failed"); return -1; }
-    *out = (tr_thread_t)h;
-    return 0;
+    tr_atomic_store_release(&g_metrics_timing, on ? 1 : 0);
 }
-static int tr_thread_join(tr_thread_t t)
+
+/* growable text buffer for the snapshot renderers */
+typedef struct {
+    char *p;
+    size_t len;
+    size_t cap;
+    int oom;
+} TrMetricsBuf;
+
+static void tr_mbuf_printf(TrMetricsBuf *b, const char *fmt, ...)
 {
-    if (!t) { tr_set_last_error_fmt("tr_thread_join: invalid thread"); return -1; }
-    WaitForSingleObject(t, INFINITE);
-    CloseHandle(t);
-    return 0;
+    if (b->oom) return;
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+        if (n < 0) { b->oom = 1; return; }
+        if ((size_t)n < b->cap - b->len) { b->len += (size_t)n; return; }
+        size_t nc = b->cap * 2 + (size_t)n;
+        char *np = (char*)realloc(b->p, nc);
+        if (!np) { b->oom = 1; return; }
+        b->p = np;
+        b->cap = nc;
+    }
 }
-#else
-static void * _posix_thread_start(void *ctx)
+
+/* label/string value with ", \ and control characters escaped (valid for JSON and Prometheus) */
+static void tr_mbuf_quoted(TrMetricsBuf *b, const char *s)
 {
-    thread_startup_t *s = (thread_startup_t*)ctx;
-    tr_thread_fn_t fn = s->fn; void *arg = s->arg;
-    free(s);
-    return fn(arg);
+    tr_mbuf_printf(b, "\"");
+    for (; s && *s; ++s) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch == '"' || ch == '\\') tr_mbuf_printf(b, "\\%c", ch);
+        else if (ch == '\n') tr_mbuf_printf(b, "\\n");
+        else if (ch < 0x20) tr_mbuf_printf(b, " ");
+        else tr_mbuf_printf(b, "%c", ch);
+    }
+    tr_mbuf_printf(b, "\"");
 }
-static int tr_thread_create(tr_thread_t *out, tr_thread_fn_t fn, void *arg)
+
+static void tr_mbuf_hist_json(TrMetricsBuf *b, const TrHist *h)
 {
-    if (!out || !fn) { tr_set_last_error_fmt("tr_thread_create: invalid args"); return -1; }
-    thread_startup_t *s = (thread_startup_t*)malloc(sizeof(thread_startup_t));
-    if (!s) { tr_set_last_error_fmt("tr_thread_create: OOM"); return -1; }
-    s->fn = fn; s->arg = arg;
-    pthread_t th;
-    if (pthread_create(&th, NULL, _posix_thread_start, s) != 0) { free(s); tr_set_last_error_fmt("tr_thread_create: pthread_create failed"); return -1; }
-    *out = th;
-    return 0;
+    tr_mbuf_printf(b, "{\"count\":%llu,\"sum_ns\":%llu,\"max_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}",
+                   (unsigned long long)h->count, (unsigned long long)h->sum, (unsigned long long)h->max,
+                   (unsigned long long)tr_hist_quantile(h, 0.5), (unsigned long long)tr_hist_quantile(h, 0.9),
+                   (unsigned long long)tr_hist_quantile(h, 0.99), (unsigned long long)tr_hist_quantile(h, 0.999));
 }
-static int tr_thread_join(tr_thread_t t)
+
+/* Prometheus histogram series: one cumulative bucket per power of two (the exact sub-buckets
+   would be ~270 series per histogram), then +Inf, _sum and _count. labels may be "" */
+static void tr_mbuf_hist_prom(TrMetricsBuf *b, const char *name, const char *labels, const TrHist *h)
 {
-    if (pthread_join(t, NULL) != 0) { tr_set_last_error_fmt("tr_thread_join: pthread_join failed"); return -1; }
-    return 0;
+    uint64_t cum = 0;
+    const char *sep = labels[0] ? "," : "";
+    for (unsigned i = 0; i < TR_HIST_BUCKETS - 1; ++i) {
+        cum += h->b[i];
+        int edge = i >= TR_HIST_LINEAR - 1 && (i + 1 - TR_HIST_LINEAR) % (1u << TR_HIST_SUB_BITS) == 0;
+        if (edge) tr_mbuf_printf(b, "%s_bucket{%s%sle=\"%.12g\"} %llu\n", name, labels, sep, (double)(tr_hist_upper(i) + 1) / 1e9, (unsigned long long)cum);
+    }
+    cum += h->b[TR_HIST_BUCKETS - 1];
+    tr_mbuf_printf(b, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep, (unsigned long long)cum);
+    tr_mbuf_printf(b, "%s_sum%s%s%s %.12g\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", (double)h->sum / 1e9);
+    tr_mbuf_printf(b, "%s_count%s%s%s %llu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "", (unsigned long long)cum);
 }
-#endif
 
 /* ---------------------------
-   Dodecagram (base-12) helpers (uint64)
+   Tracing
+   - capsule runs/steps, blocked channel sends and receives, syscall handlers, timer callbacks and
+     sandbox jobs are recorded as begin/end slices into per-thread event buffers and written out
+     as a Chrome trace-event JSON file (chrome://tracing, ui.perfetto.dev)
+   - while tracing is off every hook costs one relaxed load and a predictable branch; arguments
+     are not evaluated
+   - a buffer has a single writer (its thread) that publishes each event by a release store of
+     the count, so recording takes no lock; a full buffer drops events and counts them
+   - buffers live on a never-freed list; a thread that exits leaves its buffer (and events) for
+     the next new thread to adopt. tr_trace_start opens a new session and each buffer clears
+     itself the first time its thread records in it
    --------------------------- */
 
-static const char DG_DIGITS[] = "0123456789ab";
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
-int tr_to_base12_u64(uint64_t n, char *out, size_t outlen)
-{
-    if (!out || outlen == 0) { tr_set_last_error_fmt("tr_to_base12_u64: invalid args"); return -1; }
-    if (n == 0) {
-        if (outlen < 2) { tr_set_last_error_fmt("tr_to_base12_u64: buffer too small"); return -1; }
-        out[0] = '0'; out[1] = '\0';
-        return 0;
+#define TR_TRACE_JSON 0
+#define TR_TRACE_DEFAULT_EVENTS 32768    /* per thread, 64 bytes each */
+#define TR_TRACE_LABEL 27
+
+typedef struct {
+    uint64_t ts_ns;
+    const char *name;          /* static string "category.event" */
+    const char *arg_name;      /* static string or NULL */
+    int64_t arg;
+    uint32_t tid;
+    char ph;                   /* 'B' begin, 'E' end */
+    char label[TR_TRACE_LABEL];
+} TraceEvent;
+
+typedef struct TraceBuf {
+    struct TraceBuf *next;
+    uint32_t owned;            /* 0 = owner thread exited, free to adopt */
+    uint32_t count;            /* published events, release-stored by the owner */
+    uint32_t cap;
+    uint64_t session;          /* session the events belong to */
+    uint64_t dropped;
+    TraceEvent *ev;
+} TraceBuf;
+
+static uint32_t g_trace_on = 0;
+static uint64_t g_trace_session = 0;
+static uint32_t g_trace_cap = TR_TRACE_DEFAULT_EVENTS;
+static uint64_t g_trace_t0 = 0;
+static TraceBuf *g_trace_bufs = NULL;
+static tr_mutex_t g_trace_lock;                /* serializes start/stop/dump */
+static uint32_t g_trace_lock_state = 0;
+static TR_THREAD_LOCAL TraceBuf *g_trace_buf = NULL;
+static TR_THREAD_LOCAL uint32_t g_trace_tid = 0;
+
+#define TR_TRACE(ph, name, label, arg_name, arg) \
+    do { if (tr_atomic_load_relaxed(&g_trace_on)) tr_trace_emit((ph), (name), (label), (arg_name), (int64_t)(arg)); } while (0)
+
+#ifndef _WIN32
+static pthread_key_t g_trace_key;
+static pthread_once_t g_trace_key_once = PTHREAD_ONCE_INIT;
+
+static void tr_trace_thread_exit(void *arg)
+{
+    tr_atomic_store_release(&((TraceBuf*)arg)->owned, 0u);
+    g_trace_buf = NULL;
+}
+
+static void tr_trace_key_init(void) { pthread_key_create(&g_trace_key, tr_trace_thread_exit); }
+#endif
+
+static uint32_t tr_trace_tid(void)
+{
+    if (!g_trace_tid) {
+#if defined(_WIN32)
+        g_trace_tid = (uint32_t)GetCurrentThreadId();
+#elif defined(__linux__)
+        g_trace_tid = (uint32_t)syscall(SYS_gettid);
+#else
+        static uint32_t next = 0;
+        g_trace_tid = tr_atomic_fetch_add(&next, 1u) + 1;
+#endif
     }
-    char buf[128];
-    size_t pos = 0;
-    while (n && pos + 1 < sizeof(buf)) {
-        buf[pos++] = DG_DIGITS[n % 12];
-        n /= 12;
+    return g_trace_tid;
+}
+
+static TraceBuf *tr_trace_buf(void)
+{
+    TraceBuf *b = g_trace_buf;
+    if (!b) {
+        for (b = tr_atomic_load_acquire(&g_trace_bufs); b; b = b->next) {
+            uint32_t expected = 0;
+            if (tr_atomic_load_relaxed(&b->owned) == 0 && tr_atomic_cas(&b->owned, &expected, 1u)) break;
+        }
+        if (!b) {
+            b = (TraceBuf*)calloc(1, sizeof(TraceBuf));
+            if (!b) return NULL;
+            b->owned = 1;
+            TraceBuf *head = tr_atomic_load_relaxed(&g_trace_bufs);
+            do { b->next = head; } while (!tr_atomic_cas(&g_trace_bufs, &head, b));
+        }
+        g_trace_buf = b;
+#ifndef _WIN32
+        pthread_once(&g_trace_key_once, tr_trace_key_init);
+        pthread_setspecific(g_trace_key, (void*)b);
+#endif
     }
-    if (pos == 0) { buf[pos++] = '0'; }
-    if (pos + 1 > outlen) { tr_set_last_error_fmt("tr_to_base12_u64: outlen too small"); return -1; }
-    for (size_t i = 0; i < pos; ++i) out[i] = buf[pos - 1 - i];
-    out[pos] = '\0';
+    uint64_t session = tr_atomic_load_acquire(&g_trace_session);
+    if (b->session != session) {
+        uint32_t cap = tr_atomic_load_relaxed(&g_trace_cap);
+        if (b->cap != cap || !b->ev) {
+            free(b->ev);
+            b->ev = (TraceEvent*)malloc((size_t)cap * sizeof(TraceEvent));
+            b->cap = b->ev ? cap : 0;
+        }
+        tr_atomic_store_relaxed(&b->count, 0u);
+        tr_atomic_store_relaxed(&b->dropped, (uint64_t)0);
+        tr_atomic_store_release(&b->session, session);
+    }
+    return b;
+}
+
+/* last component of a path, so executable labels survive truncation */
+static const char *tr_trace_basename(const char *path)
+{
+    const char *slash = path ? strrchr(path, '/') : NULL;
+    return slash ? slash + 1 : path;
+}
+
+static void tr_trace_emit(char ph, const char *name, const char *label, const char *arg_name, int64_t arg)
+{
+    TraceBuf *b = tr_trace_buf();
+    if (!b) return;
+    uint32_t n = b->count;
+    if (n >= b->cap) { tr_atomic_store_relaxed(&b->dropped, b->dropped + 1); return; }
+    TraceEvent *e = &b->ev[n];
+    e->ts_ns = tr_clock_ns();
+    e->name = name;
+    e->arg_name = arg_name;
+    e->arg = arg;
+    e->tid = tr_trace_tid();
+    e->ph = ph;
+    size_t i = 0;
+    for (; label && label[i] && i < TR_TRACE_LABEL - 1; ++i) e->label[i] = label[i];
+    e->label[i] = '\0';
+    tr_atomic_store_release(&b->count, n + 1);
+}
+
+/* Start a new trace session, discarding events of the previous one. events_per_thread bounds each
+   thread's buffer (0: TR_TRACE_DEFAULT_EVENTS); later events on a full buffer are dropped. */
+int tr_trace_start(size_t events_per_thread)
+{
+    if (events_per_thread == 0) events_per_thread = TR_TRACE_DEFAULT_EVENTS;
+    if (events_per_thread > (1u << 24)) { tr_set_last_error_fmt("tr_trace_start: events_per_thread too large"); return -1; }
+    tr_lazy_mutex_lock(&g_trace_lock, &g_trace_lock_state);
+    tr_atomic_store_relaxed(&g_trace_cap, (uint32_t)events_per_thread);
+    tr_atomic_store_relaxed(&g_trace_t0, tr_clock_ns());
+    tr_atomic_store_release(&g_trace_session, g_trace_session + 1);
+    tr_atomic_store_release(&g_trace_on, 1u);
+    tr_mutex_unlock(&g_trace_lock);
     return 0;
 }
 
-int tr_from_base12_u64(const char *s, uint64_t *out)
+/* Stop recording; the session's events stay available to tr_trace_dump. */
+void tr_trace_stop(void)
 {
-    if (!s || !out) { tr_set_last_error_fmt("tr_from_base12_u64: invalid args"); return -1; }
-    uint64_t val = 0;
-    const char *p = s;
-    int neg = 0;
-    if (*p == '+' || *p == '-') { if (*p == '-') neg = 1; p++; }
-    while (*p) {
-        char c = *p++;
-        int d = -1;
-        if (c >= '0' && c <= '9') d = c - '0';
-        else if (c == 'a' || c == 'A') d = 10;
-        else if (c == 'b' || c == 'B') d = 11;
-        else if (c == '_' || c == ' ') continue;
-        else { tr_set_last_error_fmt("tr_from_base12_u64: invalid digit '%c'", c); return -1; }
-        if (val > (UINT64_MAX - d) / 12) { tr_set_last_error_fmt("tr_from_base12_u64: overflow"); return -1; }
-        val = val * 12 + (uint64_t)d;
+    tr_atomic_store_release(&g_trace_on, 0u);
+}
+
+/* Write the current session as Chrome trace-event JSON (timestamps in microseconds since
+   tr_trace_start). May be called while tracing; events published by then are included.
+   Returns the number of events written, -1 on a bad format or I/O error. */
+int tr_trace_dump(const char *path, int format)
+{
+    if (!path) { tr_set_last_error_fmt("tr_trace_dump: path is NULL"); return -1; }
+    if (format != TR_TRACE_JSON) { tr_set_last_error_fmt("tr_trace_dump: unknown format %d", format); return -1; }
+    FILE *f = fopen(path, "w");
+    if (!f) { tr_set_last_error_fmt("tr_trace_dump: cannot open %s: %s", path, strerror(errno)); return -1; }
+#ifdef _WIN32
+    unsigned long long pid = (unsigned long long)GetCurrentProcessId();
+#else
+    unsigned long long pid = (unsigned long long)getpid();
+#endif
+    tr_lazy_mutex_lock(&g_trace_lock, &g_trace_lock_state);
+    uint64_t session = g_trace_session;
+    uint64_t t0 = g_trace_t0;
+    TrMetricsBuf m = { (char*)malloc(80 * 1024), 0, 80 * 1024, 0 };
+    if (!m.p) m.oom = 1;
+    int written = 0, io_err = 0;
+    uint64_t dropped = 0;
+    tr_mbuf_printf(&m, "{\"traceEvents\":[");
+    for (TraceBuf *b = tr_atomic_load_acquire(&g_trace_bufs); b && session; b = b->next) {
+        if (tr_atomic_load_acquire(&b->session) != session) continue;
+        uint32_t n = tr_atomic_load_acquire(&b->count);
+        dropped += tr_atomic_load_relaxed(&b->dropped);
+        for (uint32_t i = 0; i < n; ++i) {
+            const TraceEvent *e = &b->ev[i];
+            uint64_t ts = e->ts_ns > t0 ? e->ts_ns - t0 : 0;
+            const char *dot = strchr(e->name, '.');
+            int catlen = dot ? (int)(dot - e->name) : (int)strlen(e->name);
+            tr_mbuf_printf(&m, "%s\n{\"name\":\"%s\",\"cat\":\"%.*s\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%llu,\"tid\":%u",
+                           written ? "," : "", e->name, catlen, e->name, e->ph,
+                           (unsigned long long)(ts / 1000), (unsigned)(ts % 1000), pid, (unsigned)e->tid);
+            if (e->label[0] || e->arg_name) {
+                tr_mbuf_printf(&m, ",\"args\":{");
+                if (e->label[0]) { tr_mbuf_printf(&m, "\"label\":"); tr_mbuf_quoted(&m, e->label); }
+                if (e->arg_name) tr_mbuf_printf(&m, "%s\"%s\":%lld", e->label[0] ? "," : "", e->arg_name, (long long)e->arg);
+                tr_mbuf_printf(&m, "}");
+            }
+            tr_mbuf_printf(&m, "}");
+            written++;
+            if (m.len >= 64 * 1024 && !m.oom) {
+                if (fwrite(m.p, 1, m.len, f) != m.len) io_err = 1;
+                m.len = 0;
+            }
+        }
     }
-    *out = neg ? (uint64_t)(-(int64_t)val) : val;
-    return 0;
+    tr_mutex_unlock(&g_trace_lock);
+    tr_mbuf_printf(&m, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped_events\":\"%llu\"}}\n", (unsigned long long)dropped);
+    if (!m.oom && fwrite(m.p, 1, m.len, f) != m.len) io_err = 1;
+    free(m.p);
+    if (fclose(f) != 0) io_err = 1;
+    if (m.oom) { tr_set_last_error_fmt("tr_trace_dump: OOM"); return -1; }
+    if (io_err) { tr_set_last_error_fmt("tr_trace_dump: write to %s failed", path); return -1; }
+    return written;
 }
 
 /* ---------------------------
-   Big-number: bytes <-> base-12 (arbitrary-length), signed and fractional support
-   - bytes_to_base12(bytes,len,out,outlen)                : integer representation (existing)
-   - bytes_to_base12_scaled(bytes,len,scale,out,outlen)   : treat bytes as integer representing value / 12^scale
-   - base12_to_bytes(s, &out_bytes, &out_len)             : parse signed integer or fixed-point (no scale output)
-   - base12_to_bytes_with_scale(s, &out_bytes, &out_len, &scale) : returns scale for fractional digits
-   Notes:
-     - bytes are interpreted as big-endian unsigned magnitude.
-     - base12 strings may include optional leading +/-, an optional decimal point '.' with fractional base-12 digits.
-     - When fractional part present, the returned bytes represent (value * 12^frac_len) as integer; `scale` will be frac_len.
+   NUMA topology and placement (Linux; elsewhere everything is one node and placement is a no-op)
+   - the topology is read once from /sys/devices/system/node
+   - tr_numa_place_self pins the calling thread to a CPU or to a node's CPUs and makes that node
+     its preferred memory node, so everything the thread first touches lands there
+   - tr_numa_bind moves the whole pages of an existing block to a node (mbind, MPOL_PREFERRED);
+     tr_numa_move re-homes a small block onto pages of its own first
+   - all of it is best effort: failures leave the default placement in place
    --------------------------- */
 
-/* helpers for big-number math */
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define TR_NUMA_MAX_NODES 64
+#define TR_NUMA_MAX_CPUS  1024
+#define TR_MPOL_PREFERRED 1
+#define TR_MPOL_MF_MOVE   2
 
-static int bn_is_zero(const uint8_t *bn, size_t len)
+typedef struct {
+    int nnodes;                        /* highest node id + 1, at least 1 */
+    int16_t cpu_node[TR_NUMA_MAX_CPUS];   /* -1 = unknown */
+} NumaTopology;
+
+static NumaTopology g_numa;
+static uint32_t g_numa_state = 0;      /* 0 = unread, 1 = reading, 2 = ready */
+
+static void tr_numa_read(void)
 {
-    for (size_t i = 0; i < len; ++i) if (bn[i]) return 0;
-    return 1;
+    g_numa.nnodes = 1;
+    for (int i = 0; i < TR_NUMA_MAX_CPUS; ++i) g_numa.cpu_node[i] = -1;
+#ifdef __linux__
+    for (int node = 0; node < TR_NUMA_MAX_NODES; ++node) {
+        char path[96], list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "r");
+        if (!f) continue;
+        size_t n = fread(list, 1, sizeof(list) - 1, f);
+        fclose(f);
+        list[n] = '\0';
+        /* "0-3,8-11" */
+        for (char *p = list; *p && *p != '\n';) {
+            char *end;
+            long lo = strtol(p, &end, 10), hi = lo;
+            if (end == p) break;
+            if (*end == '-') { p = end + 1; hi = strtol(p, &end, 10); }
+            for (long cpu = lo; cpu <= hi && cpu < TR_NUMA_MAX_CPUS; ++cpu) if (cpu >= 0) g_numa.cpu_node[cpu] = (int16_t)node;
+            p = *end == ',' ? end + 1 : end;
+        }
+        if (node + 1 > g_numa.nnodes) g_numa.nnodes = node + 1;
+    }
+#endif
 }
 
-/* divide big-endian bn (len bytes) by small divisor; write quotient back into bn.
-   return remainder in rem_out. divisor must be >0
-*/
-static int bn_divmod_small(uint8_t *bn, size_t len, uint32_t divisor, uint32_t *rem_out)
+static const NumaTopology *tr_numa(void)
 {
-    if (!bn || len == 0 || divisor == 0 || !rem_out) { tr_set_last_error_fmt("bn_divmod_small: invalid args"); return -1; }
-    uint32_t rem = 0;
-    for (size_t i = 0; i < len; ++i) {
-        uint32_t acc = (rem << 8) | bn[i];
-        uint8_t q = (uint8_t)(acc / divisor);
-        rem = acc % divisor;
-        bn[i] = q;
+    uint32_t st = tr_atomic_load_acquire(&g_numa_state);
+    if (st != 2) {
+        st = 0;
+        if (tr_atomic_cas(&g_numa_state, &st, 1u)) {
+            tr_numa_read();
+            tr_atomic_store_release(&g_numa_state, 2u);
+        } else {
+            while (tr_atomic_load_acquire(&g_numa_state) != 2) tr_cpu_relax();
+        }
     }
-    *rem_out = rem;
-    return 0;
+    return &g_numa;
 }
 
-/* multiply big-endian bn (len bytes) by small multiplier and add small addend.
-   bn is modified in place; when carry remains positive after top byte, return -2 to indicate need to grow buffer.
-*/
-static int bn_mul_small_add(uint8_t *bn, size_t len, uint32_t mul, uint32_t add)
+int tr_numa_node_count(void) { return tr_numa()->nnodes; }
+
+/* node of a CPU, 0 when the topology does not say */
+int tr_numa_node_of_cpu(int cpu)
 {
-    if (!bn || len == 0) { tr_set_last_error_fmt("bn_mul_small_add: invalid args"); return -1; }
-    uint64_t carry = add;
-    for (ssize_t i = (ssize_t)len - 1; i >= 0; --i) {
-        uint64_t prod = (uint64_t)bn[i] * (uint64_t)mul + carry;
-        bn[i] = (uint8_t)(prod & 0xFF);
-        carry = prod >> 8;
-    }
-    if (carry != 0) return -2; /* overflow -> caller should grow buffer and retry */
+    const NumaTopology *t = tr_numa();
+    if (cpu < 0 || cpu >= TR_NUMA_MAX_CPUS || t->cpu_node[cpu] < 0) return 0;
+    return t->cpu_node[cpu];
+}
+
+/* node the calling thread is running on right now */
+int tr_numa_current_node(void)
+{
+#ifdef __linux__
+    return tr_numa_node_of_cpu(sched_getcpu());
+#else
     return 0;
+#endif
 }
 
-/* Convert arbitrary big-endian byte array to base-12 string (0-9,a,b).
-   Un-signed, outputs integer string. Returns 0 on success.
-*/
-int bytes_to_base12(const uint8_t *bytes, size_t len, char *out, size_t outlen)
+static void tr_numa_bind(void *p, size_t len, int node)
 {
-    if (!out || outlen == 0) { tr_set_last_error_fmt("bytes_to_base12: invalid output buffer"); return -1; }
-    if (!bytes || len == 0) {
-        if (outlen < 2) { tr_set_last_error_fmt("bytes_to_base12: outlen too small"); return -1; }
-        out[0] = '0'; out[1] = '\0';
-        return 0;
+#ifdef __linux__
+    if (!p || node < 0 || node >= TR_NUMA_MAX_NODES || tr_numa()->nnodes < 2) return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)p + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t)p + len) & ~(page - 1);
+    if (hi <= lo) return;
+    unsigned long mask = 1ul << node;
+    syscall(SYS_mbind, (void*)lo, (unsigned long)(hi - lo), TR_MPOL_PREFERRED, &mask, (unsigned long)TR_NUMA_MAX_NODES + 1, TR_MPOL_MF_MOVE);
+#else
+    (void)p; (void)len; (void)node;
+#endif
+}
+
+/* copy a malloc'd (or posix_memalign'd) block onto whole pages bound to node and free the old
+   one; returns p itself when there is nothing to do or on failure. The result is free()able. */
+static void *tr_numa_move(void *p, size_t size, int node)
+{
+#ifdef __linux__
+    if (!p || node < 0 || tr_numa()->nnodes < 2) return p;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t rounded = (size + page - 1) & ~(page - 1);
+    void *np = NULL;
+    if (posix_memalign(&np, page, rounded) != 0) return p;
+    tr_numa_bind(np, rounded, node);
+    memcpy(np, p, size);
+    free(p);
+    return np;
+#else
+    (void)size; (void)node;
+    return p;
+#endif
+}
+
+/* Pin the calling thread to cpu (>= 0) or else to node's CPUs, and prefer node for its memory.
+   Returns 0 on success, -1 when the placement could not be applied (nothing changed). */
+static int tr_numa_place_self(int node, int cpu)
+{
+#ifdef __linux__
+    const NumaTopology *t = tr_numa();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpu >= 0) {
+        if (cpu >= CPU_SETSIZE) return -1;
+        CPU_SET(cpu, &set);
+    } else if (node >= 0) {
+        for (int i = 0; i < TR_NUMA_MAX_CPUS && i < CPU_SETSIZE; ++i) if (t->cpu_node[i] == node) CPU_SET(i, &set);
     }
-    uint8_t *bn = (uint8_t*)malloc(len);
-    if (!bn) { tr_set_last_error_fmt("bytes_to_base12: OOM"); return -1; }
-    memcpy(bn, bytes, len);
-    char *rev = (char*)malloc((len * 3) + 32);
-    if (!rev) { free(bn); tr_set_last_error_fmt("bytes_to_base12: OOM rev"); free(bn); return -1; }
-    size_t rpos = 0;
-    while (!bn_is_zero(bn, len)) {
-        uint32_t rem = 0;
-        if (bn_divmod_small(bn, len, 12, &rem) != 0) { free(bn); free(rev); tr_set_last_error_fmt("bytes_to_base12: divmod failed"); return -1; }
-        rev[rpos++] = DG_DIGITS[rem];
-        if (rpos + 2 >= (size_t)((len * 3) + 32)) break;
+    if (CPU_COUNT(&set) && sched_setaffinity(0, sizeof(set), &set) != 0) return -1;
+    if (node >= 0 && node < TR_NUMA_MAX_NODES && t->nnodes > 1) {
+        unsigned long mask = 1ul << node;
+        syscall(SYS_set_mempolicy, TR_MPOL_PREFERRED, &mask, (unsigned long)TR_NUMA_MAX_NODES + 1);
     }
-    if (rpos == 0) rev[rpos++] = '0';
-    if (rpos + 1 > outlen) { free(bn); free(rev); tr_set_last_error_fmt("bytes_to_base12: outlen too small"); return -1; }
-    for (size_t i = 0; i < rpos; ++i) out[i] = rev[rpos - 1 - i];
-    out[rpos] = '\0';
-    free(bn); free(rev);
     return 0;
+#else
+    (void)node; (void)cpu;
+    return -1;
+#endif
 }
 
-/* Convert and insert decimal point according to scale: the input bytes represent integer value v,
-   conceptual value is v / (12^scale). This function prints appropriate base-12 string with '.'
+/* ---------------------------
+   Basic concurrency & primitives (Quarantine + Channel)
+   --------------------------- */
+
+/* Quarantine modes:
+   - TR_QUARANTINE_TRACKED: every allocation is an individual malloc tracked in `items` (default)
+   - TR_QUARANTINE_ARENA: allocations are bump-carved from large chunks; each carries a small
+     header pointing at its chunk so free is O(1) (chunks are aligned to their power-of-two size and
+     looked up by base, which vets the pointer before the header is read), and
+     tr_quarantine_reset drops everything at once
+   - TR_QUARANTINE_SLAB: size-class slab pools (16..4096 bytes) fronted by per-thread magazines;
+     the quarantine lock is only taken to refill/flush a magazine in batches
 */
-int bytes_to_base12_scaled(const uint8_t *bytes, size_t len, int scale, char *out, size_t outlen)
+#define TR_QUARANTINE_TRACKED 0
+#define TR_QUARANTINE_ARENA   1
+#define TR_QUARANTINE_SLAB    2
+
+#define TR_QUARANTINE_ALIGN 16
+#define TR_QUARANTINE_DEFAULT_CHUNK (64 * 1024)
+#define TR_QUARANTINE_ROUNDUP(n) (((n) + (TR_QUARANTINE_ALIGN - 1)) & ~(size_t)(TR_QUARANTINE_ALIGN - 1))
+
+struct Quarantine;
+
+/* Address map used to validate pointers handed to free before anything around them is read:
+   keys are aligned block bases (never 0 or 1). Open addressing with linear probing; writers hold
+   q->lock. Lookups may run without it: keys are published with release stores, deleted keys turn
+   into tombstones rather than being shifted, and a table replaced when the map grows stays
+   readable on the retired list until the map is cleared or freed. */
+#define TR_QMAP_EMPTY ((uintptr_t)0)
+#define TR_QMAP_TOMB  ((uintptr_t)1)
+
+typedef struct QuarantineMap {
+    struct QuarantineMap *retired;  /* older table a lock-free lookup may still be probing */
+    size_t mask;
+    size_t used;                    /* keys + tombstones */
+    size_t live;
+    uintptr_t *keys;
+    void **vals;
+} QuarantineMap;
+
+static size_t quarantine_map_slot(const QuarantineMap *t, uintptr_t key)
 {
-    if (scale < 0) { tr_set_last_error_fmt("bytes_to_base12_scaled: negative scale"); return -1; }
-    if (!out || outlen == 0) return -1;
-    // produce integer part and fractional part by repeated division/mod
-    char *tmp = (char*)malloc(outlen + 16);
-    if (!tmp) { tr_set_last_error_fmt("bytes_to_base12_scaled: OOM"); return -1; }
-    int rc = bytes_to_base12(bytes, len, tmp, outlen + 16);
-    if (rc != 0) { free(tmp); return rc; }
-    size_t totlen = strlen(tmp);
-    if (scale == 0) {
-        // no point insertion
-        if (totlen + 1 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small"); return -1; }
-        strcpy(out, tmp);
-        free(tmp);
-        return 0;
-    }
-    // ensure we have at least scale+1 digits by left-padding with zeros
-    if ((int)totlen <= scale) {
-        // pad with leading zeros to produce 0.xxx
-        size_t need = (size_t)(scale + 1 - (int)totlen);
-        if (need + totlen + 2 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small after pad"); return -1; }
-        // write "0."
-        out[0] = '0'; out[1] = '.'; size_t pos = 2;
-        for (size_t i = 0; i < need; ++i) out[pos++] = '0';
-        strcpy(out + pos, tmp);
-        free(tmp);
-        return 0;
-    } else {
-        // insert point such that fractional part has length 'scale'
-        size_t intpart = totlen - scale;
-        if (totlen + 2 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small for insertion"); return -1; }
-        memcpy(out, tmp, intpart);
-        out[intpart] = '.';
-        strcpy(out + intpart + 1, tmp + intpart);
-        free(tmp);
-        return 0;
+    return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 32) & t->mask;
+}
+
+static void *quarantine_map_get(const QuarantineMap *t, uintptr_t key)
+{
+    if (!t) return NULL;
+    for (size_t i = quarantine_map_slot(t, key);; i = (i + 1) & t->mask) {
+        uintptr_t k = tr_atomic_load_acquire(&t->keys[i]);
+        if (k == key) return tr_atomic_load_relaxed(&t->vals[i]);
+        if (k == TR_QMAP_EMPTY) return NULL;
     }
 }
 
-/* Parse base-12 string into big-endian byte array (allocated, caller frees).
-   Supports optional sign (+/-) and optional fractional part separated by '.'.
-   When fractional digits present, result bytes represent integer value = parsed_value * 12^frac_len
-   and out_scale is set to frac_len so caller knows to interpret bytes as fixed-point.
-*/
-int base12_to_bytes_with_scale(const char *s, uint8_t **out_bytes, size_t *out_len, int *out_scale)
+static void quarantine_map_free(QuarantineMap *t)
 {
-    if (!s || !out_bytes || !out_len) { tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid args"); return -1; }
-    const char *p = s;
-    int neg = 0;
-    if (*p == '+' || *p == '-') { if (*p == '-') neg = 1; p++; }
-    // split integer and fractional parts (if any)
-    const char *dot = strchr(p, '.');
-    size_t int_len = dot ? (size_t)(dot - p) : strlen(p);
-    size_t frac_len = 0;
-    const char *frac = NULL;
-    if (dot) { frac = dot + 1; frac_len = strlen(frac); }
-    // We'll process digits left-to-right: result = 0; for each base-12 digit d: result = result*12 + d
-    // Using big-number bn (big-endian) allocate initial capacity 16 bytes and grow as needed.
-    size_t cap = 16;
-    uint8_t *bn = (uint8_t*)calloc(cap, 1);
-    if (!bn) { tr_set_last_error_fmt("base12_to_bytes_with_scale: OOM bn alloc"); return -1; }
-    size_t bn_len = 1;
-    // helper to ensure capacity >= new_len
-    auto ensure_bn_len = [&](size_t desired_len) -> int {
-        if (desired_len <= bn_len) return 0;
-        if (desired_len <= cap) { /* shift current content to rightmost position */ ; }
-        size_t newcap = cap;
-        while (newcap < desired_len) newcap *= 2;
-        uint8_t *nb = (uint8_t*)calloc(newcap, 1);
-        if (!nb) { free(bn); tr_set_last_error_fmt("base12_to_bytes_with_scale: OOM bn grow"); return -1; }
-        // align old data at the end of new buffer
-        memcpy(nb + (newcap - bn_len), bn + (cap - bn_len), bn_len);
-        // free old and reset bn to new aligned layout (we will maintain bn as big-endian in [0..bn_len-1] region)
-        free(bn);
-        bn = nb;
-        cap = newcap;
-        return 0;
-    };
-    // We will treat bn as big-endian located at bn + (cap - bn_len)
-    // To ease operations, we will maintain pointer 'ptr' to start of meaningful bytes
-    uint8_t *ptr = bn + (cap - bn_len);
-
-    // helper to multiply bn by 12 and add digit, resizing if needed
-    auto bn_mul12_add = [&](int digit)->int {
-        // multiply big-endian number at ptr with bn_len bytes by 12 and add digit
-        uint64_t carry = digit;
-        for (ssize_t i = (ssize_t)bn_len - 1; i >= 0; --i) {
-            uint64_t idx = (size_t)(ptr + i - bn);
-            uint64_t cur = (uint64_t)bn[(cap - bn_len) + i];
-            uint64_t prod = cur * 12 + carry;
-            bn[(cap - bn_len) + i] = (uint8_t)(prod & 0xFF);
-            carry = prod >> 8;
-        }
-        if (carry != 0) {
-            // need to grow by 1 byte
-            if (ensure_bn_len(bn_len + 1) != 0) return -1;
-            // shift ptr to new location
-            ptr = bn + (cap - bn_len - 1);
-            // shift existing data right by 1 byte within new buffer region
-            memmove(ptr + 1, ptr, bn_len);
-            ptr[0] = (uint8_t)carry;
-            bn_len++;
-        }
-        return 0;
-    };
+    while (t) { QuarantineMap *n = t->retired; free(t); t = n; }
+}
 
-    // parse integer part
-    for (size_t i = 0; i < int_len; ++i) {
-        char c = p[i];
-        if (c == '_' || c == ' ') continue;
-        int digit = -1;
-        if (c >= '0' && c <= '9') digit = c - '0';
-        else if (c == 'a' || c == 'A') digit = 10;
-        else if (c == 'b' || c == 'B') digit = 11;
-        else { free(bn); tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid digit '%c'", c); return -2; }
-        if (bn_mul12_add(digit) != 0) { free(bn); return -1; }
-    }
-    // parse fractional part by multiplying result by 12 for each fractional digit and adding digit,
-    // but to represent fixed-point as integer we simply continue the bn_mul12_add over fractional digits
-    for (size_t i = 0; i < frac_len; ++i) {
-        char c = frac[i];
-        if (c == '_' || c == ' ') continue;
-        int digit = -1;
-        if (c >= '0' && c <= '9') digit = c - '0';
-        else if (c == 'a' || c == 'A') digit = 10;
-        else if (c == 'b' || c == 'B') digit = 11;
-        else { free(bn); tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid frac digit '%c'", c); return -2; }
-        if (bn_mul12_add(digit) != 0) { free(bn); return -1; }
-    }
-
-    // trim leading zeros
-    size_t start = cap - bn_len;
-    while (start < cap - 1 && bn[start] == 0) { start++; }
-    size_t real_len = (cap - start);
-    uint8_t *outb = (uint8_t*)malloc(real_len);
-    if (!outb) { free(bn); tr_set_last_error_fmt("base12_to_bytes_with_scale: OOM outb"); return -1; }
-    memcpy(outb, bn + start, real_len);
-    free(bn);
-    *out_bytes = outb;
-    *out_len = real_len;
-    if (out_scale) *out_scale = (int)frac_len;
-    // Note: sign is not encoded into bytes (caller may track sign separately); return negative scale via out_scale<0? We'll set a flag by convention:
-    if (neg && out_len && out_bytes) {
-        // set leading sign indicator by prepending a single 0xFF byte? Avoid mutating bytes; instead, user should track sign based on original string.
+/* add a key that is not in the map; retire keeps a replaced table for concurrent lookups.
+   -1 on OOM (the map is unchanged) */
+static int quarantine_map_put(QuarantineMap **tp, uintptr_t key, void *val, int retire)
+{
+    QuarantineMap *t = *tp;
+    if (!t || (t->used + 1) * 4 > (t->mask + 1) * 3) {
+        size_t live = t ? t->live : 0, cap = 16;
+        while (cap < (live + 1) * 4) cap <<= 1;
+        QuarantineMap *n = (QuarantineMap*)calloc(1, sizeof(QuarantineMap) + cap * (sizeof(uintptr_t) + sizeof(void*)));
+        if (!n) return -1;
+        n->mask = cap - 1;
+        n->keys = (uintptr_t*)(n + 1);
+        n->vals = (void**)(n->keys + cap);
+        for (size_t i = 0; t && i <= t->mask; ++i) {
+            if (t->keys[i] <= TR_QMAP_TOMB) continue;
+            size_t j = quarantine_map_slot(n, t->keys[i]);
+            while (n->keys[j] != TR_QMAP_EMPTY) j = (j + 1) & n->mask;
+            n->keys[j] = t->keys[i];
+            n->vals[j] = t->vals[i];
+        }
+        n->used = n->live = live;
+        if (retire) n->retired = t;
+        else quarantine_map_free(t);
+        tr_atomic_store_release(tp, n);
+        t = n;
     }
+    size_t i = quarantine_map_slot(t, key), slot = SIZE_MAX;
+    for (; t->keys[i] != TR_QMAP_EMPTY; i = (i + 1) & t->mask) {
+        if (t->keys[i] == TR_QMAP_TOMB && slot == SIZE_MAX) slot = i;
+    }
+    if (slot == SIZE_MAX) { slot = i; t->used++; }
+    t->live++;
+    tr_atomic_store_relaxed(&t->vals[slot], val);
+    tr_atomic_store_release(&t->keys[slot], key);
     return 0;
 }
 
-/* Backwards-compat wrapper: existing base12_to_bytes returns bytes for integer strings only (scale ignored) */
-int base12_to_bytes(const char *s, uint8_t **out_bytes, size_t *out_len)
+static void quarantine_map_del(QuarantineMap *t, uintptr_t key)
 {
-    int scale = 0;
-    return base12_to_bytes_with_scale(s, out_bytes, out_len, &scale);
+    if (!t) return;
+    for (size_t i = quarantine_map_slot(t, key); t->keys[i] != TR_QMAP_EMPTY; i = (i + 1) & t->mask) {
+        if (t->keys[i] == key) {
+            tr_atomic_store_release(&t->keys[i], TR_QMAP_TOMB);
+            t->live--;
+            return;
+        }
+    }
 }
 
-/* ---------------------------
-   Packet helpers (simple)
-   --------------------------- */
+/* drop every key and the retired tables; nothing may be looking up concurrently */
+static void quarantine_map_clear(QuarantineMap *t)
+{
+    if (!t) return;
+    quarantine_map_free(t->retired);
+    t->retired = NULL;
+    memset(t->keys, 0, (t->mask + 1) * sizeof(uintptr_t));
+    t->used = t->live = 0;
+}
+
+typedef struct QuarantineChunk {
+    struct QuarantineChunk *prev;
+    struct QuarantineChunk *next;
+    struct Quarantine *owner;   /* used to validate pointers handed to free */
+    size_t size;                /* usable bytes after the chunk header */
+    size_t used;                /* bump offset */
+    size_t live;                /* live allocations carved from this chunk */
+} QuarantineChunk;
+
+/* per-allocation header in arena mode; chunk == NULL marks a freed block */
 typedef struct {
-    uint32_t src_ip;
-    uint32_t dst_ip;
-    uint16_t src_port;
-    uint16_t dst_port;
-    size_t length;
-    void *payload;       /* owned by packet->q */
-    Quarantine *q;       /* quarantine owning payload */
-} TrionPacket;
+    QuarantineChunk *chunk;
+    size_t span;                /* header + rounded payload, used to roll back the bump pointer */
+} QuarantineArenaHdr;
 
-TrionPacket *tr_packet_create(Quarantine *q, const void *payload, size_t len)
+#define TR_QCHUNK_HDR TR_QUARANTINE_ROUNDUP(sizeof(QuarantineChunk))
+#define TR_QALLOC_HDR TR_QUARANTINE_ROUNDUP(sizeof(QuarantineArenaHdr))
+
+/* Slab pools: every slab is a TR_SLAB_SIZE-aligned block, so the owning slab of any pointer is
+   found by masking. Requests above the largest class get a dedicated aligned "large" slab. */
+#define TR_SLAB_SIZE      (64 * 1024)
+#define TR_SLAB_CLASSES   9             /* 16, 32, 64, ..., 4096 */
+#define TR_SLAB_MIN_BLOCK 16
+#define TR_SLAB_MIN_SHIFT 4             /* log2(TR_SLAB_MIN_BLOCK) */
+#define TR_SLAB_MAP_WORDS (TR_SLAB_SIZE / TR_SLAB_MIN_BLOCK / 64)
+#define TR_SLAB_MAX_BLOCK (TR_SLAB_MIN_BLOCK << (TR_SLAB_CLASSES - 1))
+#define TR_SLAB_LARGE     0xFFFFFFFFu
+#define TR_MAG_CAP        32            /* blocks cached per thread per size class */
+#define TR_MAG_BATCH      16            /* blocks moved per refill/flush */
+#define TR_TLS_QUARANTINES 4            /* slab quarantines a thread caches at once */
+
+typedef struct QuarantineSlab {
+    struct QuarantineSlab *prev;
+    struct QuarantineSlab *next;
+    struct Quarantine *owner;
+    uint32_t cls;               /* size class index or TR_SLAB_LARGE */
+    uint32_t full;              /* 1 when linked on the class full list */
+    size_t nblocks;             /* blocks in this slab */
+    size_t carve;               /* blocks handed out at least once (bump index); large: payload bytes */
+    size_t live;                /* blocks handed to magazines/callers */
+    void *free_list;            /* intrusive list of returned blocks */
+    uint64_t inuse[TR_SLAB_MAP_WORDS];  /* class slabs: bit per block, set while a caller holds it */
+} QuarantineSlab;
+
+#define TR_SLAB_HDR TR_QUARANTINE_ROUNDUP(sizeof(QuarantineSlab))
+#define TR_SLAB_OF(ptr) ((QuarantineSlab*)((uintptr_t)(ptr) & ~(uintptr_t)(TR_SLAB_SIZE - 1)))
+
+typedef struct Quarantine {
+    void **items;
+    size_t *sizes;  /* tracked: request size of items[i] */
+    size_t count;   /* live allocations (tracked/arena); blocks handed out of slabs (slab) */
+    size_t capacity;
+    size_t live_bytes;  /* payload bytes handed out (slab: includes blocks cached in magazines) */
+    int sealed;     /* once sealed, new allocations are rejected */
+    int mode;
+    QuarantineChunk *chunks;    /* arena: most recent chunk first, head is the bump target */
+    QuarantineChunk *spare;     /* arena: one emptied chunk kept around for reuse */
+    size_t chunk_size;          /* arena: usable bytes of a regular chunk */
+    size_t chunk_align;         /* arena: chunk size incl. header, a power of two; chunks are aligned to it */
+    QuarantineMap *chunk_map;   /* arena: every chunk_align-sized piece of a chunk -> the chunk */
+    uint64_t id;                /* slab: identity for thread caches (never reused) */
+    uint64_t epoch;             /* slab: bumped on reset so thread caches drop stale blocks */
+    QuarantineSlab *slab_partial[TR_SLAB_CLASSES];
+    QuarantineSlab *slab_full[TR_SLAB_CLASSES];
+    QuarantineSlab *slab_large;
+    QuarantineMap *slab_map;        /* slab: class slabs by base, looked up without the lock */
+    QuarantineMap *large_map;       /* slab: large slabs by base */
+    struct Quarantine *slab_next;   /* slab: link in the global slab-quarantine registry */
+    int node;                       /* NUMA node new chunks/slabs are bound to, -1 = default */
+    tr_mutex_t lock;
+} Quarantine;
+
+Quarantine *quarantine_create(size_t initial_capacity)
 {
-    if (!q) { tr_set_last_error_fmt("tr_packet_create: invalid quarantine"); return NULL; }
-    TrionPacket *p = (TrionPacket*)malloc(sizeof(TrionPacket));
-    if (!p) { tr_set_last_error_fmt("tr_packet_create: OOM"); return NULL; }
-    p->q = q;
-    if (len > 0 && payload) {
-        void *buf = quarantine_alloc(q, len);
-        if (!buf) { free(p); tr_set_last_error_fmt("tr_packet_create: quarantine_alloc failed"); free(p); return NULL; }
-        memcpy(buf, payload, len);
-        p->payload = buf;
-        p->length = len;
-    } else {
-        p->payload = NULL;
-        p->length = 0;
-    }
-    p->src_ip = p->dst_ip = 0;
-    p->src_port = p->dst_port = 0;
+    Quarantine *q = (Quarantine*)malloc(sizeof(Quarantine));
+    if (!q) { tr_set_last_error_fmt("quarantine_create: OOM"); return NULL; }
+    q->capacity = initial_capacity ? initial_capacity : 16;
+    q->count = 0;
+    q->sealed = 0;
+    q->mode = TR_QUARANTINE_TRACKED;
+    q->chunks = NULL;
+    q->spare = NULL;
+    q->chunk_size = 0;
+    q->chunk_align = 0;
+    q->chunk_map = NULL;
+    q->id = q->epoch = 0;
+    memset(q->slab_partial, 0, sizeof(q->slab_partial));
+    memset(q->slab_full, 0, sizeof(q->slab_full));
+    q->slab_large = NULL;
+    q->slab_map = q->large_map = NULL;
+    q->slab_next = NULL;
+    q->live_bytes = 0;
+    q->node = -1;
+    q->items = (void**)calloc(q->capacity, sizeof(void*));
+    q->sizes = (size_t*)calloc(q->capacity, sizeof(size_t));
+    if (!q->items || !q->sizes) { free(q->items); free(q->sizes); free(q); tr_set_last_error_fmt("quarantine_create: calloc failed"); return NULL; }
+    tr_mutex_init(&q->lock);
+    return q;
+}
+
+/* chunk_size (0 = default) is the size of a regular chunk including its header, rounded up to a
+   power of two of at least 4 KiB */
+Quarantine *quarantine_create_arena(size_t chunk_size)
+{
+    Quarantine *q = (Quarantine*)calloc(1, sizeof(Quarantine));
+    if (!q) { tr_set_last_error_fmt("quarantine_create_arena: OOM"); return NULL; }
+    q->items = NULL;
+    q->capacity = 0;
+    q->count = 0;
+    q->sealed = 0;
+    q->mode = TR_QUARANTINE_ARENA;
+    q->chunks = NULL;
+    q->spare = NULL;
+    size_t want = chunk_size ? chunk_size : TR_QUARANTINE_DEFAULT_CHUNK, align = 4096;
+    while (align < want && align <= SIZE_MAX / 2) align <<= 1;
+    q->chunk_align = align;
+    q->chunk_size = align - TR_QCHUNK_HDR;
+    q->node = -1;
+    tr_mutex_init(&q->lock);
+    return q;
+}
+
+/* Bind memory this quarantine obtains from now on to a NUMA node (-1: default placement):
+   arena chunks, slabs, and the whole pages of large tracked allocations. */
+void quarantine_set_node(Quarantine *q, int node)
+{
+    if (!q) return;
+    tr_mutex_lock(&q->lock);
+    q->node = node >= 0 && node < tr_numa_node_count() ? node : -1;
+    tr_mutex_unlock(&q->lock);
+}
+
+static int quarantine_grow_if_needed(Quarantine *q)
+{
+    if (q->count < q->capacity) return 0;
+    size_t newcap = q->capacity * 2;
+    void **n = (void**)realloc(q->items, newcap * sizeof(void*));
+    if (!n) { tr_set_last_error_fmt("quarantine_grow_if_needed: realloc failed"); return -1; }
+    q->items = n;
+    size_t *ns = (size_t*)realloc(q->sizes, newcap * sizeof(size_t));
+    if (!ns) { tr_set_last_error_fmt("quarantine_grow_if_needed: realloc failed"); return -1; }
+    q->sizes = ns;
+    q->capacity = newcap;
+    return 0;
+}
+
+/* live-byte accounting for q and the global gauge; caller holds q->lock */
+static void quarantine_account(Quarantine *q, int64_t delta)
+{
+    if (!delta) return;
+    q->live_bytes += (size_t)delta;
+    tr_metric_add(TR_M_QUARANTINE_LIVE_BYTES, delta);
+}
+
+static void *tr_aligned_alloc(size_t align, size_t size)
+{
+#ifdef _WIN32
+    return _aligned_malloc(size, align);
+#else
+    void *p = NULL;
+    if (posix_memalign(&p, align, size) != 0) return NULL;
     return p;
+#endif
 }
 
-void tr_packet_destroy(TrionPacket *p)
+static void tr_aligned_free(void *p)
 {
-    if (!p) return;
+#ifdef _WIN32
+    _aligned_free(p);
+#else
     free(p);
+#endif
+}
+
+/* arena helpers: caller holds q->lock */
+
+static void quarantine_chunk_unlink(Quarantine *q, QuarantineChunk *ch)
+{
+    if (ch->prev) ch->prev->next = ch->next; else q->chunks = ch->next;
+    if (ch->next) ch->next->prev = ch->prev;
+    ch->prev = ch->next = NULL;
+}
+
+static void quarantine_chunk_push(Quarantine *q, QuarantineChunk *ch)
+{
+    ch->prev = NULL;
+    ch->next = q->chunks;
+    if (q->chunks) q->chunks->prev = ch;
+    q->chunks = ch;
+}
+
+static void quarantine_chunk_free(Quarantine *q, QuarantineChunk *ch)
+{
+    for (size_t off = 0; off < TR_QCHUNK_HDR + ch->size; off += q->chunk_align) quarantine_map_del(q->chunk_map, (uintptr_t)ch + off);
+    tr_aligned_free(ch);
+}
+
+static QuarantineChunk *quarantine_chunk_new(Quarantine *q, size_t usable)
+{
+    if (q->spare && q->spare->size >= usable) {
+        QuarantineChunk *ch = q->spare;
+        q->spare = NULL;
+        ch->used = 0; ch->live = 0;
+        return ch;
+    }
+    size_t total = (TR_QCHUNK_HDR + usable + q->chunk_align - 1) & ~(q->chunk_align - 1);
+    if (total < usable) return NULL;
+    QuarantineChunk *ch = (QuarantineChunk*)tr_aligned_alloc(q->chunk_align, total);
+    if (!ch) return NULL;
+    for (size_t off = 0; off < total; off += q->chunk_align) {
+        if (quarantine_map_put(&q->chunk_map, (uintptr_t)ch + off, ch, 0) != 0) {
+            while (off) { off -= q->chunk_align; quarantine_map_del(q->chunk_map, (uintptr_t)ch + off); }
+            tr_aligned_free(ch);
+            return NULL;
+        }
+    }
+    if (q->node >= 0) tr_numa_bind(ch, total, q->node);
+    ch->prev = ch->next = NULL;
+    ch->owner = q;
+    ch->size = total - TR_QCHUNK_HDR;
+    ch->used = 0;
+    ch->live = 0;
+    return ch;
+}
+
+static void *quarantine_arena_alloc(Quarantine *q, size_t size)
+{
+    size_t span = TR_QALLOC_HDR + TR_QUARANTINE_ROUNDUP(size);
+    if (span < size) { tr_set_last_error_fmt("quarantine_alloc: size overflow"); return NULL; }
+    QuarantineChunk *ch = q->chunks;
+    if (!ch || ch->size - ch->used < span) {
+        if (span > q->chunk_size / 2) {
+            /* oversized request: give it a dedicated chunk and keep bumping in the current head */
+            QuarantineChunk *big = quarantine_chunk_new(q, span);
+            if (!big) { tr_set_last_error_fmt("quarantine_alloc: arena chunk malloc failed"); return NULL; }
+            if (ch) {
+                big->prev = ch; big->next = ch->next;
+                if (ch->next) ch->next->prev = big;
+                ch->next = big;
+            } else {
+                quarantine_chunk_push(q, big);
+            }
+            ch = big;
+        } else {
+            ch = quarantine_chunk_new(q, q->chunk_size);
+            if (!ch) { tr_set_last_error_fmt("quarantine_alloc: arena chunk malloc failed"); return NULL; }
+            quarantine_chunk_push(q, ch);
+        }
+    }
+    char *base = (char*)ch + TR_QCHUNK_HDR + ch->used;
+    QuarantineArenaHdr *h = (QuarantineArenaHdr*)base;
+    h->chunk = ch;
+    h->span = span;
+    ch->used += span;
+    ch->live++;
+    q->count++;
+    quarantine_account(q, (int64_t)(span - TR_QALLOC_HDR));
+    return base + TR_QALLOC_HDR;
+}
+
+/* chunk whose carved range holds the allocation ptr, or NULL; the chunk is found by looking up
+   the aligned piece ptr falls in, so a foreign pointer is rejected before anything around it is
+   dereferenced */
+static QuarantineChunk *quarantine_arena_chunk_of(Quarantine *q, const void *ptr)
+{
+    uintptr_t p = (uintptr_t)ptr;
+    QuarantineChunk *ch = (QuarantineChunk*)quarantine_map_get(q->chunk_map, p & ~(uintptr_t)(q->chunk_align - 1));
+    if (!ch) return NULL;
+    uintptr_t lo = (uintptr_t)ch + TR_QCHUNK_HDR;
+    if (p < lo + TR_QALLOC_HDR || p >= lo + ch->used || (p - lo) % TR_QUARANTINE_ALIGN) return NULL;
+    return ch;
+}
+
+static int quarantine_arena_free(Quarantine *q, void *ptr)
+{
+    QuarantineChunk *ch = quarantine_arena_chunk_of(q, ptr);
+    QuarantineArenaHdr *h = (QuarantineArenaHdr*)((char*)ptr - TR_QALLOC_HDR);
+    if (!ch || h->chunk != ch || h->span < TR_QALLOC_HDR || h->span > (size_t)((char*)ch + TR_QCHUNK_HDR + ch->used - (char*)h)) {
+        tr_set_last_error_fmt("quarantine_free: pointer not owned by arena (or double free)");
+        return -1;
+    }
+    h->chunk = NULL;
+    ch->live--;
+    q->count--;
+    quarantine_account(q, -(int64_t)(h->span - TR_QALLOC_HDR));
+    /* last allocation in the chunk: roll the bump pointer back so LIFO patterns reuse memory */
+    if ((char*)h + h->span == (char*)ch + TR_QCHUNK_HDR + ch->used) ch->used -= h->span;
+    if (ch->live == 0) {
+        ch->used = 0;
+        if (ch != q->chunks) {
+            quarantine_chunk_unlink(q, ch);
+            if (!q->spare && ch->size == q->chunk_size) q->spare = ch;
+            else quarantine_chunk_free(q, ch);
+        }
+    }
+    return 0;
+}
+
+/* drop every chunk; when keep_one is set the head chunk is recycled as the spare */
+static void quarantine_arena_release_all(Quarantine *q, int keep_one)
+{
+    QuarantineChunk *ch = q->chunks;
+    while (ch) {
+        QuarantineChunk *next = ch->next;
+        if (keep_one && !q->spare && ch->size == q->chunk_size) {
+            ch->prev = ch->next = NULL;
+            ch->used = 0; ch->live = 0;
+            q->spare = ch;
+        } else {
+            quarantine_chunk_free(q, ch);
+        }
+        ch = next;
+    }
+    q->chunks = NULL;
+    if (!keep_one && q->spare) { quarantine_chunk_free(q, q->spare); q->spare = NULL; }
+    q->count = 0;
+    quarantine_account(q, -(int64_t)q->live_bytes);
+}
+
+/* ---- slab pools + per-thread magazines ---- */
+
+typedef struct {
+    void *items[TR_MAG_CAP];
+    uint32_t n;
+} QuarantineMagazine;
+
+typedef struct {
+    uint64_t qid;               /* 0 = slot unused */
+    uint64_t epoch;
+    Quarantine *q;              /* only dereferenced after validating qid against the registry */
+    QuarantineMagazine mags[TR_SLAB_CLASSES];
+} QuarantineTlsCache;
+
+static TR_THREAD_LOCAL QuarantineTlsCache g_q_tls[TR_TLS_QUARANTINES];
+static TR_THREAD_LOCAL uint32_t g_q_tls_victim = 0;
+
+/* registry of live slab quarantines: lets a thread safely flush a cache slot whose quarantine
+   may already be gone (eviction, thread exit). Only touched on those slow paths. */
+static tr_mutex_t g_slab_registry_lock;
+static tr_once_t g_slab_registry_once = TR_ONCE_INIT;
+static Quarantine *g_slab_registry = NULL;
+static uint64_t g_slab_next_id = 0;
+
+static uint32_t quarantine_size_class(size_t size)
+{
+    size_t s = (size - 1) / TR_SLAB_MIN_BLOCK;
+    uint32_t cls = 0;
+    while (s) { s >>= 1; cls++; }
+    return cls;
+}
+
+static void slab_list_unlink(QuarantineSlab **head, QuarantineSlab *s)
+{
+    if (s->prev) s->prev->next = s->next; else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->prev = s->next = NULL;
+}
+
+static void slab_list_push(QuarantineSlab **head, QuarantineSlab *s)
+{
+    s->prev = NULL;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+/* caller holds q->lock */
+static QuarantineSlab *quarantine_slab_new(Quarantine *q, uint32_t cls)
+{
+    QuarantineSlab *s = (QuarantineSlab*)tr_aligned_alloc(TR_SLAB_SIZE, TR_SLAB_SIZE);
+    if (!s) return NULL;
+    if (q->node >= 0) tr_numa_bind(s, TR_SLAB_SIZE, q->node);
+    s->prev = s->next = NULL;
+    s->owner = q;
+    s->cls = cls;
+    s->full = 0;
+    s->nblocks = (TR_SLAB_SIZE - TR_SLAB_HDR) / ((size_t)TR_SLAB_MIN_BLOCK << cls);
+    s->carve = 0;
+    s->live = 0;
+    s->free_list = NULL;
+    memset(s->inuse, 0, sizeof(s->inuse));
+    /* published only once the header is complete: frees look it up without the lock */
+    if (quarantine_map_put(&q->slab_map, (uintptr_t)s, s, 1) != 0) { tr_aligned_free(s); return NULL; }
+    return s;
+}
+
+/* caller holds q->lock; nothing can be handed out of s any more */
+static void quarantine_slab_drop(Quarantine *q, QuarantineSlab *s)
+{
+    slab_list_unlink(&q->slab_partial[s->cls], s);
+    quarantine_map_del(q->slab_map, (uintptr_t)s);
+    tr_aligned_free(s);
+}
+
+/* move up to TR_MAG_BATCH blocks of class `cls` into magazine m; caller holds q->lock */
+static void quarantine_slab_refill(Quarantine *q, QuarantineMagazine *m, uint32_t cls)
+{
+    size_t bs = (size_t)TR_SLAB_MIN_BLOCK << cls;
+    while (m->n < TR_MAG_BATCH) {
+        QuarantineSlab *s = q->slab_partial[cls];
+        if (!s) {
+            s = quarantine_slab_new(q, cls);
+            if (!s) return;
+            slab_list_push(&q->slab_partial[cls], s);
+        }
+        while (m->n < TR_MAG_BATCH && (s->free_list || s->carve < s->nblocks)) {
+            void *b;
+            if (s->free_list) {
+                b = s->free_list;
+                s->free_list = *(void**)b;
+            } else {
+                b = (char*)s + TR_SLAB_HDR + s->carve * bs;
+                s->carve++;
+            }
+            s->live++;
+            q->count++;
+            m->items[m->n++] = b;
+            quarantine_account(q, (int64_t)bs);
+        }
+        if (!s->free_list && s->carve == s->nblocks) {
+            slab_list_unlink(&q->slab_partial[cls], s);
+            slab_list_push(&q->slab_full[cls], s);
+            s->full = 1;
+        }
+    }
+}
+
+/* return one block to its slab; once sealed a slab that empties goes straight back to the OS.
+   b comes from a magazine, so it was validated when freed (or never left the quarantine).
+   caller holds q->lock */
+static void quarantine_slab_release_block(Quarantine *q, void *b)
+{
+    QuarantineSlab *s = TR_SLAB_OF(b);
+    *(void**)b = s->free_list;
+    s->free_list = b;
+    s->live--;
+    q->count--;
+    quarantine_account(q, -(int64_t)((size_t)TR_SLAB_MIN_BLOCK << s->cls));
+    if (s->full) {
+        slab_list_unlink(&q->slab_full[s->cls], s);
+        slab_list_push(&q->slab_partial[s->cls], s);
+        s->full = 0;
+    }
+    if (q->sealed && s->live == 0) quarantine_slab_drop(q, s);
+}
+
+/* caller holds q->lock */
+static void quarantine_slab_flush_cache(Quarantine *q, QuarantineTlsCache *e)
+{
+    for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) {
+        QuarantineMagazine *m = &e->mags[c];
+        if (e->epoch == q->epoch) {
+            for (uint32_t i = 0; i < m->n; ++i) quarantine_slab_release_block(q, m->items[i]);
+        }
+        m->n = 0;
+    }
+}
+
+static void quarantine_slab_free_all(Quarantine *q)
+{
+    for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) {
+        QuarantineSlab *lists[2] = { q->slab_partial[c], q->slab_full[c] };
+        for (int l = 0; l < 2; ++l) {
+            QuarantineSlab *s = lists[l];
+            while (s) { QuarantineSlab *n = s->next; tr_aligned_free(s); s = n; }
+        }
+        q->slab_partial[c] = q->slab_full[c] = NULL;
+    }
+    QuarantineSlab *s = q->slab_large;
+    while (s) { QuarantineSlab *n = s->next; tr_aligned_free(s); s = n; }
+    q->slab_large = NULL;
+    quarantine_map_clear(q->slab_map);
+    quarantine_map_clear(q->large_map);
+    q->count = 0;
+    quarantine_account(q, -(int64_t)q->live_bytes);
+}
+
+/* flush a cache slot back to its quarantine if that quarantine is still alive, then clear it */
+static void quarantine_tls_evict(QuarantineTlsCache *e)
+{
+    if (!e->qid) return;
+    tr_mutex_lock(&g_slab_registry_lock);
+    for (Quarantine *r = g_slab_registry; r; r = r->slab_next) {
+        if (r == e->q && r->id == e->qid) {
+            tr_mutex_lock(&r->lock);
+            quarantine_slab_flush_cache(r, e);
+            tr_mutex_unlock(&r->lock);
+            break;
+        }
+    }
+    tr_mutex_unlock(&g_slab_registry_lock);
+    for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) e->mags[c].n = 0;
+    e->qid = 0;
+    e->q = NULL;
+}
+
+#ifndef _WIN32
+static pthread_key_t g_q_tls_key;
+static pthread_once_t g_q_tls_key_once = PTHREAD_ONCE_INIT;
+
+static void quarantine_tls_thread_exit(void *unused)
+{
+    (void)unused;
+    for (int i = 0; i < TR_TLS_QUARANTINES; ++i) quarantine_tls_evict(&g_q_tls[i]);
+}
+
+static void quarantine_tls_key_init(void) { pthread_key_create(&g_q_tls_key, quarantine_tls_thread_exit); }
+#endif
+
+static QuarantineTlsCache *quarantine_tls_lookup(Quarantine *q)
+{
+    uint64_t epoch = tr_atomic_load_acquire(&q->epoch);
+    QuarantineTlsCache *empty = NULL;
+    for (int i = 0; i < TR_TLS_QUARANTINES; ++i) {
+        QuarantineTlsCache *e = &g_q_tls[i];
+        if (e->qid == q->id) {
+            if (e->epoch != epoch) {
+                /* quarantine was reset: cached blocks point into released slabs */
+                for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) e->mags[c].n = 0;
+                e->epoch = epoch;
+            }
+            return e;
+        }
+        if (!empty && e->qid == 0) empty = e;
+    }
+    if (!empty) {
+        empty = &g_q_tls[g_q_tls_victim++ % TR_TLS_QUARANTINES];
+        quarantine_tls_evict(empty);
+    }
+#ifndef _WIN32
+    pthread_once(&g_q_tls_key_once, quarantine_tls_key_init);
+    if (!pthread_getspecific(g_q_tls_key)) pthread_setspecific(g_q_tls_key, (void*)g_q_tls);
+#endif
+    for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) empty->mags[c].n = 0;
+    empty->qid = q->id;
+    empty->q = q;
+    empty->epoch = epoch;
+    return empty;
+}
+
+static void quarantine_slab_registry_init(void) { tr_mutex_init(&g_slab_registry_lock); }
+
+Quarantine *quarantine_create_slab(void)
+{
+    Quarantine *q = (Quarantine*)calloc(1, sizeof(Quarantine));
+    if (!q) { tr_set_last_error_fmt("quarantine_create_slab: OOM"); return NULL; }
+    q->mode = TR_QUARANTINE_SLAB;
+    q->node = -1;
+    tr_mutex_init(&q->lock);
+    tr_once(&g_slab_registry_once, quarantine_slab_registry_init);
+    tr_mutex_lock(&g_slab_registry_lock);
+    q->id = ++g_slab_next_id;
+    q->slab_next = g_slab_registry;
+    g_slab_registry = q;
+    tr_mutex_unlock(&g_slab_registry_lock);
+    return q;
+}
+
+static void *quarantine_slab_alloc(Quarantine *q, size_t size)
+{
+    if (tr_atomic_load_acquire(&q->sealed)) { tr_set_last_error_fmt("quarantine_alloc: quarantined sealed"); return NULL; }
+    if (size > TR_SLAB_MAX_BLOCK) {
+        size_t total = TR_SLAB_HDR + size;
+        if (total < size) { tr_set_last_error_fmt("quarantine_alloc: size overflow"); return NULL; }
+        QuarantineSlab *s = (QuarantineSlab*)tr_aligned_alloc(TR_SLAB_SIZE, total);
+        if (!s) { tr_set_last_error_fmt("quarantine_alloc: large slab alloc failed"); return NULL; }
+        if (q->node >= 0) tr_numa_bind(s, total, q->node);
+        memset(s, 0, sizeof(*s));
+        s->owner = q;
+        s->cls = TR_SLAB_LARGE;
+        s->live = 1;
+        s->carve = size;
+        tr_mutex_lock(&q->lock);
+        if (quarantine_map_put(&q->large_map, (uintptr_t)s, s, 0) != 0) {
+            tr_mutex_unlock(&q->lock);
+            tr_aligned_free(s);
+            tr_set_last_error_fmt("quarantine_alloc: large slab alloc failed");
+            return NULL;
+        }
+        slab_list_push(&q->slab_large, s);
+        q->count++;
+        quarantine_account(q, (int64_t)size);
+        tr_mutex_unlock(&q->lock);
+        return (char*)s + TR_SLAB_HDR;
+    }
+    uint32_t cls = quarantine_size_class(size);
+    QuarantineMagazine *m = &quarantine_tls_lookup(q)->mags[cls];
+    if (m->n == 0) {
+        tr_mutex_lock(&q->lock);
+        if (q->sealed) { tr_mutex_unlock(&q->lock); tr_set_last_error_fmt("quarantine_alloc: quarantined sealed"); return NULL; }
+        quarantine_slab_refill(q, m, cls);
+        tr_mutex_unlock(&q->lock);
+        if (m->n == 0) { tr_set_last_error_fmt("quarantine_alloc: slab alloc failed"); return NULL; }
+    }
+    void *b = m->items[--m->n];
+    QuarantineSlab *s = TR_SLAB_OF(b);
+    size_t idx = (size_t)((char*)b - (char*)s - TR_SLAB_HDR) >> (cls + TR_SLAB_MIN_SHIFT);
+    tr_atomic_fetch_or(&s->inuse[idx >> 6], (uint64_t)1 << (idx & 63));
+    return b;
+}
+
+/* clear ptr's in-use bit: 0, or -1 when ptr is not on a block boundary of s, -2 when the block
+   is not handed out (double free). The atomic clear lets only one of two racing frees win. */
+static int quarantine_slab_unmark(QuarantineSlab *s, void *ptr)
+{
+    size_t off = (size_t)((char*)ptr - (char*)s);
+    if (off < TR_SLAB_HDR) return -1;
+    off -= TR_SLAB_HDR;
+    size_t idx = off >> (s->cls + TR_SLAB_MIN_SHIFT);
+    if ((off & (((size_t)TR_SLAB_MIN_BLOCK << s->cls) - 1)) || idx >= s->nblocks) return -1;
+    uint64_t bit = (uint64_t)1 << (idx & 63);
+    return (tr_atomic_fetch_and(&s->inuse[idx >> 6], ~bit) & bit) ? 0 : -2;
+}
+
+/* The slab is looked up by its base before its header is read, so foreign pointers (malloc'd,
+   another quarantine's, interior, already released) fail with -1 instead of faulting. */
+static int quarantine_slab_free(Quarantine *q, void *ptr)
+{
+    QuarantineSlab *s = (QuarantineSlab*)quarantine_map_get(tr_atomic_load_acquire(&q->slab_map), (uintptr_t)TR_SLAB_OF(ptr));
+    if (!s) {
+        tr_mutex_lock(&q->lock);
+        s = (QuarantineSlab*)quarantine_map_get(q->large_map, (uintptr_t)TR_SLAB_OF(ptr));
+        if (!s || (char*)ptr != (char*)s + TR_SLAB_HDR) {
+            tr_mutex_unlock(&q->lock);
+            tr_set_last_error_fmt("quarantine_free: pointer not owned by slab quarantine (or double free)");
+            return -1;
+        }
+        quarantine_map_del(q->large_map, (uintptr_t)s);
+        slab_list_unlink(&q->slab_large, s);
+        q->count--;
+        quarantine_account(q, -(int64_t)s->carve);
+        tr_mutex_unlock(&q->lock);
+        tr_aligned_free(s);
+        return 0;
+    }
+    int bad = quarantine_slab_unmark(s, ptr);
+    if (bad) {
+        tr_set_last_error_fmt(bad == -1 ? "quarantine_free: pointer is not a slab block" : "quarantine_free: double free");
+        return -1;
+    }
+    QuarantineTlsCache *e = quarantine_tls_lookup(q);
+    if (tr_atomic_load_acquire(&q->sealed)) {
+        /* nothing can be allocated again: hand this thread's cached blocks back with it */
+        tr_mutex_lock(&q->lock);
+        quarantine_slab_flush_cache(q, e);
+        quarantine_slab_release_block(q, ptr);
+        tr_mutex_unlock(&q->lock);
+        return 0;
+    }
+    QuarantineMagazine *m = &e->mags[s->cls];
+    if (m->n == TR_MAG_CAP) {
+        /* magazine full: hand the oldest batch back to the shared slabs */
+        tr_mutex_lock(&q->lock);
+        for (uint32_t i = 0; i < TR_MAG_BATCH; ++i) quarantine_slab_release_block(q, m->items[i]);
+        tr_mutex_unlock(&q->lock);
+        memmove(m->items, m->items + TR_MAG_BATCH, (TR_MAG_CAP - TR_MAG_BATCH) * sizeof(void*));
+        m->n -= TR_MAG_BATCH;
+    }
+    m->items[m->n++] = ptr;
+    return 0;
+}
+
+/* after sealing no allocation can be served again, so slabs without live blocks are returned
+   to the OS right away; the calling thread's magazine is flushed first so its blocks count.
+   Blocks cached by other threads come back when those threads next free into q, evict the
+   cache slot or exit, and release_block frees each slab as it empties. */
+static void quarantine_slab_seal(Quarantine *q)
+{
+    for (int i = 0; i < TR_TLS_QUARANTINES; ++i) {
+        if (g_q_tls[i].qid == q->id) {
+            tr_mutex_lock(&q->lock);
+            quarantine_slab_flush_cache(q, &g_q_tls[i]);
+            tr_mutex_unlock(&q->lock);
+        }
+    }
+    tr_mutex_lock(&q->lock);
+    for (uint32_t c = 0; c < TR_SLAB_CLASSES; ++c) {
+        QuarantineSlab *s = q->slab_partial[c];
+        while (s) {
+            QuarantineSlab *n = s->next;
+            if (s->live == 0) quarantine_slab_drop(q, s);
+            s = n;
+        }
+    }
+    tr_mutex_unlock(&q->lock);
+}
+
+void *quarantine_alloc(Quarantine *q, size_t size)
+{
+    if (!q || size == 0) { tr_set_last_error_fmt("quarantine_alloc: invalid args"); return NULL; }
+    if (q->mode == TR_QUARANTINE_SLAB) return quarantine_slab_alloc(q, size);
+    tr_mutex_lock(&q->lock);
+    if (q->sealed) {
+        tr_mutex_unlock(&q->lock);
+        tr_set_last_error_fmt("quarantine_alloc: quarantined sealed");
+        return NULL;
+    }
+    if (q->mode == TR_QUARANTINE_ARENA) {
+        void *ap = quarantine_arena_alloc(q, size);
+        tr_mutex_unlock(&q->lock);
+        return ap;
+    }
+    if (quarantine_grow_if_needed(q) != 0) {
+        tr_mutex_unlock(&q->lock);
+        return NULL;
+    }
+    void *p = malloc(size);
+    if (!p) { tr_mutex_unlock(&q->lock); tr_set_last_error_fmt("quarantine_alloc: malloc failed"); return NULL; }
+    if (q->node >= 0) tr_numa_bind(p, size, q->node);   /* only whole pages move */
+    q->sizes[q->count] = size;
+    q->items[q->count++] = p;
+    quarantine_account(q, (int64_t)size);
+    tr_mutex_unlock(&q->lock);
+    return p;
+}
+
+int quarantine_free(Quarantine *q, void *ptr)
+{
+    if (!q || !ptr) { tr_set_last_error_fmt("quarantine_free: invalid args"); return -1; }
+    if (q->mode == TR_QUARANTINE_SLAB) return quarantine_slab_free(q, ptr);
+    tr_mutex_lock(&q->lock);
+    if (q->mode == TR_QUARANTINE_ARENA) {
+        int rc = quarantine_arena_free(q, ptr);
+        tr_mutex_unlock(&q->lock);
+        return rc;
+    }
+    for (size_t i = 0; i < q->count; ++i) {
+        if (q->items[i] == ptr) {
+            free(ptr);
+            quarantine_account(q, -(int64_t)q->sizes[i]);
+            q->items[i] = q->items[q->count - 1];
+            q->sizes[i] = q->sizes[q->count - 1];
+            q->items[q->count - 1] = NULL;
+            q->count--;
+            tr_mutex_unlock(&q->lock);
+            return 0;
+        }
+    }
+    tr_mutex_unlock(&q->lock);
+    tr_set_last_error_fmt("quarantine_free: pointer not found");
+    return -1;
+}
+
+/* Release every allocation owned by the quarantine in one step. The quarantine itself stays
+   usable (unless sealed); arena mode keeps one chunk cached so the next burst avoids malloc. */
+void quarantine_reset(Quarantine *q)
+{
+    if (!q) return;
+    tr_mutex_lock(&q->lock);
+    if (q->mode == TR_QUARANTINE_ARENA) {
+        quarantine_arena_release_all(q, 1);
+    } else if (q->mode == TR_QUARANTINE_SLAB) {
+        /* retire every thread cache before the slabs go, so no magazine hands out a freed block */
+        tr_atomic_fetch_add(&q->epoch, (uint64_t)1);
+        quarantine_slab_free_all(q);
+    } else {
+        for (size_t i = 0; i < q->count; ++i) {
+            if (q->items[i]) { free(q->items[i]); q->items[i] = NULL; }
+        }
+        q->count = 0;
+        quarantine_account(q, -(int64_t)q->live_bytes);
+    }
+    tr_mutex_unlock(&q->lock);
+}
+
+void quarantine_seal(Quarantine *q)
+{
+    if (!q) return;
+    tr_mutex_lock(&q->lock);
+    tr_atomic_store_release(&q->sealed, 1);
+    tr_mutex_unlock(&q->lock);
+    if (q->mode == TR_QUARANTINE_SLAB) quarantine_slab_seal(q);
+}
+
+void quarantine_destroy(Quarantine *q)
+{
+    if (!q) return;
+    if (q->mode == TR_QUARANTINE_SLAB) {
+        /* unregister first so no other thread's eviction can reach q while it is torn down */
+        tr_mutex_lock(&g_slab_registry_lock);
+        Quarantine **pp = &g_slab_registry;
+        while (*pp && *pp != q) pp = &(*pp)->slab_next;
+        if (*pp) *pp = q->slab_next;
+        tr_mutex_unlock(&g_slab_registry_lock);
+        for (int i = 0; i < TR_TLS_QUARANTINES; ++i) {
+            if (g_q_tls[i].qid == q->id) { g_q_tls[i].qid = 0; g_q_tls[i].q = NULL; }
+        }
+    }
+    tr_mutex_lock(&q->lock);
+    if (q->mode == TR_QUARANTINE_ARENA) {
+        quarantine_arena_release_all(q, 0);
+        quarantine_map_free(q->chunk_map);
+    } else if (q->mode == TR_QUARANTINE_SLAB) {
+        quarantine_slab_free_all(q);
+        quarantine_map_free(q->slab_map);
+        quarantine_map_free(q->large_map);
+    }
+    for (size_t i = 0; i < q->count; ++i) {
+        if (q->items[i]) free(q->items[i]);
+    }
+    quarantine_account(q, -(int64_t)q->live_bytes);
+    free(q->items);
+    free(q->sizes);
+    q->items = NULL;
+    q->sizes = NULL;
+    q->count = 0;
+    q->capacity = 0;
+    tr_mutex_unlock(&q->lock);
+    tr_mutex_destroy(&q->lock);
+    free(q);
+}
+
+/* Channel kinds:
+   - TR_CHANNEL_LOCKED: mutex + condition variables (same design as before, default)
+   - TR_CHANNEL_SPSC:   lock-free ring for exactly one producer and one consumer thread
+   - TR_CHANNEL_MPSC:   lock-free ring (per-slot sequence numbers) for many producers, one consumer
+   Ring kinds round capacity up to a power of two and only touch the mutex/condvars when a
+   side actually has to sleep because the ring is empty or full.
+*/
+#define TR_CHANNEL_LOCKED 0
+#define TR_CHANNEL_SPSC   1
+#define TR_CHANNEL_MPSC   2
+
+#define TR_CHANNEL_SPIN 64      /* lock-free retries before a blocking call parks */
+
+typedef struct {
+    uint64_t seq;
+    void *item;
+} ChannelRingSlot;
+
+typedef struct {
+    TR_ALIGNED(TR_CACHELINE) uint64_t tail;     /* producer index */
+    uint64_t head_cache;                        /* SPSC: producer's last view of head */
+    TR_ALIGNED(TR_CACHELINE) uint64_t head;     /* consumer index */
+    uint64_t tail_cache;                        /* SPSC: consumer's last view of tail */
+    TR_ALIGNED(TR_CACHELINE) uint64_t recv_waiters;
+    uint64_t send_waiters;
+    uint64_t mask;
+    void **items;               /* SPSC storage */
+    ChannelRingSlot *slots;     /* MPSC storage */
+} ChannelRing;
+
+typedef struct Channel {
+    void **buffer;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    size_t count;
+    tr_mutex_t lock;
+    tr_cond_t not_empty;
+    tr_cond_t not_full;
+    int closed; /* once closed, recv returns 0 items and send fails */
+    int kind;
+    ChannelRing *ring;          /* NULL for TR_CHANNEL_LOCKED */
+    /* metrics, all guarded by lock (ring kinds only take it on their blocking paths) */
+    uint64_t id;
+    char label[32];             /* channel_set_name; capsule inboxes carry the capsule name */
+    uint64_t sent;              /* locked kind only; rings report their tail/head indices */
+    uint64_t received;
+    uint64_t send_waits;
+    uint64_t send_blocked_ns;
+    uint64_t send_timeouts;
+    uint64_t recv_timeouts;
+    struct Channel *m_prev;     /* g_metric_channels */
+    struct Channel *m_next;
+    uint32_t pins;              /* async syscall completions still being delivered here */
+} Channel;
+
+Channel *channel_create_ex(size_t capacity, int kind)
+{
+    if (capacity == 0) { tr_set_last_error_fmt("channel_create: invalid capacity"); return NULL; }
+    if (kind != TR_CHANNEL_LOCKED && kind != TR_CHANNEL_SPSC && kind != TR_CHANNEL_MPSC) {
+        tr_set_last_error_fmt("channel_create: unknown kind %d", kind);
+        return NULL;
+    }
+    Channel *c = (Channel*)malloc(sizeof(Channel));
+    if (!c) { tr_set_last_error_fmt("channel_create: OOM"); return NULL; }
+    c->buffer = NULL;
+    c->ring = NULL;
+    c->kind = kind;
+    if (kind == TR_CHANNEL_LOCKED) {
+        c->buffer = (void**)calloc(capacity, sizeof(void*));
+        if (!c->buffer) { free(c); tr_set_last_error_fmt("channel_create: calloc failed"); return NULL; }
+    } else {
+        size_t cap = 1;
+        while (cap < capacity) cap <<= 1;
+        capacity = cap;
+        ChannelRing *r = (ChannelRing*)tr_aligned_alloc(TR_CACHELINE, sizeof(ChannelRing));
+        if (!r) { free(c); tr_set_last_error_fmt("channel_create: ring OOM"); return NULL; }
+        memset(r, 0, sizeof(*r));
+        r->mask = cap - 1;
+        if (kind == TR_CHANNEL_SPSC) {
+            r->items = (void**)calloc(cap, sizeof(void*));
+        } else {
+            r->slots = (ChannelRingSlot*)calloc(cap, sizeof(ChannelRingSlot));
+            if (r->slots) for (size_t i = 0; i < cap; ++i) r->slots[i].seq = i;
+        }
+        if (!r->items && !r->slots) { tr_aligned_free(r); free(c); tr_set_last_error_fmt("channel_create: ring calloc failed"); return NULL; }
+        c->ring = r;
+    }
+    c->capacity = capacity;
+    c->head = c->tail = c->count = 0;
+    c->closed = 0;
+    c->label[0] = '\0';
+    c->sent = c->received = 0;
+    c->send_waits = c->send_blocked_ns = c->send_timeouts = c->recv_timeouts = 0;
+    c->pins = 0;
+    tr_mutex_init(&c->lock);
+    tr_cond_init(&c->not_empty);
+    tr_cond_init(&c->not_full);
+    tr_metrics_lock();
+    c->id = ++g_metric_channel_next_id;
+    c->m_prev = NULL;
+    c->m_next = g_metric_channels;
+    if (g_metric_channels) g_metric_channels->m_prev = c;
+    g_metric_channels = c;
+    tr_metrics_unlock();
+    return c;
+}
+
+Channel *channel_create(size_t capacity)
+{
+    return channel_create_ex(capacity, TR_CHANNEL_LOCKED);
+}
+
+void channel_close(Channel *c)
+{
+    if (!c) return;
+    tr_mutex_lock(&c->lock);
+    tr_atomic_store_release(&c->closed, 1);
+    tr_cond_notify_all(&c->not_empty);
+    tr_cond_notify_all(&c->not_full);
+    tr_mutex_unlock(&c->lock);
+}
+
+/* label reported by tr_metrics_snapshot (truncated to 31 bytes) */
+void channel_set_name(Channel *c, const char *name)
+{
+    if (!c) return;
+    tr_mutex_lock(&c->lock);
+    snprintf(c->label, sizeof(c->label), "%s", name ? name : "");
+    tr_mutex_unlock(&c->lock);
+}
+
+/* Re-home a channel nobody else uses yet (a new capsule inbox) onto a NUMA node: the ring
+   indices and the slot array move to pages bound there. */
+static void channel_place(Channel *c, int node)
+{
+    if (!c || node < 0 || tr_numa_node_count() < 2) return;
+    if (c->ring) {
+        size_t cap = (size_t)c->ring->mask + 1;
+        if (c->ring->items) c->ring->items = (void**)tr_numa_move(c->ring->items, cap * sizeof(void*), node);
+        if (c->ring->slots) c->ring->slots = (ChannelRingSlot*)tr_numa_move(c->ring->slots, cap * sizeof(ChannelRingSlot), node);
+        c->ring = (ChannelRing*)tr_numa_move(c->ring, sizeof(ChannelRing), node);
+    } else {
+        c->buffer = (void**)tr_numa_move(c->buffer, c->capacity * sizeof(void*), node);
+    }
+}
+
+void channel_destroy(Channel *c)
+{
+    if (!c) return;
+    if (tr_atomic_load_acquire(&c->pins)) {
+        /* a completion for a request that was never reaped: closing makes its delivery give up */
+        channel_close(c);
+        while (tr_atomic_load_acquire(&c->pins)) {
+#ifdef _WIN32
+            SwitchToThread();
+#else
+            sched_yield();
+#endif
+        }
+    }
+    tr_metrics_lock();
+    if (c->m_prev) c->m_prev->m_next = c->m_next; else g_metric_channels = c->m_next;
+    if (c->m_next) c->m_next->m_prev = c->m_prev;
+    tr_metrics_unlock();
+    free(c->buffer);
+    if (c->ring) {
+        free(c->ring->items);
+        free(c->ring->slots);
+        tr_aligned_free(c->ring);
+    }
+    tr_cond_destroy(&c->not_empty);
+    tr_cond_destroy(&c->not_full);
+    tr_mutex_destroy(&c->lock);
+    free(c);
+}
+
+/* ---- metrics hooks: blocking paths only, caller holds c->lock ---- */
+
+/* returns the start of a blocked send (1 when timing is off; never 0, so callers can use it as
+   a "have waited" flag) */
+static uint64_t channel_send_block_begin(Channel *c)
+{
+    c->send_waits++;
+    tr_metric_add(TR_M_CHANNEL_SEND_WAITS, 1);
+    TR_TRACE('B', "channel.send_blocked", c->label, "channel", c->id);
+    uint64_t t = tr_metric_clock();
+    return t ? t : 1;
+}
+
+static void channel_send_block_end(Channel *c, uint64_t t0)
+{
+    TR_TRACE('E', "channel.send_blocked", NULL, NULL, 0);
+    if (t0 <= 1) return;
+    uint64_t ns = tr_metric_elapsed(t0);
+    c->send_blocked_ns += ns;
+    tr_hist_record(TR_H_CHANNEL_SEND_BLOCKED, ns);
+}
+
+/* a receiver is about to sleep on an empty channel (tracing only); call with c->lock held */
+static int channel_recv_block_begin(Channel *c)
+{
+    TR_TRACE('B', "channel.recv_blocked", c->label, "channel", c->id);
+    return 1;
+}
+
+static void channel_recv_block_end(void)
+{
+    TR_TRACE('E', "channel.recv_blocked", NULL, NULL, 0);
+}
+
+static void channel_note_timeout(Channel *c, int send)
+{
+    if (send) { c->send_timeouts++; tr_metric_add(TR_M_CHANNEL_SEND_TIMEOUTS, 1); }
+    else { c->recv_timeouts++; tr_metric_add(TR_M_CHANNEL_RECV_TIMEOUTS, 1); }
+}
+
+/* ---- lock-free ring paths ---- */
+
+/* returns 1 when the item was enqueued, 0 when the ring is full */
+static int channel_ring_try_push(Channel *c, void *item)
+{
+    ChannelRing *r = c->ring;
+    if (c->kind == TR_CHANNEL_SPSC) {
+        uint64_t tail = tr_atomic_load_relaxed(&r->tail);
+        if (tail - r->head_cache > r->mask) {
+            r->head_cache = tr_atomic_load_acquire(&r->head);
+            if (tail - r->head_cache > r->mask) return 0;
+        }
+        r->items[tail & r->mask] = item;
+        tr_atomic_store_release(&r->tail, tail + 1);
+        return 1;
+    }
+    uint64_t pos = tr_atomic_load_relaxed(&r->tail);
+    for (;;) {
+        ChannelRingSlot *slot = &r->slots[pos & r->mask];
+        uint64_t seq = tr_atomic_load_acquire(&slot->seq);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (tr_atomic_cas(&r->tail, &pos, pos + 1)) {
+                slot->item = item;
+                tr_atomic_store_release(&slot->seq, pos + 1);
+                return 1;
+            }
+        } else if (diff < 0) {
+            return 0;
+        } else {
+            pos = tr_atomic_load_relaxed(&r->tail);
+        }
+    }
+}
+
+/* single consumer; returns 1 when an item was dequeued, 0 when the ring is empty */
+static int channel_ring_try_pop(Channel *c, void **out)
+{
+    ChannelRing *r = c->ring;
+    uint64_t head = tr_atomic_load_relaxed(&r->head);
+    if (c->kind == TR_CHANNEL_SPSC) {
+        if (head == r->tail_cache) {
+            r->tail_cache = tr_atomic_load_acquire(&r->tail);
+            if (head == r->tail_cache) return 0;
+        }
+        *out = r->items[head & r->mask];
+        tr_atomic_store_release(&r->head, head + 1);
+        return 1;
+    }
+    ChannelRingSlot *slot = &r->slots[head & r->mask];
+    uint64_t seq = tr_atomic_load_acquire(&slot->seq);
+    if ((int64_t)(seq - (head + 1)) < 0) return 0;
+    *out = slot->item;
+    slot->item = NULL;
+    tr_atomic_store_release(&slot->seq, head + r->mask + 1);
+    tr_atomic_store_relaxed(&r->head, head + 1);
+    return 1;
+}
+
+/* wake the other side only if it announced it is (about to be) asleep; the full fence pairs
+   with the one a sleeper issues after bumping its waiter count, so no wakeup is lost */
+static void channel_ring_wake(Channel *c, uint64_t *waiters, tr_cond_t *cond)
+{
+    tr_atomic_fence();
+    if (tr_atomic_load_relaxed(waiters) == 0) return;
+    tr_mutex_lock(&c->lock);
+    tr_cond_notify_one(cond);
+    tr_mutex_unlock(&c->lock);
+}
+
+static int channel_ring_send(Channel *c, void *item, int blocking, uint32_t timeout_ms)
+{
+    ChannelRing *r = c->ring;
+    if (tr_atomic_load_acquire(&c->closed)) { tr_set_last_error_code(TR_ERR_CLOSED, "channel_send"); return -1; }
+    int pushed = channel_ring_try_push(c, item);
+    if (!pushed) {
+        if (!blocking) { tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_send"); return -2; }
+        for (int i = 0; i < TR_CHANNEL_SPIN && !pushed; ++i) { tr_cpu_relax(); pushed = channel_ring_try_push(c, item); }
+    }
+    if (!pushed) {
+        tr_atomic_fetch_add(&r->send_waiters, (uint64_t)1);
+        tr_atomic_fence();
+        int rc = 0;
+        tr_mutex_lock(&c->lock);
+        uint64_t t0 = channel_send_block_begin(c);
+        for (;;) {
+            if (c->closed) { rc = -1; tr_set_last_error_fmt("channel_send: closed during wait"); break; }
+            if (channel_ring_try_push(c, item)) break;
+            if (timeout_ms == 0) {
+                tr_cond_wait(&c->not_full, &c->lock);
+            } else if (tr_cond_timedwait(&c->not_full, &c->lock, timeout_ms) != 0) {
+                if (channel_ring_try_push(c, item)) break;
+                rc = -3; tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_send");
+                channel_note_timeout(c, 1);
+                break;
+            }
+        }
+        channel_send_block_end(c, t0);
+        tr_mutex_unlock(&c->lock);
+        tr_atomic_fetch_sub(&r->send_waiters, (uint64_t)1);
+        if (rc != 0) return rc;
+    }
+    channel_ring_wake(c, &r->recv_waiters, &c->not_empty);
+    return 0;
+}
+
+static int channel_ring_recv(Channel *c, void **out, int blocking, uint32_t timeout_ms)
+{
+    ChannelRing *r = c->ring;
+    int got = channel_ring_try_pop(c, out);
+    if (!got) {
+        if (tr_atomic_load_acquire(&c->closed)) {
+            /* a send may have landed right before close; drain it first */
+            if (!channel_ring_try_pop(c, out)) return 0;
+            got = 1;
+        } else if (!blocking) {
+            tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_recv");
+            return -2;
+        }
+        for (int i = 0; i < TR_CHANNEL_SPIN && !got; ++i) { tr_cpu_relax(); got = channel_ring_try_pop(c, out); }
+    }
+    if (!got) {
+        tr_atomic_fetch_add(&r->recv_waiters, (uint64_t)1);
+        tr_atomic_fence();
+        int rc = 1;
+        tr_mutex_lock(&c->lock);
+        channel_recv_block_begin(c);
+        for (;;) {
+            if (channel_ring_try_pop(c, out)) break;
+            if (c->closed) { rc = 0; break; }
+            if (timeout_ms == 0) {
+                tr_cond_wait(&c->not_empty, &c->lock);
+            } else if (tr_cond_timedwait(&c->not_empty, &c->lock, timeout_ms) != 0) {
+                if (channel_ring_try_pop(c, out)) break;
+                rc = -3; tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_recv");
+                channel_note_timeout(c, 0);
+                break;
+            }
+        }
+        channel_recv_block_end();
+        tr_mutex_unlock(&c->lock);
+        tr_atomic_fetch_sub(&r->recv_waiters, (uint64_t)1);
+        if (rc != 1) return rc;
+    }
+    channel_ring_wake(c, &r->send_waiters, &c->not_full);
+    return 1;
+}
+
+int channel_send(Channel *c, void *item, int blocking, uint32_t timeout_ms)
+{
+    if (!c) { tr_set_last_error_fmt("channel_send: null channel"); return -1; }
+    if (c->ring) return channel_ring_send(c, item, blocking, timeout_ms);
+    tr_mutex_lock(&c->lock);
+    if (c->closed) { tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_CLOSED, "channel_send"); return -1; }
+    uint64_t t0 = 0;
+    while (c->count == c->capacity) {
+        if (!blocking) { tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_send"); return -2; }
+        if (!t0) t0 = channel_send_block_begin(c);
+        if (timeout_ms == 0) {
+            tr_cond_wait(&c->not_full, &c->lock);
+        } else {
+            int w = tr_cond_timedwait(&c->not_full, &c->lock, timeout_ms);
+            if (w != 0) {
+                channel_send_block_end(c, t0);
+                channel_note_timeout(c, 1);
+                tr_mutex_unlock(&c->lock);
+                tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_send");
+                return -3;
+            }
+        }
+        if (c->closed) { channel_send_block_end(c, t0); tr_mutex_unlock(&c->lock); tr_set_last_error_fmt("channel_send: closed during wait"); return -1; }
+    }
+    if (t0) channel_send_block_end(c, t0);
+    c->buffer[c->tail] = item;
+    c->tail = (c->tail + 1) % c->capacity;
+    c->count++;
+    c->sent++;
+    tr_cond_notify_one(&c->not_empty);
+    tr_mutex_unlock(&c->lock);
+    return 0;
+}
+
+int channel_recv(Channel *c, void **out, int blocking, uint32_t timeout_ms)
+{
+    if (!c || !out) { tr_set_last_error_fmt("channel_recv: invalid args"); return -1; }
+    if (c->ring) return channel_ring_recv(c, out, blocking, timeout_ms);
+    tr_mutex_lock(&c->lock);
+    int blocked = 0;
+    while (c->count == 0) {
+        if (c->closed) { if (blocked) channel_recv_block_end(); tr_mutex_unlock(&c->lock); return 0; }
+        if (!blocking) { tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_recv"); return -2; }
+        if (!blocked) blocked = channel_recv_block_begin(c);
+        if (timeout_ms == 0) {
+            tr_cond_wait(&c->not_empty, &c->lock);
+        } else {
+            int w = tr_cond_timedwait(&c->not_empty, &c->lock, timeout_ms);
+            if (w != 0) { channel_recv_block_end(); channel_note_timeout(c, 0); tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_recv"); return -3; }
+        }
+    }
+    if (blocked) channel_recv_block_end();
+    *out = c->buffer[c->head];
+    c->buffer[c->head] = NULL;
+    c->head = (c->head + 1) % c->capacity;
+    c->count--;
+    c->received++;
+    tr_cond_notify_one(&c->not_full);
+    tr_mutex_unlock(&c->lock);
+    return 1;
+}
+
+/* ---- batched send/recv ----
+   channel_send_many moves up to n items and returns how many were enqueued; when blocking it keeps
+   going until all n are in (or the channel closes/times out, in which case the partial count is
+   returned and the reason is left in tr_last_error). If nothing could be sent the usual negative
+   code is returned (-1 closed, -2 would block, -3 timeout).
+   channel_recv_many waits for at least one item and then drains up to max in the same pass;
+   returns the count, 0 when closed and empty, or -2/-3 like channel_recv.
+   Either side takes the lock (or publishes the ring index) once per batch and issues one wakeup. */
+
+static size_t channel_ring_push_many(Channel *c, void *const *items, size_t n)
+{
+    ChannelRing *r = c->ring;
+    if (c->kind != TR_CHANNEL_SPSC) {
+        size_t k = 0;
+        while (k < n && channel_ring_try_push(c, items[k])) k++;
+        return k;
+    }
+    uint64_t tail = tr_atomic_load_relaxed(&r->tail);
+    uint64_t space = r->mask + 1 - (tail - r->head_cache);
+    if (space < n) {
+        r->head_cache = tr_atomic_load_acquire(&r->head);
+        space = r->mask + 1 - (tail - r->head_cache);
+    }
+    size_t k = n < space ? n : (size_t)space;
+    for (size_t i = 0; i < k; ++i) r->items[(tail + i) & r->mask] = items[i];
+    if (k) tr_atomic_store_release(&r->tail, tail + k);
+    return k;
+}
+
+static size_t channel_ring_pop_many(Channel *c, void **out, size_t max)
+{
+    ChannelRing *r = c->ring;
+    if (c->kind != TR_CHANNEL_SPSC) {
+        size_t k = 0;
+        while (k < max && channel_ring_try_pop(c, &out[k])) k++;
+        return k;
+    }
+    uint64_t head = tr_atomic_load_relaxed(&r->head);
+    uint64_t avail = r->tail_cache - head;
+    if (avail < max) {
+        r->tail_cache = tr_atomic_load_acquire(&r->tail);
+        avail = r->tail_cache - head;
+    }
+    size_t k = max < avail ? max : (size_t)avail;
+    for (size_t i = 0; i < k; ++i) out[i] = r->items[(head + i) & r->mask];
+    if (k) tr_atomic_store_release(&r->head, head + k);
+    return k;
+}
+
+static int channel_ring_send_many(Channel *c, void *const *items, size_t n, int blocking, uint32_t timeout_ms)
+{
+    ChannelRing *r = c->ring;
+    if (tr_atomic_load_acquire(&c->closed)) { tr_set_last_error_code(TR_ERR_CLOSED, "channel_send_many"); return -1; }
+    size_t sent = channel_ring_push_many(c, items, n);
+    int rc = 0;
+    while (sent < n) {
+        if (!blocking) { rc = -2; tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_send_many"); break; }
+        size_t k = 0;
+        for (int i = 0; i < TR_CHANNEL_SPIN && !k; ++i) { tr_cpu_relax(); k = channel_ring_push_many(c, items + sent, n - sent); }
+        if (k) { sent += k; continue; }
+        /* about to sleep: make sure the consumer knows about what is already queued */
+        if (sent) channel_ring_wake(c, &r->recv_waiters, &c->not_empty);
+        tr_atomic_fetch_add(&r->send_waiters, (uint64_t)1);
+        tr_atomic_fence();
+        tr_mutex_lock(&c->lock);
+        uint64_t t0 = channel_send_block_begin(c);
+        for (;;) {
+            if (c->closed) { rc = -1; tr_set_last_error_fmt("channel_send_many: closed during wait"); break; }
+            k = channel_ring_push_many(c, items + sent, n - sent);
+            if (k) break;
+            if (timeout_ms == 0) {
+                tr_cond_wait(&c->not_full, &c->lock);
+            } else if (tr_cond_timedwait(&c->not_full, &c->lock, timeout_ms) != 0) {
+                k = channel_ring_push_many(c, items + sent, n - sent);
+                if (!k) { rc = -3; tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_send_many"); channel_note_timeout(c, 1); }
+                break;
+            }
+        }
+        channel_send_block_end(c, t0);
+        tr_mutex_unlock(&c->lock);
+        tr_atomic_fetch_sub(&r->send_waiters, (uint64_t)1);
+        sent += k;
+        if (rc != 0) break;
+    }
+    if (sent) channel_ring_wake(c, &r->recv_waiters, &c->not_empty);
+    return sent ? (int)sent : rc;
+}
+
+static int channel_ring_recv_many(Channel *c, void **out, size_t max, int blocking, uint32_t timeout_ms)
+{
+    ChannelRing *r = c->ring;
+    size_t got = channel_ring_pop_many(c, out, max);
+    if (!got) {
+        if (tr_atomic_load_acquire(&c->closed)) {
+            got = channel_ring_pop_many(c, out, max);
+            if (!got) return 0;
+        } else if (!blocking) {
+            tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_recv_many");
+            return -2;
+        }
+        for (int i = 0; i < TR_CHANNEL_SPIN && !got; ++i) { tr_cpu_relax(); got = channel_ring_pop_many(c, out, max); }
+    }
+    if (!got) {
+        tr_atomic_fetch_add(&r->recv_waiters, (uint64_t)1);
+        tr_atomic_fence();
+        int rc = 1;
+        tr_mutex_lock(&c->lock);
+        channel_recv_block_begin(c);
+        for (;;) {
+            got = channel_ring_pop_many(c, out, max);
+            if (got) break;
+            if (c->closed) { rc = 0; break; }
+            if (timeout_ms == 0) {
+                tr_cond_wait(&c->not_empty, &c->lock);
+            } else if (tr_cond_timedwait(&c->not_empty, &c->lock, timeout_ms) != 0) {
+                got = channel_ring_pop_many(c, out, max);
+                if (!got) { rc = -3; tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_recv_many"); channel_note_timeout(c, 0); }
+                break;
+            }
+        }
+        channel_recv_block_end();
+        tr_mutex_unlock(&c->lock);
+        tr_atomic_fetch_sub(&r->recv_waiters, (uint64_t)1);
+        if (!got) return rc;
+    }
+    channel_ring_wake(c, &r->send_waiters, &c->not_full);
+    return (int)got;
+}
+
+int channel_send_many(Channel *c, void *const *items, size_t n, int blocking, uint32_t timeout_ms)
+{
+    if (!c || (!items && n)) { tr_set_last_error_fmt("channel_send_many: invalid args"); return -1; }
+    if (n == 0) return 0;
+    if (c->ring) return channel_ring_send_many(c, items, n, blocking, timeout_ms);
+    tr_mutex_lock(&c->lock);
+    if (c->closed) { tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_CLOSED, "channel_send_many"); return -1; }
+    size_t sent = 0;
+    int rc = 0;
+    uint64_t t0 = 0;
+    while (sent < n) {
+        size_t space = c->capacity - c->count;
+        if (space) {
+            size_t k = n - sent < space ? n - sent : space;
+            size_t first = c->capacity - c->tail < k ? c->capacity - c->tail : k;
+            memcpy(c->buffer + c->tail, items + sent, first * sizeof(void*));
+            memcpy(c->buffer, items + sent + first, (k - first) * sizeof(void*));
+            c->tail = (c->tail + k) % c->capacity;
+            c->count += k;
+            sent += k;
+            continue;
+        }
+        if (!blocking) { rc = -2; tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_send_many"); break; }
+        if (sent) tr_cond_notify_all(&c->not_empty);
+        if (!t0) t0 = channel_send_block_begin(c);
+        if (timeout_ms == 0) {
+            tr_cond_wait(&c->not_full, &c->lock);
+        } else if (tr_cond_timedwait(&c->not_full, &c->lock, timeout_ms) != 0 && c->count == c->capacity) {
+            rc = -3; tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_send_many");
+            channel_note_timeout(c, 1);
+            break;
+        }
+        if (c->closed) { rc = -1; tr_set_last_error_fmt("channel_send_many: closed during wait"); break; }
+    }
+    if (t0) channel_send_block_end(c, t0);
+    c->sent += sent;
+    if (sent == 1) tr_cond_notify_one(&c->not_empty);
+    else if (sent > 1) tr_cond_notify_all(&c->not_empty);
+    tr_mutex_unlock(&c->lock);
+    return sent ? (int)sent : rc;
+}
+
+int channel_recv_many(Channel *c, void **out, size_t max, int blocking, uint32_t timeout_ms)
+{
+    if (!c || !out || max == 0) { tr_set_last_error_fmt("channel_recv_many: invalid args"); return -1; }
+    if (c->ring) return channel_ring_recv_many(c, out, max, blocking, timeout_ms);
+    tr_mutex_lock(&c->lock);
+    int blocked = 0;
+    while (c->count == 0) {
+        if (c->closed) { if (blocked) channel_recv_block_end(); tr_mutex_unlock(&c->lock); return 0; }
+        if (!blocking) { tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "channel_recv_many"); return -2; }
+        if (!blocked) blocked = channel_recv_block_begin(c);
+        if (timeout_ms == 0) {
+            tr_cond_wait(&c->not_empty, &c->lock);
+        } else {
+            int w = tr_cond_timedwait(&c->not_empty, &c->lock, timeout_ms);
+            if (w != 0 && c->count == 0) { channel_recv_block_end(); channel_note_timeout(c, 0); tr_mutex_unlock(&c->lock); tr_set_last_error_code(TR_ERR_TIMEOUT, "channel_recv_many"); return -3; }
+        }
+    }
+    if (blocked) channel_recv_block_end();
+    size_t k = c->count < max ? c->count : max;
+    size_t first = c->capacity - c->head < k ? c->capacity - c->head : k;
+    memcpy(out, c->buffer + c->head, first * sizeof(void*));
+    memcpy(out + first, c->buffer, (k - first) * sizeof(void*));
+    memset(c->buffer + c->head, 0, first * sizeof(void*));
+    memset(c->buffer, 0, (k - first) * sizeof(void*));
+    c->head = (c->head + k) % c->capacity;
+    c->count -= k;
+    c->received += k;
+    if (k == 1) tr_cond_notify_one(&c->not_full);
+    else tr_cond_notify_all(&c->not_full);
+    tr_mutex_unlock(&c->lock);
+    return (int)k;
+}
+
+/* ---------------------------
+   Thread wrappers (cross-platform)
+   --------------------------- */
+
+typedef void *(*tr_thread_fn_t)(void*);
+
+typedef struct {
+    tr_thread_fn_t fn;
+    void *arg;
+} thread_startup_t;
+
+#ifdef _WIN32
+static unsigned __stdcall _win_thread_start(void *ctx)
+{
+    thread_startup_t *s = (thread_startup_t*)ctx;
+    if (!s) _exit(1);
+    tr_thread_fn_t fn = s->fn;
+    void *arg = s->arg;
+    free(s);
+    void *ret = fn(arg);
+    (void)ret;
+    return 0;
+}
+static int tr_thread_create(tr_thread_t *out, tr_thread_fn_t fn, void *arg)
+{
+    if (!out || !fn) { tr_set_last_error_fmt("tr_thread_create: invalid args"); return -1; }
+    thread_startup_t *s = (thread_startup_t*)malloc(sizeof(thread_startup_t));
+    if (!s) { tr_set_last_error_fmt("tr_thread_create: OOM"); return -1; }
+    s->fn = fn; s->arg = arg;
+    uintptr_t h = _beginthreadex(NULL, 0, _win_thread_start, s, 0, NULL);
+    if (h == 0) { free(s); tr_set_last_error_fmt("tr_thread_create: _beginthreadex failed"); return -1; }
+    *out = (tr_thread_t)h;
+    return 0;
+}
+static int tr_thread_join(tr_thread_t t)
+{
+    if (!t) { tr_set_last_error_fmt("tr_thread_join: invalid thread"); return -1; }
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+    return 0;
+}
+#else
+static void * _posix_thread_start(void *ctx)
+{
+    thread_startup_t *s = (thread_startup_t*)ctx;
+    tr_thread_fn_t fn = s->fn; void *arg = s->arg;
+    free(s);
+    return fn(arg);
+}
+static int tr_thread_create(tr_thread_t *out, tr_thread_fn_t fn, void *arg)
+{
+    if (!out || !fn) { tr_set_last_error_fmt("tr_thread_create: invalid args"); return -1; }
+    thread_startup_t *s = (thread_startup_t*)malloc(sizeof(thread_startup_t));
+    if (!s) { tr_set_last_error_fmt("tr_thread_create: OOM"); return -1; }
+    s->fn = fn; s->arg = arg;
+    pthread_t th;
+    if (pthread_create(&th, NULL, _posix_thread_start, s) != 0) { free(s); tr_set_last_error_fmt("tr_thread_create: pthread_create failed"); return -1; }
+    *out = th;
+    return 0;
+}
+static int tr_thread_join(tr_thread_t t)
+{
+    if (pthread_join(t, NULL) != 0) { tr_set_last_error_fmt("tr_thread_join: pthread_join failed"); return -1; }
+    return 0;
+}
+#endif
+
+/* ---------------------------
+   Dodecagram (base-12) helpers (uint64)
+   --------------------------- */
+
+static const char DG_DIGITS[] = "0123456789ab";
+
+/* two base-12 digits per entry: DG_PAIRS[2*v], DG_PAIRS[2*v+1] spell v for v < 144 */
+static const char DG_PAIRS[289] =
+    "000102030405060708090a0b101112131415161718191a1b"
+    "202122232425262728292a2b303132333435363738393a3b"
+    "404142434445464748494a4b505152535455565758595a5b"
+    "606162636465666768696a6b707172737475767778797a7b"
+    "808182838485868788898a8b909192939495969798999a9b"
+    "a0a1a2a3a4a5a6a7a8a9aaabb0b1b2b3b4b5b6b7b8b9babb";
+
+/* digit value per byte: 0..11, -1 for the '_' / ' ' separators, -2 for anything else */
+static const int8_t DG_VALUE[256] = {
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -1, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -2, -2, -2, -2, -2, -2,
+    -2, 10, 11, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -1,
+    -2, 10, 11, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2,
+    -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2, -2
+};
+
+#define TR_B12_U64_MAX_DIGITS 18   /* 12^17 < 2^64 < 12^18 */
+
+/* write v in base 12 (no NUL) using the pair table; returns the digit count */
+static size_t b12_encode_u64(uint64_t v, char *out)
+{
+    char buf[TR_B12_U64_MAX_DIGITS];
+    size_t pos = sizeof(buf);
+    while (v >= 144) {
+        uint64_t q = v / 144;
+        unsigned r = (unsigned)(v - q * 144);
+        pos -= 2;
+        memcpy(buf + pos, DG_PAIRS + 2 * r, 2);
+        v = q;
+    }
+    if (v >= 12) { pos -= 2; memcpy(buf + pos, DG_PAIRS + 2 * v, 2); }
+    else buf[--pos] = DG_DIGITS[v];
+    memcpy(out, buf + pos, sizeof(buf) - pos);
+    return sizeof(buf) - pos;
+}
+
+int tr_to_base12_u64(uint64_t n, char *out, size_t outlen)
+{
+    if (!out || outlen == 0) { tr_set_last_error_fmt("tr_to_base12_u64: invalid args"); return -1; }
+    if (n == 0) {
+        if (outlen < 2) { tr_set_last_error_fmt("tr_to_base12_u64: buffer too small"); return -1; }
+        out[0] = '0'; out[1] = '\0';
+        return 0;
+    }
+    char buf[TR_B12_U64_MAX_DIGITS];
+    size_t pos = b12_encode_u64(n, buf);
+    if (pos + 1 > outlen) { tr_set_last_error_fmt("tr_to_base12_u64: outlen too small"); return -1; }
+    memcpy(out, buf, pos);
+    out[pos] = '\0';
+    return 0;
+}
+
+int tr_from_base12_u64(const char *s, uint64_t *out)
+{
+    if (!s || !out) { tr_set_last_error_fmt("tr_from_base12_u64: invalid args"); return -1; }
+    uint64_t val = 0;
+    const char *p = s;
+    int neg = 0;
+    if (*p == '+' || *p == '-') { if (*p == '-') neg = 1; p++; }
+    while (*p) {
+        char c = *p++;
+        int d = DG_VALUE[(uint8_t)c];
+        if (d == -1) continue;
+        if (d < 0) { tr_set_last_error_fmt("tr_from_base12_u64: invalid digit '%c'", c); return -1; }
+        if (val > (UINT64_MAX - d) / 12) { tr_set_last_error_fmt("tr_from_base12_u64: overflow"); return -1; }
+        val = val * 12 + (uint64_t)d;
+    }
+    *out = neg ? (uint64_t)(-(int64_t)val) : val;
+    return 0;
+}
+
+/* Batch codec: values are written/read as one buffer of base-12 numbers separated by sep.
+   Decoding validates the whole buffer up front, 16 or 32 bytes at a time where SSE2/AVX2/NEON
+   are available, then parses tokens with the DG_VALUE table. */
+
+/* vector ISA picked at compile time (also used by the packet filter engine) */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TR_HAVE_AVX2 1
+#define TR_HAVE_SSE2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TR_HAVE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TR_HAVE_NEON 1
+#endif
+
+static int b12_byte_allowed(uint8_t c, char sep)
+{
+    return DG_VALUE[c] != -2 || c == '+' || c == '-' || c == (uint8_t)sep;
+}
+
+/* index of the first byte that is not a digit, '_', ' ', '+', '-' or sep; len if all are valid */
+static size_t b12_scan_invalid(const char *s, size_t len, char sep)
+{
+    size_t i = 0;
+#if defined(TR_HAVE_AVX2)
+    const __m256i lo = _mm256_set1_epi8('0' - 1), hi = _mm256_set1_epi8('9' + 1);
+    const __m256i case_bit = _mm256_set1_epi8(0x20), la = _mm256_set1_epi8('a'), lb = _mm256_set1_epi8('b');
+    const __m256i us = _mm256_set1_epi8('_'), sp = _mm256_set1_epi8(' ');
+    const __m256i plus = _mm256_set1_epi8('+'), minus = _mm256_set1_epi8('-'), vsep = _mm256_set1_epi8(sep);
+    for (; i + 32 <= len; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i lc = _mm256_or_si256(c, case_bit);
+        __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(c, lo), _mm256_cmpgt_epi8(hi, c));
+        ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(lc, la), _mm256_cmpeq_epi8(lc, lb)));
+        ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(c, us), _mm256_cmpeq_epi8(c, sp)));
+        ok = _mm256_or_si256(ok, _mm256_or_si256(_mm256_cmpeq_epi8(c, plus), _mm256_cmpeq_epi8(c, minus)));
+        ok = _mm256_or_si256(ok, _mm256_cmpeq_epi8(c, vsep));
+        uint32_t bad = ~(uint32_t)_mm256_movemask_epi8(ok);
+        if (bad) return i + tr_ctz64(bad);
+    }
+#elif defined(TR_HAVE_SSE2)
+    const __m128i lo = _mm_set1_epi8('0' - 1), hi = _mm_set1_epi8('9' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20), la = _mm_set1_epi8('a'), lb = _mm_set1_epi8('b');
+    const __m128i us = _mm_set1_epi8('_'), sp = _mm_set1_epi8(' ');
+    const __m128i plus = _mm_set1_epi8('+'), minus = _mm_set1_epi8('-'), vsep = _mm_set1_epi8(sep);
+    for (; i + 16 <= len; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i lc = _mm_or_si128(c, case_bit);
+        __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(c, lo), _mm_cmplt_epi8(c, hi));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(lc, la), _mm_cmpeq_epi8(lc, lb)));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(c, us), _mm_cmpeq_epi8(c, sp)));
+        ok = _mm_or_si128(ok, _mm_or_si128(_mm_cmpeq_epi8(c, plus), _mm_cmpeq_epi8(c, minus)));
+        ok = _mm_or_si128(ok, _mm_cmpeq_epi8(c, vsep));
+        unsigned bad = ~(unsigned)_mm_movemask_epi8(ok) & 0xffffu;
+        if (bad) return i + tr_ctz64(bad);
+    }
+#elif defined(TR_HAVE_NEON)
+    const uint8x16_t zero = vdupq_n_u8('0'), ten = vdupq_n_u8(10), case_bit = vdupq_n_u8(0x20);
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t c = vld1q_u8((const uint8_t*)(s + i));
+        uint8x16_t lc = vorrq_u8(c, case_bit);
+        uint8x16_t ok = vcltq_u8(vsubq_u8(c, zero), ten);
+        ok = vorrq_u8(ok, vorrq_u8(vceqq_u8(lc, vdupq_n_u8('a')), vceqq_u8(lc, vdupq_n_u8('b'))));
+        ok = vorrq_u8(ok, vorrq_u8(vceqq_u8(c, vdupq_n_u8('_')), vceqq_u8(c, vdupq_n_u8(' '))));
+        ok = vorrq_u8(ok, vorrq_u8(vceqq_u8(c, vdupq_n_u8('+')), vceqq_u8(c, vdupq_n_u8('-'))));
+        ok = vorrq_u8(ok, vceqq_u8(c, vdupq_n_u8((uint8_t)sep)));
+        if (vminvq_u8(ok) != 0xff) break;   /* the scalar tail pins down the exact byte */
+    }
+#endif
+    for (; i < len; ++i) if (!b12_byte_allowed((uint8_t)s[i], sep)) return i;
+    return len;
+}
+
+/* Encode n values into out, separated by sep and NUL-terminated. *out_written (may be NULL)
+   receives the length excluding the NUL. */
+static int b12_encode_u64_array(const uint64_t *vals, size_t n, char sep, char *out, size_t outlen, size_t *out_written)
+{
+    if ((!vals && n) || !out || outlen == 0) { tr_set_last_error_fmt("tr_base12_encode_u64_array: invalid args"); return -1; }
+    size_t pos = 0;
+    for (size_t i = 0; i < n; ++i) {
+        char *dst = out + pos + (i ? 1 : 0);
+        char tmp[TR_B12_U64_MAX_DIGITS];
+        /* fast path writes straight into out; near the end go through tmp to check the fit */
+        int direct = pos + 1 + TR_B12_U64_MAX_DIGITS + 1 <= outlen;
+        size_t nd = b12_encode_u64(vals[i], direct ? dst : tmp);
+        size_t need = (i ? 1 : 0) + nd;
+        if (!direct) {
+            if (pos + need + 1 > outlen) { out[pos] = '\0'; tr_set_last_error_fmt("tr_base12_encode_u64_array: outlen too small at value %zu", i); return -1; }
+            memcpy(dst, tmp, nd);
+        }
+        if (i) out[pos] = sep;
+        pos += need;
+    }
+    out[pos] = '\0';
+    if (out_written) *out_written = pos;
+    return 0;
+}
+
+/* Decode up to max values from buf[0..len) (sep-separated; empty or blank fields are skipped). Each field
+   follows tr_from_base12_u64: optional sign, '_' / ' ' ignored. *out_count receives the count. */
+static int b12_decode_u64_array(const char *buf, size_t len, char sep, uint64_t *out, size_t max, size_t *out_count)
+{
+    if (!buf || !out || !out_count) { tr_set_last_error_fmt("tr_base12_decode_u64_array: invalid args"); return -1; }
+    if ((DG_VALUE[(uint8_t)sep] != -2 && sep != ' ') || sep == '+' || sep == '-' || sep == '\0') {
+        tr_set_last_error_fmt("tr_base12_decode_u64_array: invalid separator");
+        return -1;
+    }
+    *out_count = 0;
+    size_t bad = b12_scan_invalid(buf, len, sep);
+    if (bad < len) { tr_set_last_error_fmt("tr_base12_decode_u64_array: invalid digit '%c' at offset %zu", buf[bad], bad); return -1; }
+    size_t count = 0, i = 0;
+    while (i < len) {
+        if (buf[i] == sep) { i++; continue; }
+        size_t start = i;
+        while (i < len && buf[i] != sep && DG_VALUE[(uint8_t)buf[i]] == -1) i++;   /* padding before the sign */
+        if (i == len || buf[i] == sep) continue;   /* blank field */
+        if (count == max) { tr_set_last_error_fmt("tr_base12_decode_u64_array: more than %zu values", max); return -1; }
+        int neg = 0;
+        if (buf[i] == '+' || buf[i] == '-') { neg = buf[i] == '-'; i++; }
+        uint64_t val = 0;
+        for (; i < len && buf[i] != sep; ++i) {
+            int d = DG_VALUE[(uint8_t)buf[i]];
+            if (d == -1) continue;
+            if (d < 0) { tr_set_last_error_fmt("tr_base12_decode_u64_array: invalid digit '%c' at offset %zu", buf[i], i); return -1; }
+            if (val > (UINT64_MAX - 11) / 12 && val > (UINT64_MAX - (uint64_t)d) / 12) {
+                tr_set_last_error_fmt("tr_base12_decode_u64_array: overflow in value at offset %zu", start);
+                return -1;
+            }
+            val = val * 12 + (uint64_t)d;
+        }
+        out[count++] = neg ? (uint64_t)(-(int64_t)val) : val;
+        *out_count = count;
+    }
+    return 0;
+}
+
+/* ---------------------------
+   Big-number: bytes <-> base-12 (arbitrary-length), signed and fractional support
+   - bytes_to_base12(bytes,len,out,outlen)                : integer representation (existing)
+   - bytes_to_base12_scaled(bytes,len,scale,out,outlen)   : treat bytes as integer representing value / 12^scale
+   - base12_to_bytes(s, &out_bytes, &out_len)             : parse signed integer or fixed-point (no scale output)
+   - base12_to_bytes_with_scale(s, &out_bytes, &out_len, &scale) : returns scale for fractional digits
+   Notes:
+     - bytes are interpreted as big-endian unsigned magnitude.
+     - base12 strings may include optional leading +/-, an optional decimal point '.' with fractional base-12 digits.
+     - When fractional part present, the returned bytes represent (value * 12^frac_len) as integer; `scale` will be frac_len.
+   --------------------------- */
+
+/* helpers for big-number math. The 64-bit limb arithmetic further down needs a 128-bit integer
+   type; without one the byte-at-a-time helpers here are used. */
+#if defined(__SIZEOF_INT128__)
+#define TR_HAVE_INT128 1
+#endif
+
+#ifndef TR_HAVE_INT128
+static int bn_is_zero(const uint8_t *bn, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) if (bn[i]) return 0;
+    return 1;
+}
+
+/* divide big-endian bn (len bytes) by small divisor; write quotient back into bn.
+   return remainder in rem_out. divisor must be >0
+*/
+static int bn_divmod_small(uint8_t *bn, size_t len, uint32_t divisor, uint32_t *rem_out)
+{
+    if (!bn || len == 0 || divisor == 0 || !rem_out) { tr_set_last_error_fmt("bn_divmod_small: invalid args"); return -1; }
+    uint32_t rem = 0;
+    for (size_t i = 0; i < len; ++i) {
+        uint32_t acc = (rem << 8) | bn[i];
+        uint8_t q = (uint8_t)(acc / divisor);
+        rem = acc % divisor;
+        bn[i] = q;
+    }
+    *rem_out = rem;
+    return 0;
+}
+#endif
+
+/* multiply big-endian bn (len bytes) by small multiplier and add small addend.
+   bn is modified in place; when carry remains positive after top byte, return -2 to indicate need to grow buffer.
+*/
+static int bn_mul_small_add(uint8_t *bn, size_t len, uint32_t mul, uint32_t add)
+{
+    if (!bn || len == 0) { tr_set_last_error_fmt("bn_mul_small_add: invalid args"); return -1; }
+    uint64_t carry = add;
+    for (ssize_t i = (ssize_t)len - 1; i >= 0; --i) {
+        uint64_t prod = (uint64_t)bn[i] * (uint64_t)mul + carry;
+        bn[i] = (uint8_t)(prod & 0xFF);
+        carry = prod >> 8;
+    }
+    if (carry != 0) return -2; /* overflow -> caller should grow buffer and retry */
+    return 0;
+}
+
+/* 64x64 -> 128-bit multiply: returns the low half, high half in *hi */
+static inline uint64_t bn_mul64(uint64_t a, uint64_t b, uint64_t *hi)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 p = (unsigned __int128)a * b;
+    *hi = (uint64_t)(p >> 64);
+    return (uint64_t)p;
+#elif defined(_MSC_VER) && defined(_M_X64)
+    return _umul128(a, b, hi);
+#else
+    uint64_t al = (uint32_t)a, ah = a >> 32, bl = (uint32_t)b, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    uint64_t mid = (ll >> 32) + (uint32_t)lh + (uint32_t)hl;
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)ll;
+#endif
+}
+
+/* a = a * mul + add over little-endian limbs; *len grows by at most one limb (caller presizes) */
+static void bn_limbs_mul_add_1(uint64_t *a, size_t *len, uint64_t mul, uint64_t add)
+{
+    uint64_t carry = add;
+    for (size_t i = 0; i < *len; ++i) {
+        uint64_t hi;
+        uint64_t lo = bn_mul64(a[i], mul, &hi);
+        lo += carry;
+        hi += lo < carry;
+        a[i] = lo;
+        carry = hi;
+    }
+    if (carry) a[(*len)++] = carry;
+}
+
+/* digit class for base-12 text: 0..11, -1 for the '_' / ' ' separators, -2 for anything else */
+static inline int b12_digit_value(char c)
+{
+    return DG_VALUE[(uint8_t)c];
+}
+
+/* 64-bit limb arithmetic (little-endian limb order) for the fast conversion paths */
+#ifdef TR_HAVE_INT128
+typedef unsigned __int128 tr_u128;
+
+#define TR_B12_CHUNK_DIGITS 17                      /* 12^17 is the largest power of 12 below 2^64 */
+#define TR_B12_CHUNK        2218611106740436992ull  /* 12^17 */
+#define TR_B12_DC_LIMBS     48                      /* below this, plain 12^17 passes beat splitting */
+#define TR_BN_KARATSUBA_LIMBS 32                    /* below this, schoolbook multiplication wins */
+#define TR_BN_RECIP_LIMBS     16                    /* below this, a reciprocal is one long division */
+#define TR_BN_BARRETT_LIMBS   512                   /* divisors from this size on use a reciprocal */
+
+/* (hi:lo) / d with hi < d; one hardware divide on x86-64 instead of a libgcc call */
+static inline uint64_t bn_udiv128(uint64_t hi, uint64_t lo, uint64_t d, uint64_t *rem)
+{
+#if defined(__x86_64__)
+    uint64_t q, r;
+    __asm__("divq %4" : "=a"(q), "=d"(r) : "a"(lo), "d"(hi), "rm"(d));
+    *rem = r;
+    return q;
+#else
+    tr_u128 n = ((tr_u128)hi << 64) | lo;
+    *rem = (uint64_t)(n % d);
+    return (uint64_t)(n / d);
+#endif
+}
+
+static size_t bn_limbs_trim(const uint64_t *a, size_t len)
+{
+    while (len && a[len - 1] == 0) len--;
+    return len;
+}
+
+/* big-endian bytes -> limbs; returns the trimmed limb count */
+static size_t bn_limbs_from_bytes(const uint8_t *bytes, size_t len, uint64_t *out)
+{
+    size_t nl = (len + 7) / 8;
+    for (size_t i = 0; i < nl; ++i) {
+        uint64_t v = 0;
+        for (size_t b = 0; b < 8; ++b) {
+            size_t bi = i * 8 + b;
+            if (bi >= len) break;
+            v |= (uint64_t)bytes[len - 1 - bi] << (8 * b);
+        }
+        out[i] = v;
+    }
+    return bn_limbs_trim(out, nl);
+}
+
+/* a /= d in place, returns the remainder */
+static uint64_t bn_limbs_divmod_1(uint64_t *a, size_t len, uint64_t d)
+{
+    uint64_t rem = 0;
+    for (size_t i = len; i-- > 0;) a[i] = bn_udiv128(rem, a[i], d, &rem);
+    return rem;
+}
+
+/* out[0..alen+blen) = a * b (schoolbook) */
+static void bn_limbs_mul_basecase(const uint64_t *a, size_t alen, const uint64_t *b, size_t blen, uint64_t *out)
+{
+    memset(out, 0, (alen + blen) * sizeof(uint64_t));
+    for (size_t i = 0; i < alen; ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < blen; ++j) {
+            tr_u128 t = (tr_u128)a[i] * b[j] + out[i + j] + carry;
+            out[i + j] = (uint64_t)t;
+            carry = (uint64_t)(t >> 64);
+        }
+        out[i + blen] = carry;
+    }
+}
+
+/* a[0..n) += b[0..bn) (bn <= n), returns the carry out of a[n-1] */
+static uint64_t bn_limbs_add(uint64_t *a, size_t n, const uint64_t *b, size_t bn)
+{
+    uint64_t c = 0;
+    size_t i = 0;
+    for (; i < bn; ++i) {
+        tr_u128 s = (tr_u128)a[i] + b[i] + c;
+        a[i] = (uint64_t)s;
+        c = (uint64_t)(s >> 64);
+    }
+    for (; c && i < n; ++i) c = ++a[i] == 0;
+    return c;
+}
+
+/* a[0..n) -= b[0..bn) (bn <= n), returns the borrow out of a[n-1] */
+static uint64_t bn_limbs_sub(uint64_t *a, size_t n, const uint64_t *b, size_t bn)
+{
+    uint64_t br = 0;
+    size_t i = 0;
+    for (; i < bn; ++i) {
+        uint64_t ai = a[i], t = ai - b[i];
+        uint64_t b1 = ai < b[i];
+        a[i] = t - br;
+        br = b1 | (t < br);
+    }
+    for (; br && i < n; ++i) br = a[i]-- == 0;
+    return br;
+}
+
+/* compare equal-length a and b: -1, 0 or 1 */
+static int bn_limbs_cmp(const uint64_t *a, const uint64_t *b, size_t n)
+{
+    for (size_t i = n; i-- > 0;) if (a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+/* a[0..alen) >= b[0..n) (b's top limb nonzero) */
+static int bn_limbs_ge(const uint64_t *a, size_t alen, const uint64_t *b, size_t n)
+{
+    alen = bn_limbs_trim(a, alen);
+    if (alen != n) return alen > n;
+    for (size_t i = n; i-- > 0;) if (a[i] != b[i]) return a[i] > b[i];
+    return 1;
+}
+
+/* workspace limbs bn_kara needs for n-limb operands */
+static size_t bn_kara_scratch(size_t n)
+{
+    if (n < TR_BN_KARATSUBA_LIMBS) return 0;
+    size_t nh = n - n / 2, sub = bn_kara_scratch(nh);
+    return 4 * nh + (sub > 2 * nh + 1 ? sub : 2 * nh + 1);
+}
+
+/* Karatsuba: out[0..2n) = a * b for n-limb a and b, using the subtractive middle term
+   a0*b1 + a1*b0 = z0 + z2 + (a0 - a1)(b1 - b0) so the recursion stays at half size */
+static void bn_kara(const uint64_t *a, const uint64_t *b, size_t n, uint64_t *out, uint64_t *ws)
+{
+    if (n < TR_BN_KARATSUBA_LIMBS) { bn_limbs_mul_basecase(a, n, b, n, out); return; }
+    size_t h = n / 2, nh = n - h;
+    uint64_t *da = ws, *db = ws + nh, *p = ws + 2 * nh, *t = ws + 4 * nh;
+    bn_kara(a, b, h, out, ws);                       /* z0 = a0 * b0 -> out[0, 2h) */
+    bn_kara(a + h, b + h, nh, out + 2 * h, ws);      /* z2 = a1 * b1 -> out[2h, 2n) */
+    /* da = |a0 - a1|, db = |b1 - b0|, with the low halves zero-extended to nh limbs */
+    memcpy(da, a, h * sizeof(uint64_t));
+    memcpy(db, b, h * sizeof(uint64_t));
+    if (nh > h) da[h] = db[h] = 0;
+    int neg = 0;
+    if (bn_limbs_cmp(da, a + h, nh) >= 0) {
+        bn_limbs_sub(da, nh, a + h, nh);
+    } else {
+        memcpy(t, a + h, nh * sizeof(uint64_t));
+        bn_limbs_sub(t, nh, da, nh);
+        memcpy(da, t, nh * sizeof(uint64_t));
+        neg = 1;
+    }
+    if (bn_limbs_cmp(b + h, db, nh) >= 0) {
+        memcpy(t, b + h, nh * sizeof(uint64_t));
+        bn_limbs_sub(t, nh, db, nh);
+        memcpy(db, t, nh * sizeof(uint64_t));
+    } else {
+        bn_limbs_sub(db, nh, b + h, nh);
+        neg ^= 1;
+    }
+    bn_kara(da, db, nh, p, t);
+    /* middle = z0 + z2 +/- p, always non-negative; added in at limb h */
+    memcpy(t, out + 2 * h, 2 * nh * sizeof(uint64_t));
+    t[2 * nh] = 0;
+    bn_limbs_add(t, 2 * nh + 1, out, 2 * h);
+    if (neg) bn_limbs_sub(t, 2 * nh + 1, p, 2 * nh);
+    else bn_limbs_add(t, 2 * nh + 1, p, 2 * nh);
+    bn_limbs_add(out + h, 2 * n - h, t, 2 * nh + 1);
+}
+
+/* out[0..alen+blen) = a * b; out must not overlap a or b. Karatsuba once both operands reach
+   TR_BN_KARATSUBA_LIMBS, with the longer one cut into slices the length of the shorter.
+   Returns -1 on OOM. */
+static int bn_limbs_mul(const uint64_t *a, size_t alen, const uint64_t *b, size_t blen, uint64_t *out)
+{
+    if (alen < blen) { const uint64_t *t = a; a = b; b = t; size_t tl = alen; alen = blen; blen = tl; }
+    if (blen < TR_BN_KARATSUBA_LIMBS) { bn_limbs_mul_basecase(a, alen, b, blen, out); return 0; }
+    uint64_t *tmp = (uint64_t*)malloc((2 * blen + bn_kara_scratch(blen)) * sizeof(uint64_t));
+    if (!tmp) return -1;
+    int rc = 0;
+    if (alen == blen) {
+        bn_kara(a, b, blen, out, tmp);
+    } else {
+        memset(out, 0, (alen + blen) * sizeof(uint64_t));
+        for (size_t off = 0; off < alen && rc == 0; off += blen) {
+            size_t cl = alen - off < blen ? alen - off : blen;
+            if (cl == blen) bn_kara(a + off, b, blen, tmp, tmp + 2 * blen);
+            else rc = bn_limbs_mul(b, blen, a + off, cl, tmp);
+            bn_limbs_add(out + off, alen + blen - off, tmp, cl + blen);
+        }
+    }
+    free(tmp);
+    return rc;
+}
+
+/* Knuth algorithm D: q[0..m-n] = u / v, r[0..n) = u % v. Requires m >= n >= 2 and v[n-1] != 0.
+   scratch holds m + 1 + n limbs. */
+static void bn_limbs_divmod(const uint64_t *u, size_t m, const uint64_t *v, size_t n, uint64_t *q, uint64_t *r, uint64_t *scratch)
+{
+    uint64_t *un = scratch;
+    uint64_t *vn = scratch + m + 1;
+    unsigned s = (unsigned)__builtin_clzll(v[n - 1]);
+    for (size_t i = n - 1; i > 0; --i) vn[i] = s ? (v[i] << s) | (v[i - 1] >> (64 - s)) : v[i];
+    vn[0] = v[0] << s;
+    un[m] = s ? u[m - 1] >> (64 - s) : 0;
+    for (size_t i = m - 1; i > 0; --i) un[i] = s ? (u[i] << s) | (u[i - 1] >> (64 - s)) : u[i];
+    un[0] = u[0] << s;
+    for (size_t j = m - n + 1; j-- > 0;) {
+        tr_u128 num = ((tr_u128)un[j + n] << 64) | un[j + n - 1];
+        tr_u128 qhat = num / vn[n - 1];
+        tr_u128 rhat = num % vn[n - 1];
+        while ((qhat >> 64) || qhat * vn[n - 2] > ((rhat << 64) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >> 64) break;
+        }
+        uint64_t borrow = 0, carry = 0;
+        for (size_t i = 0; i < n; ++i) {
+            tr_u128 p = qhat * vn[i] + carry;
+            carry = (uint64_t)(p >> 64);
+            uint64_t plo = (uint64_t)p;
+            uint64_t t = un[i + j] - plo;
+            uint64_t b1 = un[i + j] < plo;
+            un[i + j] = t - borrow;
+            borrow = b1 + (t < borrow);
+        }
+        uint64_t t = un[j + n] - carry;
+        uint64_t b1 = un[j + n] < carry;
+        un[j + n] = t - borrow;
+        if (b1 + (t < borrow)) {
+            /* qhat was one too large: add v back */
+            qhat--;
+            uint64_t c = 0;
+            for (size_t i = 0; i < n; ++i) {
+                tr_u128 sum = (tr_u128)un[i + j] + vn[i] + c;
+                un[i + j] = (uint64_t)sum;
+                c = (uint64_t)(sum >> 64);
+            }
+            un[j + n] += c;
+        }
+        q[j] = (uint64_t)qhat;
+    }
+    for (size_t i = 0; i < n; ++i) r[i] = s ? (un[i] >> s) | (un[i + 1] << (64 - s)) : un[i];
+}
+
+/* inv[0..n] = floor(B^2n / v) for a normalized v (n limbs, top bit set; B = 2^64). One Newton
+   step from the reciprocal of v's top h = ceil(n/2) limbs, then an exact correction, so the cost
+   is a few multiplications at each halving. Returns -1 on OOM. */
+static int bn_limbs_recip(const uint64_t *v, size_t n, uint64_t *inv)
+{
+    if (n < TR_BN_RECIP_LIMBS) {
+        /* one long division of B^2n */
+        uint64_t *buf = (uint64_t*)calloc(2 * n + 1 + n + 2 + n + 2 * n + 2 + n, sizeof(uint64_t));
+        if (!buf) return -1;
+        uint64_t *u = buf, *q = u + 2 * n + 1, *r = q + n + 2, *scratch = r + n;
+        u[2 * n] = 1;
+        if (n == 1) {
+            bn_limbs_divmod_1(u, 3, v[0]);
+            memcpy(q, u, 2 * sizeof(uint64_t));
+        } else {
+            bn_limbs_divmod(u, 2 * n + 1, v, n, q, r, scratch);
+        }
+        memcpy(inv, q, (n + 1) * sizeof(uint64_t));
+        free(buf);
+        return 0;
+    }
+    size_t h = (n + 1) / 2, l = n - h;   /* v = top * B^l + low, top = v[l..n) */
+    uint64_t *buf = (uint64_t*)calloc((h + 1) + (n + h + 1) + (2 * n + 2) + (2 * n + 1) + (2 * n + 2), sizeof(uint64_t));
+    if (!buf) return -1;
+    uint64_t *ih = buf, *p = ih + h + 1, *t = p + n + h + 1, *r = t + 2 * n + 2, *vd = r + 2 * n + 1;
+    static const uint64_t four = 4, one = 1;
+    int rc = bn_limbs_recip(v + l, h, ih);
+    /* X0 = (ih - 4) B^l is below B^2n / v: the truncated top overestimates by less than 4 B^l */
+    if (rc == 0) bn_limbs_sub(ih, h + 1, &four, 1);
+    /* e = B^(n+h) - v (ih - 4), so that B^2n - v X0 = e B^l (e >= 0 because X0 < B^2n / v) */
+    if (rc == 0) rc = bn_limbs_mul(v, n, ih, h + 1, p);
+    if (rc == 0) {
+        uint64_t *e = p;     /* in place: e = -p mod B^(n+h) */
+        size_t i = 0;
+        while (i < n + h && e[i] == 0) i++;
+        if (i < n + h) { e[i] = (uint64_t)0 - e[i]; for (size_t j = i + 1; j < n + h; ++j) e[j] = ~e[j]; }
+        /* X1 = X0 + floor(X0 e B^l / B^2n) = X0 + floor((ih - 4) e / B^2h) */
+        size_t el = bn_limbs_trim(e, n + h);
+        memset(t, 0, (2 * n + 2) * sizeof(uint64_t));
+        if (el) rc = bn_limbs_mul(ih, h + 1, e, el, t);
+        if (rc == 0) {
+            memset(inv, 0, (n + 1) * sizeof(uint64_t));
+            memcpy(inv + l, ih, (h + 1) * sizeof(uint64_t));
+            uint64_t *d = t + 2 * h;              /* floor((ih - 4) e / B^2h): n + 1 limbs */
+            size_t dl = bn_limbs_trim(d, n + 1);
+            bn_limbs_add(inv, n + 1, d, dl);
+            /* exact: r = B^2n - v X1 = e B^l - v d, and X1 <= B^2n / v; step X1 up while r >= v */
+            memset(r, 0, (2 * n + 1) * sizeof(uint64_t));
+            memcpy(r + l, e, (n + h) * sizeof(uint64_t));
+            if (dl) rc = bn_limbs_mul(v, n, d, dl, vd);
+            if (rc == 0 && dl) bn_limbs_sub(r, 2 * n + 1, vd, n + dl);
+            while (rc == 0 && bn_limbs_ge(r, 2 * n + 1, v, n)) {
+                bn_limbs_sub(r, 2 * n + 1, v, n);
+                bn_limbs_add(inv, n + 1, &one, 1);
+            }
+        }
+    }
+    free(buf);
+    return rc;
+}
+
+/* q[0..len-n+1) = a / v and r[0..n) = a % v for len >= n, given vn = v << shift (normalized) and
+   inv = floor(B^2n / vn). Barrett reduction over n-limb blocks of a << shift: each block costs two
+   multiplications and at most two corrections. Returns -1 on OOM. */
+static int bn_limbs_divmod_pre(const uint64_t *a, size_t len, const uint64_t *vn, size_t n, unsigned shift,
+                               const uint64_t *inv, uint64_t *q, uint64_t *r)
+{
+    static const uint64_t one = 1;
+    size_t nb = (len + 1) / n;           /* full blocks of a << shift, which has len + 1 limbs */
+    uint64_t *buf = (uint64_t*)calloc(len + 1 + nb * n + 2 * n + (2 * n + 2) + n + 2 * n, sizeof(uint64_t));
+    if (!buf) return -1;
+    uint64_t *un = buf, *qq = un + len + 1, *cur = qq + nb * n, *prod = cur + 2 * n, *q3 = prod + 2 * n + 2, *pv = q3 + n;
+    for (size_t i = 0; i < len; ++i) un[i] = shift ? (a[i] << shift) | (i ? a[i - 1] >> (64 - shift) : 0) : a[i];
+    un[len] = shift ? a[len - 1] >> (64 - shift) : 0;
+    /* the partial top block is below B^(n-1) < vn, so it starts out as the remainder */
+    memcpy(cur, un + nb * n, (len + 1 - nb * n) * sizeof(uint64_t));
+    int rc = 0;
+    for (size_t b = nb; b-- > 0 && rc == 0;) {
+        /* cur = rem * B^n + block, below vn * B^n */
+        memcpy(cur + n, cur, n * sizeof(uint64_t));
+        memcpy(cur, un + b * n, n * sizeof(uint64_t));
+        /* q3 = floor(floor(cur / B^(n-1)) * inv / B^(n+1)) is at most 2 below the block quotient */
+        rc = bn_limbs_mul(cur + n - 1, n + 1, inv, n + 1, prod);
+        if (rc != 0) break;
+        memcpy(q3, prod + n + 1, n * sizeof(uint64_t));
+        rc = bn_limbs_mul(q3, n, vn, n, pv);
+        if (rc != 0) break;
+        bn_limbs_sub(cur, 2 * n, pv, 2 * n);
+        while (bn_limbs_ge(cur, 2 * n, vn, n)) {
+            bn_limbs_sub(cur, 2 * n, vn, n);
+            bn_limbs_add(q3, n, &one, 1);
+        }
+        memcpy(qq + b * n, q3, n * sizeof(uint64_t));
+    }
+    if (rc == 0) {
+        memcpy(q, qq, (len - n + 1) * sizeof(uint64_t));
+        for (size_t i = 0; i < n; ++i) r[i] = shift ? (cur[i] >> shift) | (i + 1 < n ? cur[i + 1] << (64 - shift) : 0) : cur[i];
+    }
+    free(buf);
+    return rc;
+}
+
+/* write a (< 12^17) as exactly ndigits base-12 digits ending at out[ndigits-1] */
+static void b12_emit_chunk(uint64_t v, char *out, size_t ndigits)
+{
+    for (size_t i = ndigits; i-- > 0;) { out[i] = DG_DIGITS[v % 12]; v /= 12; }
+}
+
+/* leaf conversion: emits 17 digits per pass over the limbs; a is destroyed */
+static void b12_convert_passes(uint64_t *a, size_t len, char *out, size_t width)
+{
+    size_t pos = width;
+    while (pos > 0) {
+        len = bn_limbs_trim(a, len);
+        if (len == 0) { memset(out, '0', pos); return; }
+        uint64_t rem = bn_limbs_divmod_1(a, len, TR_B12_CHUNK);
+        size_t nd = pos < TR_B12_CHUNK_DIGITS ? pos : TR_B12_CHUNK_DIGITS;
+        b12_emit_chunk(rem, out + pos - nd, nd);
+        pos -= nd;
+    }
+}
+
+typedef struct {
+    uint64_t *limbs;   /* 12^(17 * 2^k) */
+    size_t len;
+    size_t digits;     /* 17 * 2^k */
+    uint64_t *norm;    /* limbs << shift (top bit set) and floor(B^2len / norm), len + 1 limbs */
+    uint64_t *inv;
+    unsigned shift;
+} B12Power;
+
+/* Divide and conquer: a = q * 12^w + r, convert q into the high digits and r into the low w digits.
+   Each split is a Barrett division by a precomputed reciprocal, so with Karatsuba underneath the
+   whole conversion is O(M(n) log n). Writes exactly width digits (zero padded); a is destroyed.
+   Returns -1 on OOM. */
+static int b12_convert_dc(uint64_t *a, size_t len, char *out, size_t width, const B12Power *pw, int npw)
+{
+    len = bn_limbs_trim(a, len);
+    int k = npw - 1;
+    while (k >= 0 && (pw[k].len * 2 > len + 1 || pw[k].len > len || pw[k].digits >= width)) k--;
+    if (len < TR_B12_DC_LIMBS || k < 0 || pw[k].len < 2) { b12_convert_passes(a, len, out, width); return 0; }
+    const B12Power *p = &pw[k];
+    size_t qlen = len - p->len + 1;
+    uint64_t *buf = (uint64_t*)malloc((qlen + p->len + (p->inv ? 0 : len + 1 + p->len)) * sizeof(uint64_t));
+    if (!buf) return -1;
+    uint64_t *q = buf, *r = buf + qlen;
+    int rc = 0;
+    if (p->inv) rc = bn_limbs_divmod_pre(a, len, p->norm, p->len, p->shift, p->inv, q, r);
+    else bn_limbs_divmod(a, len, p->limbs, p->len, q, r, r + p->len);
+    if (rc == 0) rc = b12_convert_dc(q, qlen, out, width - p->digits, pw, npw);
+    if (rc == 0) rc = b12_convert_dc(r, p->len, out + width - p->digits, p->digits, pw, npw);
+    free(buf);
+    return rc;
+}
+
+/* bytes_to_base12 for big-endian input using limbs; returns 0, -1 on OOM, -2 if outlen is too small */
+static int bytes_to_base12_limbs(const uint8_t *bytes, size_t len, char *out, size_t outlen)
+{
+    uint64_t *a = (uint64_t*)malloc(((len + 7) / 8 + 1) * sizeof(uint64_t));
+    if (!a) return -1;
+    size_t nl = bn_limbs_from_bytes(bytes, len, a);
+    if (nl == 0) {
+        free(a);
+        if (outlen < 2) return -2;
+        out[0] = '0'; out[1] = '\0';
+        return 0;
+    }
+    /* digits <= bits * log12(2) + 1, log12(2) = 0.27894... */
+    size_t width = (size_t)((double)nl * 64.0 * 0.278943) + 2;
+    char *tmp = (char*)malloc(width + 1);
+    B12Power pw[40];
+    memset(pw, 0, sizeof(pw));
+    int npw = 0;
+    int rc = tmp ? 0 : -1;
+    if (rc == 0 && nl >= TR_B12_DC_LIMBS) {
+        /* 12^(17*2^k) by repeated squaring, up to about half the input size */
+        uint64_t *p0 = (uint64_t*)malloc(sizeof(uint64_t));
+        if (!p0) rc = -1;
+        else { p0[0] = TR_B12_CHUNK; pw[0].limbs = p0; pw[0].len = 1; pw[0].digits = TR_B12_CHUNK_DIGITS; npw = 1; }
+        while (rc == 0 && pw[npw - 1].len * 4 <= nl + 2 && npw < 40) {
+            const B12Power *prev = &pw[npw - 1];
+            uint64_t *sq = (uint64_t*)malloc(prev->len * 2 * sizeof(uint64_t));
+            if (!sq) { rc = -1; break; }
+            pw[npw].limbs = sq;
+            if (bn_limbs_mul(prev->limbs, prev->len, prev->limbs, prev->len, sq) != 0) { rc = -1; break; }
+            pw[npw].len = bn_limbs_trim(sq, prev->len * 2);
+            pw[npw].digits = prev->digits * 2;
+            npw++;
+        }
+        /* reciprocals for the powers large enough to be divided by with Barrett reduction */
+        for (int i = 0; rc == 0 && i < npw; ++i) {
+            B12Power *p = &pw[i];
+            if (p->len < TR_BN_BARRETT_LIMBS) continue;
+            p->norm = (uint64_t*)malloc(p->len * sizeof(uint64_t));
+            p->inv = (uint64_t*)malloc((p->len + 1) * sizeof(uint64_t));
+            if (!p->norm || !p->inv) { rc = -1; break; }
+            p->shift = (unsigned)__builtin_clzll(p->limbs[p->len - 1]);
+            for (size_t j = p->len; j-- > 0;)
+                p->norm[j] = p->shift ? (p->limbs[j] << p->shift) | (j ? p->limbs[j - 1] >> (64 - p->shift) : 0) : p->limbs[j];
+            rc = bn_limbs_recip(p->norm, p->len, p->inv);
+        }
+    }
+    if (rc == 0) rc = b12_convert_dc(a, nl, tmp, width, pw, npw);
+    for (int i = 0; i < 40; ++i) { free(pw[i].limbs); free(pw[i].norm); free(pw[i].inv); }
+    free(a);
+    if (rc != 0) { free(tmp); return rc; }
+    size_t lead = 0;
+    while (lead + 1 < width && tmp[lead] == '0') lead++;
+    size_t nd = width - lead;
+    if (nd + 1 > outlen) { free(tmp); return -2; }
+    memcpy(out, tmp + lead, nd);
+    out[nd] = '\0';
+    free(tmp);
+    return 0;
+}
+#endif
+
+/* Convert arbitrary big-endian byte array to base-12 string (0-9,a,b).
+   Un-signed, outputs integer string. Returns 0 on success.
+   With 128-bit integer support this runs on 64-bit limbs: 17 digits per division pass, and
+   divide and conquer over powers of 12^17 for inputs of TR_B12_DC_LIMBS limbs and up.
+*/
+int bytes_to_base12(const uint8_t *bytes, size_t len, char *out, size_t outlen)
+{
+    if (!out || outlen == 0) { tr_set_last_error_fmt("bytes_to_base12: invalid output buffer"); return -1; }
+    if (!bytes || len == 0) {
+        if (outlen < 2) { tr_set_last_error_fmt("bytes_to_base12: outlen too small"); return -1; }
+        out[0] = '0'; out[1] = '\0';
+        return 0;
+    }
+#ifdef TR_HAVE_INT128
+    int frc = bytes_to_base12_limbs(bytes, len, out, outlen);
+    if (frc == -1) { tr_set_last_error_fmt("bytes_to_base12: OOM"); return -1; }
+    if (frc == -2) { tr_set_last_error_fmt("bytes_to_base12: outlen too small"); return -1; }
+    return 0;
+#else
+    uint8_t *bn = (uint8_t*)malloc(len);
+    if (!bn) { tr_set_last_error_fmt("bytes_to_base12: OOM"); return -1; }
+    memcpy(bn, bytes, len);
+    char *rev = (char*)malloc((len * 3) + 32);
+    if (!rev) { free(bn); tr_set_last_error_fmt("bytes_to_base12: OOM rev"); free(bn); return -1; }
+    size_t rpos = 0;
+    while (!bn_is_zero(bn, len)) {
+        uint32_t rem = 0;
+        if (bn_divmod_small(bn, len, 12, &rem) != 0) { free(bn); free(rev); tr_set_last_error_fmt("bytes_to_base12: divmod failed"); return -1; }
+        rev[rpos++] = DG_DIGITS[rem];
+        if (rpos + 2 >= (size_t)((len * 3) + 32)) break;
+    }
+    if (rpos == 0) rev[rpos++] = '0';
+    if (rpos + 1 > outlen) { free(bn); free(rev); tr_set_last_error_fmt("bytes_to_base12: outlen too small"); return -1; }
+    for (size_t i = 0; i < rpos; ++i) out[i] = rev[rpos - 1 - i];
+    out[rpos] = '\0';
+    free(bn); free(rev);
+    return 0;
+#endif
+}
+
+/* Convert and insert decimal point according to scale: the input bytes represent integer value v,
+   conceptual value is v / (12^scale). This function prints appropriate base-12 string with '.'
+*/
+int bytes_to_base12_scaled(const uint8_t *bytes, size_t len, int scale, char *out, size_t outlen)
+{
+    if (scale < 0) { tr_set_last_error_fmt("bytes_to_base12_scaled: negative scale"); return -1; }
+    if (!out || outlen == 0) return -1;
+    // produce integer part and fractional part by repeated division/mod
+    char *tmp = (char*)malloc(outlen + 16);
+    if (!tmp) { tr_set_last_error_fmt("bytes_to_base12_scaled: OOM"); return -1; }
+    int rc = bytes_to_base12(bytes, len, tmp, outlen + 16);
+    if (rc != 0) { free(tmp); return rc; }
+    size_t totlen = strlen(tmp);
+    if (scale == 0) {
+        // no point insertion
+        if (totlen + 1 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small"); return -1; }
+        strcpy(out, tmp);
+        free(tmp);
+        return 0;
+    }
+    // ensure we have at least scale+1 digits by left-padding with zeros
+    if ((int)totlen <= scale) {
+        // pad with leading zeros to produce 0.xxx
+        size_t need = (size_t)(scale + 1 - (int)totlen);
+        if (need + totlen + 2 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small after pad"); return -1; }
+        // write "0."
+        out[0] = '0'; out[1] = '.'; size_t pos = 2;
+        for (size_t i = 0; i < need; ++i) out[pos++] = '0';
+        strcpy(out + pos, tmp);
+        free(tmp);
+        return 0;
+    } else {
+        // insert point such that fractional part has length 'scale'
+        size_t intpart = totlen - scale;
+        if (totlen + 2 > outlen) { free(tmp); tr_set_last_error_fmt("bytes_to_base12_scaled: outlen too small for insertion"); return -1; }
+        memcpy(out, tmp, intpart);
+        out[intpart] = '.';
+        strcpy(out + intpart + 1, tmp + intpart);
+        free(tmp);
+        return 0;
+    }
+}
+
+/* Parse base-12 string into big-endian byte array (allocated, caller frees).
+   Supports optional sign (+/-) and optional fractional part separated by '.'.
+   When fractional digits present, result bytes represent integer value = parsed_value * 12^frac_len
+   and out_scale is set to frac_len so caller knows to interpret bytes as fixed-point.
+   The sign is not encoded into the bytes; out_neg (may be NULL) receives 1 for a leading '-'.
+   Digits are validated and counted first so the limb buffer is sized once, then consumed 17 at a
+   time as one uint64 chunk per multiply-accumulate pass.
+*/
+int base12_to_bytes_ex(const char *s, uint8_t **out_bytes, size_t *out_len, int *out_scale, int *out_neg)
+{
+    if (!s || !out_bytes || !out_len) { tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid args"); return -1; }
+    const char *p = s;
+    int neg = 0;
+    if (*p == '+' || *p == '-') { if (*p == '-') neg = 1; p++; }
+    // split integer and fractional parts (if any)
+    const char *dot = strchr(p, '.');
+    size_t int_len = dot ? (size_t)(dot - p) : strlen(p);
+    const char *frac = dot ? dot + 1 : NULL;
+    size_t frac_len = frac ? strlen(frac) : 0;
+    size_t ndigits = 0, frac_digits = 0;
+    for (size_t i = 0; i < int_len; ++i) {
+        int d = b12_digit_value(p[i]);
+        if (d == -2) { tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid digit '%c'", p[i]); return -2; }
+        if (d >= 0) ndigits++;
+    }
+    for (size_t i = 0; i < frac_len; ++i) {
+        int d = b12_digit_value(frac[i]);
+        if (d == -2) { tr_set_last_error_fmt("base12_to_bytes_with_scale: invalid frac digit '%c'", frac[i]); return -2; }
+        if (d >= 0) frac_digits++;
+    }
+    ndigits += frac_digits;
+    // log2(12) = 3.585 bits per digit
+    size_t cap = (size_t)((double)ndigits * 3.5849625 / 64.0) + 2;
+    uint64_t *a = (uint64_t*)calloc(cap, sizeof(uint64_t));
+    if (!a) { tr_set_last_error_fmt("base12_to_bytes_with_scale: OOM bn alloc"); return -1; }
+    size_t len = 0;
+    uint64_t chunk = 0, chunk_mul = 1;
+    for (int part = 0; part < 2; ++part) {
+        const char *q = part ? frac : p;
+        size_t n = part ? frac_len : int_len;
+        for (size_t i = 0; i < n; ++i) {
+            int d = b12_digit_value(q[i]);
+            if (d < 0) continue;
+            chunk = chunk * 12 + (uint64_t)d;
+            chunk_mul *= 12;
+            if (chunk_mul == 2218611106740436992ull) {   /* 12^17: flush a full chunk */
+                bn_limbs_mul_add_1(a, &len, chunk_mul, chunk);
+                chunk = 0;
+                chunk_mul = 1;
+            }
+        }
+    }
+    if (chunk_mul != 1) bn_limbs_mul_add_1(a, &len, chunk_mul, chunk);
+    size_t nbytes = 1;
+    if (len) {
+        uint64_t top = a[len - 1];
+        size_t topbytes = 0;
+        while (top) { topbytes++; top >>= 8; }
+        nbytes = (len - 1) * 8 + topbytes;
+    }
+    uint8_t *outb = (uint8_t*)malloc(nbytes);
+    if (!outb) { free(a); tr_set_last_error_fmt("base12_to_bytes_with_scale: OOM outb"); return -1; }
+    for (size_t i = 0; i < nbytes; ++i) outb[nbytes - 1 - i] = i / 8 < len ? (uint8_t)(a[i / 8] >> (8 * (i % 8))) : 0;
+    free(a);
+    *out_bytes = outb;
+    *out_len = nbytes;
+    if (out_scale) *out_scale = (int)frac_digits;
+    if (out_neg) *out_neg = neg;
+    return 0;
+}
+
+int base12_to_bytes_with_scale(const char *s, uint8_t **out_bytes, size_t *out_len, int *out_scale)
+{
+    return base12_to_bytes_ex(s, out_bytes, out_len, out_scale, NULL);
+}
+
+/* Backwards-compat wrapper: existing base12_to_bytes returns bytes for integer strings only (scale ignored) */
+int base12_to_bytes(const char *s, uint8_t **out_bytes, size_t *out_len)
+{
+    int scale = 0;
+    return base12_to_bytes_with_scale(s, out_bytes, out_len, &scale);
+}
+
+/* ---------------------------
+   Packet helpers (simple)
+   - tr_packet_create copies the payload into a block owned by the quarantine
+   - zero-copy packets instead reference a slice of a refcounted TrionPacketBuf drawn from a
+     TrionPacketPool; forwarding a packet or slicing it only takes another reference, and the
+     buffer goes back to its pool when the last reference drops
+   - pool buffers are quarantine allocations, so a sealed quarantine rejects new buffers
+   --------------------------- */
+struct TrionPacketPool;
+
+typedef struct TrionPacketBuf {
+    uint32_t refs;                  /* packets (and callers) holding the buffer */
+    uint32_t reserved;
+    struct TrionPacketPool *pool;
+    struct TrionPacketBuf *next;    /* link while cached in the pool */
+    size_t capacity;
+    uint8_t *data;                  /* capacity bytes following the header */
+} TrionPacketBuf;
+
+typedef struct TrionPacket {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    size_t length;
+    void *payload;       /* owned by packet->q, or a slice of packet->buf; free-list link while cached */
+    Quarantine *q;       /* quarantine owning payload */
+    TrionPacketBuf *buf; /* shared payload buffer (zero-copy packets), NULL when payload was copied */
+} TrionPacket;
+
+/* Buffers are allocated from pool->q with the payload right after the header. The pool caches
+   up to max_cached released buffers (and as many packet headers) so a steady forwarding loop
+   allocates nothing; refs is 1 for the creator plus one per live buffer, so the pool outlives
+   tr_packet_pool_destroy until the last outstanding buffer is released. */
+typedef struct TrionPacketPool {
+    Quarantine *q;
+    size_t buf_size;
+    size_t max_cached;
+    TrionPacketBuf *free_bufs;
+    size_t nfree_bufs;
+    TrionPacket *free_pkts;
+    size_t nfree_pkts;
+    uint32_t refs;
+    int closed;
+    tr_mutex_t lock;
+} TrionPacketPool;
+
+#define TR_PBUF_HDR TR_QUARANTINE_ROUNDUP(sizeof(TrionPacketBuf))
+
+TrionPacket *tr_packet_create(Quarantine *q, const void *payload, size_t len)
+{
+    if (!q) { tr_set_last_error_fmt("tr_packet_create: invalid quarantine"); return NULL; }
+    TrionPacket *p = (TrionPacket*)malloc(sizeof(TrionPacket));
+    if (!p) { tr_set_last_error_fmt("tr_packet_create: OOM"); return NULL; }
+    p->q = q;
+    p->buf = NULL;
+    if (len > 0 && payload) {
+        void *buf = quarantine_alloc(q, len);
+        if (!buf) { tr_set_last_error_fmt("tr_packet_create: quarantine_alloc failed"); free(p); return NULL; }
+        memcpy(buf, payload, len);
+        p->payload = buf;
+        p->length = len;
+    } else {
+        p->payload = NULL;
+        p->length = 0;
+    }
+    p->src_ip = p->dst_ip = 0;
+    p->src_port = p->dst_port = 0;
+    return p;
+}
+
+static void packet_pool_unref(TrionPacketPool *pool)
+{
+    if (tr_atomic_fetch_sub(&pool->refs, 1u) != 1) return;
+    tr_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+TrionPacketPool *tr_packet_pool_create(Quarantine *q, size_t buf_size, size_t max_cached)
+{
+    if (!q || buf_size == 0) { tr_set_last_error_fmt("tr_packet_pool_create: invalid args"); return NULL; }
+    TrionPacketPool *pool = (TrionPacketPool*)calloc(1, sizeof(TrionPacketPool));
+    if (!pool) { tr_set_last_error_fmt("tr_packet_pool_create: OOM"); return NULL; }
+    pool->q = q;
+    pool->buf_size = buf_size;
+    pool->max_cached = max_cached;
+    pool->refs = 1;
+    tr_mutex_init(&pool->lock);
+    return pool;
+}
+
+/* Drops cached buffers/headers and the creator's reference. Buffers still referenced by packets
+   stay valid and are returned straight to the quarantine when released. The quarantine must
+   outlive every buffer of the pool (reset/destroy it only after the last packet is gone). */
+void tr_packet_pool_destroy(TrionPacketPool *pool)
+{
+    if (!pool) return;
+    tr_mutex_lock(&pool->lock);
+    pool->closed = 1;
+    TrionPacketBuf *bufs = pool->free_bufs;
+    TrionPacket *pkts = pool->free_pkts;
+    pool->free_bufs = NULL; pool->nfree_bufs = 0;
+    pool->free_pkts = NULL; pool->nfree_pkts = 0;
+    tr_mutex_unlock(&pool->lock);
+    while (bufs) {
+        TrionPacketBuf *n = bufs->next;
+        quarantine_free(pool->q, bufs);
+        bufs = n;
+    }
+    while (pkts) {
+        TrionPacket *n = (TrionPacket*)pkts->payload;
+        free(pkts);
+        pkts = n;
+    }
+    packet_pool_unref(pool);
+}
+
+/* Returns a buffer with one reference held by the caller. Fails once the quarantine is sealed,
+   whether or not a cached buffer is available. */
+TrionPacketBuf *tr_packet_buf_acquire(TrionPacketPool *pool)
+{
+    if (!pool) { tr_set_last_error_fmt("tr_packet_buf_acquire: invalid pool"); return NULL; }
+    if (tr_atomic_load_acquire(&pool->q->sealed)) { tr_set_last_error_fmt("tr_packet_buf_acquire: quarantine sealed"); return NULL; }
+    TrionPacketBuf *b = NULL;
+    tr_mutex_lock(&pool->lock);
+    if (pool->closed) { tr_mutex_unlock(&pool->lock); tr_set_last_error_fmt("tr_packet_buf_acquire: pool destroyed"); return NULL; }
+    if (pool->free_bufs) {
+        b = pool->free_bufs;
+        pool->free_bufs = b->next;
+        pool->nfree_bufs--;
+    }
+    tr_mutex_unlock(&pool->lock);
+    if (!b) {
+        b = (TrionPacketBuf*)quarantine_alloc(pool->q, TR_PBUF_HDR + pool->buf_size);
+        if (!b) return NULL;   /* quarantine_alloc set the error (sealed / OOM) */
+        b->pool = pool;
+        b->capacity = pool->buf_size;
+        b->data = (uint8_t*)b + TR_PBUF_HDR;
+        b->reserved = 0;
+    }
+    b->next = NULL;
+    b->refs = 1;
+    tr_atomic_fetch_add(&pool->refs, 1u);
+    return b;
+}
+
+void tr_packet_buf_retain(TrionPacketBuf *b)
+{
+    if (b) tr_atomic_fetch_add(&b->refs, 1u);
+}
+
+/* Drops one reference; the last one returns the buffer to its pool cache (or to the quarantine
+   when the cache is full, the pool is destroyed or the quarantine is sealed). */
+void tr_packet_buf_release(TrionPacketBuf *b)
+{
+    if (!b || tr_atomic_fetch_sub(&b->refs, 1u) != 1) return;
+    TrionPacketPool *pool = b->pool;
+    int cached = 0;
+    if (!tr_atomic_load_acquire(&pool->q->sealed)) {
+        tr_mutex_lock(&pool->lock);
+        if (!pool->closed && pool->nfree_bufs < pool->max_cached) {
+            b->next = pool->free_bufs;
+            pool->free_bufs = b;
+            pool->nfree_bufs++;
+            cached = 1;
+        }
+        tr_mutex_unlock(&pool->lock);
+    }
+    if (!cached) quarantine_free(pool->q, b);
+    packet_pool_unref(pool);
+}
+
+void *tr_packet_buf_data(TrionPacketBuf *b) { return b ? b->data : NULL; }
+size_t tr_packet_buf_capacity(const TrionPacketBuf *b) { return b ? b->capacity : 0; }
+
+/* Zero-copy packet over b->data[off, off+len): takes its own reference on b, so the caller may
+   release theirs right away. Several packets may share one buffer (e.g. one per datagram of a
+   batched receive). */
+TrionPacket *tr_packet_wrap(TrionPacketBuf *b, size_t off, size_t len)
+{
+    if (!b || off > b->capacity || len > b->capacity - off) { tr_set_last_error_fmt("tr_packet_wrap: invalid args"); return NULL; }
+    TrionPacketPool *pool = b->pool;
+    TrionPacket *p = NULL;
+    tr_mutex_lock(&pool->lock);
+    if (pool->free_pkts) {
+        p = pool->free_pkts;
+        pool->free_pkts = (TrionPacket*)p->payload;
+        pool->nfree_pkts--;
+    }
+    tr_mutex_unlock(&pool->lock);
+    if (!p) {
+        p = (TrionPacket*)malloc(sizeof(TrionPacket));
+        if (!p) { tr_set_last_error_fmt("tr_packet_wrap: OOM"); return NULL; }
+    }
+    tr_packet_buf_retain(b);
+    p->buf = b;
+    p->q = pool->q;
+    p->payload = b->data + off;
+    p->length = len;
+    p->src_ip = p->dst_ip = 0;
+    p->src_port = p->dst_port = 0;
+    return p;
+}
+
+/* New packet sharing p's buffer for p->payload[off, off+len), with p's addressing copied.
+   Only zero-copy packets can be sliced; tr_packet_slice(p, 0, p->length) clones a handle. */
+TrionPacket *tr_packet_slice(const TrionPacket *p, size_t off, size_t len)
+{
+    if (!p || !p->buf) { tr_set_last_error_fmt("tr_packet_slice: not a zero-copy packet"); return NULL; }
+    if (off > p->length || len > p->length - off) { tr_set_last_error_fmt("tr_packet_slice: range out of bounds"); return NULL; }
+    size_t base = (size_t)((uint8_t*)p->payload - p->buf->data);
+    TrionPacket *s = tr_packet_wrap(p->buf, base + off, len);
+    if (!s) return NULL;
+    s->src_ip = p->src_ip;
+    s->dst_ip = p->dst_ip;
+    s->src_port = p->src_port;
+    s->dst_port = p->dst_port;
+    return s;
+}
+
+void tr_packet_destroy(TrionPacket *p)
+{
+    if (!p) return;
+    TrionPacketBuf *b = p->buf;
+    if (!b) { free(p); return; }
+    /* cache the header while our buffer reference still keeps the pool alive */
+    TrionPacketPool *pool = b->pool;
+    int cached = 0;
+    tr_mutex_lock(&pool->lock);
+    if (!pool->closed && pool->nfree_pkts < pool->max_cached) {
+        p->payload = pool->free_pkts;
+        pool->free_pkts = p;
+        pool->nfree_pkts++;
+        cached = 1;
+    }
+    tr_mutex_unlock(&pool->lock);
+    if (!cached) free(p);
+    tr_packet_buf_release(b);
+}
+
+int tr_packet_drop_if_src_ip(TrionPacket *p, uint32_t ip)
+{
+    if (!p) return 0;
+    return p->src_ip == ip;
+}
+
+/* ---------------------------
+   Packet filter engine (batched)
+   - a filter is an ordered rule list (CIDR src/dst, port ranges, allow/drop; first match wins)
+     plus src/dst blocklists and a default action
+   - batches of up to TR_PFILTER_BATCH packets are transposed into structure-of-arrays form and
+     each rule is evaluated across all lanes with AVX2/SSE2 compares (scalar elsewhere); rules
+     stop as soon as every lane is decided
+   - blocklists are 16/8/8 multibit prefix tries, so a lookup costs at most three loads no
+     matter how many prefixes are blocked; they are checked before the rules
+   - a filter is built first and then only read: tr_packet_filter_run may be called from many
+     threads at once, but not concurrently with add/block calls
+   --------------------------- */
+#define TR_PFILTER_ALLOW 0
+#define TR_PFILTER_DROP  1
+#define TR_PFILTER_SRC   0
+#define TR_PFILTER_DST   1
+#define TR_PFILTER_BATCH 256
+#define TR_PFILTER_WORDS (TR_PFILTER_BATCH / 64)
+
+typedef struct {
+    uint32_t src_net, src_mask;
+    uint32_t dst_net, dst_mask;
+    int32_t sport_lo, sport_hi;     /* inclusive; int32 so signed vector compares work */
+    int32_t dport_lo, dport_hi;
+    int action;
+} PacketFilterRule;
+
+/* level 0 is indexed by the top 16 bits, mid nodes by the next 8, leaves by the last 8; a set
+   term bit means the whole range below that entry is covered. Child indices are 1-based. */
+typedef struct {
+    uint64_t term[4];
+    uint32_t child[256];
+} PacketTrieMid;
+
+typedef struct {
+    uint64_t term[4];
+} PacketTrieLeaf;
+
+typedef struct {
+    int all;                    /* a /0 was inserted */
+    uint64_t *root_term;        /* 65536 bits */
+    uint32_t *root_child;       /* 65536 entries */
+    PacketTrieMid *mids;
+    size_t nmids, cap_mids;
+    PacketTrieLeaf *leaves;
+    size_t nleaves, cap_leaves;
+    size_t prefixes;
+} PacketTrie;
+
+typedef struct TrionPacketFilter {
+    PacketFilterRule *rules;
+    size_t nrules, cap_rules;
+    int default_action;
+    PacketTrie block[2];        /* TR_PFILTER_SRC / TR_PFILTER_DST */
+} TrionPacketFilter;
+
+static inline uint32_t pfilter_prefix_mask(int prefix)
+{
+    return prefix <= 0 ? 0u : 0xFFFFFFFFu << (32 - prefix);
+}
+
+static void pfilter_bits_set(uint64_t *w, uint32_t start, uint32_t count)
+{
+    while (count) {
+        uint32_t bit = start & 63;
+        uint32_t take = 64 - bit < count ? 64 - bit : count;
+        uint64_t m = take == 64 ? ~0ull : (((1ull << take) - 1) << bit);
+        w[start >> 6] |= m;
+        start += take;
+        count -= take;
+    }
+}
+
+static inline int pfilter_bit(const uint64_t *w, uint32_t i) { return (int)((w[i >> 6] >> (i & 63)) & 1); }
+
+static int pfilter_trie_insert(PacketTrie *t, uint32_t net, int prefix)
+{
+    if (prefix == 0) { t->all = 1; t->prefixes++; return 0; }
+    if (!t->root_term) {
+        t->root_term = (uint64_t*)calloc(65536 / 64, sizeof(uint64_t));
+        t->root_child = (uint32_t*)calloc(65536, sizeof(uint32_t));
+        if (!t->root_term || !t->root_child) { free(t->root_term); free(t->root_child); t->root_term = NULL; t->root_child = NULL; return -1; }
+    }
+    uint32_t i0 = net >> 16;
+    if (prefix <= 16) {
+        uint32_t span = 1u << (16 - prefix);
+        pfilter_bits_set(t->root_term, i0 & ~(span - 1), span);
+        t->prefixes++;
+        return 0;
+    }
+    if (pfilter_bit(t->root_term, i0)) return 0;   /* already covered by a shorter prefix */
+    if (!t->root_child[i0]) {
+        if (t->nmids == t->cap_mids) {
+            size_t nc = t->cap_mids ? t->cap_mids * 2 : 16;
+            PacketTrieMid *n = (PacketTrieMid*)realloc(t->mids, nc * sizeof(PacketTrieMid));
+            if (!n) return -1;
+            t->mids = n; t->cap_mids = nc;
+        }
+        memset(&t->mids[t->nmids], 0, sizeof(PacketTrieMid));
+        t->root_child[i0] = (uint32_t)++t->nmids;
+    }
+    PacketTrieMid *mid = &t->mids[t->root_child[i0] - 1];
+    uint32_t i1 = (net >> 8) & 0xFF;
+    if (prefix <= 24) {
+        uint32_t span = 1u << (24 - prefix);
+        pfilter_bits_set(mid->term, i1 & ~(span - 1), span);
+        t->prefixes++;
+        return 0;
+    }
+    if (pfilter_bit(mid->term, i1)) return 0;
+    if (!mid->child[i1]) {
+        if (t->nleaves == t->cap_leaves) {
+            size_t nc = t->cap_leaves ? t->cap_leaves * 2 : 16;
+            PacketTrieLeaf *n = (PacketTrieLeaf*)realloc(t->leaves, nc * sizeof(PacketTrieLeaf));
+            if (!n) return -1;
+            t->leaves = n; t->cap_leaves = nc;
+        }
+        memset(&t->leaves[t->nleaves], 0, sizeof(PacketTrieLeaf));
+        mid->child[i1] = (uint32_t)++t->nleaves;
+    }
+    uint32_t span = 1u << (32 - prefix);
+    pfilter_bits_set(t->leaves[mid->child[i1] - 1].term, (net & 0xFF) & ~(span - 1), span);
+    t->prefixes++;
+    return 0;
+}
+
+static inline int pfilter_trie_lookup(const PacketTrie *t, uint32_t ip)
+{
+    if (t->all) return 1;
+    if (!t->root_term) return 0;
+    uint32_t i0 = ip >> 16;
+    if (pfilter_bit(t->root_term, i0)) return 1;
+    uint32_t m = t->root_child[i0];
+    if (!m) return 0;
+    const PacketTrieMid *mid = &t->mids[m - 1];
+    uint32_t i1 = (ip >> 8) & 0xFF;
+    if (pfilter_bit(mid->term, i1)) return 1;
+    uint32_t l = mid->child[i1];
+    return l ? pfilter_bit(t->leaves[l - 1].term, ip & 0xFF) : 0;
+}
+
+static void pfilter_trie_free(PacketTrie *t)
+{
+    free(t->root_term);
+    free(t->root_child);
+    free(t->mids);
+    free(t->leaves);
+    memset(t, 0, sizeof(*t));
+}
+
+TrionPacketFilter *tr_packet_filter_create(int default_action)
+{
+    if (default_action != TR_PFILTER_ALLOW && default_action != TR_PFILTER_DROP) {
+        tr_set_last_error_fmt("tr_packet_filter_create: invalid default action");
+        return NULL;
+    }
+    TrionPacketFilter *f = (TrionPacketFilter*)calloc(1, sizeof(TrionPacketFilter));
+    if (!f) { tr_set_last_error_fmt("tr_packet_filter_create: OOM"); return NULL; }
+    f->default_action = default_action;
+    return f;
+}
+
+void tr_packet_filter_destroy(TrionPacketFilter *f)
+{
+    if (!f) return;
+    pfilter_trie_free(&f->block[0]);
+    pfilter_trie_free(&f->block[1]);
+    free(f->rules);
+    free(f);
+}
+
+/* Append a rule (evaluated after all earlier ones). Addresses are host order like
+   TrionPacket::src_ip; a prefix of 0 matches any address, 0..65535 any port. */
+int tr_packet_filter_add_rule(TrionPacketFilter *f, uint32_t src_net, int src_prefix, uint32_t dst_net, int dst_prefix,
+                              uint16_t sport_lo, uint16_t sport_hi, uint16_t dport_lo, uint16_t dport_hi, int action)
+{
+    if (!f || src_prefix < 0 || src_prefix > 32 || dst_prefix < 0 || dst_prefix > 32 ||
+        sport_lo > sport_hi || dport_lo > dport_hi || (action != TR_PFILTER_ALLOW && action != TR_PFILTER_DROP)) {
+        tr_set_last_error_fmt("tr_packet_filter_add_rule: invalid args");
+        return -1;
+    }
+    if (f->nrules == f->cap_rules) {
+        size_t nc = f->cap_rules ? f->cap_rules * 2 : 8;
+        PacketFilterRule *n = (PacketFilterRule*)realloc(f->rules, nc * sizeof(PacketFilterRule));
+        if (!n) { tr_set_last_error_fmt("tr_packet_filter_add_rule: OOM"); return -1; }
+        f->rules = n; f->cap_rules = nc;
+    }
+    PacketFilterRule *r = &f->rules[f->nrules++];
+    r->src_mask = pfilter_prefix_mask(src_prefix);
+    r->src_net = src_net & r->src_mask;
+    r->dst_mask = pfilter_prefix_mask(dst_prefix);
+    r->dst_net = dst_net & r->dst_mask;
+    r->sport_lo = sport_lo; r->sport_hi = sport_hi;
+    r->dport_lo = dport_lo; r->dport_hi = dport_hi;
+    r->action = action;
+    return 0;
+}
+
+/* Add net/prefix to the source (TR_PFILTER_SRC) or destination (TR_PFILTER_DST) blocklist. */
+int tr_packet_filter_block(TrionPacketFilter *f, uint32_t net, int prefix, int which)
+{
+    if (!f || prefix < 0 || prefix > 32 || (which != TR_PFILTER_SRC && which != TR_PFILTER_DST)) {
+        tr_set_last_error_fmt("tr_packet_filter_block: invalid args");
+        return -1;
+    }
+    if (pfilter_trie_insert(&f->block[which], net & pfilter_prefix_mask(prefix), prefix) != 0) {
+        tr_set_last_error_fmt("tr_packet_filter_block: OOM");
+        return -1;
+    }
+    return 0;
+}
+
+/* header lanes of one batch; tails past n are zero and never marked undecided */
+typedef struct {
+    TR_ALIGNED(32) uint32_t src[TR_PFILTER_BATCH];
+    TR_ALIGNED(32) uint32_t dst[TR_PFILTER_BATCH];
+    TR_ALIGNED(32) int32_t sport[TR_PFILTER_BATCH];
+    TR_ALIGNED(32) int32_t dport[TR_PFILTER_BATCH];
+} PacketFilterLanes;
+
+/* match bits of rule r for lanes [0, nwords*64) */
+static void pfilter_match_rule(const PacketFilterLanes *L, size_t nwords, const PacketFilterRule *r, uint64_t *match)
+{
+#if defined(TR_HAVE_AVX2)
+    const __m256i sn = _mm256_set1_epi32((int)r->src_net), sm = _mm256_set1_epi32((int)r->src_mask);
+    const __m256i dn = _mm256_set1_epi32((int)r->dst_net), dm = _mm256_set1_epi32((int)r->dst_mask);
+    const __m256i spl = _mm256_set1_epi32(r->sport_lo - 1), sph = _mm256_set1_epi32(r->sport_hi + 1);
+    const __m256i dpl = _mm256_set1_epi32(r->dport_lo - 1), dph = _mm256_set1_epi32(r->dport_hi + 1);
+    for (size_t w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (unsigned j = 0; j < 64; j += 8) {
+            size_t i = w * 64 + j;
+            __m256i s = _mm256_load_si256((const __m256i*)(L->src + i));
+            __m256i d = _mm256_load_si256((const __m256i*)(L->dst + i));
+            __m256i sp = _mm256_load_si256((const __m256i*)(L->sport + i));
+            __m256i dp = _mm256_load_si256((const __m256i*)(L->dport + i));
+            __m256i m = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(s, sm), sn),
+                                         _mm256_cmpeq_epi32(_mm256_and_si256(d, dm), dn));
+            m = _mm256_and_si256(m, _mm256_and_si256(_mm256_cmpgt_epi32(sp, spl), _mm256_cmpgt_epi32(sph, sp)));
+            m = _mm256_and_si256(m, _mm256_and_si256(_mm256_cmpgt_epi32(dp, dpl), _mm256_cmpgt_epi32(dph, dp)));
+            bits |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(m)) << j;
+        }
+        match[w] = bits;
+    }
+#elif defined(TR_HAVE_SSE2)
+    const __m128i sn = _mm_set1_epi32((int)r->src_net), sm = _mm_set1_epi32((int)r->src_mask);
+    const __m128i dn = _mm_set1_epi32((int)r->dst_net), dm = _mm_set1_epi32((int)r->dst_mask);
+    const __m128i spl = _mm_set1_epi32(r->sport_lo - 1), sph = _mm_set1_epi32(r->sport_hi + 1);
+    const __m128i dpl = _mm_set1_epi32(r->dport_lo - 1), dph = _mm_set1_epi32(r->dport_hi + 1);
+    for (size_t w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (unsigned j = 0; j < 64; j += 4) {
+            size_t i = w * 64 + j;
+            __m128i s = _mm_load_si128((const __m128i*)(L->src + i));
+            __m128i d = _mm_load_si128((const __m128i*)(L->dst + i));
+            __m128i sp = _mm_load_si128((const __m128i*)(L->sport + i));
+            __m128i dp = _mm_load_si128((const __m128i*)(L->dport + i));
+            __m128i m = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(s, sm), sn),
+                                      _mm_cmpeq_epi32(_mm_and_si128(d, dm), dn));
+            m = _mm_and_si128(m, _mm_and_si128(_mm_cmpgt_epi32(sp, spl), _mm_cmplt_epi32(sp, sph)));
+            m = _mm_and_si128(m, _mm_and_si128(_mm_cmpgt_epi32(dp, dpl), _mm_cmplt_epi32(dp, dph)));
+            bits |= (uint64_t)(unsigned)_mm_movemask_ps(_mm_castsi128_ps(m)) << j;
+        }
+        match[w] = bits;
+    }
+#else
+    for (size_t w = 0; w < nwords; ++w) {
+        uint64_t bits = 0;
+        for (unsigned j = 0; j < 64; ++j) {
+            size_t i = w * 64 + j;
+            int m = (L->src[i] & r->src_mask) == r->src_net && (L->dst[i] & r->dst_mask) == r->dst_net &&
+                    L->sport[i] >= r->sport_lo && L->sport[i] <= r->sport_hi &&
+                    L->dport[i] >= r->dport_lo && L->dport[i] <= r->dport_hi;
+            bits |= (uint64_t)m << j;
+        }
+        match[w] = bits;
+    }
+#endif
+}
+
+/* Evaluate f over pkts[0..n) and write the verdicts to drop_bitmap ((n + 63) / 64 words, bit i
+   set = drop pkts[i]). NULL packets are dropped. Returns the number of dropped packets. */
+int tr_packet_filter_run(const TrionPacketFilter *f, TrionPacket *const *pkts, size_t n, uint64_t *drop_bitmap)
+{
+    if (!f || (n && (!pkts || !drop_bitmap))) { tr_set_last_error_fmt("tr_packet_filter_run: invalid args"); return -1; }
+    PacketFilterLanes L;
+    int check_src = f->block[TR_PFILTER_SRC].all || f->block[TR_PFILTER_SRC].prefixes;
+    int check_dst = f->block[TR_PFILTER_DST].all || f->block[TR_PFILTER_DST].prefixes;
+    size_t dropped = 0;
+    for (size_t base = 0; base < n; base += TR_PFILTER_BATCH) {
+        size_t cnt = n - base < TR_PFILTER_BATCH ? n - base : TR_PFILTER_BATCH;
+        size_t nwords = (cnt + 63) / 64;
+        uint64_t undecided[TR_PFILTER_WORDS] = {0}, drop[TR_PFILTER_WORDS] = {0}, match[TR_PFILTER_WORDS];
+        for (size_t i = 0; i < cnt; ++i) {
+            const TrionPacket *p = pkts[base + i];
+            if (!p) {
+                L.src[i] = L.dst[i] = 0; L.sport[i] = L.dport[i] = 0;
+                drop[i >> 6] |= 1ull << (i & 63);
+                continue;
+            }
+            L.src[i] = p->src_ip; L.dst[i] = p->dst_ip;
+            L.sport[i] = p->src_port; L.dport[i] = p->dst_port;
+            if ((check_src && pfilter_trie_lookup(&f->block[TR_PFILTER_SRC], p->src_ip)) ||
+                (check_dst && pfilter_trie_lookup(&f->block[TR_PFILTER_DST], p->dst_ip))) {
+                drop[i >> 6] |= 1ull << (i & 63);
+            } else {
+                undecided[i >> 6] |= 1ull << (i & 63);
+            }
+        }
+        for (size_t i = cnt; i < nwords * 64; ++i) { L.src[i] = L.dst[i] = 0; L.sport[i] = L.dport[i] = 0; }
+        for (size_t ri = 0; ri < f->nrules; ++ri) {
+            const PacketFilterRule *r = &f->rules[ri];
+            pfilter_match_rule(&L, nwords, r, match);
+            uint64_t left = 0;
+            for (size_t w = 0; w < nwords; ++w) {
+                uint64_t m = match[w] & undecided[w];
+                if (r->action == TR_PFILTER_DROP) drop[w] |= m;
+                undecided[w] &= ~m;
+                left |= undecided[w];
+            }
+            if (!left) break;
+        }
+        for (size_t w = 0; w < nwords; ++w) {
+            if (f->default_action == TR_PFILTER_DROP) drop[w] |= undecided[w];
+            drop_bitmap[base / 64 + w] = drop[w];
+#if defined(__GNUC__) || defined(__clang__)
+            dropped += (size_t)__builtin_popcountll(drop[w]);
+#else
+            for (uint64_t v = drop[w]; v; v &= v - 1) dropped++;
+#endif
+        }
+    }
+    return (int)dropped;
+}
+
+/* ---------------------------
+   Capsule lifecycle, messaging and callbacks
+   --------------------------- */
+
+/* Capsule execution modes:
+   - TR_CAPSULE_MODE_THREAD: `entry` runs to completion on a dedicated OS thread and may block freely
+   - TR_CAPSULE_MODE_TASK:   `step` is run by the work-stealing scheduler whenever the inbox has
+     messages; it must not block and reports what to do next with one of the codes below
+*/
+#define TR_CAPSULE_MODE_THREAD 0
+#define TR_CAPSULE_MODE_TASK   1
+
+#define TR_CAPSULE_PARK  0      /* inbox drained: sleep until the next tr_capsule_send */
+#define TR_CAPSULE_YIELD 1      /* more work pending: requeue behind other runnable capsules */
+#define TR_CAPSULE_DONE  2      /* finished; negative return values also stop the capsule */
+
+/* scheduling state of a task capsule */
+#define TR_SCHED_IDLE     0
+#define TR_SCHED_QUEUED   1
+#define TR_SCHED_RUNNING  2
+#define TR_SCHED_NOTIFIED 3     /* a message arrived while running: requeue instead of parking */
+#define TR_SCHED_FINISHED 4
+#define TR_SCHED_NEW      5     /* created, not started: sends only queue messages */
+
+/* placement state of a capsule created without one, see capsule_colocate */
+#define TR_CAPSULE_NODE_FIXED   0   /* placed (or nothing to place on a single-node machine) */
+#define TR_CAPSULE_NODE_OPEN    1   /* unplaced: the first peer it exchanges messages with decides */
+#define TR_CAPSULE_NODE_CLAIMED 2   /* being placed right now */
+#define TR_CAPSULE_NODE_RUNNING 3   /* unplaced thread capsule already running: only it can move itself */
+
+typedef struct Capsule {
+    char *name;
+    Quarantine *q;
+    Channel *inbox;            /* message channel for capsule */
+    tr_thread_t thread;
+    int running;
+    void *user_ctx;
+    int (*entry)(struct Capsule*, void*); /* entry procedure supplied by embedder */
+    int mode;
+    int (*step)(struct Capsule*, void*);  /* task mode: non-blocking step procedure */
+    uint32_t sched_state;
+    struct Capsule *sched_next;           /* link in the scheduler's injection queue */
+    int started;                          /* task mode: capsule_start already emitted */
+    int finished;
+    int exit_code;
+    tr_mutex_t done_lock;
+    tr_cond_t done_cond;
+    /* metrics: written only by the thread running the capsule, read by tr_metrics_snapshot */
+    uint64_t m_runs;                      /* entry runs (thread mode) or steps (task mode) */
+    uint64_t m_run_ns;
+    uint64_t m_lag_ns;                    /* task mode: total time spent runnable but not running */
+    uint64_t m_lag_max_ns;
+    uint64_t m_queued_ns;                 /* clock when last submitted to the scheduler */
+    struct Capsule *m_prev;               /* g_metric_capsules */
+    struct Capsule *m_next;
+    int node;                             /* NUMA node of its memory (and thread), -1 = unplaced */
+    int cpu;                              /* thread mode: CPU the thread is pinned to, -1 = any on node */
+    uint32_t node_open;                   /* TR_CAPSULE_NODE_* */
+} Capsule;
+
+/* capsule whose entry or step the calling thread is running, NULL elsewhere */
+static TR_THREAD_LOCAL Capsule *g_capsule_self = NULL;
+
+/* Capsule placement, fixed at creation:
+   - cpu >= 0 pins a thread capsule to that CPU (its node follows from the topology)
+   - node >= 0 keeps the capsule's quarantine and inbox ring on that node and runs a thread
+     capsule on the node's CPUs
+   - near co-locates with another capsule, typically the other end of its channels (when that
+     capsule is itself unplaced, this behaves like no placement)
+   - with everything unset (-1, -1, NULL, or no placement at all) on a multi-node machine the
+     capsule is placed by its wiring: the first time a capsule sends to it, or it sends to a
+     capsule, it takes the node of that peer (or, when neither is placed, the node the sender is
+     running on, and both go there). A thread capsule that has not started yet is pinned there
+     when it starts; a running one only moves when it is the sender. New quarantine memory is
+     bound to the node; the inbox ring stays where it was allocated, since it may be in use
+   Task capsules run on whichever scheduler worker picks them up, so for them only the memory part
+   applies. */
+typedef struct {
+    int node;
+    int cpu;
+    const Capsule *near;
+} TrCapsulePlacement;
+
+/* Event callback: capsule lifecycle or message events */
+typedef void (*tr_event_callback_t)(Capsule *capsule, const char *event, void *ctx);
+
+/* event filter bits for tr_register_event_callback_ex */
+#define TR_EVENT_CAPSULE_START (1u << 0)
+#define TR_EVENT_CAPSULE_STOP  (1u << 1)
+#define TR_EVENT_ALL           0xffffffffu
+
+/* Callback registry impl
+   Emit does one acquire load of the current snapshot and walks it; no lock, no allocation.
+   Register (rare) copies on write under the lock: entries are appended past the published
+   count of a shared, capacity-doubling array and a new snapshot header is published. Published
+   entries never change, and since callbacks cannot be unregistered, superseded headers and
+   arrays are only kept on a retired list until the registry is destroyed. Doubling keeps that
+   retained memory linear in the number of registrations. */
+typedef struct {
+    tr_event_callback_t cb;
+    void *ctx;
+    uint32_t mask;
+} CallbackEntry;
+
+typedef struct CallbackSnapshot {
+    const CallbackEntry *entries;
+    size_t count;
+    uint32_t mask;                    /* union of entry masks: emit returns early on no match */
+    struct CallbackSnapshot *retired; /* older header, kept for readers that may still hold it */
+} CallbackSnapshot;
+
+typedef struct CallbackArray {
+    struct CallbackArray *retired;
+    size_t capacity;
+    CallbackEntry entries[1];
+} CallbackArray;
+
+typedef struct {
+    CallbackSnapshot *snap;
+    CallbackArray *array;
+    tr_mutex_t lock;                  /* writers only */
+} CallbackRegistry;
+
+static CallbackRegistry *g_callback_registry = NULL;
+
+static CallbackRegistry *callback_registry_create(void)
+{
+    CallbackRegistry *r = (CallbackRegistry*)calloc(1, sizeof(CallbackRegistry));
+    if (!r) return NULL;
+    tr_mutex_init(&r->lock);
+    return r;
+}
+
+static void callback_registry_destroy(CallbackRegistry *r)
+{
+    if (!r) return;
+    tr_mutex_destroy(&r->lock);
+    for (CallbackSnapshot *s = r->snap, *n; s; s = n) { n = s->retired; free(s); }
+    for (CallbackArray *a = r->array, *n; a; a = n) { n = a->retired; free(a); }
+    free(r);
+}
+
+int tr_register_event_callback_ex(tr_event_callback_t cb, void *ctx, uint32_t event_mask)
+{
+    if (!cb || !event_mask) { tr_set_last_error_fmt("tr_register_event_callback: invalid cb or event mask"); return -1; }
+    if (!g_callback_registry) g_callback_registry = callback_registry_create();
+    CallbackRegistry *r = g_callback_registry;
+    tr_mutex_lock(&r->lock);
+    CallbackSnapshot *old = r->snap;
+    size_t count = old ? old->count : 0;
+    CallbackSnapshot *ns = (CallbackSnapshot*)malloc(sizeof(CallbackSnapshot));
+    if (!ns) { tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("tr_register_event_callback: OOM"); return -1; }
+    if (!r->array || count == r->array->capacity) {
+        size_t nc = r->array ? r->array->capacity * 2 : 4;
+        CallbackArray *na = (CallbackArray*)malloc(sizeof(CallbackArray) + (nc - 1) * sizeof(CallbackEntry));
+        if (!na) { free(ns); tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("tr_register_event_callback: realloc failed"); return -1; }
+        na->capacity = nc;
+        na->retired = r->array;
+        if (count) memcpy(na->entries, r->array->entries, count * sizeof(CallbackEntry));
+        r->array = na;
+    }
+    CallbackEntry *e = &r->array->entries[count];
+    e->cb = cb;
+    e->ctx = ctx;
+    e->mask = event_mask;
+    ns->entries = r->array->entries;
+    ns->count = count + 1;
+    ns->mask = (old ? old->mask : 0) | event_mask;
+    ns->retired = old;
+    tr_atomic_store_release(&r->snap, ns);
+    tr_mutex_unlock(&r->lock);
+    return 0;
+}
+
+int tr_register_event_callback(tr_event_callback_t cb, void *ctx)
+{
+    return tr_register_event_callback_ex(cb, ctx, TR_EVENT_ALL);
+}
+
+static void callback_registry_emit(CallbackRegistry *r, Capsule *c, uint32_t evt, const char *name)
+{
+    if (!r || !c) return;
+    const CallbackSnapshot *s = tr_atomic_load_acquire(&r->snap);
+    if (!s || !(s->mask & evt)) return;
+    for (size_t i = 0; i < s->count; ++i) {
+        if (s->entries[i].mask & evt) s->entries[i].cb(c, name, s->entries[i].ctx);
+    }
+}
+
+/* account one entry run or task step that started at t0 (0: timing off) */
+static void capsule_note_run(Capsule *c, uint64_t t0)
+{
+    tr_atomic_store_relaxed(&c->m_runs, c->m_runs + 1);
+    tr_metric_add(TR_M_CAPSULE_RUNS, 1);
+    if (!t0) return;
+    uint64_t ns = tr_metric_elapsed(t0);
+    tr_atomic_store_relaxed(&c->m_run_ns, c->m_run_ns + ns);
+    tr_hist_record(TR_H_CAPSULE_RUN, ns);
+}
+
+/* Thread entry wrapper for capsule */
+static void *capsule_thread_start(void *arg)
+{
+    Capsule *c = (Capsule*)arg;
+    if (!c) return NULL;
+    /* from here on an unplaced capsule can only be moved by itself (see capsule_adopt_node) */
+    uint32_t st = TR_CAPSULE_NODE_OPEN;
+    while (!tr_atomic_cas(&c->node_open, &st, (uint32_t)TR_CAPSULE_NODE_RUNNING) && st != TR_CAPSULE_NODE_FIXED) {
+        st = TR_CAPSULE_NODE_OPEN;
+        tr_cpu_relax();
+    }
+    int node = tr_atomic_load_acquire(&c->node);
+    if (node >= 0 || c->cpu >= 0) tr_numa_place_self(node, c->cpu);
+    g_capsule_self = c;
+    c->running = 1;
+    if (g_callback_registry) callback_registry_emit(g_callback_registry, c, TR_EVENT_CAPSULE_START, "capsule_start");
+    int rc = 0;
+    uint64_t t0 = tr_metric_clock();
+    TR_TRACE('B', "capsule.run", c->name, NULL, 0);
+    if (c->entry) rc = c->entry(c, c->user_ctx);
+    TR_TRACE('E', "capsule.run", NULL, "rc", rc);
+    capsule_note_run(c, t0);
+    /* drain inbox if present */
+    if (c->inbox) {
+        void *msgs[32];
+        while (channel_recv_many(c->inbox, msgs, 32, 0, 0) > 0) {
+            (void)msgs;
+        }
+    }
+    c->running = 0;
+    if (g_callback_registry) callback_registry_emit(g_callback_registry, c, TR_EVENT_CAPSULE_STOP, "capsule_stop");
+    return (void*)(intptr_t)rc;
+}
+
+/* ---------------------------
+   Work-stealing capsule scheduler (M:N)
+   - fixed pool of workers (default: one per online CPU), each owning a Chase-Lev deque
+   - capsules scheduled from outside the pool go through a mutex-protected injection queue
+   - idle workers steal from random victims, then sleep on a condvar; submitters only take the
+     lock to wake someone when a worker has announced it is going to sleep
+   --------------------------- */
+
+#define TR_SCHED_DEQUE_CAP 1024   /* per-worker; overflow spills into the injection queue */
+#define TR_SCHED_SPIN      64
+#define TR_SCHED_FAIRNESS  61     /* poll the injection queue first every N local pops */
+
+typedef struct {
+    TR_ALIGNED(TR_CACHELINE) int64_t top;      /* steal end */
+    TR_ALIGNED(TR_CACHELINE) int64_t bottom;   /* owner end */
+    Capsule **buf;
+    int64_t mask;
+    tr_thread_t thread;
+    uint32_t rng;
+    uint32_t tick;
+    size_t index;
+} SchedWorker;
+
+typedef struct {
+    SchedWorker *workers;
+    size_t nworkers;
+    tr_mutex_t lock;             /* injection queue + sleeping */
+    tr_cond_t wake;
+    Capsule *inject_head;
+    Capsule *inject_tail;
+    uint64_t inject_count;
+    uint64_t sleepers;
+    uint64_t wake_gen;           /* bumped under lock for every wakeup, guards against lost signals */
+    int shutdown;
+} Scheduler;
+
+static Scheduler g_sched;
+static uint32_t g_sched_state = 0;   /* 0 = stopped, 1 = transitioning, 2 = running */
+static TR_THREAD_LOCAL SchedWorker *g_sched_self = NULL;
+
+static size_t tr_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors ? (size_t)si.dwNumberOfProcessors : 1;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t)n : 1;
+#endif
+}
+
+/* Chase-Lev deque operations */
+
+static int sched_deque_push(SchedWorker *w, Capsule *c)
+{
+    int64_t b = tr_atomic_load_relaxed(&w->bottom);
+    int64_t t = tr_atomic_load_acquire(&w->top);
+    if (b - t > w->mask) return 0;
+    tr_atomic_store_relaxed(&w->buf[b & w->mask], c);
+    tr_atomic_store_release(&w->bottom, b + 1);
+    return 1;
+}
+
+static Capsule *sched_deque_pop(SchedWorker *w)
+{
+    int64_t b = tr_atomic_load_relaxed(&w->bottom) - 1;
+    tr_atomic_store_relaxed(&w->bottom, b);
+    tr_atomic_fence();
+    int64_t t = tr_atomic_load_relaxed(&w->top);
+    if (t > b) { tr_atomic_store_relaxed(&w->bottom, b + 1); return NULL; }
+    Capsule *c = tr_atomic_load_relaxed(&w->buf[b & w->mask]);
+    if (t == b) {
+        /* last element: race against thieves for it */
+        if (!tr_atomic_cas(&w->top, &t, t + 1)) c = NULL;
+        tr_atomic_store_relaxed(&w->bottom, b + 1);
+    }
+    return c;
+}
+
+static Capsule *sched_deque_steal(SchedWorker *w)
+{
+    int64_t t = tr_atomic_load_acquire(&w->top);
+    tr_atomic_fence();
+    int64_t b = tr_atomic_load_acquire(&w->bottom);
+    if (t >= b) return NULL;
+    Capsule *c = tr_atomic_load_relaxed(&w->buf[t & w->mask]);
+    if (!tr_atomic_cas(&w->top, &t, t + 1)) return NULL;
+    return c;
+}
+
+static void sched_wake_one(void)
+{
+    tr_atomic_fence();
+    if (tr_atomic_load_relaxed(&g_sched.sleepers) == 0) return;
+    tr_mutex_lock(&g_sched.lock);
+    g_sched.wake_gen++;
+    tr_cond_notify_one(&g_sched.wake);
+    tr_mutex_unlock(&g_sched.lock);
+}
+
+static void sched_inject(Capsule *c)
+{
+    tr_mutex_lock(&g_sched.lock);
+    c->sched_next = NULL;
+    if (g_sched.inject_tail) g_sched.inject_tail->sched_next = c; else g_sched.inject_head = c;
+    g_sched.inject_tail = c;
+    tr_atomic_fetch_add(&g_sched.inject_count, (uint64_t)1);
+    tr_mutex_unlock(&g_sched.lock);
+}
+
+/* capsules woken from a worker go to its own deque (LIFO, cache-warm); everything else, including
+   yielded capsules that should run behind their peers, goes to the FIFO injection queue */
+static void sched_submit_ex(Capsule *c, int to_back)
+{
+    tr_atomic_store_relaxed(&c->m_queued_ns, tr_metric_clock());
+    SchedWorker *w = g_sched_self;
+    if (to_back || !w || !sched_deque_push(w, c)) sched_inject(c);
+    sched_wake_one();
+}
+
+static void sched_submit(Capsule *c) { sched_submit_ex(c, 0); }
+
+static Capsule *sched_take_injected(void)
+{
+    if (!tr_atomic_load_acquire(&g_sched.inject_count)) return NULL;
+    tr_mutex_lock(&g_sched.lock);
+    Capsule *c = g_sched.inject_head;
+    if (c) {
+        g_sched.inject_head = c->sched_next;
+        if (!g_sched.inject_head) g_sched.inject_tail = NULL;
+        tr_atomic_fetch_sub(&g_sched.inject_count, (uint64_t)1);
+    }
+    tr_mutex_unlock(&g_sched.lock);
+    return c;
+}
+
+static Capsule *sched_find_work(SchedWorker *w)
+{
+    Capsule *c = NULL;
+    if (++w->tick % TR_SCHED_FAIRNESS == 0) c = sched_take_injected();
+    if (!c) c = sched_deque_pop(w);
+    if (!c) c = sched_take_injected();
+    if (c) return c;
+    size_t n = g_sched.nworkers;
+    w->rng = w->rng * 1103515245u + 12345u;
+    size_t start = (size_t)(w->rng >> 16) % n;
+    for (size_t i = 0; i < n; ++i) {
+        SchedWorker *v = &g_sched.workers[(start + i) % n];
+        if (v == w) continue;
+        c = sched_deque_steal(v);
+        if (c) return c;
+    }
+    return NULL;
+}
+
+static void capsule_task_finish(Capsule *c, int rc)
+{
+    tr_atomic_store_release(&c->sched_state, (uint32_t)TR_SCHED_FINISHED);
+    tr_atomic_store_release(&c->running, 0);
+    if (c->inbox) {
+        void *msgs[32];
+        while (channel_recv_many(c->inbox, msgs, 32, 0, 0) > 0) {
+            (void)msgs;
+        }
+    }
+    if (g_callback_registry) callback_registry_emit(g_callback_registry, c, TR_EVENT_CAPSULE_STOP, "capsule_stop");
+    /* last touch of c: a joiner may free it as soon as the lock is released */
+    tr_mutex_lock(&c->done_lock);
+    c->exit_code = rc;
+    c->finished = 1;
+    tr_cond_notify_all(&c->done_cond);
+    tr_mutex_unlock(&c->done_lock);
+}
+
+static void capsule_task_run(Capsule *c)
+{
+    tr_atomic_store_release(&c->sched_state, (uint32_t)TR_SCHED_RUNNING);
+    uint64_t t0 = tr_metric_clock();
+    uint64_t queued = tr_atomic_load_relaxed(&c->m_queued_ns);
+    if (t0 && queued && t0 > queued) {
+        uint64_t lag = t0 - queued;
+        tr_atomic_store_relaxed(&c->m_lag_ns, c->m_lag_ns + lag);
+        if (lag > c->m_lag_max_ns) tr_atomic_store_relaxed(&c->m_lag_max_ns, lag);
+        tr_hist_record(TR_H_CAPSULE_INBOX_LAG, lag);
+    }
+    if (!c->started) {
+        c->started = 1;
+        if (g_callback_registry) callback_registry_emit(g_callback_registry, c, TR_EVENT_CAPSULE_START, "capsule_start");
+    }
+    TR_TRACE('B', "capsule.step", c->name, NULL, 0);
+    g_capsule_self = c;
+    int rc = c->step ? c->step(c, c->user_ctx) : TR_CAPSULE_DONE;
+    g_capsule_self = NULL;
+    TR_TRACE('E', "capsule.step", NULL, "rc", rc);
+    capsule_note_run(c, t0);
+    if (rc == TR_CAPSULE_PARK) {
+        uint32_t expected = TR_SCHED_RUNNING;
+        if (tr_atomic_cas(&c->sched_state, &expected, (uint32_t)TR_SCHED_IDLE)) return;
+        /* notified while running */
+        tr_atomic_store_release(&c->sched_state, (uint32_t)TR_SCHED_QUEUED);
+        sched_submit(c);
+        return;
+    }
+    if (rc == TR_CAPSULE_YIELD) {
+        tr_atomic_store_release(&c->sched_state, (uint32_t)TR_SCHED_QUEUED);
+        sched_submit_ex(c, 1);
+        return;
+    }
+    capsule_task_finish(c, rc == TR_CAPSULE_DONE ? 0 : rc);
+}
+
+/* make a task capsule runnable after a send/close; cheap when it is already queued or running */
+static void capsule_sched_notify(Capsule *c)
+{
+    for (;;) {
+        uint32_t st = tr_atomic_load_acquire(&c->sched_state);
+        if (st == TR_SCHED_IDLE) {
+            if (tr_atomic_cas(&c->sched_state, &st, (uint32_t)TR_SCHED_QUEUED)) { sched_submit(c); return; }
+        } else if (st == TR_SCHED_RUNNING) {
+            if (tr_atomic_cas(&c->sched_state, &st, (uint32_t)TR_SCHED_NOTIFIED)) return;
+        } else {
+            return;
+        }
+    }
+}
+
+static void *sched_worker_main(void *arg)
+{
+    SchedWorker *w = (SchedWorker*)arg;
+    g_sched_self = w;
+    while (!tr_atomic_load_acquire(&g_sched.shutdown)) {
+        Capsule *c = sched_find_work(w);
+        for (int i = 0; !c && i < TR_SCHED_SPIN; ++i) { tr_cpu_relax(); c = sched_find_work(w); }
+        if (!c) {
+            tr_mutex_lock(&g_sched.lock);
+            uint64_t gen = g_sched.wake_gen;
+            tr_mutex_unlock(&g_sched.lock);
+            tr_atomic_fetch_add(&g_sched.sleepers, (uint64_t)1);
+            tr_atomic_fence();
+            c = sched_find_work(w);
+            if (!c) {
+                tr_mutex_lock(&g_sched.lock);
+                if (gen == g_sched.wake_gen && !tr_atomic_load_relaxed(&g_sched.shutdown)) tr_cond_timedwait(&g_sched.wake, &g_sched.lock, 100);
+                tr_mutex_unlock(&g_sched.lock);
+            }
+            tr_atomic_fetch_sub(&g_sched.sleepers, (uint64_t)1);
+            if (!c) continue;
+        }
+        capsule_task_run(c);
+    }
+    g_sched_self = NULL;
+    return NULL;
+}
+
+/* Start the worker pool (nworkers == 0: one per online CPU). Idempotent; called implicitly by
+   tr_capsule_start for task capsules. */
+int tr_scheduler_start(size_t nworkers)
+{
+    uint32_t st = 0;
+    while (!tr_atomic_cas(&g_sched_state, &st, (uint32_t)1)) {
+        if (st == 2) return 0;
+        st = 0;
+        tr_cpu_relax();
+    }
+    size_t n = nworkers ? nworkers : tr_cpu_count();
+    memset(&g_sched, 0, sizeof(g_sched));
+    g_sched.workers = (SchedWorker*)tr_aligned_alloc(TR_CACHELINE, n * sizeof(SchedWorker));
+    if (!g_sched.workers) {
+        tr_atomic_store_release(&g_sched_state, (uint32_t)0);
+        tr_set_last_error_fmt("tr_scheduler_start: OOM");
+        return -1;
+    }
+    memset(g_sched.workers, 0, n * sizeof(SchedWorker));
+    tr_mutex_init(&g_sched.lock);
+    tr_cond_init(&g_sched.wake);
+    size_t started = 0;
+    for (size_t i = 0; i < n; ++i) {
+        SchedWorker *w = &g_sched.workers[i];
+        w->buf = (Capsule**)calloc(TR_SCHED_DEQUE_CAP, sizeof(Capsule*));
+        w->mask = TR_SCHED_DEQUE_CAP - 1;
+        w->rng = (uint32_t)(i * 2654435761u + 1);
+        w->index = i;
+        if (!w->buf) break;
+    }
+    g_sched.nworkers = n;
+    for (size_t i = 0; i < n; ++i) {
+        if (!g_sched.workers[i].buf) break;
+        if (tr_thread_create(&g_sched.workers[i].thread, sched_worker_main, &g_sched.workers[i]) != 0) break;
+        started++;
+    }
+    if (started < n) {
+        tr_atomic_store_release(&g_sched.shutdown, 1);
+        tr_mutex_lock(&g_sched.lock);
+        g_sched.wake_gen++;
+        tr_cond_notify_all(&g_sched.wake);
+        tr_mutex_unlock(&g_sched.lock);
+        for (size_t i = 0; i < started; ++i) tr_thread_join(g_sched.workers[i].thread);
+        for (size_t i = 0; i < n; ++i) free(g_sched.workers[i].buf);
+        tr_aligned_free(g_sched.workers);
+        tr_cond_destroy(&g_sched.wake);
+        tr_mutex_destroy(&g_sched.lock);
+        tr_atomic_store_release(&g_sched_state, (uint32_t)0);
+        tr_set_last_error_fmt("tr_scheduler_start: failed to start %zu workers", n);
+        return -1;
+    }
+    tr_atomic_store_release(&g_sched_state, (uint32_t)2);
+    return 0;
+}
+
+/* Stop and join the worker pool. Capsules still queued are not run; callers should stop or
+   destroy task capsules before shutting the scheduler down. */
+void tr_scheduler_shutdown(void)
+{
+    uint32_t st = 2;
+    if (!tr_atomic_cas(&g_sched_state, &st, (uint32_t)1)) return;
+    tr_atomic_store_release(&g_sched.shutdown, 1);
+    tr_mutex_lock(&g_sched.lock);
+    g_sched.wake_gen++;
+    tr_cond_notify_all(&g_sched.wake);
+    tr_mutex_unlock(&g_sched.lock);
+    for (size_t i = 0; i < g_sched.nworkers; ++i) tr_thread_join(g_sched.workers[i].thread);
+    for (size_t i = 0; i < g_sched.nworkers; ++i) free(g_sched.workers[i].buf);
+    tr_aligned_free(g_sched.workers);
+    g_sched.workers = NULL;
+    g_sched.nworkers = 0;
+    tr_cond_destroy(&g_sched.wake);
+    tr_mutex_destroy(&g_sched.lock);
+    tr_atomic_store_release(&g_sched_state, (uint32_t)0);
+}
+
+/* resolves a placement into node/cpu; -1 with the error set when it names a CPU or node the
+   topology does not have */
+static int capsule_resolve_placement(const TrCapsulePlacement *pl, int *node, int *cpu)
+{
+    int nnodes = tr_numa_node_count();
+    *node = -1;
+    *cpu = -1;
+    if (pl && pl->cpu >= 0) {
+        if (pl->cpu >= TR_NUMA_MAX_CPUS || (size_t)pl->cpu >= tr_cpu_count()) { tr_set_last_error_fmt("tr_capsule_create: no CPU %d", pl->cpu); return -1; }
+        *cpu = pl->cpu;
+        *node = nnodes > 1 ? tr_numa_node_of_cpu(pl->cpu) : -1;
+        if (pl->node >= 0 && nnodes > 1 && pl->node != *node) { tr_set_last_error_fmt("tr_capsule_create: CPU %d is not on node %d", pl->cpu, pl->node); return -1; }
+    } else if (pl && pl->node >= 0) {
+        if (pl->node >= nnodes) { tr_set_last_error_fmt("tr_capsule_create: no NUMA node %d", pl->node); return -1; }
+        *node = nnodes > 1 ? pl->node : -1;
+    } else if (pl && pl->near) {
+        *node = tr_atomic_load_acquire(&pl->near->node);
+    }
+    return 0;
+}
+
+/* Create capsule: name owned by caller, will be copied into quarantine */
+static Capsule *capsule_create_common(const char *name, int mode, int inbox_kind, const TrCapsulePlacement *pl)
+{
+    if (!name) { tr_set_last_error_fmt("tr_capsule_create: invalid name"); return NULL; }
+    int node, cpu;
+    if (capsule_resolve_placement(pl, &node, &cpu) != 0) return NULL;
+    uint32_t node_open = node < 0 && cpu < 0 && tr_numa_node_count() > 1 ? TR_CAPSULE_NODE_OPEN : TR_CAPSULE_NODE_FIXED;
+    Capsule *c = (Capsule*)malloc(sizeof(Capsule));
+    if (!c) { tr_set_last_error_fmt("tr_capsule_create: OOM"); return NULL; }
+    c->q = quarantine_create(16);
+    if (!c->q) { free(c); tr_set_last_error_fmt("tr_capsule_create: quarantine_create failed"); return NULL; }
+    // store name in quarantine-owned memory
+    size_t nl = strlen(name) + 1;
+    char *nn = (char*)quarantine_alloc(c->q, nl);
+    if (!nn) { quarantine_destroy(c->q); free(c); tr_set_last_error_fmt("tr_capsule_create: name alloc failed"); return NULL; }
+    memcpy(nn, name, nl);
+    c->name = nn;
+    quarantine_set_node(c->q, node);
+    c->inbox = channel_create_ex(32, inbox_kind); /* default inbox size */
+    channel_place(c->inbox, node);
+    c->node = node;
+    c->cpu = cpu;
+    c->node_open = node_open;
+    c->thread = 0;
+    c->running = 0;
+    c->user_ctx = NULL;
+    c->entry = NULL;
+    c->mode = mode;
+    c->step = NULL;
+    c->sched_state = TR_SCHED_NEW;
+    c->sched_next = NULL;
+    c->started = 0;
+    c->finished = 0;
+    c->exit_code = 0;
+    c->m_runs = c->m_run_ns = c->m_lag_ns = c->m_lag_max_ns = c->m_queued_ns = 0;
+    tr_mutex_init(&c->done_lock);
+    tr_cond_init(&c->done_cond);
+    if (c->inbox) channel_set_name(c->inbox, nn);
+    tr_metrics_lock();
+    c->m_prev = NULL;
+    c->m_next = g_metric_capsules;
+    if (g_metric_capsules) g_metric_capsules->m_prev = c;
+    g_metric_capsules = c;
+    tr_metrics_unlock();
+    return c;
+}
+
+Capsule *tr_capsule_create_placed(const char *name, int (*entry)(Capsule*, void*), void *user_ctx, const TrCapsulePlacement *placement)
+{
+    Capsule *c = capsule_create_common(name, TR_CAPSULE_MODE_THREAD, TR_CHANNEL_LOCKED, placement);
+    if (!c) return NULL;
+    c->user_ctx = user_ctx;
+    c->entry = entry;
+    return c;
+}
+
+Capsule *tr_capsule_create(const char *name, int (*entry)(Capsule*, void*), void *user_ctx)
+{
+    return tr_capsule_create_placed(name, entry, user_ctx, NULL);
+}
+
+/* Task capsule: multiplexed onto the scheduler's worker pool instead of owning a thread.
+   `step` is called with the capsule's inbox ready to drain via tr_capsule_try_recv_batch and
+   returns TR_CAPSULE_PARK / TR_CAPSULE_YIELD / TR_CAPSULE_DONE (or a negative error). */
+Capsule *tr_capsule_create_task_placed(const char *name, int (*step)(Capsule*, void*), void *user_ctx, const TrCapsulePlacement *placement)
+{
+    if (!step) { tr_set_last_error_fmt("tr_capsule_create_task: invalid step"); return NULL; }
+    Capsule *c = capsule_create_common(name, TR_CAPSULE_MODE_TASK, TR_CHANNEL_MPSC, placement);
+    if (!c) return NULL;
+    c->user_ctx = user_ctx;
+    c->step = step;
+    return c;
+}
+
+Capsule *tr_capsule_create_task(const char *name, int (*step)(Capsule*, void*), void *user_ctx)
+{
+    return tr_capsule_create_task_placed(name, step, user_ctx, NULL);
+}
+
+/* NUMA node the capsule was placed on, -1 if unplaced */
+int tr_capsule_node(const Capsule *c) { return c ? tr_atomic_load_acquire(&c->node) : -1; }
+
+/* Fix an unplaced capsule on node. self: c is the calling thread's own capsule, so a running
+   thread capsule may pin itself. */
+static void capsule_adopt_node(Capsule *c, int node, int self)
+{
+    uint32_t st = TR_CAPSULE_NODE_OPEN;
+    if (!tr_atomic_cas(&c->node_open, &st, (uint32_t)TR_CAPSULE_NODE_CLAIMED)) {
+        if (!self || st != TR_CAPSULE_NODE_RUNNING) return;
+        if (!tr_atomic_cas(&c->node_open, &st, (uint32_t)TR_CAPSULE_NODE_CLAIMED)) return;
+        tr_numa_place_self(node, -1);
+    }
+    /* a thread capsule that has not started reads node when it starts, after this is published */
+    quarantine_set_node(c->q, node);
+    tr_atomic_store_release(&c->node, node);
+    tr_atomic_store_release(&c->node_open, (uint32_t)TR_CAPSULE_NODE_FIXED);
+    tr_audit_log("capsule %s: placed on node %d by its wiring", c->name, node);
+}
+
+/* topology-aware default placement: called on every send, so the common case (both ends already
+   placed) is two loads */
+static void capsule_colocate(Capsule *to)
+{
+    Capsule *from = g_capsule_self;
+    if (!from || from == to) return;
+    uint32_t fs = tr_atomic_load_relaxed(&from->node_open);
+    uint32_t ts = tr_atomic_load_relaxed(&to->node_open);
+    if (ts == TR_CAPSULE_NODE_OPEN) {
+        if (fs != TR_CAPSULE_NODE_FIXED) capsule_adopt_node(from, tr_numa_current_node(), 1);
+        int node = tr_atomic_load_acquire(&from->node);
+        if (node >= 0) capsule_adopt_node(to, node, 0);
+    } else if (fs != TR_CAPSULE_NODE_FIXED) {
+        int node = tr_atomic_load_acquire(&to->node);
+        if (node >= 0) capsule_adopt_node(from, node, 1);
+    }
+}
+
+static void capsule_task_wait(Capsule *c)
+{
+    tr_mutex_lock(&c->done_lock);
+    while (!c->finished) tr_cond_wait(&c->done_cond, &c->done_lock);
+    tr_mutex_unlock(&c->done_lock);
+}
+
+void tr_capsule_destroy(Capsule *c)
+{
+    if (!c) return;
+    if (c->mode == TR_CAPSULE_MODE_TASK) {
+        if (tr_atomic_load_acquire(&c->sched_state) != TR_SCHED_NEW) {
+            if (c->inbox) channel_close(c->inbox);
+            capsule_sched_notify(c);
+            capsule_task_wait(c);
+        }
+    } else if (c->thread) {
+        if (c->inbox) channel_close(c->inbox);
+        tr_thread_join(c->thread);
+        c->thread = 0;
+    }
+    tr_metrics_lock();
+    if (c->m_prev) c->m_prev->m_next = c->m_next; else g_metric_capsules = c->m_next;
+    if (c->m_next) c->m_next->m_prev = c->m_prev;
+    tr_metrics_unlock();
+    if (c->inbox) channel_destroy(c->inbox);
+    quarantine_destroy(c->q);
+    tr_cond_destroy(&c->done_cond);
+    tr_mutex_destroy(&c->done_lock);
+    free(c);
+}
+
+int tr_capsule_start(Capsule *c)
+{
+    if (!c) { tr_set_last_error_fmt("tr_capsule_start: invalid capsule"); return -1; }
+    if (c->running || c->thread) { tr_set_last_error_fmt("tr_capsule_start: already running"); return -1; }
+    if (c->mode == TR_CAPSULE_MODE_TASK) {
+        if (tr_atomic_load_acquire(&c->sched_state) != TR_SCHED_NEW) { tr_set_last_error_fmt("tr_capsule_start: task already started"); return -1; }
+        if (tr_scheduler_start(0) != 0) return -1;
+        c->running = 1;
+        uint32_t st = TR_SCHED_NEW;
+        if (!tr_atomic_cas(&c->sched_state, &st, (uint32_t)TR_SCHED_QUEUED)) { tr_set_last_error_fmt("tr_capsule_start: already running"); return -1; }
+        sched_submit(c);
+        return 0;
+    }
+    if (tr_thread_create(&c->thread, capsule_thread_start, (void*)c) != 0) { tr_set_last_error_fmt("tr_capsule_start: thread create failed"); return -1; }
+    return 0;
+}
+
+int tr_capsule_join(Capsule *c)
+{
+    if (!c) { tr_set_last_error_fmt("tr_capsule_join: invalid capsule"); return -1; }
+    if (c->mode == TR_CAPSULE_MODE_TASK) {
+        if (tr_atomic_load_acquire(&c->sched_state) != TR_SCHED_NEW) capsule_task_wait(c);
+        return 0;
+    }
+    /* the thread handle, not `running`, says whether there is something to join: the thread may
+       not have set running yet, or may already have cleared it */
+    if (!c->thread) return 0;
+    int rc = tr_thread_join(c->thread);
+    c->thread = 0;
+    return rc;
+}
+
+/* Sends block while the inbox is full, except on a scheduler worker (inside a task step): there
+   waiting could park the worker the receiving task needs, so a full inbox returns -2 instead and
+   the step should retry after returning TR_CAPSULE_YIELD. The batch send follows the same rule. */
+int tr_capsule_send(Capsule *c, void *msg)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_send: invalid args"); return -1; }
+    capsule_colocate(c);
+    int rc = channel_send(c->inbox, msg, g_sched_self == NULL, 0);
+    if (rc == 0 && c->mode == TR_CAPSULE_MODE_TASK) capsule_sched_notify(c);
+    return rc;
+}
+
+int tr_capsule_try_send(Capsule *c, void *msg)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_try_send: invalid args"); return -1; }
+    capsule_colocate(c);
+    int rc = channel_send(c->inbox, msg, 0, 0);
+    if (rc == 0 && c->mode == TR_CAPSULE_MODE_TASK) capsule_sched_notify(c);
+    return rc;
+}
+
+/* Stop a capsule: closes its inbox so the entry/step sees end-of-stream (task capsules are
+   scheduled one last time to observe it). Does not wait; use tr_capsule_join. */
+void tr_capsule_stop(Capsule *c)
+{
+    if (!c || !c->inbox) return;
+    channel_close(c->inbox);
+    if (c->mode == TR_CAPSULE_MODE_TASK) capsule_sched_notify(c);
+}
+
+/* Batched inbox I/O: send blocks until all n messages are queued (on a scheduler worker it
+   returns what fit, or -2); recv waits up to timeout_ms (0 = forever) for the first message and
+   then returns everything pending, up to max. */
+int tr_capsule_send_batch(Capsule *c, void *const *msgs, size_t n)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_send_batch: invalid args"); return -1; }
+    capsule_colocate(c);
+    int blocking = g_sched_self == NULL;
+    if (c->mode != TR_CAPSULE_MODE_TASK) return channel_send_many(c->inbox, msgs, n, blocking, 0);
+    /* a task only drains its inbox once scheduled, so every partial push is followed by a notify;
+       the only wait is a single-message send, which happens after the consumer has been notified */
+    size_t sent = 0;
+    int rc = 0;
+    while (sent < n) {
+        rc = channel_send_many(c->inbox, msgs + sent, n - sent, 0, 0);
+        if (rc == -2 && blocking) { rc = channel_send(c->inbox, msgs[sent], 1, 0); if (rc == 0) rc = 1; }
+        if (rc < 0) break;
+        sent += (size_t)rc;
+        capsule_sched_notify(c);
+    }
+    return sent ? (int)sent : rc;
+}
+
+/* Non-blocking variant: queues as many as fit and returns that count (-2 when none fit). */
+int tr_capsule_try_send_batch(Capsule *c, void *const *msgs, size_t n)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_try_send_batch: invalid args"); return -1; }
+    capsule_colocate(c);
+    int rc = channel_send_many(c->inbox, msgs, n, 0, 0);
+    if (rc > 0 && c->mode == TR_CAPSULE_MODE_TASK) capsule_sched_notify(c);
+    return rc;
+}
+
+int tr_capsule_recv_batch(Capsule *c, void **out, size_t max, uint32_t timeout_ms)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_recv_batch: invalid args"); return -1; }
+    return channel_recv_many(c->inbox, out, max, 1, timeout_ms);
+}
+
+/* Non-blocking drain for task steps: returns the count, 0 once the inbox is closed and empty,
+   or -2 when there is nothing to read right now (return TR_CAPSULE_PARK). */
+int tr_capsule_try_recv_batch(Capsule *c, void **out, size_t max)
+{
+    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_try_recv_batch: invalid args"); return -1; }
+    return channel_recv_many(c->inbox, out, max, 0, 0);
+}
+
+/* ---------------------------
+   Packet ingestion (recvmmsg / sendmmsg batches)
+   - one poll drains up to TR_INGEST_MAX_BATCH datagrams/frames with a single recvmmsg straight
+     into TrionPacketPool buffers; each becomes a zero-copy TrionPacket without a memcpy
+   - TR_INGEST_UDP: datagram sockets, payload = datagram, addressing from the sender/local address
+   - TR_INGEST_RAW: AF_PACKET (Ethernet, optional 802.1Q) or raw IPv4 sockets; IPv4 + TCP/UDP
+     headers are parsed into the packet fields and payload points at the L4 payload
+   - packets fan out to capsule inboxes by flow hash (same 4-tuple -> same capsule, so per-flow
+     order is kept) with one non-blocking batch send per capsule; a full inbox drops the packet
+     instead of stalling the receive loop
+   - Linux only; elsewhere the calls fail with "unsupported on this platform"
+   --------------------------- */
+#define TR_INGEST_UDP 0
+#define TR_INGEST_RAW 1
+#define TR_INGEST_MAX_BATCH 64
+
+typedef struct {
+    uint64_t received;          /* datagrams/frames read from the socket */
+    uint64_t delivered;         /* packets queued on a capsule inbox */
+    uint64_t dropped_full;      /* target inbox full or closed, or no packet header available */
+    uint64_t dropped_parse;     /* RAW mode: not IPv4 or truncated headers */
+    uint64_t batches;           /* recvmmsg calls that returned data */
+} TrionIngestStats;
+
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+
+typedef struct TrionPacketIngest {
+    int fd;
+    int mode;
+    int l2;                     /* RAW: frames start with an Ethernet header */
+    size_t batch;
+    TrionPacketPool *pool;      /* not owned */
+    Capsule **targets;
+    size_t ntargets;
+    uint32_t local_ip;          /* UDP: destination fields for received datagrams */
+    uint16_t local_port;
+    TrionPacketBuf *bufs[TR_INGEST_MAX_BATCH];      /* acquired buffers carried across polls */
+    struct mmsghdr msgs[TR_INGEST_MAX_BATCH];
+    struct iovec iov[TR_INGEST_MAX_BATCH];
+    struct sockaddr_in names[TR_INGEST_MAX_BATCH];
+    TrionPacket **fan;          /* ntargets * batch staging slots */
+    size_t *fan_count;
+    TrionIngestStats stats;
+    int state;                  /* 0 stopped, 1 transitioning, 2 running (poll thread) */
+    int stop;
+    tr_thread_t thread;
+} TrionPacketIngest;
+
+static inline uint32_t ingest_flow_slot(const TrionPacket *p, size_t n)
+{
+    uint64_t h = ((uint64_t)p->src_ip << 32 | p->dst_ip) ^ (((uint64_t)p->src_port << 16 | p->dst_port) * 0x9E3779B97F4A7C15ull);
+    h ^= h >> 33; h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return (uint32_t)(((h >> 32) * (uint64_t)n) >> 32);
+}
+
+/* RAW mode: fill addressing from the frame and narrow the payload; returns -1 when unusable */
+static int ingest_parse_frame(TrionPacket *p, int l2)
+{
+    const uint8_t *b = (const uint8_t*)p->payload;
+    size_t len = p->length, off = 0;
+    if (l2) {
+        if (len < 14) return -1;
+        uint16_t et = (uint16_t)(b[12] << 8 | b[13]);
+        off = 14;
+        if (et == 0x8100) {
+            if (len < 18) return -1;
+            et = (uint16_t)(b[16] << 8 | b[17]);
+            off = 18;
+        }
+        if (et != 0x0800) return -1;
+    }
+    if (len - off < 20 || (b[off] >> 4) != 4) return -1;
+    size_t ihl = (size_t)(b[off] & 0x0F) * 4;
+    size_t tot = (size_t)(b[off + 2] << 8 | b[off + 3]);
+    if (ihl < 20 || tot < ihl || tot > len - off) return -1;
+    uint8_t proto = b[off + 9];
+    uint32_t src, dst;
+    memcpy(&src, b + off + 12, 4);
+    memcpy(&dst, b + off + 16, 4);
+    p->src_ip = ntohl(src);
+    p->dst_ip = ntohl(dst);
+    p->src_port = p->dst_port = 0;
+    size_t l4 = off + ihl, end = off + tot, data = l4;
+    if (proto == 17 || proto == 6) {
+        if (end - l4 < (proto == 17 ? 8u : 20u)) return -1;
+        p->src_port = (uint16_t)(b[l4] << 8 | b[l4 + 1]);
+        p->dst_port = (uint16_t)(b[l4 + 2] << 8 | b[l4 + 3]);
+        data = proto == 17 ? l4 + 8 : l4 + (size_t)(b[l4 + 12] >> 4) * 4;
+        if (data > end) return -1;
+    }
+    p->payload = (uint8_t*)p->payload + data;
+    p->length = end - data;
+    return 0;
+}
+
+/* fd: bound datagram socket (UDP) or AF_PACKET / raw IPv4 socket (RAW, l2 = 1 when frames carry
+   an Ethernet header). Buffers come from pool, whose buffer size bounds the datagram size
+   (longer ones are truncated). The ingest does not own fd, pool or the targets. */
+TrionPacketIngest *tr_packet_ingest_create(int fd, int mode, int l2, TrionPacketPool *pool, Capsule **targets, size_t ntargets, size_t batch)
+{
+    if (fd < 0 || !pool || !targets || ntargets == 0 || (mode != TR_INGEST_UDP && mode != TR_INGEST_RAW)) {
+        tr_set_last_error_fmt("tr_packet_ingest_create: invalid args");
+        return NULL;
+    }
+    TrionPacketIngest *g = (TrionPacketIngest*)calloc(1, sizeof(TrionPacketIngest));
+    if (!g) { tr_set_last_error_fmt("tr_packet_ingest_create: OOM"); return NULL; }
+    g->fd = fd;
+    g->mode = mode;
+    g->l2 = mode == TR_INGEST_RAW && l2;
+    g->batch = batch == 0 || batch > TR_INGEST_MAX_BATCH ? TR_INGEST_MAX_BATCH : batch;
+    g->pool = pool;
+    g->ntargets = ntargets;
+    g->targets = (Capsule**)malloc(ntargets * sizeof(Capsule*));
+    g->fan = (TrionPacket**)malloc(ntargets * g->batch * sizeof(TrionPacket*));
+    g->fan_count = (size_t*)calloc(ntargets, sizeof(size_t));
+    if (!g->targets || !g->fan || !g->fan_count) {
+        free(g->targets); free(g->fan); free(g->fan_count); free(g);
+        tr_set_last_error_fmt("tr_packet_ingest_create: OOM");
+        return NULL;
+    }
+    memcpy(g->targets, targets, ntargets * sizeof(Capsule*));
+    if (mode == TR_INGEST_UDP) {
+        struct sockaddr_in la;
+        socklen_t sl = sizeof(la);
+        if (getsockname(fd, (struct sockaddr*)&la, &sl) == 0 && la.sin_family == AF_INET) {
+            g->local_ip = ntohl(la.sin_addr.s_addr);
+            g->local_port = ntohs(la.sin_port);
+        }
+    }
+    return g;
+}
+
+/* Receive one batch (waiting up to timeout_ms for the socket to become readable, 0 = do not
+   wait) and hand it to the targets. Returns the number of packets delivered, -1 on a socket
+   error. Only one thread may poll a given ingest at a time. */
+int tr_packet_ingest_poll(TrionPacketIngest *g, uint32_t timeout_ms)
+{
+    if (!g) { tr_set_last_error_fmt("tr_packet_ingest_poll: invalid args"); return -1; }
+    if (timeout_ms) {
+        struct pollfd pfd;
+        pfd.fd = g->fd; pfd.events = POLLIN; pfd.revents = 0;
+        int pr = poll(&pfd, 1, (int)timeout_ms);
+        if (pr == 0) return 0;
+        if (pr < 0) {
+            if (errno == EINTR) return 0;
+            tr_set_last_error_fmt("tr_packet_ingest_poll: poll failed: %s", strerror(errno));
+            return -1;
+        }
+    }
+    size_t nb = 0;
+    while (nb < g->batch) {
+        if (!g->bufs[nb] && !(g->bufs[nb] = tr_packet_buf_acquire(g->pool))) break;
+        g->iov[nb].iov_base = g->bufs[nb]->data;
+        g->iov[nb].iov_len = g->bufs[nb]->capacity;
+        struct msghdr *h = &g->msgs[nb].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_iov = &g->iov[nb];
+        h->msg_iovlen = 1;
+        if (g->mode == TR_INGEST_UDP) { h->msg_name = &g->names[nb]; h->msg_namelen = sizeof(g->names[nb]); }
+        nb++;
+    }
+    if (nb == 0) return 0;      /* pool exhausted or quarantine sealed; error already set */
+    int n = recvmmsg(g->fd, g->msgs, (unsigned)nb, MSG_DONTWAIT, NULL);
+    if (n <= 0) {
+        if (n == 0 || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+        tr_set_last_error_fmt("tr_packet_ingest_poll: recvmmsg failed: %s", strerror(errno));
+        return -1;
+    }
+    uint64_t parse_drops = 0, full_drops = 0, delivered = 0;
+    for (int i = 0; i < n; ++i) {
+        TrionPacketBuf *b = g->bufs[i];
+        g->bufs[i] = NULL;
+        size_t len = g->msgs[i].msg_len < b->capacity ? g->msgs[i].msg_len : b->capacity;
+        TrionPacket *p = tr_packet_wrap(b, 0, len);
+        tr_packet_buf_release(b);       /* the packet holds the buffer from here on */
+        if (!p) { full_drops++; continue; }
+        if (g->mode == TR_INGEST_UDP) {
+            const struct sockaddr_in *sa = &g->names[i];
+            if (g->msgs[i].msg_hdr.msg_namelen >= sizeof(*sa) && sa->sin_family == AF_INET) {
+                p->src_ip = ntohl(sa->sin_addr.s_addr);
+                p->src_port = ntohs(sa->sin_port);
+            }
+            p->dst_ip = g->local_ip;
+            p->dst_port = g->local_port;
+        } else if (ingest_parse_frame(p, g->l2) != 0) {
+            tr_packet_destroy(p);
+            parse_drops++;
+            continue;
+        }
+        size_t t = g->ntargets == 1 ? 0 : ingest_flow_slot(p, g->ntargets);
+        g->fan[t * g->batch + g->fan_count[t]++] = p;
+    }
+    /* buffers the kernel did not fill stay in g->bufs for the next poll */
+    for (size_t i = (size_t)n; i < nb; ++i) { g->bufs[i - n] = g->bufs[i]; g->bufs[i] = NULL; }
+    for (size_t t = 0; t < g->ntargets; ++t) {
+        size_t cnt = g->fan_count[t];
+        if (!cnt) continue;
+        TrionPacket **slot = g->fan + t * g->batch;
+        int sent = tr_capsule_try_send_batch(g->targets[t], (void *const*)slot, cnt);
+        size_t ok = sent > 0 ? (size_t)sent : 0;
+        for (size_t k = ok; k < cnt; ++k) tr_packet_destroy(slot[k]);
+        delivered += ok;
+        full_drops += cnt - ok;
+        g->fan_count[t] = 0;
+    }
+    tr_atomic_fetch_add(&g->stats.received, (uint64_t)n);
+    tr_atomic_fetch_add(&g->stats.batches, (uint64_t)1);
+    if (delivered) tr_atomic_fetch_add(&g->stats.delivered, delivered);
+    if (full_drops) tr_atomic_fetch_add(&g->stats.dropped_full, full_drops);
+    if (parse_drops) tr_atomic_fetch_add(&g->stats.dropped_parse, parse_drops);
+    return (int)delivered;
+}
+
+static void *ingest_thread_main(void *arg)
+{
+    TrionPacketIngest *g = (TrionPacketIngest*)arg;
+    while (!tr_atomic_load_acquire(&g->stop)) {
+        if (tr_packet_ingest_poll(g, 100) < 0) {
+            tr_audit_log("packet ingest: %s", tr_get_last_error());
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Run tr_packet_ingest_poll on a dedicated thread until tr_packet_ingest_stop. Idempotent. */
+int tr_packet_ingest_start(TrionPacketIngest *g)
+{
+    if (!g) { tr_set_last_error_fmt("tr_packet_ingest_start: invalid args"); return -1; }
+    int expected = 0;
+    if (!tr_atomic_cas(&g->state, &expected, 1)) return 0;
+    tr_atomic_store_release(&g->stop, 0);
+    if (tr_thread_create(&g->thread, ingest_thread_main, g) != 0) {
+        tr_atomic_store_release(&g->state, 0);
+        return -1;
+    }
+    tr_atomic_store_release(&g->state, 2);
+    return 0;
+}
+
+void tr_packet_ingest_stop(TrionPacketIngest *g)
+{
+    if (!g) return;
+    int expected = 2;
+    if (!tr_atomic_cas(&g->state, &expected, 1)) return;
+    tr_atomic_store_release(&g->stop, 1);
+    tr_thread_join(g->thread);
+    tr_atomic_store_release(&g->state, 0);
+}
+
+void tr_packet_ingest_stats(const TrionPacketIngest *g, TrionIngestStats *out)
+{
+    if (!g || !out) return;
+    out->received = tr_atomic_load_relaxed(&g->stats.received);
+    out->delivered = tr_atomic_load_relaxed(&g->stats.delivered);
+    out->dropped_full = tr_atomic_load_relaxed(&g->stats.dropped_full);
+    out->dropped_parse = tr_atomic_load_relaxed(&g->stats.dropped_parse);
+    out->batches = tr_atomic_load_relaxed(&g->stats.batches);
+}
+
+void tr_packet_ingest_destroy(TrionPacketIngest *g)
+{
+    if (!g) return;
+    tr_packet_ingest_stop(g);
+    for (size_t i = 0; i < TR_INGEST_MAX_BATCH; ++i) tr_packet_buf_release(g->bufs[i]);
+    free(g->targets);
+    free(g->fan);
+    free(g->fan_count);
+    free(g);
+}
+
+/* Send each packet's payload as one datagram with sendmmsg, up to TR_INGEST_MAX_BATCH per call.
+   A non-zero dst_ip/dst_port is used as the destination, otherwise fd must be connected.
+   Returns the number sent (which may be short when the socket would block), -1 on error. */
+int tr_packet_send_batch(int fd, TrionPacket *const *pkts, size_t n)
+{
+    if (fd < 0 || (n && !pkts)) { tr_set_last_error_fmt("tr_packet_send_batch: invalid args"); return -1; }
+    struct mmsghdr msgs[TR_INGEST_MAX_BATCH];
+    struct iovec iov[TR_INGEST_MAX_BATCH];
+    struct sockaddr_in names[TR_INGEST_MAX_BATCH];
+    size_t sent = 0;
+    while (sent < n) {
+        size_t k = n - sent < TR_INGEST_MAX_BATCH ? n - sent : TR_INGEST_MAX_BATCH;
+        for (size_t i = 0; i < k; ++i) {
+            const TrionPacket *p = pkts[sent + i];
+            struct msghdr *h = &msgs[i].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            iov[i].iov_base = p->payload;
+            iov[i].iov_len = p->length;
+            h->msg_iov = &iov[i];
+            h->msg_iovlen = 1;
+            if (p->dst_ip || p->dst_port) {
+                memset(&names[i], 0, sizeof(names[i]));
+                names[i].sin_family = AF_INET;
+                names[i].sin_addr.s_addr = htonl(p->dst_ip);
+                names[i].sin_port = htons(p->dst_port);
+                h->msg_name = &names[i];
+                h->msg_namelen = sizeof(names[i]);
+            }
+        }
+        int r = sendmmsg(fd, msgs, (unsigned)k, 0);
+        if (r < 0) {
+            if (sent || errno == EAGAIN || errno == EWOULDBLOCK) break;
+            tr_set_last_error_fmt("tr_packet_send_batch: sendmmsg failed: %s", strerror(errno));
+            return -1;
+        }
+        sent += (size_t)r;
+        if ((size_t)r < k) break;
+    }
+    return (int)sent;
+}
+
+#else /* !__linux__ */
+
+typedef struct TrionPacketIngest { int unused; } TrionPacketIngest;
+
+TrionPacketIngest *tr_packet_ingest_create(int fd, int mode, int l2, TrionPacketPool *pool, Capsule **targets, size_t ntargets, size_t batch)
+{
+    (void)fd; (void)mode; (void)l2; (void)pool; (void)targets; (void)ntargets; (void)batch;
+    tr_set_last_error_fmt("tr_packet_ingest_create: unsupported on this platform");
+    return NULL;
+}
+int tr_packet_ingest_poll(TrionPacketIngest *g, uint32_t timeout_ms) { (void)g; (void)timeout_ms; tr_set_last_error_fmt("tr_packet_ingest_poll: unsupported on this platform"); return -1; }
+int tr_packet_ingest_start(TrionPacketIngest *g) { (void)g; tr_set_last_error_fmt("tr_packet_ingest_start: unsupported on this platform"); return -1; }
+void tr_packet_ingest_stop(TrionPacketIngest *g) { (void)g; }
+void tr_packet_ingest_stats(const TrionPacketIngest *g, TrionIngestStats *out) { (void)g; if (out) memset(out, 0, sizeof(*out)); }
+void tr_packet_ingest_destroy(TrionPacketIngest *g) { (void)g; }
+int tr_packet_send_batch(int fd, TrionPacket *const *pkts, size_t n) { (void)fd; (void)pkts; (void)n; tr_set_last_error_fmt("tr_packet_send_batch: unsupported on this platform"); return -1; }
+
+#endif
+
+/* ---------------------------
+   Timer service (hierarchical timing wheel)
+   - one driver thread advances a 4-level wheel of 64 slots at 1 ms resolution; a timer on
+     level n sits in the slot for its 64^n ms window and is cascaded down as the level below wraps
+   - arm/cancel are O(1): timers live on intrusive doubly-linked slot lists, and a per-level
+     occupancy bitmap lets the driver sleep until the next non-empty slot instead of ticking
+   - expired timers go onto a ready list that a small dispatch pool drains in batches, so slow
+     callbacks never hold up the wheel
+   - handles encode (generation << 32 | index + 1); a stale handle fails cancel instead of
+     touching a recycled timer
+   --------------------------- */
+
+#define TR_TIMER_LEVELS       4
+#define TR_TIMER_SLOT_BITS    6
+#define TR_TIMER_SLOTS        (1u << TR_TIMER_SLOT_BITS)
+#define TR_TIMER_SLOT_MASK    (TR_TIMER_SLOTS - 1)
+#define TR_TIMER_CHUNK        256   /* nodes per allocation; node addresses never move */
+#define TR_TIMER_BATCH        64    /* callbacks a dispatcher takes per lock round-trip */
+#define TR_TIMER_MAX_DISPATCH 4
+
+#define TR_TIMER_FREE    0
+#define TR_TIMER_ARMED   1   /* on a wheel slot */
+#define TR_TIMER_READY   2   /* expired, waiting on the ready list */
+#define TR_TIMER_RUNNING 3   /* callback executing on a dispatcher */
+
+typedef uint64_t tr_timer_handle_t;   /* 0 = invalid */
+
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;
+    uint64_t expires;          /* absolute tick (monotonic ms) */
+    uint32_t period;           /* 0 = one-shot */
+    uint32_t index;
+    uint32_t gen;
+    uint8_t state;
+    uint8_t level;
+    uint8_t slot;
+    uint8_t cancelled;         /* periodic timer cancelled while its callback was running */
+    void (*cb)(void*);
+    void *ctx;
+} TimerNode;
+
+typedef struct {
+    tr_mutex_t lock;
+    tr_cond_t tick_cond;       /* driver: earlier deadline armed, or shutdown */
+    tr_cond_t ready_cond;      /* dispatchers: ready list non-empty, or shutdown */
+    TimerNode *slots[TR_TIMER_LEVELS][TR_TIMER_SLOTS];
+    uint64_t bitmap[TR_TIMER_LEVELS];
+    uint64_t now;              /* last processed tick */
+    uint64_t deadline;         /* tick the driver sleeps until (UINT64_MAX = idle) */
+    size_t armed;
+    TimerNode *ready_head;
+    TimerNode **ready_tail;
+    TimerNode **chunks;
+    size_t nchunks;
+    TimerNode *free_list;      /* linked through next */
+    tr_thread_t driver;
+    tr_thread_t dispatch[TR_TIMER_MAX_DISPATCH];
+    size_t ndispatch;
+    int shutdown;
+} TimerWheel;
+
+static TimerWheel g_timers;
+static uint32_t g_timers_state = 0;   /* 0 = stopped, 1 = transitioning, 2 = running */
+
+static uint64_t tr_monotonic_ms(void)
+{
+#ifdef _WIN32
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)(ts.tv_nsec / 1000000);
+#endif
+}
+
+static TimerNode *timer_node_alloc(TimerWheel *w)
+{
+    if (!w->free_list) {
+        TimerNode **nc = (TimerNode**)realloc(w->chunks, (w->nchunks + 1) * sizeof(TimerNode*));
+        if (!nc) return NULL;
+        w->chunks = nc;
+        TimerNode *chunk = (TimerNode*)calloc(TR_TIMER_CHUNK, sizeof(TimerNode));
+        if (!chunk) return NULL;
+        w->chunks[w->nchunks] = chunk;
+        for (size_t i = TR_TIMER_CHUNK; i-- > 0;) {
+            chunk[i].index = (uint32_t)(w->nchunks * TR_TIMER_CHUNK + i);
+            chunk[i].gen = 1;
+            chunk[i].next = w->free_list;
+            w->free_list = &chunk[i];
+        }
+        w->nchunks++;
+    }
+    TimerNode *n = w->free_list;
+    w->free_list = n->next;
+    n->next = NULL;
+    n->pprev = NULL;
+    n->cancelled = 0;
+    return n;
+}
+
+static void timer_node_free(TimerWheel *w, TimerNode *n)
+{
+    n->state = TR_TIMER_FREE;
+    n->cb = NULL;
+    n->ctx = NULL;
+    if (++n->gen == 0) n->gen = 1;
+    n->pprev = NULL;
+    n->next = w->free_list;
+    w->free_list = n;
+}
+
+static tr_timer_handle_t timer_node_handle(const TimerNode *n)
+{
+    return ((uint64_t)n->gen << 32) | ((uint64_t)n->index + 1);
+}
+
+static TimerNode *timer_node_lookup(TimerWheel *w, tr_timer_handle_t h)
+{
+    uint64_t idx = (h & 0xffffffffu);
+    if (idx == 0) return NULL;
+    idx--;
+    if (idx >= (uint64_t)w->nchunks * TR_TIMER_CHUNK) return NULL;
+    TimerNode *n = &w->chunks[idx / TR_TIMER_CHUNK][idx % TR_TIMER_CHUNK];
+    if (n->state == TR_TIMER_FREE || n->gen != (uint32_t)(h >> 32)) return NULL;
+    return n;
+}
+
+/* place an armed node on the slot matching its distance from w->now (lock held) */
+static void timer_wheel_insert(TimerWheel *w, TimerNode *n)
+{
+    uint64_t e = n->expires > w->now ? n->expires : w->now + 1;
+    uint64_t delta = e - w->now;
+    unsigned level = 0;
+    while (level < TR_TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << (TR_TIMER_SLOT_BITS * (level + 1)))) level++;
+    uint64_t span = (uint64_t)1 << (TR_TIMER_SLOT_BITS * TR_TIMER_LEVELS);
+    if (delta >= span) e = w->now + span - 1;   /* beyond the wheel: farthest slot, re-cascaded later */
+    unsigned slot = (unsigned)((e >> (TR_TIMER_SLOT_BITS * level)) & TR_TIMER_SLOT_MASK);
+    TimerNode **head = &w->slots[level][slot];
+    n->next = *head;
+    if (n->next) n->next->pprev = &n->next;
+    n->pprev = head;
+    *head = n;
+    n->level = (uint8_t)level;
+    n->slot = (uint8_t)slot;
+    n->state = TR_TIMER_ARMED;
+    w->bitmap[level] |= (uint64_t)1 << slot;
+}
+
+static void timer_wheel_unlink(TimerWheel *w, TimerNode *n)
+{
+    *n->pprev = n->next;
+    if (n->next) n->next->pprev = n->pprev;
+    if (!w->slots[n->level][n->slot]) w->bitmap[n->level] &= ~((uint64_t)1 << n->slot);
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+static void timer_ready_push(TimerWheel *w, TimerNode *n)
+{
+    n->state = TR_TIMER_READY;
+    n->next = NULL;
+    n->pprev = w->ready_tail;
+    *w->ready_tail = n;
+    w->ready_tail = &n->next;
+}
+
+static void timer_ready_unlink(TimerWheel *w, TimerNode *n)
+{
+    if (!n->next) w->ready_tail = n->pprev;
+    else n->next->pprev = n->pprev;
+    *n->pprev = n->next;
+    n->next = NULL;
+    n->pprev = NULL;
+}
+
+/* detach a whole slot and re-file its timers relative to w->now; due ones go to the ready list */
+static void timer_wheel_cascade(TimerWheel *w, unsigned level, unsigned slot)
+{
+    TimerNode *n = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->bitmap[level] &= ~((uint64_t)1 << slot);
+    while (n) {
+        TimerNode *next = n->next;
+        if (n->expires <= w->now) { w->armed--; timer_ready_push(w, n); }
+        else timer_wheel_insert(w, n);
+        n = next;
+    }
+}
+
+/* advance w->now to target, moving every timer that falls due onto the ready list (lock held) */
+static void timer_wheel_advance(TimerWheel *w, uint64_t target)
+{
+    while (w->now < target) {
+        if (w->armed == 0) { w->now = target; break; }
+        if (w->bitmap[0] == 0 && ((w->now + 1) & TR_TIMER_SLOT_MASK)) {
+            /* nothing on level 0: jump to the tick before the next wrap */
+            uint64_t wrap = w->now | TR_TIMER_SLOT_MASK;
+            w->now = wrap < target ? wrap : target;
+            continue;
+        }
+        uint64_t t = ++w->now;
+        if ((t & TR_TIMER_SLOT_MASK) == 0) {
+            for (unsigned l = 1; l < TR_TIMER_LEVELS; ++l) {
+                unsigned s = (unsigned)((t >> (TR_TIMER_SLOT_BITS * l)) & TR_TIMER_SLOT_MASK);
+                if (w->bitmap[l] & ((uint64_t)1 << s)) timer_wheel_cascade(w, l, s);
+                if (s != 0) break;
+            }
+        }
+        unsigned s0 = (unsigned)(t & TR_TIMER_SLOT_MASK);
+        if (w->bitmap[0] & ((uint64_t)1 << s0)) timer_wheel_cascade(w, 0, s0);
+    }
+}
+
+/* earliest tick at which advancing can produce work: next level-0 slot, else the next cascade */
+static uint64_t timer_wheel_next_deadline(const TimerWheel *w)
+{
+    if (w->armed == 0) return UINT64_MAX;
+    if (w->bitmap[0]) {
+        unsigned from = (unsigned)((w->now + 1) & TR_TIMER_SLOT_MASK);
+        uint64_t rot = from ? (w->bitmap[0] >> from) | (w->bitmap[0] << (TR_TIMER_SLOTS - from)) : w->bitmap[0];
+        return w->now + 1 + tr_ctz64(rot);
+    }
+    return (w->now | TR_TIMER_SLOT_MASK) + 1;
+}
+
+static void *timer_driver_main(void *arg)
+{
+    TimerWheel *w = (TimerWheel*)arg;
+    tr_mutex_lock(&w->lock);
+    while (!w->shutdown) {
+        int had_ready = w->ready_head != NULL;
+        timer_wheel_advance(w, tr_monotonic_ms());
+        if (w->ready_head && !had_ready) tr_cond_notify_all(&w->ready_cond);
+        w->deadline = timer_wheel_next_deadline(w);
+        if (w->deadline == UINT64_MAX) { tr_cond_wait(&w->tick_cond, &w->lock); continue; }
+        uint64_t now = tr_monotonic_ms();
+        if (w->deadline > now) {
+            uint64_t wait = w->deadline - now;
+            tr_cond_timedwait(&w->tick_cond, &w->lock, (uint32_t)(wait > 1000 ? 1000 : wait));
+        }
+    }
+    tr_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void *timer_dispatch_main(void *arg)
+{
+    TimerWheel *w = (TimerWheel*)arg;
+    TimerNode *batch[TR_TIMER_BATCH];
+    tr_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->ready_head && !w->shutdown) tr_cond_wait(&w->ready_cond, &w->lock);
+        if (w->shutdown) break;
+        size_t n = 0;
+        while (n < TR_TIMER_BATCH && w->ready_head) {
+            TimerNode *t = w->ready_head;
+            timer_ready_unlink(w, t);
+            t->state = TR_TIMER_RUNNING;
+            batch[n++] = t;
+        }
+        if (w->ready_head) tr_cond_notify_one(&w->ready_cond);   /* leave the rest to a peer */
+        tr_mutex_unlock(&w->lock);
+        /* RUNNING nodes are never freed by cancel, so cb/ctx are stable without the lock */
+        for (size_t i = 0; i < n; ++i) {
+            TR_TRACE('B', "timer.fire", NULL, "timer", batch[i]->index);
+            batch[i]->cb(batch[i]->ctx);
+            TR_TRACE('E', "timer.fire", NULL, NULL, 0);
+        }
+        tr_mutex_lock(&w->lock);
+        int earlier = 0;
+        for (size_t i = 0; i < n; ++i) {
+            TimerNode *t = batch[i];
+            if (t->period && !t->cancelled) {
+                /* fixed rate; periods missed while the callback ran late are skipped */
+                t->expires += t->period;
+                if (t->expires <= w->now) t->expires = w->now + t->period;
+                timer_wheel_insert(w, t);
+                w->armed++;
+                if (t->expires < w->deadline) earlier = 1;
+            } else {
+                timer_node_free(w, t);
+            }
+        }
+        if (earlier) tr_cond_notify_one(&w->tick_cond);
+    }
+    tr_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void timer_service_teardown(TimerWheel *w, size_t ndispatch, int driver_started)
+{
+    tr_mutex_lock(&w->lock);
+    w->shutdown = 1;
+    tr_cond_notify_all(&w->tick_cond);
+    tr_cond_notify_all(&w->ready_cond);
+    tr_mutex_unlock(&w->lock);
+    if (driver_started) tr_thread_join(w->driver);
+    for (size_t i = 0; i < ndispatch; ++i) tr_thread_join(w->dispatch[i]);
+    for (size_t i = 0; i < w->nchunks; ++i) free(w->chunks[i]);
+    free(w->chunks);
+    w->chunks = NULL;
+    w->nchunks = 0;
+    tr_cond_destroy(&w->ready_cond);
+    tr_cond_destroy(&w->tick_cond);
+    tr_mutex_destroy(&w->lock);
+}
+
+/* Start the driver and dispatch pool (dispatch_threads == 0: one per CPU, at most
+   TR_TIMER_MAX_DISPATCH). Idempotent; called implicitly by the first timer_arm. */
+static int timer_service_start(size_t dispatch_threads)
+{
+    uint32_t st = 0;
+    while (!tr_atomic_cas(&g_timers_state, &st, (uint32_t)1)) {
+        if (st == 2) return 0;
+        st = 0;
+        tr_cpu_relax();
+    }
+    size_t n = dispatch_threads ? dispatch_threads : tr_cpu_count();
+    if (n > TR_TIMER_MAX_DISPATCH) n = TR_TIMER_MAX_DISPATCH;
+    memset(&g_timers, 0, sizeof(g_timers));
+    tr_mutex_init(&g_timers.lock);
+    tr_cond_init(&g_timers.tick_cond);
+    tr_cond_init(&g_timers.ready_cond);
+    g_timers.ready_tail = &g_timers.ready_head;
+    g_timers.now = tr_monotonic_ms();
+    g_timers.deadline = UINT64_MAX;
+    if (tr_thread_create(&g_timers.driver, timer_driver_main, &g_timers) != 0) {
+        timer_service_teardown(&g_timers, 0, 0);
+        tr_atomic_store_release(&g_timers_state, (uint32_t)0);
+        tr_set_last_error_fmt("timer_service_start: driver thread create failed");
+        return -1;
+    }
+    size_t started = 0;
+    while (started < n && tr_thread_create(&g_timers.dispatch[started], timer_dispatch_main, &g_timers) == 0) started++;
+    if (started == 0) {
+        timer_service_teardown(&g_timers, 0, 1);
+        tr_atomic_store_release(&g_timers_state, (uint32_t)0);
+        tr_set_last_error_fmt("timer_service_start: dispatch thread create failed");
+        return -1;
+    }
+    g_timers.ndispatch = started;
+    tr_atomic_store_release(&g_timers_state, (uint32_t)2);
+    return 0;
+}
+
+/* Stop and join the service. Pending timers are discarded without running their callbacks. */
+static void timer_service_shutdown(void)
+{
+    uint32_t st = 2;
+    if (!tr_atomic_cas(&g_timers_state, &st, (uint32_t)1)) return;
+    timer_service_teardown(&g_timers, g_timers.ndispatch, 1);
+    tr_atomic_store_release(&g_timers_state, (uint32_t)0);
+}
+
+/* Arm a timer firing after ms, then every period_ms if non-zero. Returns a cancel handle, 0 on error. */
+static tr_timer_handle_t timer_arm(uint32_t ms, uint32_t period_ms, void (*cb)(void*), void *ctx)
+{
+    if (!cb) { tr_set_last_error_fmt("timer_arm: invalid callback"); return 0; }
+    if (timer_service_start(0) != 0) return 0;
+    TimerWheel *w = &g_timers;
+    uint64_t now = tr_monotonic_ms();
+    tr_mutex_lock(&w->lock);
+    TimerNode *n = timer_node_alloc(w);
+    if (!n) { tr_mutex_unlock(&w->lock); tr_set_last_error_fmt("timer_arm: OOM"); return 0; }
+    /* an idle driver stops advancing now; catch it up so the slot math stays relative to real time */
+    if (w->armed == 0 && now > w->now) w->now = now;
+    n->expires = now + (ms ? ms : 1);
+    n->period = period_ms;
+    n->cb = cb;
+    n->ctx = ctx;
+    timer_wheel_insert(w, n);
+    w->armed++;
+    if (n->expires < w->deadline) tr_cond_notify_one(&w->tick_cond);
+    tr_timer_handle_t h = timer_node_handle(n);
+    tr_mutex_unlock(&w->lock);
+    return h;
+}
+
+/* Cancel a pending timer. Returns 0 if it will not fire again, -1 if the handle is unknown,
+   already expired, or a one-shot callback is already running. */
+static int timer_cancel(tr_timer_handle_t h)
+{
+    if (tr_atomic_load_acquire(&g_timers_state) != 2) { tr_set_last_error_fmt("timer_cancel: service not running"); return -1; }
+    TimerWheel *w = &g_timers;
+    int rc = 0;
+    tr_mutex_lock(&w->lock);
+    TimerNode *n = timer_node_lookup(w, h);
+    if (!n) {
+        rc = -1;
+    } else if (n->state == TR_TIMER_ARMED) {
+        timer_wheel_unlink(w, n);
+        w->armed--;
+        timer_node_free(w, n);
+    } else if (n->state == TR_TIMER_READY) {
+        timer_ready_unlink(w, n);
+        timer_node_free(w, n);
+    } else if (n->period && !n->cancelled) {
+        n->cancelled = 1;   /* running: the dispatcher frees it instead of re-arming */
+    } else {
+        rc = -1;
+    }
+    tr_mutex_unlock(&w->lock);
+    if (rc != 0) tr_set_last_error_fmt("timer_cancel: unknown or already fired timer");
+    return rc;
+}
+
+int tr_timer_start(uint32_t ms, void (*cb)(void*), void *ctx)
+{
+    if (!cb) { tr_set_last_error_fmt("tr_timer_start: invalid callback"); return -1; }
+    return timer_arm(ms, 0, cb, ctx) ? 0 : -1;
+}
+
+/* ---------------------------
+   Asynchronous audit writer
+   - tr_audit_async_start moves tr_audit_log onto per-thread SPSC byte rings: a record is a
+     16-byte header (length, wall-clock second) followed by the text; no lock, no syscall
+   - one writer thread drains the rings with writev (prefix, text, newline per record) and only
+     reformats the "[YYYY-mm-dd HH:MM:SS] " prefix when the second changes
+   - full ring: TR_AUDIT_FULL_DROP counts the record and reports the total in the log,
+     TR_AUDIT_FULL_BLOCK waits for the writer to make room
+   - fsync policy: none, every fsync_param ms, or every fsync_param records
+   --------------------------- */
+
+#define TR_AUDIT_FULL_DROP      0
+#define TR_AUDIT_FULL_BLOCK     1
+#define TR_AUDIT_FSYNC_NONE     0
+#define TR_AUDIT_FSYNC_INTERVAL 1
+#define TR_AUDIT_FSYNC_EVERY_N  2
+
+#define TR_AUDIT_RING_BYTES  (64 * 1024)   /* per producing thread; power of two */
+#define TR_AUDIT_RING_MASK   (TR_AUDIT_RING_BYTES - 1)
+#define TR_AUDIT_FLUSH_MS    10            /* writer wakeup interval while producers stay quiet */
+#define TR_AUDIT_IOV         192           /* iovecs per writev: 64 records */
+#define TR_AUDIT_WRAP        0xffffffffu   /* header length: rest of the ring is unused */
+
+#ifdef _WIN32
+struct iovec { void *iov_base; size_t iov_len; };
+#endif
+
+typedef struct {
+    uint32_t len;
+    uint32_t reserved;
+    int64_t when;              /* time(NULL) at tr_audit_log */
+} AuditRecordHdr;
+
+typedef struct AuditRing {
+    TR_ALIGNED(TR_CACHELINE) uint64_t head;   /* producer: bytes written */
+    TR_ALIGNED(TR_CACHELINE) uint64_t tail;   /* writer: bytes consumed */
+    uint32_t orphaned;                        /* owner exited; writer frees the ring once empty */
+    struct AuditRing *next;
+    uint8_t *buf;
+} AuditRing;
+
+typedef struct {
+    tr_mutex_t lock;           /* ring list, writer sleep, blocked producers; never destroyed */
+    tr_cond_t wake;
+    tr_cond_t space;
+    int inited;
+    AuditRing *rings;
+    tr_thread_t writer;
+    int full_policy;
+    int fsync_policy;
+    uint32_t fsync_param;
+    uint64_t dropped;
+    uint32_t blocked;
+    int stopping;
+} AuditAsync;
+
+static AuditAsync g_audit_async;
+static uint32_t g_audit_async_state = 0;   /* 0 = stopped, 1 = transitioning, 2 = running */
+static uint32_t g_audit_async_gen = 0;     /* bumped when rings are freed; stale TLS rings are ignored */
+static TR_THREAD_LOCAL AuditRing *g_audit_ring = NULL;
+static TR_THREAD_LOCAL uint32_t g_audit_ring_gen = 0;
+
+/* producers inside audit_async_submit, sharded by thread so submits don't share a cache line.
+   Kept outside the rings: a producer announces itself here before it touches its ring, and
+   tr_audit_async_stop waits for every shard to drain before it frees any ring. */
+#define TR_AUDIT_INFLIGHT_SHARDS 16
+typedef struct { TR_ALIGNED(TR_CACHELINE) uint32_t n; } AuditInflight;
+static AuditInflight g_audit_inflight[TR_AUDIT_INFLIGHT_SHARDS];
+static uint32_t g_audit_inflight_next = 0;
+static TR_THREAD_LOCAL uint32_t *g_audit_inflight_slot = NULL;
+
+static uint32_t *audit_inflight_slot(void)
+{
+    if (!g_audit_inflight_slot) {
+        uint32_t i = tr_atomic_fetch_add(&g_audit_inflight_next, 1u) % TR_AUDIT_INFLIGHT_SHARDS;
+        g_audit_inflight_slot = &g_audit_inflight[i].n;
+    }
+    return g_audit_inflight_slot;
+}
+
+#ifndef _WIN32
+static pthread_key_t g_audit_ring_key;
+static pthread_once_t g_audit_ring_key_once = PTHREAD_ONCE_INIT;
+
+static void audit_ring_thread_exit(void *arg)
+{
+    tr_mutex_lock(&g_audit_async.lock);
+    if (arg == (void*)g_audit_ring && g_audit_ring_gen == g_audit_async_gen) tr_atomic_store_release(&g_audit_ring->orphaned, 1u);
+    tr_mutex_unlock(&g_audit_async.lock);
+    g_audit_ring = NULL;
+}
+
+static void audit_ring_key_init(void) { pthread_key_create(&g_audit_ring_key, audit_ring_thread_exit); }
+#endif
+
+static void audit_ring_free(AuditRing *r)
+{
+    if (!r) return;
+    free(r->buf);
+    tr_aligned_free(r);
+}
+
+static AuditRing *audit_ring_get(void)
+{
+    uint32_t gen = tr_atomic_load_acquire(&g_audit_async_gen);
+    if (g_audit_ring && g_audit_ring_gen == gen) return g_audit_ring;
+    AuditRing *r = (AuditRing*)tr_aligned_alloc(TR_CACHELINE, sizeof(AuditRing));
+    if (!r) return NULL;
+    memset(r, 0, sizeof(*r));
+    r->buf = (uint8_t*)malloc(TR_AUDIT_RING_BYTES);
+    if (!r->buf) { tr_aligned_free(r); return NULL; }
+    tr_mutex_lock(&g_audit_async.lock);
+    if (tr_atomic_load_relaxed(&g_audit_async_state) != 2 || gen != g_audit_async_gen) {
+        tr_mutex_unlock(&g_audit_async.lock);
+        audit_ring_free(r);
+        return NULL;
+    }
+    r->next = g_audit_async.rings;
+    g_audit_async.rings = r;
+    tr_mutex_unlock(&g_audit_async.lock);
+    g_audit_ring = r;
+    g_audit_ring_gen = gen;
+#ifndef _WIN32
+    pthread_once(&g_audit_ring_key_once, audit_ring_key_init);
+    pthread_setspecific(g_audit_ring_key, (void*)r);
+#endif
+    return r;
+}
+
+/* Queue one record on the calling thread's ring. Returns -1 when async mode is off (the caller
+   then writes synchronously), 0 when the record was queued or dropped by policy. */
+static int audit_async_submit(const char *text, size_t len)
+{
+    if (tr_atomic_load_relaxed(&g_audit_async_state) != 2) return -1;
+    uint32_t *inflight = audit_inflight_slot();
+    tr_atomic_fetch_add(inflight, 1u);
+    tr_atomic_fence();   /* pairs with tr_audit_async_stop: state change, fence, wait for no inflight */
+    if (tr_atomic_load_relaxed(&g_audit_async_state) != 2) { tr_atomic_fetch_sub(inflight, 1u); return -1; }
+    AuditRing *r = audit_ring_get();
+    if (!r) { tr_atomic_fetch_sub(inflight, 1u); return -1; }
+    uint64_t need = (sizeof(AuditRecordHdr) + len + 15) & ~(uint64_t)15;
+    uint64_t head = r->head;
+    uint64_t tail, off, pad;
+    for (;;) {
+        tail = tr_atomic_load_acquire(&r->tail);
+        off = head & TR_AUDIT_RING_MASK;
+        pad = need <= TR_AUDIT_RING_BYTES - off ? 0 : TR_AUDIT_RING_BYTES - off;
+        if (TR_AUDIT_RING_BYTES - (head - tail) >= pad + need) break;
+        if (g_audit_async.full_policy == TR_AUDIT_FULL_DROP) {
+            tr_atomic_fetch_add(&g_audit_async.dropped, (uint64_t)1);
+            tr_atomic_fetch_sub(inflight, 1u);
+            return 0;
+        }
+        tr_atomic_fetch_add(&g_audit_async.blocked, 1u);
+        tr_mutex_lock(&g_audit_async.lock);
+        tr_cond_notify_one(&g_audit_async.wake);
+        tr_cond_timedwait(&g_audit_async.space, &g_audit_async.lock, 1);
+        tr_mutex_unlock(&g_audit_async.lock);
+        tr_atomic_fetch_sub(&g_audit_async.blocked, 1u);
+    }
+    if (pad) {
+        ((AuditRecordHdr*)(r->buf + off))->len = TR_AUDIT_WRAP;
+        head += pad;
+        off = 0;
+    }
+    AuditRecordHdr *h = (AuditRecordHdr*)(r->buf + off);
+    h->len = (uint32_t)len;
+    h->when = (int64_t)time(NULL);
+    memcpy(h + 1, text, len);
+    tr_atomic_store_release(&r->head, head + need);
+    tr_atomic_fetch_sub(inflight, 1u);
+    /* wake the writer early only when this record pushed the ring past half full */
+    uint64_t used = head + need - tail;
+    if (used > TR_AUDIT_RING_BYTES / 2 && used - need - pad <= TR_AUDIT_RING_BYTES / 2) {
+        tr_mutex_lock(&g_audit_async.lock);
+        tr_cond_notify_one(&g_audit_async.wake);
+        tr_mutex_unlock(&g_audit_async.lock);
+    }
+    return 0;
+}
+
+/* writer-only: "[YYYY-mm-dd HH:MM:SS] " for when, reformatted only when the second changes */
+static size_t audit_prefix(int64_t when, char *out)
+{
+    static int64_t cached_when = -1;
+    static char cached[32];
+    static size_t cached_len = 0;
+    if (when != cached_when) {
+        time_t t = (time_t)when;
+        struct tm tm;
+#if defined(_WIN32)
+        localtime_s(&tm, &t);
+#else
+        localtime_r(&t, &tm);
+#endif
+        char ts[24];
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tm);
+        cached_len = (size_t)snprintf(cached, sizeof(cached), "[%s] ", ts);
+        cached_when = when;
+    }
+    memcpy(out, cached, cached_len);
+    return cached_len;
+}
+
+static int audit_writev_all(int fd, struct iovec *iov, int n)
+{
+#ifdef _WIN32
+    for (int i = 0; i < n; ++i) {
+        if (_write(fd, iov[i].iov_base, (unsigned)iov[i].iov_len) < 0) return -1;
+    }
+#else
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) { if (errno == EINTR) continue; return -1; }
+        while (n > 0 && (size_t)w >= iov->iov_len) { w -= (ssize_t)iov->iov_len; iov++; n--; }
+        if (n > 0) { iov->iov_base = (char*)iov->iov_base + w; iov->iov_len -= (size_t)w; }
+    }
+#endif
+    return 0;
+}
+
+/* write everything currently queued on r; returns the number of records written */
+static uint64_t audit_drain_ring(AuditRing *r, int fd, int timestamps)
+{
+    struct iovec iov[TR_AUDIT_IOV];
+    char prefixes[TR_AUDIT_IOV / 3][32];
+    uint64_t records = 0;
+    uint64_t t = r->tail;
+    for (;;) {
+        uint64_t head = tr_atomic_load_acquire(&r->head);
+        if (t == head) break;
+        int n = 0, np = 0;
+        int64_t last_when = -1;
+        size_t last_len = 0;
+        while (t != head && n + 3 <= TR_AUDIT_IOV) {
+            uint64_t off = t & TR_AUDIT_RING_MASK;
+            AuditRecordHdr *h = (AuditRecordHdr*)(r->buf + off);
+            if (h->len == TR_AUDIT_WRAP) { t += TR_AUDIT_RING_BYTES - off; continue; }
+            if (!timestamps) {
+                iov[n].iov_base = (void*)"[audit] ";
+                iov[n].iov_len = 8;
+            } else {
+                if (np == 0 || h->when != last_when) { last_len = audit_prefix(h->when, prefixes[np++]); last_when = h->when; }
+                iov[n].iov_base = prefixes[np - 1];
+                iov[n].iov_len = last_len;
+            }
+            iov[n + 1].iov_base = (void*)(h + 1);
+            iov[n + 1].iov_len = h->len;
+            iov[n + 2].iov_base = (void*)"\n";
+            iov[n + 2].iov_len = 1;
+            n += 3;
+            t += (sizeof(AuditRecordHdr) + h->len + 15) & ~(uint64_t)15;
+            records++;
+        }
+        if (n) (void)audit_writev_all(fd, iov, n);   /* a failing fd drops the batch rather than wedging producers */
+        tr_atomic_store_release(&r->tail, t);
+    }
+    return records;
+}
+
+static void *audit_writer_main(void *arg)
+{
+    AuditAsync *a = (AuditAsync*)arg;
+    uint64_t since_sync = 0;
+    uint64_t last_sync = tr_monotonic_ms();
+    for (;;) {
+        tr_mutex_lock(&a->lock);
+        int stopping = a->stopping;
+        AuditRing *rings = a->rings;
+        tr_mutex_unlock(&a->lock);
+
+        uint64_t records = 0;
+        tr_mutex_lock(&g_audit_lock);
+#ifdef _WIN32
+        int fd = g_audit_fp ? _fileno(g_audit_fp) : 2;
+#else
+        int fd = g_audit_fp ? fileno(g_audit_fp) : 2;
+#endif
+        for (AuditRing *r = rings; r; r = r->next) records += audit_drain_ring(r, fd, g_audit_fp != NULL);
+        uint64_t dropped = tr_atomic_exchange(&a->dropped, (uint64_t)0);
+        if (dropped) {
+            char msg[96];
+            int ml = snprintf(msg, sizeof(msg), "[audit] %llu records dropped: ring full\n", (unsigned long long)dropped);
+            struct iovec v;
+            v.iov_base = msg;
+            v.iov_len = (size_t)ml;
+            (void)audit_writev_all(fd, &v, 1);
+        }
+        since_sync += records;
+        if (g_audit_fp && since_sync) {
+            uint64_t now = tr_monotonic_ms();
+            int do_sync = (a->fsync_policy == TR_AUDIT_FSYNC_EVERY_N && since_sync >= a->fsync_param) ||
+                          (a->fsync_policy == TR_AUDIT_FSYNC_INTERVAL && now - last_sync >= a->fsync_param) ||
+                          (stopping && a->fsync_policy != TR_AUDIT_FSYNC_NONE);
+            if (do_sync) {
+#ifdef _WIN32
+                _commit(fd);
+#else
+                fsync(fd);
+#endif
+                since_sync = 0;
+                last_sync = now;
+            }
+        }
+        tr_mutex_unlock(&g_audit_lock);
+
+        tr_mutex_lock(&a->lock);
+        if (tr_atomic_load_acquire(&a->blocked)) tr_cond_notify_all(&a->space);
+        if (tr_atomic_load_relaxed(&g_audit_async_state) == 2) {
+            /* free rings whose thread has exited; stop frees the rest itself */
+            for (AuditRing **pp = &a->rings; *pp;) {
+                AuditRing *r = *pp;
+                if (tr_atomic_load_acquire(&r->orphaned) && tr_atomic_load_acquire(&r->head) == r->tail) {
+                    *pp = r->next;
+                    audit_ring_free(r);
+                } else {
+                    pp = &r->next;
+                }
+            }
+        }
+        if (stopping) { tr_mutex_unlock(&a->lock); break; }
+        if (!a->stopping) tr_cond_timedwait(&a->wake, &a->lock, TR_AUDIT_FLUSH_MS);
+        tr_mutex_unlock(&a->lock);
+    }
+    return NULL;
+}
+
+/* Switch tr_audit_log to asynchronous mode. fsync_param is milliseconds for
+   TR_AUDIT_FSYNC_INTERVAL and a record count for TR_AUDIT_FSYNC_EVERY_N. */
+int tr_audit_async_start(int full_policy, int fsync_policy, uint32_t fsync_param)
+{
+    if ((full_policy != TR_AUDIT_FULL_DROP && full_policy != TR_AUDIT_FULL_BLOCK) ||
+        fsync_policy < TR_AUDIT_FSYNC_NONE || fsync_policy > TR_AUDIT_FSYNC_EVERY_N ||
+        (fsync_policy != TR_AUDIT_FSYNC_NONE && fsync_param == 0)) {
+        tr_set_last_error_fmt("tr_audit_async_start: invalid policy");
+        return -1;
+    }
+    uint32_t st = 0;
+    if (!tr_atomic_cas(&g_audit_async_state, &st, (uint32_t)1)) { tr_set_last_error_fmt("tr_audit_async_start: already running"); return -1; }
+    tr_init_audit_once();
+    if (!g_audit_async.inited) {
+        tr_mutex_init(&g_audit_async.lock);
+        tr_cond_init(&g_audit_async.wake);
+        tr_cond_init(&g_audit_async.space);
+        g_audit_async.inited = 1;
+    }
+    g_audit_async.rings = NULL;
+    g_audit_async.full_policy = full_policy;
+    g_audit_async.fsync_policy = fsync_policy;
+    g_audit_async.fsync_param = fsync_param;
+    g_audit_async.dropped = 0;
+    g_audit_async.blocked = 0;
+    g_audit_async.stopping = 0;
+    if (tr_thread_create(&g_audit_async.writer, audit_writer_main, &g_audit_async) != 0) {
+        tr_atomic_store_release(&g_audit_async_state, (uint32_t)0);
+        tr_set_last_error_fmt("tr_audit_async_start: writer thread create failed");
+        return -1;
+    }
+    tr_atomic_store_release(&g_audit_async_state, (uint32_t)2);
+    return 0;
+}
+
+/* Drain every queued record, stop the writer and return to synchronous logging. */
+void tr_audit_async_stop(void)
+{
+    uint32_t st = 2;
+    if (!tr_atomic_cas(&g_audit_async_state, &st, (uint32_t)1)) return;
+    tr_atomic_fence();
+    /* no ring is registered or reaped once the state left 2; wait out producers mid-submit */
+    for (int i = 0; i < TR_AUDIT_INFLIGHT_SHARDS; ++i) {
+        while (tr_atomic_load_acquire(&g_audit_inflight[i].n)) {
+#ifdef _WIN32
+            SwitchToThread();
+#else
+            sched_yield();
+#endif
+        }
+    }
+    tr_mutex_lock(&g_audit_async.lock);
+    g_audit_async.stopping = 1;
+    tr_cond_notify_all(&g_audit_async.wake);
+    tr_mutex_unlock(&g_audit_async.lock);
+    tr_thread_join(g_audit_async.writer);
+    tr_mutex_lock(&g_audit_async.lock);
+    for (AuditRing *r = g_audit_async.rings, *n; r; r = n) { n = r->next; audit_ring_free(r); }
+    g_audit_async.rings = NULL;
+    tr_atomic_fetch_add(&g_audit_async_gen, 1u);
+    tr_mutex_unlock(&g_audit_async.lock);
+    tr_atomic_store_release(&g_audit_async_state, (uint32_t)0);
+}
+
+/* ---------------------------
+   Syscall registry (maximized)
+   - register syscall handler functions by name with metadata, permissions, and audit flags
+   - tr_invoke_syscall does validation and produces structured error messages
+   - lookups are hashed and lock-free; tr_resolve_syscall hands out handles that skip lookup entirely
+   - two calling conventions: JSON text in, malloc'd JSON out (tr_register_syscall_ex), or a flat
+     binary argument struct described by a TrSyscallSchema in, result written into caller memory
+     (tr_register_syscall_bin_ex); a syscall is invoked through the convention it was registered with
+   --------------------------- */
+
+/* JSON convention: args_json is the caller's argument text; the handler stores a malloc'd JSON
+   result (or NULL) in *out_json and returns 0 on success. */
+typedef int (*tr_syscall_handler_t)(const char *args_json, char **out_json, void *ctx);
+
+/* binary convention: args points at args_len bytes laid out as the schema describes; the handler
+   writes its result to out (capacity *out_len, may be NULL when that is 0) and stores the size
+   written in *out_len. A handler that needs more room returns nonzero with *out_len set to the
+   size it needs. */
+typedef int (*tr_syscall_bin_handler_t)(const void *args, size_t args_len, void *out, size_t *out_len, void *ctx);
+
+/* schema field types, used for validation and to render args in the audit log */
+#define TR_SYSARG_I32 1
+#define TR_SYSARG_I64 2
+#define TR_SYSARG_U64 3
+#define TR_SYSARG_F64 4
+#define TR_SYSARG_STR 5     /* const char * (NUL-terminated, may be NULL) */
+#define TR_SYSARG_PTR 6     /* opaque pointer, rendered as an address */
+
+typedef struct {
+    const char *name;
+    int type;               /* TR_SYSARG_* */
+    size_t offset;          /* offsetof(args struct, field) */
+} TrSyscallField;
+
+typedef struct {
+    const TrSyscallField *fields;
+    size_t nfields;
+    size_t args_size;       /* minimum args_len accepted */
+} TrSyscallSchema;
+
+/* Entries are immutable once published. Readers go through an immutable SyscallIndex snapshot
+   (open-addressed by name hash, plus a handle -> entry table) under an epoch read section that
+   takes no lock; writers serialize on the registry mutex, publish a rebuilt snapshot, then wait
+   for a grace period before freeing the old snapshot and any removed entry. */
+
+/* per-name invocation metrics; created at first registration and never freed, so counts survive
+   unregister/re-register and the snapshot can walk them without the registry lock */
+typedef struct SyscallStats {
+    struct SyscallStats *next;
+    char *name;
+    uint64_t calls;
+    uint64_t errors;
+    TrHist lat;                 /* handler runs only; auth failures are calls + errors */
+} SyscallStats;
+
+static SyscallStats *g_syscall_stats = NULL;    /* prepend-only, published with release */
+
+/* the handler may block (sandbox runs, JIT builds): tr_syscall_submit runs it on the syscall pool */
+#define TR_SYSCALL_FLAG_BLOCKING 4
+
+typedef struct {
+    char *name;
+    tr_syscall_handler_t handler;            /* JSON convention; NULL for binary syscalls */
+    tr_syscall_bin_handler_t bin_handler;    /* binary convention */
+    TrSyscallSchema schema;                  /* binary only; fields copied with the entry */
+    void *ctx;
+    int flags;              /* bitfield for permissions, e.g. 1=audit, 2=trusted-only, TR_SYSCALL_FLAG_BLOCKING */
+    char *auth_token;       /* optional token required to invoke */
+    char *description;      /* human-friendly description */
+    uint64_t hash;
+    uint32_t id;            /* handle = id + 1; ids are never reused */
+    SyscallStats *stats;    /* NULL if it could not be allocated */
+} SyscallEntry;
+
+typedef struct {
+    SyscallEntry **table;   /* linear probing, NULL = empty; first registration of a name wins */
+    size_t mask;
+    SyscallEntry **by_id;   /* NULL once unregistered */
+    size_t nids;
+} SyscallIndex;
+
+typedef struct {
+    SyscallEntry **entries; /* registration order */
+    size_t count;
+    size_t capacity;
+    uint32_t next_id;
+    tr_mutex_t lock;        /* writers only */
+} SyscallRegistry;
+
+typedef uint64_t tr_syscall_handle_t;   /* 0 = invalid */
+
+#define TR_SYSCALL_READER_STRIPES 16
+
+typedef struct {
+    TR_ALIGNED(TR_CACHELINE) uint64_t active[2];   /* readers inside a section, by epoch parity */
+} SyscallReaderStripe;
+
+static SyscallRegistry *g_syscall_registry = NULL;
+static SyscallIndex *g_syscall_index = NULL;
+static SyscallReaderStripe g_syscall_readers[TR_SYSCALL_READER_STRIPES];
+static uint32_t g_syscall_epoch = 0;
+static uint32_t g_syscall_stripe_next = 0;
+static TR_THREAD_LOCAL uint32_t g_syscall_stripe = 0;   /* stripe + 1, 0 = unassigned */
+
+static uint64_t syscall_name_hash(const char *s)
+{
+    uint64_t h = 1469598103934665603ull;   /* FNV-1a */
+    while (*s) { h ^= (uint8_t)*s++; h *= 1099511628211ull; }
+    return h;
+}
+
+static uint32_t syscall_read_enter(uint64_t **slot)
+{
+    if (!g_syscall_stripe) g_syscall_stripe = (tr_atomic_fetch_add(&g_syscall_stripe_next, 1u) % TR_SYSCALL_READER_STRIPES) + 1;
+    uint32_t e = tr_atomic_load_acquire(&g_syscall_epoch) & 1u;
+    *slot = &g_syscall_readers[g_syscall_stripe - 1].active[e];
+    tr_atomic_fetch_add(*slot, (uint64_t)1);
+    tr_atomic_fence();   /* pairs with the writer's fence between epoch flip and draining */
+    return e;
+}
+
+static void syscall_read_exit(uint64_t *slot)
+{
+    tr_atomic_fetch_sub(slot, (uint64_t)1);
+}
+
+/* Wait until no reader can still see a snapshot unpublished before this call. Two flips, so a
+   reader that loaded the epoch just before a flip but counted itself just after is covered. */
+static void syscall_synchronize(void)
+{
+    for (int round = 0; round < 2; ++round) {
+        uint32_t old = tr_atomic_fetch_add(&g_syscall_epoch, 1u) & 1u;
+        tr_atomic_fence();
+        for (size_t i = 0; i < TR_SYSCALL_READER_STRIPES; ++i) {
+            while (tr_atomic_load_acquire(&g_syscall_readers[i].active[old]) != 0) {
+#ifdef _WIN32
+                SwitchToThread();
+#else
+                sched_yield();
+#endif
+            }
+        }
+    }
+}
+
+static SyscallEntry *syscall_index_find(const SyscallIndex *ix, const char *name)
+{
+    if (!ix || !ix->table) return NULL;
+    uint64_t h = syscall_name_hash(name);
+    for (size_t i = (size_t)h & ix->mask;; i = (i + 1) & ix->mask) {
+        SyscallEntry *e = ix->table[i];
+        if (!e) return NULL;
+        if (e->hash == h && strcmp(e->name, name) == 0) return e;
+    }
+}
+
+static void syscall_index_free(SyscallIndex *ix)
+{
+    if (!ix) return;
+    free(ix->table);
+    free(ix->by_id);
+    free(ix);
+}
+
+/* build a snapshot of the registry's current entries (registry lock held) */
+static SyscallIndex *syscall_index_build(const SyscallRegistry *r)
+{
+    SyscallIndex *ix = (SyscallIndex*)calloc(1, sizeof(SyscallIndex));
+    if (!ix) return NULL;
+    size_t cap = 16;
+    while (cap < r->count * 2) cap <<= 1;
+    ix->table = (SyscallEntry**)calloc(cap, sizeof(SyscallEntry*));
+    ix->mask = cap - 1;
+    ix->nids = r->next_id;
+    ix->by_id = (SyscallEntry**)calloc(ix->nids ? ix->nids : 1, sizeof(SyscallEntry*));
+    if (!ix->table || !ix->by_id) { syscall_index_free(ix); return NULL; }
+    for (size_t k = 0; k < r->count; ++k) {
+        SyscallEntry *e = r->entries[k];
+        ix->by_id[e->id] = e;
+        size_t i = (size_t)e->hash & ix->mask;
+        for (; ix->table[i]; i = (i + 1) & ix->mask) {
+            if (ix->table[i]->hash == e->hash && strcmp(ix->table[i]->name, e->name) == 0) break;
+        }
+        if (!ix->table[i]) ix->table[i] = e;
+    }
+    return ix;
+}
+
+static void syscall_entry_free(SyscallEntry *e)
+{
+    if (!e) return;
+    free(e->name);
+    free((void*)e->schema.fields);
+    if (e->auth_token) free(e->auth_token);
+    if (e->description) free(e->description);
+    free(e);
+}
+
+/* registry lock held */
+static SyscallStats *syscall_stats_get(const char *name)
+{
+    for (SyscallStats *st = g_syscall_stats; st; st = st->next) {
+        if (strcmp(st->name, name) == 0) return st;
+    }
+    SyscallStats *st = (SyscallStats*)calloc(1, sizeof(SyscallStats));
+    if (!st) return NULL;
+    st->name = strdup(name);
+    if (!st->name) { free(st); return NULL; }
+    st->next = g_syscall_stats;
+    tr_atomic_store_release(&g_syscall_stats, st);
+    return st;
+}
+
+static void syscall_note_call(SyscallStats *st, uint64_t t0, int failed)
+{
+    tr_metric_add(TR_M_SYSCALL_CALLS, 1);
+    if (failed) tr_metric_add(TR_M_SYSCALL_ERRORS, 1);
+    if (st) {
+        tr_atomic_fetch_add(&st->calls, (uint64_t)1);
+        if (failed) tr_atomic_fetch_add(&st->errors, (uint64_t)1);
+    }
+    if (!t0) return;
+    uint64_t ns = tr_metric_elapsed(t0);
+    tr_hist_record(TR_H_SYSCALL_LATENCY, ns);
+    if (st) tr_hist_record_into(&st->lat, ns);
+}
+
+static SyscallRegistry *syscall_registry_create(void)
+{
+    SyscallRegistry *r = (SyscallRegistry*)malloc(sizeof(SyscallRegistry));
+    if (!r) return NULL;
+    r->entries = (SyscallEntry**)malloc(sizeof(SyscallEntry*) * 8);
+    if (!r->entries) { free(r); return NULL; }
+    r->count = 0; r->capacity = 8; r->next_id = 0;
+    tr_mutex_init(&r->lock);
+    return r;
+}
+
+/* copy of a schema's field table with the names stored behind it, freed as one block */
+static TrSyscallField *syscall_schema_copy(const TrSyscallSchema *sc)
+{
+    size_t bytes = sc->nfields * sizeof(TrSyscallField);
+    for (size_t i = 0; i < sc->nfields; ++i) bytes += strlen(sc->fields[i].name) + 1;
+    TrSyscallField *f = (TrSyscallField*)malloc(bytes ? bytes : 1);
+    if (!f) return NULL;
+    char *names = (char*)(f + sc->nfields);
+    for (size_t i = 0; i < sc->nfields; ++i) {
+        size_t nl = strlen(sc->fields[i].name) + 1;
+        memcpy(names, sc->fields[i].name, nl);
+        f[i] = sc->fields[i];
+        f[i].name = names;
+        names += nl;
+    }
+    return f;
+}
+
+static int syscall_register(const char *fn, const char *name, tr_syscall_handler_t handler, tr_syscall_bin_handler_t bin_handler,
+                            const TrSyscallSchema *schema, void *ctx, int flags, const char *auth_token, const char *description)
+{
+    if (!g_syscall_registry) g_syscall_registry = syscall_registry_create();
+    SyscallRegistry *r = g_syscall_registry;
+    tr_mutex_lock(&r->lock);
+    if (r->count == r->capacity) {
+        size_t nc = r->capacity * 2;
+        SyscallEntry **ne = (SyscallEntry**)realloc(r->entries, sizeof(SyscallEntry*) * nc);
+        if (!ne) { tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("%s: realloc failed", fn); return -1; }
+        r->entries = ne; r->capacity = nc;
+    }
+    SyscallEntry *e = (SyscallEntry*)calloc(1, sizeof(SyscallEntry));
+    size_t nl = strlen(name) + 1;
+    char *ncopy = (char*)malloc(nl);
+    if (!e || !ncopy) { free(e); free(ncopy); tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("%s: OOM name copy", fn); return -1; }
+    memcpy(ncopy, name, nl);
+    e->name = ncopy;
+    e->handler = handler;
+    e->bin_handler = bin_handler;
+    if (schema) {
+        e->schema = *schema;
+        e->schema.fields = syscall_schema_copy(schema);
+        if (!e->schema.fields) { syscall_entry_free(e); tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("%s: OOM schema copy", fn); return -1; }
+    }
+    e->ctx = ctx;
+    e->flags = flags;
+    e->auth_token = auth_token ? strdup(auth_token) : NULL;
+    e->description = description ? strdup(description) : NULL;
+    e->hash = syscall_name_hash(name);
+    e->id = r->next_id++;
+    e->stats = syscall_stats_get(name);
+    r->entries[r->count++] = e;
+    SyscallIndex *ix = syscall_index_build(r);
+    if (!ix) {
+        r->count--;
+        syscall_entry_free(e);
+        tr_mutex_unlock(&r->lock);
+        tr_set_last_error_fmt("%s: OOM index", fn);
+        return -1;
+    }
+    SyscallIndex *old = tr_atomic_exchange(&g_syscall_index, ix);
+    tr_mutex_unlock(&r->lock);
+    if (old) { syscall_synchronize(); syscall_index_free(old); }
+    tr_audit_log("syscall_registered: %s flags=%d abi=%s desc=%s", name, flags, bin_handler ? "binary" : "json", description ? description : "");
+    return 0;
+}
+
+int tr_register_syscall_ex(const char *name, tr_syscall_handler_t handler, void *ctx, int flags, const char *auth_token, const char *description)
+{
+    if (!name || !handler) { tr_set_last_error_fmt("tr_register_syscall_ex: invalid args"); return -1; }
+    return syscall_register("tr_register_syscall_ex", name, handler, NULL, NULL, ctx, flags, auth_token, description);
+}
+
+/* Register a binary-convention syscall. schema may be NULL (args are then opaque bytes and the
+   audit log shows a hex prefix); it is copied, as are the field names. */
+int tr_register_syscall_bin_ex(const char *name, tr_syscall_bin_handler_t handler, const TrSyscallSchema *schema, void *ctx,
+                               int flags, const char *auth_token, const char *description)
+{
+    if (!name || !handler) { tr_set_last_error_fmt("tr_register_syscall_bin_ex: invalid args"); return -1; }
+    if (schema) {
+        if (schema->nfields && !schema->fields) { tr_set_last_error_fmt("tr_register_syscall_bin_ex: schema has no fields"); return -1; }
+        for (size_t i = 0; i < schema->nfields; ++i) {
+            const TrSyscallField *f = &schema->fields[i];
+            size_t w = f->type == TR_SYSARG_I32 ? 4 : f->type == TR_SYSARG_STR || f->type == TR_SYSARG_PTR ? sizeof(void*) : 8;
+            if (!f->name || f->type < TR_SYSARG_I32 || f->type > TR_SYSARG_PTR || f->offset + w > schema->args_size) {
+                tr_set_last_error_fmt("tr_register_syscall_bin_ex: bad schema field %zu", i);
+                return -1;
+            }
+        }
+    }
+    return syscall_register("tr_register_syscall_bin_ex", name, NULL, handler, schema, ctx, flags, auth_token, description);
+}
+
+int tr_unregister_syscall(const char *name)
+{
+    if (!name) { tr_set_last_error_fmt("tr_unregister_syscall: invalid name"); return -1; }
+    if (!g_syscall_registry) { tr_set_last_error_fmt("tr_unregister_syscall: no registry"); return -1; }
+    SyscallRegistry *r = g_syscall_registry;
+    tr_mutex_lock(&r->lock);
+    for (size_t i = 0; i < r->count; ++i) {
+        if (strcmp(r->entries[i]->name, name) == 0) {
+            SyscallEntry *e = r->entries[i];
+            memmove(&r->entries[i], &r->entries[i + 1], (r->count - i - 1) * sizeof(SyscallEntry*));
+            r->count--;
+            SyscallIndex *ix = syscall_index_build(r);
+            if (!ix) {
+                memmove(&r->entries[i + 1], &r->entries[i], (r->count - i) * sizeof(SyscallEntry*));
+                r->entries[i] = e;
+                r->count++;
+                tr_mutex_unlock(&r->lock);
+                tr_set_last_error_fmt("tr_unregister_syscall: OOM index");
+                return -1;
+            }
+            SyscallIndex *old = tr_atomic_exchange(&g_syscall_index, ix);
+            tr_mutex_unlock(&r->lock);
+            syscall_synchronize();
+            syscall_index_free(old);
+            syscall_entry_free(e);
+            tr_audit_log("syscall_unregistered: %s", name);
+            return 0;
+        }
+    }
+    tr_mutex_unlock(&r->lock);
+    tr_set_last_error_fmt("tr_unregister_syscall: not found");
+    return -1;
+}
+
+/* Resolve name to a handle that stays valid until the syscall is unregistered; 0 if not found. */
+tr_syscall_handle_t tr_resolve_syscall(const char *name)
+{
+    if (!name) { tr_set_last_error_fmt("tr_resolve_syscall: invalid name"); return 0; }
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallEntry *e = syscall_index_find(tr_atomic_load_acquire(&g_syscall_index), name);
+    tr_syscall_handle_t h = e ? (tr_syscall_handle_t)e->id + 1 : 0;
+    syscall_read_exit(slot);
+    if (!h) tr_set_last_error_fmt("tr_resolve_syscall: not found");
+    return h;
+}
+
+/* token and convention checks for an entry seen inside a read section; on failure the section is
+   exited and the error code returned */
+static int syscall_entry_check(SyscallEntry *e, uint64_t *slot, const char *auth_token, int binary, const char *fn)
+{
+    if ((e->bin_handler != NULL) != binary) {
+        syscall_read_exit(slot);
+        tr_set_last_error_fmt("%s: %s is a %s syscall", fn, e->name, binary ? "JSON" : "binary");
+        return -5;
+    }
+    if (e->auth_token) {
+        if (!auth_token || strcmp(auth_token, e->auth_token) != 0) {
+            SyscallStats *st = e->stats;
+            char name[128];
+            snprintf(name, sizeof(name), "%s", e->name);
+            syscall_read_exit(slot);
+            syscall_note_call(st, 0, 1);
+            tr_set_last_error_fmt("%s: auth failed for %s", fn, name);
+            tr_audit_log("syscall_invoke_failed_auth: %s", name);
+            return -4;
+        }
+    }
+    return 0;
+}
+
+/* shared by name and handle invocation; called inside a read section, which it exits */
+static int syscall_invoke_entry(SyscallEntry *e, uint64_t *slot, const char *args_json, const char *auth_token, char **out_json)
+{
+    int bad = syscall_entry_check(e, slot, auth_token, 0, "tr_invoke_syscall_ex");
+    if (bad) return bad;
+    char name[128];
+    snprintf(name, sizeof(name), "%s", e->name);
+    SyscallStats *st = e->stats;
+    int audit = (e->flags & 1) != 0;
+    tr_syscall_handler_t h = e->handler;
+    void *ctx = e->ctx;
+    syscall_read_exit(slot);
+    if (audit) tr_audit_log("syscall_invoke: %s args=%s", name, args_json ? args_json : "null");
+    uint64_t t0 = tr_metric_clock();
+    TR_TRACE('B', "syscall.invoke", name, NULL, 0);
+    int rc = h(args_json, out_json, ctx);
+    TR_TRACE('E', "syscall.invoke", NULL, "rc", rc);
+    syscall_note_call(st, t0, rc != 0);
+    if (audit) tr_audit_log("syscall_invoke_result: %s rc=%d out=%s", name, rc, out_json ? (*out_json ? *out_json : "null") : "null");
+    if (rc != 0 && !tr_get_last_error()[0]) tr_set_last_error_fmt("syscall handler %s returned %d", name, rc);
+    return rc;
+}
+
+/* args as malloc'd text for the audit log: {"field":value,...} from the schema, else a hex prefix;
+   NULL on OOM */
+static char *syscall_render_bin_args(const TrSyscallSchema *sc, const void *args, size_t args_len)
+{
+    TrMetricsBuf b = { (char*)malloc(256), 0, 256, 0 };
+    if (!b.p) return NULL;
+    const unsigned char *a = (const unsigned char*)args;
+    if (!sc->fields) {
+        size_t n = args_len < 32 ? args_len : 32;
+        tr_mbuf_printf(&b, "0x");
+        for (size_t i = 0; i < n && !b.oom; ++i) tr_mbuf_printf(&b, "%02x", a[i]);
+        if (n < args_len) tr_mbuf_printf(&b, "... (%zu bytes)", args_len);
+    } else {
+        tr_mbuf_printf(&b, "{");
+        for (size_t i = 0; i < sc->nfields; ++i) {
+            const TrSyscallField *f = &sc->fields[i];
+            const unsigned char *v = a + f->offset;
+            tr_mbuf_printf(&b, "%s\"%s\":", i ? "," : "", f->name);
+            if (f->type == TR_SYSARG_I32) { int32_t x; memcpy(&x, v, sizeof(x)); tr_mbuf_printf(&b, "%d", (int)x); }
+            else if (f->type == TR_SYSARG_I64) { int64_t x; memcpy(&x, v, sizeof(x)); tr_mbuf_printf(&b, "%lld", (long long)x); }
+            else if (f->type == TR_SYSARG_U64) { uint64_t x; memcpy(&x, v, sizeof(x)); tr_mbuf_printf(&b, "%llu", (unsigned long long)x); }
+            else if (f->type == TR_SYSARG_F64) { double x; memcpy(&x, v, sizeof(x)); tr_mbuf_printf(&b, "%.17g", x); }
+            else if (f->type == TR_SYSARG_PTR) { void *x; memcpy(&x, v, sizeof(x)); tr_mbuf_printf(&b, "\"%p\"", x); }
+            else {
+                const char *x; memcpy(&x, v, sizeof(x));
+                if (x) tr_mbuf_quoted(&b, x);
+                else tr_mbuf_printf(&b, "null");
+            }
+        }
+        tr_mbuf_printf(&b, "}");
+    }
+    if (b.oom) { free(b.p); return NULL; }
+    return b.p;
+}
+
+/* binary counterpart of syscall_invoke_entry */
+static int syscall_invoke_bin_entry(SyscallEntry *e, uint64_t *slot, const void *args, size_t args_len, const char *auth_token,
+                                    void *out, size_t *out_len, const char *fn)
+{
+    int bad = syscall_entry_check(e, slot, auth_token, 1, fn);
+    if (bad) return bad;
+    if (args_len < e->schema.args_size || (args_len && !args)) {
+        size_t need = e->schema.args_size;
+        syscall_read_exit(slot);
+        tr_set_last_error_fmt("%s: args too short (%zu < %zu bytes)", fn, args_len, need);
+        return -1;
+    }
+    char name[128];
+    snprintf(name, sizeof(name), "%s", e->name);
+    SyscallStats *st = e->stats;
+    int audit = (e->flags & 1) != 0;
+    tr_syscall_bin_handler_t h = e->bin_handler;
+    void *ctx = e->ctx;
+    if (audit) {
+        /* rendered only for audited entries, while the read section still pins the schema */
+        char *text = syscall_render_bin_args(&e->schema, args, args_len);
+        syscall_read_exit(slot);
+        tr_audit_log("syscall_invoke: %s args=%s", name, text ? text : "?");
+        free(text);
+    } else {
+        syscall_read_exit(slot);
+    }
+    size_t cap = out_len ? *out_len : 0;
+    size_t len = cap;
+    uint64_t t0 = tr_metric_clock();
+    TR_TRACE('B', "syscall.invoke", name, NULL, 0);
+    int rc = h(args, args_len, cap ? out : NULL, &len, ctx);
+    TR_TRACE('E', "syscall.invoke", NULL, "rc", rc);
+    syscall_note_call(st, t0, rc != 0);
+    if (rc == 0 && len > cap) {
+        tr_set_last_error_fmt("%s: handler %s reported %zu result bytes for a %zu byte buffer", fn, name, len, cap);
+        rc = -1;
+    }
+    if (out_len) *out_len = len;
+    if (audit) tr_audit_log("syscall_invoke_result: %s rc=%d out_len=%zu", name, rc, len);
+    if (rc != 0 && !tr_get_last_error()[0]) tr_set_last_error_fmt("syscall handler %s returned %d", name, rc);
+    return rc;
+}
+
+/* invoke syscall by name; returns handler return code, out_json is allocated by handler and must be freed by caller
+   For extended validation, caller may pass auth_token (NULL if none).
+*/
+int tr_invoke_syscall_ex(const char *name, const char *args_json, const char *auth_token, char **out_json)
+{
+    if (!name) { tr_set_last_error_fmt("tr_invoke_syscall_ex: invalid name"); return -1; }
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallIndex *ix = tr_atomic_load_acquire(&g_syscall_index);
+    if (!ix) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_ex: no registry"); return -2; }
+    SyscallEntry *e = syscall_index_find(ix, name);
+    if (!e) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_ex: not found"); return -3; }
+    return syscall_invoke_entry(e, slot, args_json, auth_token, out_json);
+}
+
+/* invoke a handle from tr_resolve_syscall without any name lookup; -3 if it has been unregistered */
+int tr_invoke_syscall_handle(tr_syscall_handle_t handle, const char *args_json, const char *auth_token, char **out_json)
+{
+    if (!handle) { tr_set_last_error_fmt("tr_invoke_syscall_handle: invalid handle"); return -1; }
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallIndex *ix = tr_atomic_load_acquire(&g_syscall_index);
+    if (!ix) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_handle: no registry"); return -2; }
+    SyscallEntry *e = handle - 1 < ix->nids ? ix->by_id[handle - 1] : NULL;
+    if (!e) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_handle: stale handle"); return -3; }
+    return syscall_invoke_entry(e, slot, args_json, auth_token, out_json);
+}
+
+/* Invoke a binary-convention syscall by name. *out_len is the capacity of out on entry and the
+   result size on return (the size needed when the handler reports a short buffer); nothing is
+   allocated, so out can live on the caller's stack or in a quarantine arena. -5 if name is a
+   JSON syscall. */
+int tr_invoke_syscall_bin(const char *name, const void *args, size_t args_len, const char *auth_token, void *out, size_t *out_len)
+{
+    if (!name) { tr_set_last_error_fmt("tr_invoke_syscall_bin: invalid name"); return -1; }
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallIndex *ix = tr_atomic_load_acquire(&g_syscall_index);
+    if (!ix) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_bin: no registry"); return -2; }
+    SyscallEntry *e = syscall_index_find(ix, name);
+    if (!e) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_bin: not found"); return -3; }
+    return syscall_invoke_bin_entry(e, slot, args, args_len, auth_token, out, out_len, "tr_invoke_syscall_bin");
+}
+
+int tr_invoke_syscall_handle_bin(tr_syscall_handle_t handle, const void *args, size_t args_len, const char *auth_token, void *out, size_t *out_len)
+{
+    if (!handle) { tr_set_last_error_fmt("tr_invoke_syscall_handle_bin: invalid handle"); return -1; }
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallIndex *ix = tr_atomic_load_acquire(&g_syscall_index);
+    if (!ix) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_handle_bin: no registry"); return -2; }
+    SyscallEntry *e = handle - 1 < ix->nids ? ix->by_id[handle - 1] : NULL;
+    if (!e) { syscall_read_exit(slot); tr_set_last_error_fmt("tr_invoke_syscall_handle_bin: stale handle"); return -3; }
+    return syscall_invoke_bin_entry(e, slot, args, args_len, auth_token, out, out_len, "tr_invoke_syscall_handle_bin");
+}
+
+/* Backwards compatibility wrappers */
+int tr_register_syscall(const char *name, tr_syscall_handler_t handler, void *ctx)
+{
+    return tr_register_syscall_ex(name, handler, ctx, 0, NULL, NULL);
+}
+int tr_invoke_syscall(const char *name, const char *args_json, char **out_json)
+{
+    return tr_invoke_syscall_ex(name, args_json, NULL, out_json);
+}
+
+/* ---------------------------
+   Asynchronous syscall submission
+   - tr_syscall_submit takes a batch of caller-owned TrSyscallReq and returns without waiting for
+     the slow ones; each finished request is delivered as a message (the request pointer itself)
+     to reply_to's inbox or to reply_cq, so a capsule reaps completions like any other message
+   - handlers registered with TR_SYSCALL_FLAG_BLOCKING run on a dedicated syscall pool; the rest
+     are cheap by contract and run inline on the submitting thread, so compute workers are never
+     parked behind a sandbox run or a JIT build
+   - an inline completion that does not fit the target's inbox is handed to the pool to deliver,
+     since the submitter is usually the capsule that would have to drain it
+   --------------------------- */
+
+#define TR_SYSCALL_POOL_QUEUE 4096
+
+typedef struct TrSyscallReq {
+    /* filled in by the caller */
+    const char *name;               /* NULL: use handle */
+    tr_syscall_handle_t handle;
+    const char *auth_token;
+    int binary;                     /* 0: args_json/out_json, 1: args/out (tr_invoke_syscall_bin) */
+    const char *args_json;
+    const void *args;
+    size_t args_len;
+    void *out;
+    size_t out_len;                 /* capacity on submit, result size on completion */
+    Capsule *reply_to;              /* completion target: a capsule inbox, */
+    Channel *reply_cq;              /* or any channel; neither: poll tr_syscall_req_done */
+    void *user_data;
+    /* set on completion */
+    int rc;
+    char *out_json;                 /* JSON convention; freed by the caller */
+    uint32_t done;
+    char error[128];                /* tr_last_error of a failed call */
+} TrSyscallReq;
+
+typedef struct {
+    Channel *queue;                 /* pending blocking requests and undelivered completions */
+    tr_thread_t *threads;
+    size_t nthreads;
+} SyscallPool;
+
+static SyscallPool g_syscall_pool;
+static uint32_t g_syscall_pool_state = 0;   /* 0 = stopped, 1 = transitioning, 2 = running */
+
+/* flags of the entry a request names; -1 if it is not registered */
+static int syscall_req_flags(const TrSyscallReq *r)
+{
+    uint64_t *slot;
+    syscall_read_enter(&slot);
+    SyscallIndex *ix = tr_atomic_load_acquire(&g_syscall_index);
+    SyscallEntry *e = NULL;
+    if (ix && r->name) e = syscall_index_find(ix, r->name);
+    else if (ix && r->handle && r->handle - 1 < ix->nids) e = ix->by_id[r->handle - 1];
+    int flags = e ? e->flags : -1;
+    syscall_read_exit(slot);
+    return flags;
+}
+
+static void syscall_req_execute(TrSyscallReq *r)
+{
+    tr_clear_last_error();
+    int rc;
+    if (r->binary) {
+        rc = r->name ? tr_invoke_syscall_bin(r->name, r->args, r->args_len, r->auth_token, r->out, &r->out_len)
+                     : tr_invoke_syscall_handle_bin(r->handle, r->args, r->args_len, r->auth_token, r->out, &r->out_len);
+    } else {
+        rc = r->name ? tr_invoke_syscall_ex(r->name, r->args_json, r->auth_token, &r->out_json)
+                     : tr_invoke_syscall_handle(r->handle, r->args_json, r->auth_token, &r->out_json);
+    }
+    r->rc = rc;
+    if (rc != 0) snprintf(r->error, sizeof(r->error), "%s", tr_get_last_error());
+}
+
+/* the channel a completion lands in; it is pinned from submission until delivery returns, so a
+   receiver that reaps the last completion and destroys its capsule or channel right away waits
+   for the sender to get out of channel_send / tr_capsule_send */
+static Channel *syscall_req_target(const TrSyscallReq *r)
+{
+    return r->reply_to ? r->reply_to->inbox : r->reply_cq;
+}
+
+/* Publish a finished request. Returns 0 when it was delivered, there is nowhere to deliver it or
+   the target is closed (the completion is then dropped, done still reads 1), -2 when !wait and
+   the target is full (it stays pinned). */
+static int syscall_req_deliver(TrSyscallReq *r, int wait)
+{
+    Capsule *cap = r->reply_to;
+    Channel *cq = syscall_req_target(r);
+    tr_atomic_store_release(&r->done, 1u);
+    if (!cq) return 0;
+    int rc = cap ? (wait ? tr_capsule_send(cap, r) : tr_capsule_try_send(cap, r)) : channel_send(cq, r, wait, 0);
+    if (rc == -2) return -2;
+    tr_atomic_fetch_sub(&cq->pins, 1u);
+    return 0;
+}
+
+static void *syscall_pool_main(void *arg)
+{
+    Channel *q = (Channel*)arg;
+    void *m;
+    while (channel_recv(q, &m, 1, 0) == 1) {
+        TrSyscallReq *r = (TrSyscallReq*)m;
+        if (!tr_atomic_load_acquire(&r->done)) syscall_req_execute(r);
+        syscall_req_deliver(r, 1);
+    }
+    return NULL;
+}
+
+/* Start the blocking-syscall pool (nthreads == 0: one per online CPU, at least 2). Idempotent;
+   called implicitly by the first submission that needs it. */
+int tr_syscall_pool_start(size_t nthreads)
+{
+    uint32_t st = 0;
+    while (!tr_atomic_cas(&g_syscall_pool_state, &st, (uint32_t)1)) {
+        if (st == 2) return 0;
+        st = 0;
+        tr_cpu_relax();
+    }
+    size_t n = nthreads ? nthreads : tr_cpu_count();
+    if (!nthreads && n < 2) n = 2;
+    memset(&g_syscall_pool, 0, sizeof(g_syscall_pool));
+    g_syscall_pool.queue = channel_create_ex(TR_SYSCALL_POOL_QUEUE, TR_CHANNEL_LOCKED);
+    g_syscall_pool.threads = (tr_thread_t*)calloc(n, sizeof(tr_thread_t));
+    if (!g_syscall_pool.queue || !g_syscall_pool.threads) {
+        if (g_syscall_pool.queue) channel_destroy(g_syscall_pool.queue);
+        free(g_syscall_pool.threads);
+        tr_atomic_store_release(&g_syscall_pool_state, (uint32_t)0);
+        tr_set_last_error_fmt("tr_syscall_pool_start: OOM");
+        return -1;
+    }
+    channel_set_name(g_syscall_pool.queue, "syscall_pool");
+    size_t started = 0;
+    while (started < n && tr_thread_create(&g_syscall_pool.threads[started], syscall_pool_main, g_syscall_pool.queue) == 0) started++;
+    if (started < n) {
+        channel_close(g_syscall_pool.queue);
+        for (size_t i = 0; i < started; ++i) tr_thread_join(g_syscall_pool.threads[i]);
+        channel_destroy(g_syscall_pool.queue);
+        free(g_syscall_pool.threads);
+        tr_atomic_store_release(&g_syscall_pool_state, (uint32_t)0);
+        tr_set_last_error_fmt("tr_syscall_pool_start: failed to start %zu threads", n);
+        return -1;
+    }
+    g_syscall_pool.nthreads = n;
+    tr_atomic_store_release(&g_syscall_pool_state, (uint32_t)2);
+    return 0;
+}
+
+/* Run every queued request, deliver its completion, then stop the pool. Submissions must not
+   race with the shutdown. */
+void tr_syscall_pool_shutdown(void)
+{
+    uint32_t st = 2;
+    if (!tr_atomic_cas(&g_syscall_pool_state, &st, (uint32_t)1)) return;
+    channel_close(g_syscall_pool.queue);
+    for (size_t i = 0; i < g_syscall_pool.nthreads; ++i) tr_thread_join(g_syscall_pool.threads[i]);
+    channel_destroy(g_syscall_pool.queue);
+    free(g_syscall_pool.threads);
+    memset(&g_syscall_pool, 0, sizeof(g_syscall_pool));
+    tr_atomic_store_release(&g_syscall_pool_state, (uint32_t)0);
+}
+
+/* Submit n requests. Returns how many were accepted, in order; a request that is not accepted was
+   left untouched (the pool queue is full) and can be resubmitted; -2 when none were accepted, -1
+   on a NULL request or when the pool cannot start.
+   An accepted request belongs to the runtime until its completion is delivered; with no reply
+   target it is complete once tr_syscall_req_done returns 1. Lookup and handler errors complete
+   the request with the usual negative rc rather than failing the submission. */
+int tr_syscall_submit(TrSyscallReq *const *reqs, size_t n)
+{
+    if (!reqs && n) { tr_set_last_error_fmt("tr_syscall_submit: invalid args"); return -1; }
+    size_t accepted = 0;
+    int err = 0;
+    for (; accepted < n; ++accepted) {
+        TrSyscallReq *r = reqs[accepted];
+        if (!r) { err = -1; tr_set_last_error_fmt("tr_syscall_submit: request %zu is NULL", accepted); break; }
+        int flags = syscall_req_flags(r);
+        int pooled = flags >= 0 && (flags & TR_SYSCALL_FLAG_BLOCKING);
+        if (pooled && tr_atomic_load_acquire(&g_syscall_pool_state) != 2 && tr_syscall_pool_start(0) != 0) { err = -1; break; }
+        r->rc = 0;
+        r->out_json = NULL;
+        r->error[0] = '\0';
+        tr_atomic_store_relaxed(&r->done, 0u);
+        Channel *target = syscall_req_target(r);
+        if (target) tr_atomic_fetch_add(&target->pins, 1u);
+        if (pooled) {
+            if (channel_send(g_syscall_pool.queue, r, 0, 0) != 0) {
+                if (target) tr_atomic_fetch_sub(&target->pins, 1u);
+                err = -2;
+                tr_set_last_error_code(TR_ERR_WOULD_BLOCK, "tr_syscall_submit");
+                break;
+            }
+            continue;
+        }
+        syscall_req_execute(r);
+        if (syscall_req_deliver(r, 0) == -2) {
+            /* target inbox full: let the pool wait for room instead of the (likely same) capsule */
+            if (tr_atomic_load_acquire(&g_syscall_pool_state) == 2 || tr_syscall_pool_start(0) == 0) channel_send(g_syscall_pool.queue, r, 1, 0);
+            else syscall_req_deliver(r, 1);
+        }
+    }
+    return accepted == 0 && err ? err : (int)accepted;
+}
+
+/* 1 once the request has completed (acquire: its results are visible), else 0 */
+int tr_syscall_req_done(const TrSyscallReq *r)
+{
+    return r && tr_atomic_load_acquire(&r->done) ? 1 : 0;
+}
+
+/* ---------------------------
+   Runtime metrics snapshot
+   - per-object values are copied out first (channel stats under each channel's lock, while the
+     registry lock keeps the objects alive), then rendered without holding anything
+   - JSON: { counters, histograms, channels[], capsules[], syscalls[] }, durations in ns
+   - Prometheus text exposition: trion_* families, durations in seconds
+   --------------------------- */
+
+typedef struct {
+    uint64_t id;
+    char label[32];
+    int kind;
+    int closed;
+    size_t capacity;
+    size_t depth;
+    uint64_t sent, received;
+    uint64_t send_waits, send_blocked_ns, send_timeouts, recv_timeouts;
+} TrChannelSample;
+
+typedef struct {
+    char name[64];
+    int mode;
+    uint64_t inbox_id;
+    uint64_t runs, run_ns, lag_ns, lag_max_ns;
+} TrCapsuleSample;
+
+static const char *tr_channel_kind_name(int kind)
+{
+    return kind == TR_CHANNEL_SPSC ? "spsc" : kind == TR_CHANNEL_MPSC ? "mpsc" : "locked";
+}
+
+/* arrays are malloc'd (NULL on OOM with a zero count) */
+static void tr_metrics_collect(TrChannelSample **chs, size_t *nch, TrCapsuleSample **caps, size_t *ncap)
+{
+    *nch = *ncap = 0;
+    tr_metrics_lock();
+    size_t n = 0;
+    for (Channel *c = g_metric_channels; c; c = c->m_next) n++;
+    *chs = (TrChannelSample*)calloc(n ? n : 1, sizeof(TrChannelSample));
+    for (Channel *c = g_metric_channels; c && *chs; c = c->m_next) {
+        TrChannelSample *o = &(*chs)[(*nch)++];
+        tr_mutex_lock(&c->lock);
+        o->id = c->id;
+        memcpy(o->label, c->label, sizeof(o->label));
+        o->kind = c->kind;
+        o->closed = c->closed;
+        o->capacity = c->capacity;
+        if (c->ring) {
+            o->received = tr_atomic_load_acquire(&c->ring->head);
+            o->sent = tr_atomic_load_acquire(&c->ring->tail);
+            if (o->sent < o->received) o->sent = o->received;
+            o->depth = (size_t)(o->sent - o->received);
+            if (o->depth > c->capacity) o->depth = c->capacity;
+        } else {
+            o->sent = c->sent;
+            o->received = c->received;
+            o->depth = c->count;
+        }
+        o->send_waits = c->send_waits;
+        o->send_blocked_ns = c->send_blocked_ns;
+        o->send_timeouts = c->send_timeouts;
+        o->recv_timeouts = c->recv_timeouts;
+        tr_mutex_unlock(&c->lock);
+    }
+    n = 0;
+    for (Capsule *c = g_metric_capsules; c; c = c->m_next) n++;
+    *caps = (TrCapsuleSample*)calloc(n ? n : 1, sizeof(TrCapsuleSample));
+    for (Capsule *c = g_metric_capsules; c && *caps; c = c->m_next) {
+        TrCapsuleSample *o = &(*caps)[(*ncap)++];
+        snprintf(o->name, sizeof(o->name), "%s", c->name);
+        o->mode = c->mode;
+        o->inbox_id = c->inbox ? c->inbox->id : 0;
+        o->runs = tr_atomic_load_relaxed(&c->m_runs);
+        o->run_ns = tr_atomic_load_relaxed(&c->m_run_ns);
+        o->lag_ns = tr_atomic_load_relaxed(&c->m_lag_ns);
+        o->lag_max_ns = tr_atomic_load_relaxed(&c->m_lag_max_ns);
+    }
+    tr_metrics_unlock();
+}
+
+static void tr_metrics_render_json(TrMetricsBuf *b, const int64_t *ctr, const TrHist *hist,
+                                   const TrChannelSample *chs, size_t nch, const TrCapsuleSample *caps, size_t ncap)
+{
+    tr_mbuf_printf(b, "{\"counters\":{");
+    for (int i = 0; i < TR_M_COUNTERS; ++i) tr_mbuf_printf(b, "%s\"%s\":%lld", i ? "," : "", g_metric_counter_defs[i].key, (long long)ctr[i]);
+    tr_mbuf_printf(b, "},\"histograms\":{");
+    for (int i = 0; i < TR_H_COUNT; ++i) {
+        tr_mbuf_printf(b, "%s\"%s\":", i ? "," : "", g_metric_hist_defs[i].key);
+        tr_mbuf_hist_json(b, &hist[i]);
+    }
+    tr_mbuf_printf(b, "},\"channels\":[");
+    for (size_t i = 0; i < nch; ++i) {
+        const TrChannelSample *c = &chs[i];
+        tr_mbuf_printf(b, "%s{\"id\":%llu,\"name\":", i ? "," : "", (unsigned long long)c->id);
+        tr_mbuf_quoted(b, c->label);
+        tr_mbuf_printf(b, ",\"kind\":\"%s\",\"closed\":%d,\"capacity\":%zu,\"depth\":%zu,\"sent\":%llu,\"received\":%llu,"
+                          "\"send_waits\":%llu,\"send_blocked_ns\":%llu,\"send_timeouts\":%llu,\"recv_timeouts\":%llu}",
+                       tr_channel_kind_name(c->kind), c->closed, c->capacity, c->depth,
+                       (unsigned long long)c->sent, (unsigned long long)c->received, (unsigned long long)c->send_waits,
+                       (unsigned long long)c->send_blocked_ns, (unsigned long long)c->send_timeouts, (unsigned long long)c->recv_timeouts);
+    }
+    tr_mbuf_printf(b, "],\"capsules\":[");
+    for (size_t i = 0; i < ncap; ++i) {
+        const TrCapsuleSample *c = &caps[i];
+        tr_mbuf_printf(b, "%s{\"name\":", i ? "," : "");
+        tr_mbuf_quoted(b, c->name);
+        tr_mbuf_printf(b, ",\"mode\":\"%s\",\"inbox_id\":%llu,\"runs\":%llu,\"run_ns\":%llu,\"inbox_lag_ns\":%llu,\"inbox_lag_max_ns\":%llu}",
+                       c->mode == TR_CAPSULE_MODE_TASK ? "task" : "thread", (unsigned long long)c->inbox_id,
+                       (unsigned long long)c->runs, (unsigned long long)c->run_ns, (unsigned long long)c->lag_ns, (unsigned long long)c->lag_max_ns);
+    }
+    tr_mbuf_printf(b, "],\"syscalls\":[");
+    int first = 1;
+    for (SyscallStats *st = tr_atomic_load_acquire(&g_syscall_stats); st; st = st->next) {
+        TrHist h;
+        memset(&h, 0, sizeof(h));
+        tr_hist_merge(&h, &st->lat);
+        tr_mbuf_printf(b, "%s{\"name\":", first ? "" : ",");
+        tr_mbuf_quoted(b, st->name);
+        tr_mbuf_printf(b, ",\"calls\":%llu,\"errors\":%llu,\"latency\":", (unsigned long long)tr_atomic_load_relaxed(&st->calls),
+                       (unsigned long long)tr_atomic_load_relaxed(&st->errors));
+        tr_mbuf_hist_json(b, &h);
+        tr_mbuf_printf(b, "}");
+        first = 0;
+    }
+    tr_mbuf_printf(b, "]}\n");
+}
+
+/* channel label set: id="..",name="..",kind=".." */
+static void tr_mbuf_channel_labels(TrMetricsBuf *b, const TrChannelSample *c)
+{
+    tr_mbuf_printf(b, "{id=\"%llu\",name=", (unsigned long long)c->id);
+    tr_mbuf_quoted(b, c->label);
+    tr_mbuf_printf(b, ",kind=\"%s\"}", tr_channel_kind_name(c->kind));
+}
+
+static void tr_metrics_render_prom(TrMetricsBuf *b, const int64_t *ctr, const TrHist *hist,
+                                   const TrChannelSample *chs, size_t nch, const TrCapsuleSample *caps, size_t ncap)
+{
+    for (int i = 0; i < TR_M_COUNTERS; ++i) {
+        tr_mbuf_printf(b, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", g_metric_counter_defs[i].name, g_metric_counter_defs[i].help,
+                       g_metric_counter_defs[i].name, g_metric_counter_defs[i].gauge ? "gauge" : "counter",
+                       g_metric_counter_defs[i].name, (long long)ctr[i]);
+    }
+    for (int i = 0; i < TR_H_COUNT; ++i) {
+        tr_mbuf_printf(b, "# HELP %s %s\n# TYPE %s histogram\n", g_metric_hist_defs[i].name, g_metric_hist_defs[i].help, g_metric_hist_defs[i].name);
+        tr_mbuf_hist_prom(b, g_metric_hist_defs[i].name, "", &hist[i]);
+    }
+
+    static const struct { const char *name; const char *type; const char *help; } chan_defs[] = {
+        { "trion_channel_depth", "gauge", "Items currently queued." },
+        { "trion_channel_capacity", "gauge", "Channel capacity (ring kinds round up to a power of two)." },
+        { "trion_channel_sent_items_total", "counter", "Items enqueued." },
+        { "trion_channel_received_items_total", "counter", "Items dequeued." },
+        { "trion_channel_blocked_sends_total", "counter", "Send calls that had to wait for space." },
+        { "trion_channel_send_blocked_seconds_total", "counter", "Total time sends spent waiting for space." },
+        { "trion_channel_timed_out_sends_total", "counter", "Sends that timed out." },
+        { "trion_channel_timed_out_recvs_total", "counter", "Receives that timed out." },
+    };
+    for (size_t d = 0; d < sizeof(chan_defs) / sizeof(chan_defs[0]); ++d) {
+        if (!nch) break;
+        const char *fam = chan_defs[d].name;
+        tr_mbuf_printf(b, "# HELP %s %s\n# TYPE %s %s\n", fam, chan_defs[d].help, fam, chan_defs[d].type);
+        for (size_t i = 0; i < nch; ++i) {
+            const TrChannelSample *c = &chs[i];
+            uint64_t v;
+            switch (d) {
+            case 0: v = c->depth; break;
+            case 1: v = c->capacity; break;
+            case 2: v = c->sent; break;
+            case 3: v = c->received; break;
+            case 4: v = c->send_waits; break;
+            case 5: v = c->send_blocked_ns; break;
+            case 6: v = c->send_timeouts; break;
+            default: v = c->recv_timeouts; break;
+            }
+            tr_mbuf_printf(b, "%s", fam);
+            tr_mbuf_channel_labels(b, c);
+            if (d == 5) tr_mbuf_printf(b, " %.12g\n", (double)v / 1e9);
+            else tr_mbuf_printf(b, " %llu\n", (unsigned long long)v);
+        }
+    }
+
+    static const struct { const char *name; const char *type; const char *help; } cap_defs[] = {
+        { "trion_capsule_executions_total", "counter", "Entry runs (thread capsules) or steps (task capsules)." },
+        { "trion_capsule_busy_seconds_total", "counter", "Time spent inside the capsule's entry or step." },
+        { "trion_capsule_queued_seconds_total", "counter", "Time a task capsule spent runnable but waiting for a worker." },
+        { "trion_capsule_queued_max_seconds", "gauge", "Longest single wait for a worker." },
+    };
+    for (size_t d = 0; d < sizeof(cap_defs) / sizeof(cap_defs[0]); ++d) {
+        if (!ncap) break;
+        const char *fam = cap_defs[d].name;
+        tr_mbuf_printf(b, "# HELP %s %s\n# TYPE %s %s\n", fam, cap_defs[d].help, fam, cap_defs[d].type);
+        for (size_t i = 0; i < ncap; ++i) {
+            const TrCapsuleSample *c = &caps[i];
+            tr_mbuf_printf(b, "%s{capsule=", fam);
+            tr_mbuf_quoted(b, c->name);
+            tr_mbuf_printf(b, ",mode=\"%s\"} ", c->mode == TR_CAPSULE_MODE_TASK ? "task" : "thread");
+            if (d == 0) tr_mbuf_printf(b, "%llu\n", (unsigned long long)c->runs);
+            else tr_mbuf_printf(b, "%.12g\n", (double)(d == 1 ? c->run_ns : d == 2 ? c->lag_ns : c->lag_max_ns) / 1e9);
+        }
+    }
+
+    SyscallStats *stats = tr_atomic_load_acquire(&g_syscall_stats);
+    if (!stats) return;
+    tr_mbuf_printf(b, "# HELP trion_syscall_handler_seconds Handler latency per syscall name.\n# TYPE trion_syscall_handler_seconds histogram\n");
+    for (SyscallStats *st = stats; st; st = st->next) {
+        TrHist h;
+        memset(&h, 0, sizeof(h));
+        tr_hist_merge(&h, &st->lat);
+        TrMetricsBuf lb = { (char*)malloc(128), 0, 128, 0 };
+        if (!lb.p) { b->oom = 1; return; }
+        tr_mbuf_printf(&lb, "syscall=");
+        tr_mbuf_quoted(&lb, st->name);
+        if (lb.oom) { free(lb.p); b->oom = 1; return; }
+        tr_mbuf_hist_prom(b, "trion_syscall_handler_seconds", lb.p, &h);
+        free(lb.p);
+    }
+    tr_mbuf_printf(b, "# HELP trion_syscall_handler_errors_total Failed invocations per syscall name.\n# TYPE trion_syscall_handler_errors_total counter\n");
+    for (SyscallStats *st = stats; st; st = st->next) {
+        tr_mbuf_printf(b, "trion_syscall_handler_errors_total{syscall=");
+        tr_mbuf_quoted(b, st->name);
+        tr_mbuf_printf(b, "} %llu\n", (unsigned long long)tr_atomic_load_relaxed(&st->errors));
+    }
+}
+
+/* Render every runtime metric as TR_METRICS_JSON or TR_METRICS_PROMETHEUS text. Returns a
+   malloc'd NUL-terminated string (caller frees), or NULL with tr_last_error set. */
+char *tr_metrics_snapshot(int format)
+{
+    if (format != TR_METRICS_JSON && format != TR_METRICS_PROMETHEUS) {
+        tr_set_last_error_fmt("tr_metrics_snapshot: unknown format %d", format);
+        return NULL;
+    }
+    int64_t ctr[TR_M_COUNTERS];
+    TrHist *hist = (TrHist*)calloc(TR_H_COUNT, sizeof(TrHist));
+    TrMetricsBuf b = { (char*)malloc(16384), 0, 16384, 0 };
+    if (!hist || !b.p) { free(hist); free(b.p); tr_set_last_error_fmt("tr_metrics_snapshot: OOM"); return NULL; }
+    memset(ctr, 0, sizeof(ctr));
+    for (size_t s = 0; s < TR_METRIC_SHARDS; ++s) {
+        for (int i = 0; i < TR_M_COUNTERS; ++i) ctr[i] += (int64_t)tr_atomic_load_relaxed(&g_metric_shards[s].c[i]);
+        for (int i = 0; i < TR_H_COUNT; ++i) tr_hist_merge(&hist[i], &g_metric_shards[s].h[i]);
+    }
+    TrChannelSample *chs = NULL;
+    TrCapsuleSample *caps = NULL;
+    size_t nch = 0, ncap = 0;
+    tr_metrics_collect(&chs, &nch, &caps, &ncap);
+    b.p[0] = '\0';
+    if (format == TR_METRICS_JSON) tr_metrics_render_json(&b, ctr, hist, chs, nch, caps, ncap);
+    else tr_metrics_render_prom(&b, ctr, hist, chs, nch, caps, ncap);
+    free(chs);
+    free(caps);
+    free(hist);
+    if (b.oom) { free(b.p); tr_set_last_error_fmt("tr_metrics_snapshot: OOM"); return NULL; }
+    return b.p;
+}
+
+/* ---------------------------
+   Process sandbox runner (maximized)
+   - If running on Linux: attempt unshare(CLONE_NEWPID|CLONE_NEWNS|CLONE_NEWNET) and seccomp when available.
+   - Always set rlimits, optionally chroot (requires root), optionally drop uid/gid.
+   - Returns detailed error codes and sets tr_last_error with diagnostic.
+   - The seccomp policy is compiled to BPF once per process; children only install it.
+   - One-shot runs use clone(CLONE_VM|CLONE_VFORK) on Linux (no page-table copy of a large parent);
+     tr_sandbox_pool keeps pre-forked, pre-hardened zygotes that take exec requests over a
+     socketpair. Both report wall time, CPU time and peak RSS from wait4.
+   --------------------------- */
+
+/* per-job accounting returned by tr_sandbox_spawn and tr_sandbox_pool_run */
+typedef struct TrionSandboxResult {
+    int exit_code;          /* exit status, -signal when killed by a signal, -1 on timeout */
+    int exec_errno;         /* errno of a failed execve when known (exit_code is then 127), else 0 */
+    uint64_t wall_us;       /* spawn to reap */
+    uint64_t user_us;
+    uint64_t sys_us;
+    uint64_t max_rss_kb;    /* peak resident set size; on the tr_sandbox_spawn vfork path this also
+                               covers the caller's own peak (folded in by the kernel at exec), the
+                               pool reports the job alone */
+} TrionSandboxResult;
+
+typedef struct TrionSandboxPool TrionSandboxPool;
+
+#ifndef _WIN32
+
+#include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#ifdef __has_include
+#if __has_include(<linux/seccomp.h>) && __has_include(<seccomp.h>)
+#define HAVE_LIBSECCOMP 1
+#include <seccomp.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#endif
+#endif
+#endif
+
+/* Everything a child needs between spawn and execve. The child writes the *_err fields back;
+   on the vfork path it shares the parent's memory, so they are read directly after the spawn. */
+typedef struct SandboxJob {
+    const char *path;
+    char *const *argv;
+    char *const *envp;
+    const char *working_dir;
+    uint64_t time_ms;
+    size_t memory_limit_bytes;
+    uid_t run_uid;
+    gid_t run_gid;
+    int ns_flags;           /* namespaces to unshare in the child */
+    int set_nnp;            /* set PR_SET_NO_NEW_PRIVS in the child */
+    int unshare_err;        /* -1: not attempted, 0: ok, else errno */
+    int nnp_err;
+    int seccomp_err;
+    int exec_errno;
+#ifdef __linux__
+    sigset_t sigmask;       /* the spawning thread's mask, restored in the child before exec */
+#endif
+} SandboxJob;
+
+static int sandbox_ns_flags(void)
+{
+    int flags = 0;
+#ifdef __linux__
+    // Unshare PID, mount, and network namespaces if available
+#ifdef CLONE_NEWPID
+    flags |= CLONE_NEWPID;
+#endif
+#ifdef CLONE_NEWNS
+    flags |= CLONE_NEWNS;
+#endif
+#ifdef CLONE_NEWNET
+    flags |= CLONE_NEWNET;
+#endif
+#endif
+    return flags;
+}
+
+#ifdef HAVE_LIBSECCOMP
+static struct sock_filter *g_sandbox_bpf;
+static unsigned short g_sandbox_bpf_len;
+#endif
+static pthread_once_t g_sandbox_once = PTHREAD_ONCE_INIT;
+
+/* Compile the seccomp policy once and keep the raw BPF program, so a child installs it with a
+   single prctl instead of running libseccomp (and malloc) between fork and exec. */
+static void sandbox_init(void)
+{
+#ifdef HAVE_LIBSECCOMP
+    // minimal seccomp filter: allow read, write, exit, sigreturn, rt_sigreturn; block execve by default
+    scmp_filter_ctx ctx = seccomp_init(SCMP_ACT_KILL); // deny by kill
+    if (!ctx) {
+        tr_audit_log("sandbox: seccomp_init failed");
+        return;
+    }
+    // allow some syscalls commonly required for normal process operation; this is conservative skeleton
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(sigreturn), 0);
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rt_sigreturn), 0);
+    // allow futex for threads
+    seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 0);
+    // export the compiled program instead of loading it here
+    FILE *tmp = tmpfile();
+    if (tmp && seccomp_export_bpf(ctx, fileno(tmp)) == 0) {
+        off_t sz = lseek(fileno(tmp), 0, SEEK_END);
+        size_t count = sz > 0 ? (size_t)sz / sizeof(struct sock_filter) : 0;
+        if (count && count <= 0xFFFF && (size_t)sz % sizeof(struct sock_filter) == 0) {
+            g_sandbox_bpf = (struct sock_filter*)malloc((size_t)sz);
+            if (g_sandbox_bpf && pread(fileno(tmp), g_sandbox_bpf, (size_t)sz, 0) == sz) {
+                g_sandbox_bpf_len = (unsigned short)count;
+            } else {
+                free(g_sandbox_bpf);
+                g_sandbox_bpf = NULL;
+            }
+        }
+    }
+    if (!g_sandbox_bpf_len) tr_audit_log("sandbox: seccomp export failed");
+    if (tmp) fclose(tmp);
+    seccomp_release(ctx);
+#endif // HAVE_LIBSECCOMP
+}
+
+/* Child side of a spawn, up to execve. Only async-signal-safe calls: on the vfork path this runs
+   on a borrowed stack in the parent's address space, so credentials are dropped with raw
+   syscalls (glibc's setuid would try to signal every thread of the parent). */
+static void sandbox_child_setup(SandboxJob *j)
+{
+    // make session to isolate signals
+    setsid();
+    if (j->working_dir) chdir(j->working_dir);
+    // set resource limits
+    if (j->memory_limit_bytes > 0) {
+        struct rlimit rl;
+        rl.rlim_cur = rl.rlim_max = j->memory_limit_bytes;
+        setrlimit(RLIMIT_AS, &rl);
+    }
+    if (j->time_ms > 0) {
+        struct rlimit rl;
+        rl.rlim_cur = rl.rlim_max = (j->time_ms + 999) / 1000;
+        setrlimit(RLIMIT_CPU, &rl);
+    }
+#ifdef __linux__
+    // try to further harden child process (namespaces, seccomp) - best-effort
+    if (j->ns_flags) j->unshare_err = unshare(j->ns_flags) == 0 ? 0 : errno;
+    // no_new_privs is a prerequisite for seccomp
+    if (j->set_nnp) j->nnp_err = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 ? 0 : errno;
+    // drop credentials before the filter goes in; caller should have set them
+    if (j->run_gid != (gid_t)-1) syscall(SYS_setgid, j->run_gid);
+    if (j->run_uid != (uid_t)-1) syscall(SYS_setuid, j->run_uid);
+#ifdef HAVE_LIBSECCOMP
+    if (g_sandbox_bpf_len) {
+        struct sock_fprog prog;
+        prog.len = g_sandbox_bpf_len;
+        prog.filter = g_sandbox_bpf;
+        j->seccomp_err = prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0) == 0 ? 0 : errno;
+    }
+#endif
+#endif // __linux__
+}
+
+static void sandbox_job_init(SandboxJob *j, const char *path, char *const argv[], char *const envp[],
+                             const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                             uid_t run_uid, gid_t run_gid)
+{
+    memset(j, 0, sizeof(*j));
+    j->path = path;
+    j->argv = argv;
+    j->envp = envp;
+    j->working_dir = working_dir;
+    j->time_ms = time_ms;
+    j->memory_limit_bytes = memory_limit_bytes;
+    j->run_uid = run_uid;
+    j->run_gid = run_gid;
+    j->unshare_err = j->nnp_err = j->seccomp_err = -1;
+}
+
+/* Audit what the child managed to apply (it cannot log safely itself). */
+static void sandbox_log_job(const SandboxJob *j, int ns_flags)
+{
+    if (j->unshare_err > 0) tr_audit_log("sandbox: unshare failed: %s", strerror(j->unshare_err));
+    else if (j->unshare_err == 0) tr_audit_log("sandbox: unshare succeeded flags=%d", ns_flags);
+    if (j->nnp_err > 0) tr_audit_log("sandbox: PR_SET_NO_NEW_PRIVS failed: %s", strerror(j->nnp_err));
+    if (j->seccomp_err > 0) tr_audit_log("sandbox: seccomp_load failed: %s", strerror(j->seccomp_err));
+    else if (j->seccomp_err == 0) tr_audit_log("sandbox: seccomp loaded");
+    if (j->exec_errno) tr_audit_log("sandbox: execve %s failed: %s", j->path, strerror(j->exec_errno));
+}
+
+static uint64_t sandbox_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)(ts.tv_nsec / 1000);
+}
+
+/* Reap pid, killing it once time_ms has passed since t0_us (0 = no limit), and fill res from
+   wait4's rusage. Returns 0 (exited), -2 (timeout), -3 (signaled) or -1 with errno set. Waits on
+   a pidfd when the kernel has one, else polls with a backoff that starts well under the old
+   fixed 50ms sleep, so short jobs are not rounded up. */
+static int sandbox_wait(pid_t pid, uint64_t time_ms, uint64_t t0_us, TrionSandboxResult *res)
+{
+    int status = 0;
+    int timed_out = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    if (time_ms == 0) {
+        while (wait4(pid, &status, 0, &ru) < 0) if (errno != EINTR) return -1;
+    } else {
+        uint64_t deadline = t0_us + time_ms * 1000u;
+        int pfd = -1;
+#if defined(__linux__) && defined(SYS_pidfd_open)
+        pfd = (int)syscall(SYS_pidfd_open, pid, 0);
+#endif
+        uint64_t nap_us = 500;
+        for (;;) {
+            pid_t w = wait4(pid, &status, WNOHANG, &ru);
+            if (w == pid) break;
+            if (w < 0 && errno != EINTR) {
+                int e = errno;
+                if (pfd >= 0) close(pfd);
+                errno = e;
+                return -1;
+            }
+            uint64_t now = sandbox_now_us();
+            if (now >= deadline) {
+                kill(pid, SIGKILL);
+                while (wait4(pid, &status, 0, &ru) < 0 && errno == EINTR) {}
+                timed_out = 1;
+                break;
+            }
+            uint64_t left = deadline - now;
+#ifdef __linux__
+            if (pfd >= 0) {
+                struct pollfd pf;
+                pf.fd = pfd; pf.events = POLLIN; pf.revents = 0;
+                poll(&pf, 1, (int)((left + 999) / 1000));
+                continue;
+            }
+#endif
+            usleep((useconds_t)(left < nap_us ? left : nap_us));
+            if (nap_us < 50000) nap_us *= 2;
+        }
+        if (pfd >= 0) close(pfd);
+    }
+    res->wall_us = sandbox_now_us() - t0_us;
+    res->user_us = (uint64_t)ru.ru_utime.tv_sec * 1000000u + (uint64_t)ru.ru_utime.tv_usec;
+    res->sys_us = (uint64_t)ru.ru_stime.tv_sec * 1000000u + (uint64_t)ru.ru_stime.tv_usec;
+#if defined(__APPLE__)
+    res->max_rss_kb = (uint64_t)ru.ru_maxrss / 1024;   /* bytes on Darwin */
+#else
+    res->max_rss_kb = (uint64_t)ru.ru_maxrss;
+#endif
+    if (timed_out) { res->exit_code = -1; return -2; }
+    if (WIFSIGNALED(status)) { res->exit_code = -WTERMSIG(status); return -3; }
+    res->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+    return 0;
+}
+
+#ifdef __linux__
+#define TR_SANDBOX_STACK (64 * 1024)
+
+static int sandbox_clone_main(void *arg)
+{
+    SandboxJob *j = (SandboxJob*)arg;
+    /* the handler table is our own copy (no CLONE_SIGHAND); reset it so no parent handler can run
+       on this borrowed stack once signals are unblocked */
+    for (int sig = 1; sig < NSIG; ++sig) {
+        struct sigaction sa;
+        if (sigaction(sig, NULL, &sa) != 0 || sa.sa_handler == SIG_IGN || sa.sa_handler == SIG_DFL) continue;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_DFL;
+        sigaction(sig, &sa, NULL);
+    }
+    sigprocmask(SIG_SETMASK, &j->sigmask, NULL);
+    sandbox_child_setup(j);
+    // exec
+    execve(j->path, j->argv, j->envp);
+    j->exec_errno = errno;
+    _exit(127);
+}
+#endif
+
+#ifdef __linux__
+/* vfork-style spawn of j; returns the pid or -1 */
+static pid_t sandbox_vfork(SandboxJob *j)
+{
+    /* the parent thread is suspended until the child execs or exits, so the stack can be freed
+       right after clone returns */
+    void *stack = mmap(NULL, TR_SANDBOX_STACK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) return -1;
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &j->sigmask);
+    pid_t pid = clone(sandbox_clone_main, (char*)stack + TR_SANDBOX_STACK, CLONE_VM | CLONE_VFORK | SIGCHLD, j);
+    int e = errno;
+    pthread_sigmask(SIG_SETMASK, &j->sigmask, NULL);
+    munmap(stack, TR_SANDBOX_STACK);
+    errno = e;
+    return pid;
+}
+#endif
+
+static pid_t sandbox_fork(SandboxJob *j)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* child */
+        sandbox_child_setup(j);
+        execve(j->path, j->argv, j->envp);
+        // if exec fails
+        j->exec_errno = errno;
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Start j and wait for it. Returns like sandbox_wait. share_vm selects the vfork path (Linux);
+   otherwise the child is forked and its *_err fields only come back if j is in shared memory. */
+static int sandbox_spawn_wait(SandboxJob *j, int share_vm, TrionSandboxResult *res)
+{
+    memset(res, 0, sizeof(*res));
+    uint64_t t0 = sandbox_now_us();
+#ifdef __linux__
+    pid_t pid = share_vm ? sandbox_vfork(j) : sandbox_fork(j);
+#else
+    (void)share_vm;
+    pid_t pid = sandbox_fork(j);
+#endif
+    if (pid < 0) return -1;
+    TR_TRACE('B', "sandbox.run", tr_trace_basename(j->path), "pid", pid);
+    int rc = sandbox_wait(pid, j->time_ms, t0, res);
+    res->exec_errno = j->exec_errno;
+    TR_TRACE('E', "sandbox.run", NULL, "exit_code", res->exit_code);
+    return rc;
+}
+
+int tr_sandbox_spawn(const char *path, char *const argv[], char *const envp[],
+                     const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                     uid_t run_uid, gid_t run_gid, TrionSandboxResult *res)
+{
+    if (!path) { tr_set_last_error_fmt("tr_sandbox_spawn: path is NULL"); return -1; }
+    pthread_once(&g_sandbox_once, sandbox_init);
+    SandboxJob j;
+    sandbox_job_init(&j, path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid);
+    j.ns_flags = sandbox_ns_flags();
+    j.set_nnp = 1;
+    TrionSandboxResult r;
+    int rc = sandbox_spawn_wait(&j, 1, &r);
+    if (rc == -1) { tr_set_last_error_fmt("tr_sandbox_spawn: spawn/wait failed: %s", strerror(errno)); return -1; }
+    sandbox_log_job(&j, j.ns_flags);
+    if (rc == -2) {
+        tr_set_last_error_fmt("tr_sandbox_spawn: timeout, killed child");
+        tr_audit_log("sandbox_run: timeout path=%s", path);
+    }
+    if (res) *res = r;
+    return rc;
+}
+
+int tr_sandbox_run(const char *path, char *const argv[], char *const envp[],
+                   const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                   uid_t run_uid, gid_t run_gid, int *out_exitcode)
+{
+    if (!path) { tr_set_last_error_fmt("tr_sandbox_run: path is NULL"); return -1; }
+    TrionSandboxResult res;
+    int rc = tr_sandbox_spawn(path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid, &res);
+    if (rc == -1) return -1;
+    if (out_exitcode) *out_exitcode = res.exit_code;
+    return rc;
+}
+
+#ifdef __linux__
+/* ---- zygote pool ----
+   Each zygote is forked once, applies the hardening that can be shared by every job (mount and
+   network namespaces, no_new_privs), then serves one request at a time from its socketpair: it
+   vfork-spawns the job (pid namespace, rlimits, credentials, seccomp), reaps it and replies with
+   the result. A zygote is small and single-threaded, so its spawns stay cheap however large the
+   parent grows. */
+
+#define TR_SANDBOX_REQ_MAX (64 * 1024)
+#define TR_SANDBOX_MAX_ARGS 1024
+
+typedef struct SandboxReqHdr {
+    uint64_t time_ms;
+    uint64_t memory_limit_bytes;
+    int64_t run_uid;            /* -1 keeps the zygote's credentials */
+    int64_t run_gid;
+    uint32_t nargv;
+    uint32_t nenvp;
+    uint32_t has_wd;
+    /* followed by NUL-terminated strings: path, [working_dir], argv..., envp... */
+} SandboxReqHdr;
+
+typedef struct SandboxReply {
+    int32_t rc;
+    int32_t err;                /* errno when rc == -1 */
+    int32_t unshare_err;
+    int32_t nnp_err;
+    int32_t seccomp_err;
+    TrionSandboxResult res;
+} SandboxReply;
+
+typedef struct SandboxZygote {
+    pid_t pid;
+    int fd;                     /* our end of the socketpair, -1 when the zygote is gone */
+    int busy;
+} SandboxZygote;
+
+struct TrionSandboxPool {
+    tr_mutex_t lock;
+    tr_cond_t idle;
+    size_t n;
+    int closed;
+    int ns_flags;               /* what the zygotes unshare once, for the audit log */
+    SandboxZygote *z;
+};
+
+/* Split a request into a job; pointers refer into buf and the two arrays. Returns -1 if malformed. */
+static int sandbox_req_parse(char *buf, size_t len, SandboxJob *j, char **argv, char **envp)
+{
+    SandboxReqHdr h;
+    if (len < sizeof(h) || buf[len - 1] != '\0') return -1;
+    memcpy(&h, buf, sizeof(h));
+    if (h.nargv >= TR_SANDBOX_MAX_ARGS || h.nenvp >= TR_SANDBOX_MAX_ARGS) return -1;
+    char *p = buf + sizeof(h), *end = buf + len;
+    size_t need = 1 + (h.has_wd ? 1 : 0) + h.nargv + h.nenvp;
+    char *strs[2];
+    for (size_t k = 0; k < need; ++k) {
+        if (p >= end) return -1;
+        if (k < 1 + (h.has_wd ? 1u : 0u)) strs[k] = p;
+        else if (k < 1 + (h.has_wd ? 1u : 0u) + h.nargv) argv[k - 1 - (h.has_wd ? 1 : 0)] = p;
+        else envp[k - 1 - (h.has_wd ? 1 : 0) - h.nargv] = p;
+        p += strlen(p) + 1;
+    }
+    argv[h.nargv] = NULL;
+    envp[h.nenvp] = NULL;
+    sandbox_job_init(j, strs[0], argv, envp, h.has_wd ? strs[1] : NULL, h.time_ms, (size_t)h.memory_limit_bytes,
+                     (uid_t)h.run_uid, (gid_t)h.run_gid);
+    return 0;
+}
+
+static void sandbox_zygote_main(TrionSandboxPool *p, size_t self, int fd)
+{
+    /* the zygote exits on EOF, i.e. when the pool (or the whole parent) goes away. PDEATHSIG
+       is not used: it tracks the forking thread, which may be a short-lived caller. Siblings'
+       sockets are closed so they do not keep each other alive. */
+    for (size_t i = 0; i < p->n; ++i) if (i != self && p->z[i].fd >= 0) close(p->z[i].fd);
+    int job_ns = 0;
+#ifdef CLONE_NEWPID
+    job_ns = CLONE_NEWPID;      /* a pid namespace dies with its first process, so it stays per job */
+#endif
+    int ns_err = -1;
+    if (p->ns_flags) ns_err = unshare(p->ns_flags) == 0 ? 0 : errno;
+    int nnp_err = prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 ? 0 : errno;
+    /* no malloc from here on: the parent may have been multithreaded when it forked us */
+    size_t arena = TR_SANDBOX_REQ_MAX + 2 * TR_SANDBOX_MAX_ARGS * sizeof(char*);
+    char *buf = (char*)mmap(NULL, arena, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) _exit(1);
+    char **argv = (char**)(buf + TR_SANDBOX_REQ_MAX);
+    char **envp = argv + TR_SANDBOX_MAX_ARGS;
+    /* jobs are forked, not vforked: with a shared mm the kernel folds the zygote's own RSS
+       high-water mark into the job's ru_maxrss. The job lives in a shared page instead so the
+       child's hardening and exec errors still reach us. */
+    SandboxJob *j = (SandboxJob*)mmap(NULL, sizeof(SandboxJob), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (j == MAP_FAILED) _exit(1);
+    for (;;) {
+        ssize_t got = recv(fd, buf, TR_SANDBOX_REQ_MAX, 0);
+        if (got == 0) _exit(0);
+        if (got < 0) { if (errno == EINTR) continue; _exit(1); }
+        SandboxReply rep;
+        memset(&rep, 0, sizeof(rep));
+        if (sandbox_req_parse(buf, (size_t)got, j, argv, envp) != 0) {
+            rep.rc = -1;
+            rep.err = EINVAL;
+        } else {
+            j->ns_flags = job_ns;
+            rep.rc = sandbox_spawn_wait(j, 0, &rep.res);
+            rep.err = rep.rc == -1 ? errno : 0;
+            rep.unshare_err = ns_err > 0 ? ns_err : j->unshare_err;
+            rep.nnp_err = nnp_err;
+            rep.seccomp_err = j->seccomp_err;
+        }
+        while (send(fd, &rep, sizeof(rep), MSG_NOSIGNAL) < 0 && errno == EINTR) {}
+    }
+}
+
+/* Fork zygote i; the pool lock is held (or the pool is not yet shared). */
+static int sandbox_zygote_start(TrionSandboxPool *p, size_t i)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* nothing dumps the zygote's trace buffers, and recording could malloc in a forked child */
+        tr_atomic_store_relaxed(&g_trace_on, 0u);
+        close(sv[0]);
+        sandbox_zygote_main(p, i, sv[1]);
+        _exit(0);
+    }
+    close(sv[1]);
+    if (pid < 0) { close(sv[0]); return -1; }
+    p->z[i].pid = pid;
+    p->z[i].fd = sv[0];
+    return 0;
+}
+
+/* The fd is cleared under the pool lock: a sibling being forked concurrently closes every fd it
+   sees in p->z, and a stale number may already belong to that sibling's own new socket. */
+static void sandbox_zygote_stop(TrionSandboxPool *p, SandboxZygote *z)
+{
+    tr_mutex_lock(&p->lock);
+    int fd = z->fd;
+    z->fd = -1;
+    tr_mutex_unlock(&p->lock);
+    if (fd < 0) return;
+    close(fd);              /* EOF ends the zygote's loop */
+    while (waitpid(z->pid, NULL, 0) < 0 && errno == EINTR) {}
+}
+
+/* nworkers == 0 starts one zygote per CPU. Call early, before the parent grows large, so the
+   forks stay cheap; zygotes that die are restarted on demand. */
+TrionSandboxPool *tr_sandbox_pool_create(size_t nworkers)
+{
+    if (nworkers == 0) nworkers = tr_cpu_count();
+    pthread_once(&g_sandbox_once, sandbox_init);
+    TrionSandboxPool *p = (TrionSandboxPool*)calloc(1, sizeof(TrionSandboxPool));
+    if (p) p->z = (SandboxZygote*)calloc(nworkers, sizeof(SandboxZygote));
+    if (!p || !p->z) { free(p); tr_set_last_error_fmt("tr_sandbox_pool_create: OOM"); return NULL; }
+    p->n = nworkers;
+    p->ns_flags = sandbox_ns_flags() & ~CLONE_NEWPID;
+    for (size_t i = 0; i < nworkers; ++i) p->z[i].fd = -1;
+    tr_mutex_init(&p->lock);
+    tr_cond_init(&p->idle);
+    for (size_t i = 0; i < nworkers; ++i) {
+        if (sandbox_zygote_start(p, i) != 0) {
+            int e = errno;
+            for (size_t k = 0; k < i; ++k) sandbox_zygote_stop(p, &p->z[k]);
+            tr_cond_destroy(&p->idle);
+            tr_mutex_destroy(&p->lock);
+            free(p->z); free(p);
+            tr_set_last_error_fmt("tr_sandbox_pool_create: zygote start failed: %s", strerror(e));
+            return NULL;
+        }
+    }
+    tr_audit_log("sandbox_pool: started %zu zygotes", nworkers);
+    return p;
+}
+
+/* Same contract as tr_sandbox_spawn, run on an idle zygote (blocks while all are busy). */
+int tr_sandbox_pool_run(TrionSandboxPool *p, const char *path, char *const argv[], char *const envp[],
+                        const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                        uid_t run_uid, gid_t run_gid, TrionSandboxResult *res)
+{
+    if (!p || !path) { tr_set_last_error_fmt("tr_sandbox_pool_run: invalid args"); return -1; }
+    SandboxReqHdr h;
+    memset(&h, 0, sizeof(h));
+    h.time_ms = time_ms;
+    h.memory_limit_bytes = memory_limit_bytes;
+    h.run_uid = run_uid == (uid_t)-1 ? -1 : (int64_t)run_uid;
+    h.run_gid = run_gid == (gid_t)-1 ? -1 : (int64_t)run_gid;
+    h.has_wd = working_dir != NULL;
+    size_t len = sizeof(h) + strlen(path) + 1 + (working_dir ? strlen(working_dir) + 1 : 0);
+    while (argv && argv[h.nargv]) len += strlen(argv[h.nargv++]) + 1;
+    while (envp && envp[h.nenvp]) len += strlen(envp[h.nenvp++]) + 1;
+    if (len > TR_SANDBOX_REQ_MAX || h.nargv >= TR_SANDBOX_MAX_ARGS || h.nenvp >= TR_SANDBOX_MAX_ARGS) {
+        tr_set_last_error_fmt("tr_sandbox_pool_run: request too large");
+        return -1;
+    }
+    char *buf = (char*)malloc(len);
+    if (!buf) { tr_set_last_error_fmt("tr_sandbox_pool_run: OOM"); return -1; }
+    memcpy(buf, &h, sizeof(h));
+    char *q = buf + sizeof(h);
+    q += strlen(strcpy(q, path)) + 1;
+    if (working_dir) q += strlen(strcpy(q, working_dir)) + 1;
+    for (uint32_t i = 0; i < h.nargv; ++i) q += strlen(strcpy(q, argv[i])) + 1;
+    for (uint32_t i = 0; i < h.nenvp; ++i) q += strlen(strcpy(q, envp[i])) + 1;
+
+    tr_mutex_lock(&p->lock);
+    size_t i = p->n;
+    while (!p->closed) {
+        for (i = 0; i < p->n && p->z[i].busy; ++i) {}
+        if (i < p->n) break;
+        tr_cond_wait(&p->idle, &p->lock);
+    }
+    if (p->closed) {
+        tr_mutex_unlock(&p->lock);
+        free(buf);
+        tr_set_last_error_fmt("tr_sandbox_pool_run: pool is closed");
+        return -1;
+    }
+    SandboxZygote *z = &p->z[i];
+    z->busy = 1;
+    tr_mutex_unlock(&p->lock);
+
+    SandboxReply rep;
+    int ok = 0;
+    TR_TRACE('B', "sandbox.run", tr_trace_basename(path), "zygote", i);
+    for (int attempt = 0; attempt < 2 && !ok; ++attempt) {
+        if (z->fd < 0) {
+            tr_mutex_lock(&p->lock);
+            int started = sandbox_zygote_start(p, i);
+            tr_mutex_unlock(&p->lock);
+            if (started != 0) break;
+            tr_audit_log("sandbox_pool: restarted zygote %zu", i);
+        }
+        ok = send(z->fd, buf, len, MSG_NOSIGNAL) == (ssize_t)len && recv(z->fd, &rep, sizeof(rep), 0) == (ssize_t)sizeof(rep);
+        if (!ok) sandbox_zygote_stop(p, z);     /* it died (or was killed); reap and retry on a fresh one */
+    }
+    free(buf);
+    TR_TRACE('E', "sandbox.run", NULL, "exit_code", ok ? rep.res.exit_code : -1);
+
+    tr_mutex_lock(&p->lock);
+    z->busy = 0;
+    tr_cond_notify_all(&p->idle);
+    tr_mutex_unlock(&p->lock);
+
+    if (!ok) { tr_set_last_error_fmt("tr_sandbox_pool_run: no usable zygote"); return -1; }
+    if (rep.rc == -1) { tr_set_last_error_fmt("tr_sandbox_pool_run: spawn/wait failed: %s", strerror(rep.err)); return -1; }
+    SandboxJob j;
+    sandbox_job_init(&j, path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid);
+    j.unshare_err = rep.unshare_err;
+    j.nnp_err = rep.nnp_err;
+    j.seccomp_err = rep.seccomp_err;
+    j.exec_errno = rep.res.exec_errno;
+    sandbox_log_job(&j, sandbox_ns_flags());
+    if (rep.rc == -2) {
+        tr_set_last_error_fmt("tr_sandbox_pool_run: timeout, killed child");
+        tr_audit_log("sandbox_run: timeout path=%s", path);
+    }
+    if (res) *res = rep.res;
+    return rep.rc;
+}
+
+/* Waits for running jobs, then stops every zygote. */
+void tr_sandbox_pool_destroy(TrionSandboxPool *p)
+{
+    if (!p) return;
+    tr_mutex_lock(&p->lock);
+    p->closed = 1;
+    tr_cond_notify_all(&p->idle);
+    for (;;) {
+        size_t i = 0;
+        while (i < p->n && !p->z[i].busy) i++;
+        if (i == p->n) break;
+        tr_cond_wait(&p->idle, &p->lock);
+    }
+    tr_mutex_unlock(&p->lock);
+    for (size_t i = 0; i < p->n; ++i) sandbox_zygote_stop(p, &p->z[i]);
+    tr_cond_destroy(&p->idle);
+    tr_mutex_destroy(&p->lock);
+    free(p->z);
+    free(p);
+}
+#else
+TrionSandboxPool *tr_sandbox_pool_create(size_t nworkers)
+{
+    (void)nworkers;
+    tr_set_last_error_fmt("tr_sandbox_pool_create: only supported on Linux");
+    return NULL;
+}
+int tr_sandbox_pool_run(TrionSandboxPool *p, const char *path, char *const argv[], char *const envp[],
+                        const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                        uid_t run_uid, gid_t run_gid, TrionSandboxResult *res)
+{
+    (void)p; (void)path; (void)argv; (void)envp; (void)working_dir; (void)time_ms;
+    (void)memory_limit_bytes; (void)run_uid; (void)run_gid; (void)res;
+    tr_set_last_error_fmt("tr_sandbox_pool_run: only supported on Linux");
+    return -1;
+}
+void tr_sandbox_pool_destroy(TrionSandboxPool *p) { (void)p; }
+#endif // __linux__
+
+#else // _WIN32
+
+int tr_sandbox_run(const char *path, char *const argv[], char *const envp[],
+                   const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                   unsigned int run_uid, unsigned int run_gid, int *out_exitcode)
+{
+    (void)argv; (void)envp; (void)run_uid; (void)run_gid; (void)memory_limit_bytes;
+    if (!path) { tr_set_last_error_fmt("tr_sandbox_run: path is NULL"); return -1; }
+    STARTUPINFOA si; PROCESS_INFORMATION pi;
+    ZeroMemory(&si, sizeof(si)); si.cb = sizeof(si);
+    ZeroMemory(&pi, sizeof(pi));
+    char cmdline[MAX_PATH];
+    strncpy(cmdline, path, MAX_PATH-1);
+    if (!CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, working_dir, &si, &pi)) {
+        tr_set_last_error_fmt("tr_sandbox_run: CreateProcess failed: %lu", GetLastError());
+        return -1;
+    }
+    ResumeThread(pi.hThread);
+    uint32_t wait_ms = (time_ms == 0) ? INFINITE : (DWORD)time_ms;
+    DWORD w = WaitForSingleObject(pi.hProcess, wait_ms);
+    if (w == WAIT_TIMEOUT) {
+        TerminateProcess(pi.hProcess, 1);
+        CloseHandle(pi.hThread); CloseHandle(pi.hProcess);
+        if (out_exitcode) *out_exitcode = -1;
+        tr_set_last_error_fmt("tr_sandbox_run: timeout");
+        return -2;
+    }
+    DWORD exitcode = 0;
+    GetExitCodeProcess(pi.hProcess, &exitcode);
+    if (out_exitcode) *out_exitcode = (int)exitcode;
+    CloseHandle(pi.hThread); CloseHandle(pi.hProcess);
+    return 0;
+}
+
+/* no rusage here: only exit code and wall time are reported */
+int tr_sandbox_spawn(const char *path, char *const argv[], char *const envp[],
+                     const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                     unsigned int run_uid, unsigned int run_gid, TrionSandboxResult *res)
+{
+    uint64_t t0 = tr_monotonic_ms();
+    int code = 0;
+    int rc = tr_sandbox_run(path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid, &code);
+    if (res && rc != -1) {
+        memset(res, 0, sizeof(*res));
+        res->exit_code = code;
+        res->wall_us = (tr_monotonic_ms() - t0) * 1000u;
+    }
+    return rc;
+}
+
+TrionSandboxPool *tr_sandbox_pool_create(size_t nworkers)
+{
+    (void)nworkers;
+    tr_set_last_error_fmt("tr_sandbox_pool_create: only supported on Linux");
+    return NULL;
+}
+int tr_sandbox_pool_run(TrionSandboxPool *p, const char *path, char *const argv[], char *const envp[],
+                        const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+                        unsigned int run_uid, unsigned int run_gid, TrionSandboxResult *res)
+{
+    (void)p; (void)path; (void)argv; (void)envp; (void)working_dir; (void)time_ms;
+    (void)memory_limit_bytes; (void)run_uid; (void)run_gid; (void)res;
+    tr_set_last_error_fmt("tr_sandbox_pool_run: only supported on Linux");
+    return -1;
+}
+void tr_sandbox_pool_destroy(TrionSandboxPool *p) { (void)p; }
+
+#endif // sandbox
+
+/* ---------------------------
+   JIT / NASM bridging (switch to clang+LLVM with fallback)
+   - tr_nasm_compile_and_load: attempts clang first (preferred), falls back to nasm+clang/gcc, then to "no-compile" safe mode.
+   - Produces detailed logs written to tmpdir/build.log and returns err_msg containing diagnostics.
+   - On success returns pointer to symbol via dlopen/dlsym (POSIX).
+   - Artifacts are content-addressed by a 128-bit hash of (source, entry symbol, toolchain
+     identity, build flags): built .so files persist in the cache directory ($TRION_JIT_CACHE,
+     else $XDG_CACHE_HOME/trion/jit, else ~/.cache/trion/jit), and an in-process memo maps the
+     hash to the loaded symbol so a repeated block costs one table lookup. The cache directory
+     is only used when it is owned by the user and not writable by group or others; build
+     directories are removed once their .so is loaded (failed builds keep theirs for build.log).
+   - tr_nasm_compile_batch: builds many blocks at once; objects are assembled in parallel on a
+     bounded worker pool and linked into a single shared object, so a program with many
+     embedded blocks waits for one link and one dlopen instead of one per block. Its build
+     directory always goes once the batch is bound: per-block errors are already in err_msg.
+   --------------------------- */
+
+/* one entry of a tr_nasm_compile_batch call; the out fields are overwritten */
+typedef struct TrionNasmBlock {
+    const char *src;        /* in: NASM source */
+    const char *symbol;     /* in: entry symbol */
+    void *fn;               /* out: loaded symbol (release with tr_nasm_unload), NULL on failure */
+    int rc;                 /* out: 0, or the tr_nasm_compile_and_load error code for this block */
+    char *err_msg;          /* out: diagnostics for a failed block (malloc'd; caller frees) */
+} TrionNasmBlock;
+
+#ifndef _WIN32
+#include <unistd.h>
+
+/* In-process assembler for the NASM subset used by embedded blocks (x86-64 only):
+   - directives: bits 64, default rel, global, section .text/.rodata, align, db/dw/dd/dq
+   - 32/64-bit GPR forms of mov, lea, add/or/adc/sbb/and/sub/xor/cmp, test, xchg, imul,
+     inc/dec/not/neg/mul/div/idiv, shifts/rotates, push/pop, cmovcc, jmp/jcc/call (label or
+     register), ret, nop, syscall, cqo, cdq, leave, int3, ud2
+   - memory operands [base + index*scale + disp] and rip-relative [rel label]
+   Code is written into a private RW mapping that is flipped to RX before use (never W+X).
+   Anything outside the subset makes jit_assemble fail, and the caller falls back to the
+   clang/nasm toolchain. */
+
+#define JIT_OP_REG   1
+#define JIT_OP_IMM   2
+#define JIT_OP_MEM   3
+#define JIT_OP_LABEL 4
+#define JIT_NAME_MAX 128
+
+typedef struct {
+    int kind;
+    int reg;                    /* JIT_OP_REG: 0..15 */
+    int size;                   /* register width, or the explicit qword/dword/... of a memory operand */
+    int base, index;            /* JIT_OP_MEM: -1 when absent */
+    int scale;
+    int64_t disp;               /* memory displacement or immediate */
+    char label[JIT_NAME_MAX];   /* branch target or rip-relative memory */
+} JitOperand;
+
+typedef struct { char name[JIT_NAME_MAX]; size_t off; } JitLabel;
+typedef struct { char name[JIT_NAME_MAX]; size_t pos, end; int64_t addend; int line; } JitFixup;
+
+typedef struct {
+    uint8_t *code;
+    size_t len, cap;
+    JitLabel *labels;
+    size_t nlabels, cap_labels;
+    JitFixup *fixups;
+    size_t nfix, cap_fix;
+    char scope[JIT_NAME_MAX];   /* last non-local label, prefix for .local names */
+    int line;
+    int oom;
+    char err[256];
+} JitAsm;
+
+typedef struct TrionJitModule {
+    uint8_t *mem;
+    size_t map_len;
+    size_t code_len;
+    JitLabel *syms;
+    size_t nsyms;
+} TrionJitModule;
+
+static const char *const g_jit_reg64[16] = { "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+                                             "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15" };
+static const char *const g_jit_reg32[16] = { "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+                                             "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d" };
+static const char *const g_jit_cc[] = { "o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g" };
+static const struct { const char *name; int cc; } g_jit_cc_alias[] = {
+    { "c", 2 }, { "nae", 2 }, { "nb", 3 }, { "nc", 3 }, { "z", 4 }, { "nz", 5 }, { "na", 6 }, { "nbe", 7 },
+    { "pe", 10 }, { "po", 11 }, { "nge", 12 }, { "nl", 13 }, { "ng", 14 }, { "nle", 15 }
+};
+
+static int jit_fail(JitAsm *a, const char *fmt, ...)
+{
+    if (a->err[0]) return -1;
+    int n = snprintf(a->err, sizeof(a->err), "line %d: ", a->line);
+    va_list ap;
+    va_start(ap, fmt);
+    if (n > 0 && (size_t)n < sizeof(a->err)) vsnprintf(a->err + n, sizeof(a->err) - (size_t)n, fmt, ap);
+    va_end(ap);
+    return -1;
+}
+
+static void *jit_grow(void *p, size_t *cap, size_t need, size_t elem, int *oom)
+{
+    if (need <= *cap) return p;
+    size_t nc = *cap ? *cap : 64;
+    while (nc < need) nc *= 2;
+    void *n = realloc(p, nc * elem);
+    if (!n) { *oom = 1; return NULL; }
+    *cap = nc;
+    return n;
+}
+
+static void jit_byte(JitAsm *a, uint8_t b)
+{
+    uint8_t *n = (uint8_t*)jit_grow(a->code, &a->cap, a->len + 1, 1, &a->oom);
+    if (!n) return;
+    a->code = n;
+    a->code[a->len++] = b;
+}
+
+static void jit_le(JitAsm *a, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; ++i) jit_byte(a, (uint8_t)(v >> (8 * i)));
+}
+
+static int jit_ieq(const char *a, const char *b)
+{
+    for (; *a && *b; ++a, ++b) if ((*a | 0x20) != (*b | 0x20)) return 0;
+    return *a == *b;
+}
+
+static int jit_is_ident_char(char c, int first)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.' || c == '$' || c == '?' || c == '@') return 1;
+    return !first && ((c >= '0' && c <= '9') || c == '#' || c == '~');
+}
+
+/* full label name: ".x" is scoped to the last non-local label, as in NASM */
+static int jit_label_name(JitAsm *a, const char *s, size_t n, char *out)
+{
+    if (n == 0 || !jit_is_ident_char(s[0], 1)) return -1;
+    for (size_t i = 1; i < n; ++i) if (!jit_is_ident_char(s[i], 0)) return -1;
+    size_t pre = s[0] == '.' ? strlen(a->scope) : 0;
+    if (pre + n >= JIT_NAME_MAX) return -1;
+    memcpy(out, a->scope, pre);
+    memcpy(out + pre, s, n);
+    out[pre + n] = '\0';
+    return 0;
+}
+
+static int jit_parse_reg(const char *s, size_t n, int *reg, int *size)
+{
+    char buf[8];
+    if (n == 0 || n >= sizeof(buf)) return 0;
+    memcpy(buf, s, n); buf[n] = '\0';
+    for (int i = 0; i < 16; ++i) {
+        if (jit_ieq(buf, g_jit_reg64[i])) { *reg = i; *size = 8; return 1; }
+        if (jit_ieq(buf, g_jit_reg32[i])) { *reg = i; *size = 4; return 1; }
+    }
+    if (jit_ieq(buf, "cl")) { *reg = 1; *size = 1; return 1; }     /* shift counts only */
+    return 0;
+}
+
+/* decimal, 0x/0b prefixes, NASM 'h' suffix, 'c' character constants; optional leading '-' */
+static int jit_parse_int(const char *s, size_t n, int64_t *out)
+{
+    while (n && (*s == ' ' || *s == '\t')) { s++; n--; }
+    while (n && (s[n - 1] == ' ' || s[n - 1] == '\t')) n--;
+    int neg = 0;
+    if (n && (*s == '-' || *s == '+')) { neg = *s == '-'; s++; n--; }
+    if (n == 0) return -1;
+    uint64_t v = 0;
+    if (n == 3 && (s[0] == '\'' || s[0] == '"') && s[2] == s[0]) {
+        v = (uint8_t)s[1];
+    } else {
+        int base = 10;
+        if (n > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) { base = 16; s += 2; n -= 2; }
+        else if (n > 2 && s[0] == '0' && (s[1] == 'b' || s[1] == 'B')) { base = 2; s += 2; n -= 2; }
+        else if (n > 1 && (s[n - 1] == 'h' || s[n - 1] == 'H')) {
+            /* as in NASM the suffix form must start with a digit, so labels like 'each' stay labels */
+            if (s[0] < '0' || s[0] > '9') return -1;
+            base = 16; n--;
+        }
+        if (s[0] < '0' || s[0] > '9') { if (base != 16 || !((s[0] | 0x20) >= 'a' && (s[0] | 0x20) <= 'f')) return -1; }
+        for (size_t i = 0; i < n; ++i) {
+            char c = s[i];
+            int d;
+            if (c == '_') continue;
+            if (c >= '0' && c <= '9') d = c - '0';
+            else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') d = (c | 0x20) - 'a' + 10;
+            else return -1;
+            if (d >= base) return -1;
+            v = v * (uint64_t)base + (uint64_t)d;
+        }
+    }
+    *out = neg ? -(int64_t)v : (int64_t)v;
+    return 0;
+}
+
+static int jit_parse_mem(JitAsm *a, const char *s, size_t n, JitOperand *op)
+{
+    op->kind = JIT_OP_MEM;
+    op->base = op->index = -1;
+    op->scale = 1;
+    op->disp = 0;
+    op->label[0] = '\0';
+    while (n && (*s == ' ' || *s == '\t')) { s++; n--; }
+    if (n > 4 && (s[0] | 0x20) == 'r' && (s[1] | 0x20) == 'e' && (s[2] | 0x20) == 'l' && (s[3] == ' ' || s[3] == '\t')) { s += 4; n -= 4; }
+    size_t i = 0;
+    int sign = 1;
+    while (i < n) {
+        while (i < n && (s[i] == ' ' || s[i] == '\t')) i++;
+        if (i >= n) break;
+        size_t j = i;
+        while (j < n && s[j] != '+' && s[j] != '-') j++;
+        if (j == i) return jit_fail(a, "bad memory operand");
+        size_t e = j;
+        while (e > i && (s[e - 1] == ' ' || s[e - 1] == '\t')) e--;
+        const char *t = s + i;
+        size_t tn = e - i;
+        const char *star = (const char*)memchr(t, '*', tn);
+        int reg, rsz;
+        int64_t v;
+        if (star) {
+            const char *l = t, *r = star + 1;
+            size_t ln = (size_t)(star - t), rn = tn - ln - 1;
+            while (ln && l[ln - 1] == ' ') ln--;
+            while (rn && *r == ' ') { r++; rn--; }
+            if (!jit_parse_reg(l, ln, &reg, &rsz)) { const char *x = l; size_t xn = ln; l = r; ln = rn; r = x; rn = xn; }
+            if (!jit_parse_reg(l, ln, &reg, &rsz) || rsz != 8 || jit_parse_int(r, rn, &v) != 0 || sign < 0) return jit_fail(a, "bad index term");
+            if (v != 1 && v != 2 && v != 4 && v != 8) return jit_fail(a, "bad scale");
+            if (op->index >= 0 || reg == 4) return jit_fail(a, "bad index register");
+            op->index = reg;
+            op->scale = (int)v;
+        } else if (jit_parse_reg(t, tn, &reg, &rsz)) {
+            if (rsz != 8 || sign < 0) return jit_fail(a, "bad address register");
+            if (op->base < 0) op->base = reg;
+            else if (op->index < 0 && reg != 4) op->index = reg;
+            else return jit_fail(a, "too many address registers");
+        } else if (jit_parse_int(t, tn, &v) == 0) {
+            op->disp += sign * v;
+        } else {
+            if (op->label[0] || sign < 0 || jit_label_name(a, t, tn, op->label) != 0) return jit_fail(a, "bad memory term");
+        }
+        if (j < n) sign = s[j] == '-' ? -1 : 1;
+        i = j + 1;
+        if (j >= n) break;
+    }
+    if (op->label[0] && (op->base >= 0 || op->index >= 0)) return jit_fail(a, "rip-relative operand cannot use registers");
+    if (op->disp < INT32_MIN || op->disp > INT32_MAX) return jit_fail(a, "displacement out of range");
+    return 0;
+}
+
+static int jit_parse_operand(JitAsm *a, const char *s, size_t n, JitOperand *op)
+{
+    while (n && (*s == ' ' || *s == '\t')) { s++; n--; }
+    while (n && (s[n - 1] == ' ' || s[n - 1] == '\t')) n--;
+    memset(op, 0, sizeof(*op));
+    op->base = op->index = -1;
+    static const struct { const char *kw; int size; } sizes[] = { { "byte", 1 }, { "word", 2 }, { "dword", 4 }, { "qword", 8 }, { "short", -1 }, { "near", -1 } };
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k) {
+        size_t kl = strlen(sizes[k].kw);
+        if (n > kl && (s[kl] == ' ' || s[kl] == '\t' || s[kl] == '[')) {
+            char buf[8];
+            memcpy(buf, s, kl); buf[kl] = '\0';
+            if (jit_ieq(buf, sizes[k].kw)) {
+                if (sizes[k].size > 0) op->size = sizes[k].size;
+                s += kl; n -= kl;
+                while (n && (*s == ' ' || *s == '\t')) { s++; n--; }
+                break;
+            }
+        }
+    }
+    if (n == 0) return jit_fail(a, "missing operand");
+    if (s[0] == '[') {
+        if (s[n - 1] != ']') return jit_fail(a, "unterminated memory operand");
+        int sz = op->size;
+        if (jit_parse_mem(a, s + 1, n - 2, op) != 0) return -1;
+        op->size = sz;
+        if (sz && sz != 4 && sz != 8) return jit_fail(a, "only dword/qword memory operands are supported");
+        return 0;
+    }
+    if (jit_parse_reg(s, n, &op->reg, &op->size)) { op->kind = JIT_OP_REG; return 0; }
+    if (jit_parse_int(s, n, &op->disp) == 0) { op->kind = JIT_OP_IMM; return 0; }
+    if (jit_label_name(a, s, n, op->label) == 0) { op->kind = JIT_OP_LABEL; return 0; }
+    return jit_fail(a, "unsupported operand '%.*s'", (int)n, s);
+}
+
+static void jit_fixup(JitAsm *a, const char *label, int64_t addend)
+{
+    JitFixup *n = (JitFixup*)jit_grow(a->fixups, &a->cap_fix, a->nfix + 1, sizeof(JitFixup), &a->oom);
+    if (!n) return;
+    a->fixups = n;
+    JitFixup *f = &a->fixups[a->nfix++];
+    snprintf(f->name, sizeof(f->name), "%s", label);
+    f->pos = a->len;
+    f->end = 0;                 /* set once the whole instruction is emitted */
+    f->addend = addend;
+    f->line = a->line;
+}
+
+/* REX + opcode + ModRM/SIB/disp for "op reg, rm" (reg may be an opcode extension /digit) */
+static void jit_emit_rm(JitAsm *a, int w, const uint8_t *opc, size_t nopc, int reg, const JitOperand *rm)
+{
+    int rex = w ? 8 : 0;
+    if (reg & 8) rex |= 4;
+    if (rm->kind == JIT_OP_REG) { if (rm->reg & 8) rex |= 1; }
+    else { if (rm->base >= 8) rex |= 1; if (rm->index >= 8) rex |= 2; }
+    if (rex) jit_byte(a, (uint8_t)(0x40 | rex));
+    for (size_t i = 0; i < nopc; ++i) jit_byte(a, opc[i]);
+    int r = (reg & 7) << 3;
+    if (rm->kind == JIT_OP_REG) { jit_byte(a, (uint8_t)(0xC0 | r | (rm->reg & 7))); return; }
+    int ss = rm->scale == 8 ? 3 : rm->scale == 4 ? 2 : rm->scale == 2 ? 1 : 0;
+    int idx = rm->index < 0 ? 4 : (rm->index & 7);
+    if (rm->label[0]) {
+        jit_byte(a, (uint8_t)(r | 5));
+        jit_fixup(a, rm->label, rm->disp);
+        jit_le(a, 0, 4);
+        return;
+    }
+    if (rm->base < 0) {
+        jit_byte(a, (uint8_t)(r | 4));
+        jit_byte(a, (uint8_t)(ss << 6 | idx << 3 | 5));
+        jit_le(a, (uint64_t)(uint32_t)(int32_t)rm->disp, 4);
+        return;
+    }
+    int b = rm->base & 7;
+    int mod = (rm->disp == 0 && b != 5) ? 0 : (rm->disp >= -128 && rm->disp <= 127) ? 1 : 2;
+    if (rm->index >= 0 || b == 4) {
+        jit_byte(a, (uint8_t)(mod << 6 | r | 4));
+        jit_byte(a, (uint8_t)(ss << 6 | idx << 3 | b));
+    } else {
+        jit_byte(a, (uint8_t)(mod << 6 | r | b));
+    }
+    if (mod == 1) jit_byte(a, (uint8_t)(int8_t)rm->disp);
+    else if (mod == 2) jit_le(a, (uint64_t)(uint32_t)(int32_t)rm->disp, 4);
+}
+
+static int jit_cc_index(const char *s)
+{
+    for (int i = 0; i < 16; ++i) if (jit_ieq(s, g_jit_cc[i])) return i;
+    for (size_t i = 0; i < sizeof(g_jit_cc_alias) / sizeof(g_jit_cc_alias[0]); ++i) if (jit_ieq(s, g_jit_cc_alias[i].name)) return g_jit_cc_alias[i].cc;
+    return -1;
+}
+
+static int jit_is_rm(const JitOperand *o) { return o->kind == JIT_OP_REG || o->kind == JIT_OP_MEM; }
+static int jit_fits8(int64_t v) { return v >= -128 && v <= 127; }
+
+/* operand width for an instruction: register width, or the explicit size of a memory operand */
+static int jit_width(JitAsm *a, const JitOperand *o, int n)
+{
+    int sz = 0;
+    for (int i = 0; i < n; ++i) {
+        int s = o[i].kind == JIT_OP_REG || o[i].kind == JIT_OP_MEM ? o[i].size : 0;
+        if (!s) continue;
+        if (s != 4 && s != 8) return jit_fail(a, "only 32/64-bit operands are supported"), 0;
+        if (sz && s != sz) return jit_fail(a, "operand size mismatch"), 0;
+        sz = s;
+    }
+    if (!sz) jit_fail(a, "operation size not specified");
+    return sz;
+}
+
+/* immediate that is sign-extended from 32 bits (64-bit ops) or used as-is (32-bit ops) */
+static int jit_imm32_ok(int64_t v, int sz) { return sz == 8 ? (v >= INT32_MIN && v <= INT32_MAX) : (v >= INT32_MIN && v <= (int64_t)UINT32_MAX); }
+
+static int jit_emit_insn(JitAsm *a, const char *mn, JitOperand *o, int n)
+{
+    static const char *const alu[8] = { "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp" };
+    static const char *const unary[8] = { "inc", "dec", "not", "neg", "mul", NULL, "div", "idiv" };
+    static const char *const shifts[8] = { "rol", "ror", "rcl", "rcr", "shl", "shr", "sal", "sar" };
+    uint8_t opc[2];
+
+    if (n == 0) {
+        static const struct { const char *mn; uint8_t b[2]; int n; } simple[] = {
+            { "ret", { 0xC3 }, 1 }, { "nop", { 0x90 }, 1 }, { "syscall", { 0x0F, 0x05 }, 2 }, { "cqo", { 0x48, 0x99 }, 2 },
+            { "cdq", { 0x99 }, 1 }, { "leave", { 0xC9 }, 1 }, { "int3", { 0xCC }, 1 }, { "ud2", { 0x0F, 0x0B }, 2 }
+        };
+        for (size_t i = 0; i < sizeof(simple) / sizeof(simple[0]); ++i) {
+            if (jit_ieq(mn, simple[i].mn)) { for (int k = 0; k < simple[i].n; ++k) jit_byte(a, simple[i].b[k]); return 0; }
+        }
+    }
+    for (int d = 0; d < 8; ++d) {
+        if (!jit_ieq(mn, alu[d])) continue;
+        if (n != 2) return jit_fail(a, "%s needs two operands", mn);
+        if (o[1].kind == JIT_OP_IMM && jit_is_rm(&o[0])) {
+            int sz = jit_width(a, o, 1);
+            if (!sz) return -1;
+            if (!jit_imm32_ok(o[1].disp, sz)) return jit_fail(a, "immediate out of range");
+            int small = jit_fits8(o[1].disp);
+            opc[0] = small ? 0x83 : 0x81;
+            jit_emit_rm(a, sz == 8, opc, 1, d, &o[0]);
+            jit_le(a, (uint64_t)o[1].disp, small ? 1 : 4);
+            return 0;
+        }
+        int sz = jit_width(a, o, 2);
+        if (!sz) return -1;
+        if (o[1].kind == JIT_OP_REG && jit_is_rm(&o[0])) { opc[0] = (uint8_t)(d * 8 + 1); jit_emit_rm(a, sz == 8, opc, 1, o[1].reg, &o[0]); return 0; }
+        if (o[0].kind == JIT_OP_REG && o[1].kind == JIT_OP_MEM) { opc[0] = (uint8_t)(d * 8 + 3); jit_emit_rm(a, sz == 8, opc, 1, o[0].reg, &o[1]); return 0; }
+        return jit_fail(a, "unsupported operands for %s", mn);
+    }
+    if (jit_ieq(mn, "mov")) {
+        if (n != 2) return jit_fail(a, "mov needs two operands");
+        if (o[0].kind == JIT_OP_REG && o[1].kind == JIT_OP_IMM) {
+            if (!jit_width(a, o, 1)) return -1;
+            int64_t v = o[1].disp;
+            int r = o[0].reg;
+            if (o[0].size == 8 && v >= INT32_MIN && v <= INT32_MAX && v < 0) {
+                opc[0] = 0xC7; jit_emit_rm(a, 1, opc, 1, 0, &o[0]); jit_le(a, (uint64_t)v, 4);
+            } else if (o[0].size == 8 && (v < 0 || v > (int64_t)UINT32_MAX)) {
+                jit_byte(a, (uint8_t)(0x48 | (r >> 3))); jit_byte(a, (uint8_t)(0xB8 | (r & 7))); jit_le(a, (uint64_t)v, 8);
+            } else {
+                if (o[0].size == 4 && !jit_imm32_ok(v, 4)) return jit_fail(a, "immediate out of range");
+                if (r & 8) jit_byte(a, 0x41);
+                jit_byte(a, (uint8_t)(0xB8 | (r & 7))); jit_le(a, (uint64_t)v, 4);   /* 32-bit write zero-extends */
+            }
+            return 0;
+        }
+        if (o[0].kind == JIT_OP_MEM && o[1].kind == JIT_OP_IMM) {
+            int sz = jit_width(a, o, 1);
+            if (!sz) return -1;
+            if (!jit_imm32_ok(o[1].disp, sz)) return jit_fail(a, "immediate out of range");
+            opc[0] = 0xC7; jit_emit_rm(a, sz == 8, opc, 1, 0, &o[0]); jit_le(a, (uint64_t)o[1].disp, 4);
+            return 0;
+        }
+        int sz = jit_width(a, o, 2);
+        if (!sz) return -1;
+        if (o[1].kind == JIT_OP_REG && jit_is_rm(&o[0])) { opc[0] = 0x89; jit_emit_rm(a, sz == 8, opc, 1, o[1].reg, &o[0]); return 0; }
+        if (o[0].kind == JIT_OP_REG && o[1].kind == JIT_OP_MEM) { opc[0] = 0x8B; jit_emit_rm(a, sz == 8, opc, 1, o[0].reg, &o[1]); return 0; }
+        return jit_fail(a, "unsupported operands for mov");
+    }
+    if (jit_ieq(mn, "lea")) {
+        if (n != 2 || o[0].kind != JIT_OP_REG || o[0].size < 4 || o[1].kind != JIT_OP_MEM) return jit_fail(a, "lea needs reg, [mem]");
+        opc[0] = 0x8D; jit_emit_rm(a, o[0].size == 8, opc, 1, o[0].reg, &o[1]);
+        return 0;
+    }
+    if (jit_ieq(mn, "test") || jit_ieq(mn, "xchg")) {
+        int test = jit_ieq(mn, "test");
+        if (n != 2) return jit_fail(a, "%s needs two operands", mn);
+        if (test && o[1].kind == JIT_OP_IMM && jit_is_rm(&o[0])) {
+            int sz = jit_width(a, o, 1);
+            if (!sz) return -1;
+            if (!jit_imm32_ok(o[1].disp, sz)) return jit_fail(a, "immediate out of range");
+            opc[0] = 0xF7; jit_emit_rm(a, sz == 8, opc, 1, 0, &o[0]); jit_le(a, (uint64_t)o[1].disp, 4);
+            return 0;
+        }
+        int sz = jit_width(a, o, 2);
+        if (!sz) return -1;
+        opc[0] = test ? 0x85 : 0x87;
+        if (o[1].kind == JIT_OP_REG && jit_is_rm(&o[0])) { jit_emit_rm(a, sz == 8, opc, 1, o[1].reg, &o[0]); return 0; }
+        if (o[0].kind == JIT_OP_REG && o[1].kind == JIT_OP_MEM) { jit_emit_rm(a, sz == 8, opc, 1, o[0].reg, &o[1]); return 0; }
+        return jit_fail(a, "unsupported operands for %s", mn);
+    }
+    if (jit_ieq(mn, "imul")) {
+        if (n == 1) goto unary_op;
+        if (o[0].kind != JIT_OP_REG || !jit_is_rm(&o[1])) return jit_fail(a, "unsupported operands for imul");
+        int sz = jit_width(a, o, 2);
+        if (!sz) return -1;
+        if (n == 2) { opc[0] = 0x0F; opc[1] = 0xAF; jit_emit_rm(a, sz == 8, opc, 2, o[0].reg, &o[1]); return 0; }
+        if (n != 3 || o[2].kind != JIT_OP_IMM || !jit_imm32_ok(o[2].disp, sz)) return jit_fail(a, "unsupported operands for imul");
+        int small = jit_fits8(o[2].disp);
+        opc[0] = small ? 0x6B : 0x69;
+        jit_emit_rm(a, sz == 8, opc, 1, o[0].reg, &o[1]);
+        jit_le(a, (uint64_t)o[2].disp, small ? 1 : 4);
+        return 0;
+    }
+unary_op:
+    for (int d = 0; d < 8; ++d) {
+        if (!(unary[d] && jit_ieq(mn, unary[d])) && !(d == 5 && jit_ieq(mn, "imul"))) continue;
+        if (n != 1 || !jit_is_rm(&o[0])) return jit_fail(a, "%s needs one register/memory operand", mn);
+        int sz = jit_width(a, o, 1);
+        if (!sz) return -1;
+        opc[0] = d < 2 ? 0xFF : 0xF7;
+        jit_emit_rm(a, sz == 8, opc, 1, d, &o[0]);
+        return 0;
+    }
+    for (int d = 0; d < 8; ++d) {
+        if (!jit_ieq(mn, shifts[d])) continue;
+        int ext = d == 6 ? 4 : d;      /* sal == shl */
+        if (n != 2 || !jit_is_rm(&o[0])) return jit_fail(a, "%s needs r/m, imm|cl", mn);
+        int sz = jit_width(a, o, 1);
+        if (!sz) return -1;
+        if (o[1].kind == JIT_OP_REG && o[1].size == 1) { opc[0] = 0xD3; jit_emit_rm(a, sz == 8, opc, 1, ext, &o[0]); return 0; }
+        if (o[1].kind != JIT_OP_IMM || o[1].disp < 0 || o[1].disp > 63) return jit_fail(a, "bad shift count");
+        if (o[1].disp == 1) { opc[0] = 0xD1; jit_emit_rm(a, sz == 8, opc, 1, ext, &o[0]); return 0; }
+        opc[0] = 0xC1; jit_emit_rm(a, sz == 8, opc, 1, ext, &o[0]); jit_byte(a, (uint8_t)o[1].disp);
+        return 0;
+    }
+    if (jit_ieq(mn, "push") || jit_ieq(mn, "pop")) {
+        int push = jit_ieq(mn, "push");
+        if (n != 1) return jit_fail(a, "%s needs one operand", mn);
+        if (o[0].kind == JIT_OP_REG && o[0].size == 8) {
+            if (o[0].reg & 8) jit_byte(a, 0x41);
+            jit_byte(a, (uint8_t)((push ? 0x50 : 0x58) | (o[0].reg & 7)));
+            return 0;
+        }
+        if (push && o[0].kind == JIT_OP_IMM && o[0].disp >= INT32_MIN && o[0].disp <= INT32_MAX) {
+            int small = jit_fits8(o[0].disp);
+            jit_byte(a, small ? 0x6A : 0x68);
+            jit_le(a, (uint64_t)o[0].disp, small ? 1 : 4);
+            return 0;
+        }
+        return jit_fail(a, "unsupported operand for %s", mn);
+    }
+    if (jit_ieq(mn, "jmp") || jit_ieq(mn, "call")) {
+        int jmp = jit_ieq(mn, "jmp");
+        if (n != 1) return jit_fail(a, "%s needs one operand", mn);
+        if (o[0].kind == JIT_OP_LABEL) { jit_byte(a, jmp ? 0xE9 : 0xE8); jit_fixup(a, o[0].label, 0); jit_le(a, 0, 4); return 0; }
+        if (o[0].kind == JIT_OP_REG && o[0].size == 8) { opc[0] = 0xFF; jit_emit_rm(a, 0, opc, 1, jmp ? 4 : 2, &o[0]); return 0; }
+        return jit_fail(a, "unsupported operand for %s", mn);
+    }
+    if (mn[0] == 'j' && jit_cc_index(mn + 1) >= 0) {
+        if (n != 1 || o[0].kind != JIT_OP_LABEL) return jit_fail(a, "%s needs a label", mn);
+        jit_byte(a, 0x0F); jit_byte(a, (uint8_t)(0x80 | jit_cc_index(mn + 1)));
+        jit_fixup(a, o[0].label, 0); jit_le(a, 0, 4);
+        return 0;
+    }
+    if (!strncmp(mn, "cmov", 4) && jit_cc_index(mn + 4) >= 0) {
+        if (n != 2 || o[0].kind != JIT_OP_REG || !jit_is_rm(&o[1])) return jit_fail(a, "%s needs reg, r/m", mn);
+        int sz = jit_width(a, o, 2);
+        if (!sz) return -1;
+        opc[0] = 0x0F; opc[1] = (uint8_t)(0x40 | jit_cc_index(mn + 4));
+        jit_emit_rm(a, sz == 8, opc, 2, o[0].reg, &o[1]);
+        return 0;
+    }
+    return jit_fail(a, "unsupported instruction '%s'", mn);
+}
+
+/* db/dw/dd/dq: comma-separated numbers; db also takes quoted strings */
+static int jit_emit_data(JitAsm *a, int width, const char *s)
+{
+    while (*s) {
+        while (*s == ' ' || *s == '\t' || *s == ',') s++;
+        if (!*s) break;
+        if (width == 1 && (*s == '\'' || *s == '"' || *s == '`')) {
+            const char *e = strchr(s + 1, *s);
+            if (!e) return jit_fail(a, "unterminated string");
+            for (++s; s < e; ++s) jit_byte(a, (uint8_t)*s);
+            s = e + 1;
+            continue;
+        }
+        const char *e = s;
+        int inq = 0;
+        while (*e && (inq || *e != ',')) { if (*e == '\'' || *e == '"') inq = !inq; e++; }
+        int64_t v;
+        if (jit_parse_int(s, (size_t)(e - s), &v) != 0) return jit_fail(a, "bad data value '%.*s'", (int)(e - s), s);
+        jit_le(a, (uint64_t)v, width);
+        s = e;
+    }
+    return 0;
+}
+
+static int jit_add_label(JitAsm *a, const char *s, size_t n)
+{
+    char name[JIT_NAME_MAX];
+    if (jit_label_name(a, s, n, name) != 0) return jit_fail(a, "bad label '%.*s'", (int)n, s);
+    for (size_t i = 0; i < a->nlabels; ++i) if (strcmp(a->labels[i].name, name) == 0) return jit_fail(a, "duplicate label '%s'", name);
+    JitLabel *l = (JitLabel*)jit_grow(a->labels, &a->cap_labels, a->nlabels + 1, sizeof(JitLabel), &a->oom);
+    if (!l) return jit_fail(a, "out of memory");
+    a->labels = l;
+    memcpy(a->labels[a->nlabels].name, name, sizeof(name));
+    a->labels[a->nlabels++].off = a->len;
+    if (s[0] != '.') snprintf(a->scope, sizeof(a->scope), "%s", name);
+    return 0;
+}
+
+static int jit_assemble_line(JitAsm *a, char *ln)
+{
+    /* strip the comment (outside quotes) and surrounding blanks */
+    int inq = 0;
+    for (char *p = ln; *p; ++p) {
+        if (*p == '\'' || *p == '"' || *p == '`') inq = !inq;
+        else if (*p == ';' && !inq) { *p = '\0'; break; }
+    }
+    char *s = ln;
+    while (*s == ' ' || *s == '\t') s++;
+    size_t n = strlen(s);
+    while (n && (s[n - 1] == ' ' || s[n - 1] == '\t' || s[n - 1] == '\r')) s[--n] = '\0';
+    if (!n) return 0;
+    if (s[0] == '[' && s[n - 1] == ']') { s[n - 1] = '\0'; s++; }   /* [bits 64], [section .text] */
+
+    size_t w = 0;
+    while (s[w] && jit_is_ident_char(s[w], w == 0)) w++;
+    if (w && s[w] == ':') {
+        if (jit_add_label(a, s, w) != 0) return -1;
+        s += w + 1;
+        while (*s == ' ' || *s == '\t') s++;
+        if (!*s) return 0;
+        w = 0;
+        while (s[w] && jit_is_ident_char(s[w], w == 0)) w++;
+    }
+    char mn[16];
+    if (w == 0 || w >= sizeof(mn)) return jit_fail(a, "cannot parse '%s'", s);
+    for (size_t i = 0; i < w; ++i) mn[i] = (char)(s[i] | 0x20);
+    mn[w] = '\0';
+    char *rest = s + w;
+    while (*rest == ' ' || *rest == '\t') rest++;
+
+    if (!strcmp(mn, "bits")) return atoi(rest) == 64 ? 0 : jit_fail(a, "only bits 64 is supported");
+    if (!strcmp(mn, "default") || !strcmp(mn, "global")) return 0;     /* every label is exported */
+    if (!strcmp(mn, "section") || !strcmp(mn, "segment")) {
+        if (!strncmp(rest, ".text", 5) || !strncmp(rest, ".rodata", 7)) return 0;
+        return jit_fail(a, "section '%s' is not supported in-process", rest);
+    }
+    if (!strcmp(mn, "align")) {
+        int64_t v;
+        if (jit_parse_int(rest, strlen(rest), &v) != 0 || v <= 0 || v > 4096 || (v & (v - 1))) return jit_fail(a, "bad alignment");
+        while (a->len & (size_t)(v - 1)) jit_byte(a, 0x90);
+        return 0;
+    }
+    if (!strcmp(mn, "db")) return jit_emit_data(a, 1, rest);
+    if (!strcmp(mn, "dw")) return jit_emit_data(a, 2, rest);
+    if (!strcmp(mn, "dd")) return jit_emit_data(a, 4, rest);
+    if (!strcmp(mn, "dq")) return jit_emit_data(a, 8, rest);
+
+    JitOperand ops[3];
+    int nops = 0;
+    while (*rest) {
+        char *e = rest;
+        int depth = 0;
+        inq = 0;
+        while (*e && (depth || inq || *e != ',')) {
+            if (*e == '\'' || *e == '"') inq = !inq;
+            else if (!inq && *e == '[') depth++;
+            else if (!inq && *e == ']') depth--;
+            e++;
+        }
+        if (nops == 3) return jit_fail(a, "too many operands");
+        if (jit_parse_operand(a, rest, (size_t)(e - rest), &ops[nops++]) != 0) return -1;
+        rest = *e ? e + 1 : e;
+    }
+    size_t fix0 = a->nfix;
+    if (jit_emit_insn(a, mn, ops, nops) != 0) return -1;
+    for (size_t i = fix0; i < a->nfix; ++i) a->fixups[i].end = a->len;
+    return 0;
+}
+
+static void jit_asm_free(JitAsm *a)
+{
+    free(a->code);
+    free(a->labels);
+    free(a->fixups);
+}
+
+/* Assemble src into a fresh RX mapping. Returns 0, or -1 with *err_msg (may be NULL) set. */
+static int jit_assemble(const char *src, TrionJitModule **out, char **err_msg)
+{
+    JitAsm a;
+    memset(&a, 0, sizeof(a));
+    const char *p = src;
+    while (*p && !a.err[0]) {
+        const char *e = strchr(p, '\n');
+        size_t n = e ? (size_t)(e - p) : strlen(p);
+        char line[1024];
+        a.line++;
+        if (n >= sizeof(line)) { jit_fail(&a, "line too long"); break; }
+        memcpy(line, p, n); line[n] = '\0';
+        jit_assemble_line(&a, line);
+        if (a.oom) jit_fail(&a, "out of memory");
+        p = e ? e + 1 : p + n;
+    }
+    for (size_t i = 0; i < a.nfix && !a.err[0]; ++i) {
+        JitFixup *f = &a.fixups[i];
+        size_t k = 0;
+        while (k < a.nlabels && strcmp(a.labels[k].name, f->name) != 0) k++;
+        if (k == a.nlabels) { a.line = f->line; jit_fail(&a, "undefined label '%s'", f->name); break; }
+        int64_t rel = (int64_t)a.labels[k].off + f->addend - (int64_t)f->end;
+        uint32_t v = (uint32_t)(int32_t)rel;
+        memcpy(a.code + f->pos, &v, 4);
+    }
+    if (!a.err[0] && a.len == 0) jit_fail(&a, "no code");
+    TrionJitModule *m = NULL;
+    if (!a.err[0]) {
+        m = (TrionJitModule*)calloc(1, sizeof(TrionJitModule));
+        long pg = sysconf(_SC_PAGESIZE);
+        size_t page = pg > 0 ? (size_t)pg : 4096;
+        size_t map_len = (a.len + page - 1) & ~(page - 1);
+        void *mem = m ? mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+        if (mem == MAP_FAILED) {
+            free(m); m = NULL;
+            jit_fail(&a, "mmap failed");
+        } else {
+            memcpy(mem, a.code, a.len);
+            if (mprotect(mem, map_len, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, map_len);
+                free(m); m = NULL;
+                jit_fail(&a, "mprotect failed: %s", strerror(errno));
+            } else {
+                m->mem = (uint8_t*)mem;
+                m->map_len = map_len;
+                m->code_len = a.len;
+                m->syms = a.labels;         /* ownership moves to the module */
+                m->nsyms = a.nlabels;
+                a.labels = NULL;
+            }
+        }
+    }
+    jit_asm_free(&a);
+    if (!m) {
+        if (err_msg) *err_msg = strdup(a.err);
+        tr_set_last_error_fmt("tr_jit_assemble: %s", a.err);
+        return -1;
+    }
+    *out = m;
+    return 0;
+}
+
+void *tr_jit_module_symbol(const TrionJitModule *m, const char *name)
+{
+    if (!m || !name) return NULL;
+    for (size_t i = 0; i < m->nsyms; ++i) if (strcmp(m->syms[i].name, name) == 0) return m->mem + m->syms[i].off;
+    return NULL;
+}
+
+void tr_jit_module_unload(TrionJitModule *m)
+{
+    if (!m) return;
+    munmap(m->mem, m->map_len);
+    free(m->syms);
+    free(m);
+}
+
+int tr_jit_assemble(const char *nasm_src, TrionJitModule **out, char **err_msg)
+{
+    if (!nasm_src || !out) {
+        if (err_msg) *err_msg = strdup("invalid arguments");
+        tr_set_last_error_fmt("tr_jit_assemble: invalid args");
+        return -1;
+    }
+#if defined(__x86_64__) || defined(_M_X64)
+    return jit_assemble(nasm_src, out, err_msg);
+#else
+    if (err_msg) *err_msg = strdup("in-process assembler targets x86-64 only");
+    tr_set_last_error_fmt("tr_jit_assemble: unsupported on this architecture");
+    return -1;
+#endif
+}
+
+/* part of the cache key: bump when the build commands below change */
+#define TR_JIT_BUILD_FLAGS "clang -c -x assembler|clang -shared -fPIC|nasm -f elf64|gcc -shared -fPIC;v1"
+#define TR_JIT_MEMO_BUCKETS 256
+
+/* one loaded block: either a dlopen handle or an in-process module; refs counts the successful
+   tr_nasm_compile_and_load calls not yet matched by tr_nasm_unload */
+typedef struct JitMemoEntry {
+    struct JitMemoEntry *next;
+    uint64_t key[2];
+    void *handle;
+    TrionJitModule *module;
+    void *sym;
+    uint32_t refs;
+} JitMemoEntry;
+
+static JitMemoEntry *g_jit_memo[TR_JIT_MEMO_BUCKETS];
+static tr_mutex_t g_jit_lock;
+static pthread_once_t g_jit_once = PTHREAD_ONCE_INIT;
+static char g_jit_cache_dir[1024];          /* empty when no usable cache directory */
+static char g_jit_toolchain[512];
+static int g_jit_inproc = 1;                /* TRION_JIT_INPROC=0 forces the toolchain path */
+
+static int jit_mkdir_p(const char *path)
+{
+    char tmp[1024];
+    size_t n = strlen(path);
+    if (n == 0 || n >= sizeof(tmp)) return -1;
+    memcpy(tmp, path, n + 1);
+    for (char *p = tmp + 1; *p; ++p) {
+        if (*p != '/') continue;
+        *p = '\0';
+        if (mkdir(tmp, 0700) != 0 && errno != EEXIST) return -1;
+        *p = '/';
+    }
+    return mkdir(tmp, 0700) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+/* .so files in the cache are dlopen'ed, so only a directory of ours that nobody else can write to
+   is used: owned by the effective user, no group/other write bit */
+static int jit_cache_dir_trusted(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) return 0;
+    return st.st_uid == geteuid() && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/* remove a finished build directory; a .so that is already mapped stays valid after unlink */
+static void jit_remove_build_dir(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *e;
+        char path[1400];
+        while ((e = readdir(d)) != NULL) {
+            if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+            snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+            unlink(path);
+        }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+/* "name:size:mtime;" for each tool found on PATH: changes whenever the toolchain is upgraded,
+   without spawning `clang --version` on every process start */
+static void jit_probe_toolchain(char *out, size_t outlen)
+{
+    static const char *const tools[] = { "clang", "nasm", "gcc" };
+    const char *path = getenv("PATH");
+    size_t pos = 0;
+    out[0] = '\0';
+    for (size_t t = 0; t < sizeof(tools) / sizeof(tools[0]); ++t) {
+        const char *p = path ? path : "/usr/bin:/bin";
+        while (*p) {
+            const char *e = strchr(p, ':');
+            size_t dl = e ? (size_t)(e - p) : strlen(p);
+            char cand[1024];
+            struct stat st;
+            if (dl > 0 && dl < sizeof(cand) - 16) {
+                snprintf(cand, sizeof(cand), "%.*s/%s", (int)dl, p, tools[t]);
+                if (stat(cand, &st) == 0 && S_ISREG(st.st_mode)) {
+                    int w = snprintf(out + pos, outlen - pos, "%s:%lld:%lld;", tools[t], (long long)st.st_size, (long long)st.st_mtime);
+                    if (w > 0 && (size_t)w < outlen - pos) pos += (size_t)w;
+                    break;
+                }
+            }
+            if (!e) break;
+            p = e + 1;
+        }
+    }
+}
+
+static void jit_init(void)
+{
+    tr_mutex_init(&g_jit_lock);
+    const char *ip = getenv("TRION_JIT_INPROC");
+    if (ip && ip[0] == '0') g_jit_inproc = 0;
+    jit_probe_toolchain(g_jit_toolchain, sizeof(g_jit_toolchain));
+    const char *dir = getenv("TRION_JIT_CACHE");
+    char buf[1024];
+    buf[0] = '\0';
+    if (dir && *dir) {
+        snprintf(buf, sizeof(buf), "%s", dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(buf, sizeof(buf), "%s/trion/jit", dir);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(buf, sizeof(buf), "%s/.cache/trion/jit", dir);
+    }
+    if (buf[0] && jit_mkdir_p(buf) == 0) {
+        if (jit_cache_dir_trusted(buf)) memcpy(g_jit_cache_dir, buf, sizeof(buf));
+        else tr_audit_log("jit: not using cache dir %s: not owned by this user or writable by others", buf);
+    }
+}
+
+/* two independent 64-bit hashes (FNV-1a and a multiply/xorshift mix) over the key material */
+static void jit_key_hash(const char *src, const char *entry, uint64_t key[2])
+{
+    const char *parts[4] = { src, entry, g_jit_toolchain, TR_JIT_BUILD_FLAGS };
+    uint64_t a = 1469598103934665603ull, b = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < 4; ++i) {
+        for (const uint8_t *p = (const uint8_t*)parts[i]; *p; ++p) {
+            a ^= *p; a *= 1099511628211ull;
+            b = (b ^ *p) * 0xff51afd7ed558ccdull;
+            b ^= b >> 29;
+        }
+        a ^= 0xFF; a *= 1099511628211ull;     /* part separator */
+        b = (b ^ 0xFF) * 0xc4ceb9fe1a85ec53ull;
+        b ^= b >> 32;
+    }
+    key[0] = a;
+    key[1] = b;
+}
+
+static void *jit_memo_lookup(const uint64_t key[2])
+{
+    void *sym = NULL;
+    tr_mutex_lock(&g_jit_lock);
+    for (JitMemoEntry *e = g_jit_memo[key[0] % TR_JIT_MEMO_BUCKETS]; e; e = e->next) {
+        if (e->key[0] == key[0] && e->key[1] == key[1]) { e->refs++; sym = e->sym; break; }
+    }
+    tr_mutex_unlock(&g_jit_lock);
+    return sym;
+}
+
+static void jit_memo_release(void *handle, TrionJitModule *module)
+{
+    if (module) tr_jit_module_unload(module);
+    else if (handle) dlclose(handle);
+}
+
+/* Record a freshly loaded block and return the symbol callers should use: when another thread
+   loaded the same key first, ours is released and theirs is shared. */
+static void *jit_memo_insert(const uint64_t key[2], void *handle, TrionJitModule *module, void *sym)
+{
+    JitMemoEntry *n = (JitMemoEntry*)malloc(sizeof(JitMemoEntry));
+    if (!n) return sym;     /* only the memo is lost; the symbol is still valid (but cannot be unloaded) */
+    n->key[0] = key[0]; n->key[1] = key[1];
+    n->handle = handle;
+    n->module = module;
+    n->sym = sym;
+    n->refs = 1;
+    tr_mutex_lock(&g_jit_lock);
+    JitMemoEntry **b = &g_jit_memo[key[0] % TR_JIT_MEMO_BUCKETS];
+    for (JitMemoEntry *e = *b; e; e = e->next) {
+        if (e->key[0] == key[0] && e->key[1] == key[1]) {
+            e->refs++;
+            void *shared = e->sym;
+            tr_mutex_unlock(&g_jit_lock);
+            free(n);
+            jit_memo_release(handle, module);
+            return shared;
+        }
+    }
+    n->next = *b;
+    *b = n;
+    tr_mutex_unlock(&g_jit_lock);
+    return sym;
+}
+
+/* Drop one reference to a symbol returned by tr_nasm_compile_and_load; the last one unmaps the
+   in-process module or dlcloses the shared object. Returns -1 for an unknown pointer. */
+int tr_nasm_unload(void *fn_ptr)
+{
+    if (!fn_ptr) { tr_set_last_error_fmt("tr_nasm_unload: invalid args"); return -1; }
+    pthread_once(&g_jit_once, jit_init);
+    JitMemoEntry *dead = NULL;
+    tr_mutex_lock(&g_jit_lock);
+    for (size_t i = 0; i < TR_JIT_MEMO_BUCKETS && !dead; ++i) {
+        for (JitMemoEntry **pp = &g_jit_memo[i]; *pp; pp = &(*pp)->next) {
+            if ((*pp)->sym != fn_ptr) continue;
+            JitMemoEntry *e = *pp;
+            if (--e->refs == 0) { *pp = e->next; dead = e; }
+            tr_mutex_unlock(&g_jit_lock);
+            if (dead) {
+                jit_memo_release(dead->handle, dead->module);
+                free(dead);
+            }
+            return 0;
+        }
+    }
+    tr_mutex_unlock(&g_jit_lock);
+    tr_set_last_error_fmt("tr_nasm_unload: unknown symbol");
+    return -1;
+}
+
+/* dlopen + dlsym; returns 0, -4 (dlopen) or -5 (dlsym) like tr_nasm_compile_and_load */
+static int jit_load_symbol(const char *so_path, const char *entry_symbol, void **handle_out, void **sym_out, char **err_msg)
+{
+    void *handle = dlopen(so_path, RTLD_NOW);
+    if (!handle) {
+        const char *de = dlerror();
+        if (err_msg) *err_msg = strdup(de ? de : "dlopen failed");
+        tr_set_last_error_fmt("tr_nasm_compile_and_load: dlopen failed: %s", de ? de : "?");
+        return -4;
+    }
+    void *sym = dlsym(handle, entry_symbol);
+    if (!sym) {
+        const char *de = dlerror();
+        if (err_msg) *err_msg = strdup(de ? de : "dlsym failed");
+        tr_set_last_error_fmt("tr_nasm_compile_and_load: dlsym failed: %s", de ? de : "?");
+        dlclose(handle);
+        return -5;
+    }
+    *handle_out = handle;
+    *sym_out = sym;
+    return 0;
+}
+
+/* Turn a failed build's log into err_msg (may be NULL) and set the last error. Returns -2. */
+static int jit_build_failed(const char *log_path, int used_clang, char **err_msg)
+{
+    if (err_msg) {
+        FILE *lf = fopen(log_path, "rb");
+        if (lf) {
+            fseek(lf, 0, SEEK_END); long sz = ftell(lf); fseek(lf, 0, SEEK_SET);
+            char *buf = (char*)malloc(sz + 256);
+            if (buf) {
+                size_t got = fread(buf, 1, sz, lf);
+                buf[got] = '\0';
+                snprintf(buf + got, 256, "\nCommand failed. Clang used=%d", used_clang);
+                *err_msg = buf;
+            }
+            fclose(lf);
+        } else {
+            *err_msg = strdup("build failed and no log available");
+        }
+    }
+    tr_set_last_error_fmt("tr_nasm_compile_and_load: build failed; see err_msg");
+    return -2;
+}
+
+/* Assemble asm_path into obj_path with clang, falling back to nasm. Returns 0 or -2. */
+static int jit_toolchain_assemble(const char *asm_path, const char *obj_path, const char *log_path, char **err_msg)
+{
+    // clang command: clang -c -x assembler -o module.o module.asm
+    char cmd[4096];
+    snprintf(cmd, sizeof(cmd), "clang -c -x assembler \"%s\" -o \"%s\" 2> \"%s\"", asm_path, obj_path, log_path);
+    if (system(cmd) == 0) return 0;
+    // fallback: nasm
+    snprintf(cmd, sizeof(cmd), "nasm -f elf64 \"%s\" -o \"%s\" 2>> \"%s\"", asm_path, obj_path, log_path);
+    if (system(cmd) == 0) return 0;
+    return jit_build_failed(log_path, 0, err_msg);
+}
+
+/* Link nobj objects into so_path with clang if available, else gcc. Returns 0 or -2. */
+static int jit_toolchain_link(const char *const *obj_paths, size_t nobj, const char *so_path, const char *log_path, char **err_msg)
+{
+    // the toolchain probe already searched PATH
+    int used_clang = strstr(g_jit_toolchain, "clang:") != NULL;
+    size_t cap = 256 + strlen(so_path) + strlen(log_path);
+    for (size_t i = 0; i < nobj; ++i) cap += strlen(obj_paths[i]) + 3;
+    char *cmd = (char*)malloc(cap);
+    if (!cmd) {
+        if (err_msg) *err_msg = strdup("out of memory");
+        tr_set_last_error_fmt("tr_nasm_compile_and_load: OOM");
+        return -1;
+    }
+    size_t off = (size_t)snprintf(cmd, cap, "%s -shared -fPIC -o \"%s\"", used_clang ? "clang" : "gcc", so_path);
+    for (size_t i = 0; i < nobj; ++i) off += (size_t)snprintf(cmd + off, cap - off, " \"%s\"", obj_paths[i]);
+    snprintf(cmd + off, cap - off, " 2>> \"%s\"", log_path);
+    int r = system(cmd);
+    free(cmd);
+    return r == 0 ? 0 : jit_build_failed(log_path, used_clang, err_msg);
+}
+
+/* Assemble asm_path and link it into so_path. Returns 0, or -2 with err_msg holding the build log. */
+static int jit_toolchain_build(const char *asm_path, const char *obj_path, const char *so_path, const char *log_path, char **err_msg)
+{
+    int rc = jit_toolchain_assemble(asm_path, obj_path, log_path, err_msg);
+    if (rc != 0) return rc;
+    return jit_toolchain_link(&obj_path, 1, so_path, log_path, err_msg);
+}
+
+/* metrics for one finished build that started at t0 (0: timing off) */
+static void jit_note_build(uint64_t t0, int ok)
+{
+    tr_metric_add(ok ? TR_M_JIT_BUILDS : TR_M_JIT_BUILD_FAILURES, 1);
+    if (ok && t0) tr_hist_record(TR_H_JIT_COMPILE, tr_metric_elapsed(t0));
+}
+
+int tr_nasm_compile_and_load(const char *nasm_src, const char *entry_symbol, void **fn_ptr, char **err_msg)
+{
+    if (!nasm_src || !entry_symbol || !fn_ptr) {
+        if (err_msg) *err_msg = strdup("invalid arguments");
+        tr_set_last_error_fmt("tr_nasm_compile_and_load: invalid args");
+        return -1;
+    }
+    pthread_once(&g_jit_once, jit_init);
+    uint64_t key[2];
+    jit_key_hash(nasm_src, entry_symbol, key);
+    void *sym = jit_memo_lookup(key);
+    if (sym) { tr_metric_add(TR_M_JIT_CACHE_HITS, 1); *fn_ptr = sym; return 0; }
+    uint64_t t0 = tr_metric_clock();
+
+#if defined(__x86_64__)
+    /* in-process first: no fork, no temp files; blocks outside the subset fall through */
+    if (g_jit_inproc) {
+        TrionJitModule *m = NULL;
+        if (jit_assemble(nasm_src, &m, NULL) == 0) {
+            sym = tr_jit_module_symbol(m, entry_symbol);
+            if (sym) {
+                size_t sz = m->code_len;
+                *fn_ptr = jit_memo_insert(key, NULL, m, sym);
+                jit_note_build(t0, 1);
+                tr_audit_log("jit_load: assembled in-process entry=%s (%zu bytes)", entry_symbol, sz);
+                return 0;
+            }
+            tr_jit_module_unload(m);    /* let the toolchain path report the missing symbol */
+        }
+    }
+#endif
+
+    void *handle = NULL;
+    char cached[1200];
+    cached[0] = '\0';
+    if (g_jit_cache_dir[0]) {
+        snprintf(cached, sizeof(cached), "%s/%016llx%016llx.so", g_jit_cache_dir, (unsigned long long)key[0], (unsigned long long)key[1]);
+        if (access(cached, R_OK) == 0 && jit_load_symbol(cached, entry_symbol, &handle, &sym, NULL) == 0) {
+            *fn_ptr = jit_memo_insert(key, handle, NULL, sym);
+            tr_metric_add(TR_M_JIT_CACHE_HITS, 1);
+            tr_audit_log("jit_load: cache hit %s entry=%s", cached, entry_symbol);
+            return 0;
+        }
+        /* unreadable or stale entry: rebuild and replace it */
+    }
+
+    // create tmpdir (inside the cache directory so the finished .so can be renamed into place)
+    char tmpl[1200];
+    if (g_jit_cache_dir[0]) snprintf(tmpl, sizeof(tmpl), "%s/build.XXXXXX", g_jit_cache_dir);
+    else snprintf(tmpl, sizeof(tmpl), "/tmp/trion_nasm_XXXXXX");
+    char *tmpdir = mkdtemp(tmpl);
+    if (!tmpdir) {
+        if (err_msg) *err_msg = strdup("mkdtemp failed");
+        tr_set_last_error_fmt("tr_nasm_compile_and_load: mkdtemp failed");
+        return -1;
+    }
+    char asm_path[1300], obj_path[1300], so_path[1300], log_path[1300];
+    snprintf(asm_path, sizeof(asm_path), "%s/module.asm", tmpdir);
+    snprintf(obj_path, sizeof(obj_path), "%s/module.o", tmpdir);
+    snprintf(so_path, sizeof(so_path), "%s/module.so", tmpdir);
+    snprintf(log_path, sizeof(log_path), "%s/build.log", tmpdir);
+
+    FILE *f = fopen(asm_path, "wb");
+    if (!f) { jit_remove_build_dir(tmpdir); if (err_msg) *err_msg = strdup("fopen asm failed"); tr_set_last_error_fmt("fopen asm failed"); return -1; }
+    fwrite(nasm_src, 1, strlen(nasm_src), f); fclose(f);
+
+    int rc = jit_toolchain_build(asm_path, obj_path, so_path, log_path, err_msg);
+    if (rc != 0) { jit_note_build(t0, 0); return rc; }  /* tmpdir is kept so build.log can be inspected */
+
+    /* rename is atomic, so concurrent builders of the same block never expose a partial file */
+    const char *load_path = so_path;
+    if (cached[0] && rename(so_path, cached) == 0) load_path = cached;
+    rc = jit_load_symbol(load_path, entry_symbol, &handle, &sym, err_msg);
+    if (load_path == cached || rc == 0) jit_remove_build_dir(tmpdir);
+    jit_note_build(t0, rc == 0);
+    if (rc != 0) return rc;
+    *fn_ptr = jit_memo_insert(key, handle, NULL, sym);
+    tr_audit_log("jit_load: compiled and loaded %s entry=%s", load_path, entry_symbol);
+    return 0;
+}
+
+/* ---- batch builds ---- */
+
+#define TR_JIT_MAX_WORKERS 16
+
+typedef struct JitBatchJob {
+    TrionNasmBlock *blk;
+    uint64_t key[2];
+    char asm_path[1300];
+    char obj_path[1300];
+    char so_path[1300];     /* per-block link fallback only */
+    char log_path[1300];
+} JitBatchJob;
+
+typedef struct JitBatchPool {
+    JitBatchJob *jobs;
+    size_t njobs;
+    size_t next;            /* claim counter shared by the workers */
+    int link_each;          /* 0: assemble every job; 1: link every assembled job into its own .so */
+} JitBatchPool;
+
+static void *jit_batch_worker(void *arg)
+{
+    JitBatchPool *p = (JitBatchPool*)arg;
+    for (;;) {
+        size_t i = tr_atomic_fetch_add(&p->next, (size_t)1);
+        if (i >= p->njobs) break;
+        JitBatchJob *j = &p->jobs[i];
+        if (!p->link_each) {
+            if (j->blk->rc == 0) j->blk->rc = jit_toolchain_assemble(j->asm_path, j->obj_path, j->log_path, &j->blk->err_msg);
+        } else if (j->blk->rc == 0) {
+            const char *obj = j->obj_path;
+            j->blk->rc = jit_toolchain_link(&obj, 1, j->so_path, j->log_path, &j->blk->err_msg);
+        }
+    }
+    return NULL;
+}
+
+/* Run the pool's jobs on up to nworkers threads; the calling thread is one of them, so a thread
+   creation failure only reduces parallelism. */
+static void jit_batch_run(JitBatchPool *p, size_t nworkers)
+{
+    tr_thread_t th[TR_JIT_MAX_WORKERS];
+    size_t started = 0;
+    p->next = 0;
+    while (started + 1 < nworkers && tr_thread_create(&th[started], jit_batch_worker, p) == 0) started++;
+    jit_batch_worker(p);
+    for (size_t i = 0; i < started; ++i) tr_thread_join(th[i]);
+}
+
+/* Resolve every assembled job against the shared object at path and memoise the symbols; each
+   memo entry holds its own dlopen reference. Returns the number of symbols resolved. */
+static size_t jit_batch_bind(JitBatchJob *jobs, size_t n, const char *path, int only_probe)
+{
+    void *handle = dlopen(path, RTLD_NOW);
+    if (!handle) {
+        const char *de = dlerror();
+        for (size_t i = 0; i < n && !only_probe; ++i) {
+            if (jobs[i].blk->rc != 0) continue;
+            jobs[i].blk->rc = -4;
+            jobs[i].blk->err_msg = strdup(de ? de : "dlopen failed");
+        }
+        return 0;
+    }
+    size_t found = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (jobs[i].blk->rc == 0 && dlsym(handle, jobs[i].blk->symbol)) found++;
+    }
+    if (only_probe && found != n) { dlclose(handle); return 0; }
+    for (size_t i = 0; i < n; ++i) {
+        TrionNasmBlock *b = jobs[i].blk;
+        if (b->rc != 0) continue;
+        void *sym = dlsym(handle, b->symbol);
+        void *ref = sym ? dlopen(path, RTLD_NOW | RTLD_NOLOAD) : NULL;
+        if (!ref) {
+            const char *de = dlerror();
+            b->rc = -5;
+            b->err_msg = strdup(de ? de : "dlsym failed");
+            continue;
+        }
+        b->fn = jit_memo_insert(jobs[i].key, ref, NULL, sym);
+    }
+    dlclose(handle);
+    return found;
+}
+
+/* Cache path of the combined object for jobs[0..n); the key covers every block key in order. */
+static int jit_batch_cache_path(const JitBatchJob *jobs, size_t n, char *out, size_t outlen)
+{
+    if (!g_jit_cache_dir[0]) return -1;
+    char *ids = (char*)malloc(n * 32 + 1);
+    if (!ids) return -1;
+    for (size_t k = 0; k < n; ++k)
+        snprintf(ids + k * 32, 33, "%016llx%016llx", (unsigned long long)jobs[k].key[0], (unsigned long long)jobs[k].key[1]);
+    uint64_t key[2];
+    jit_key_hash(ids, "tr_nasm_compile_batch", key);
+    free(ids);
+    snprintf(out, outlen, "%s/%016llx%016llx.so", g_jit_cache_dir, (unsigned long long)key[0], (unsigned long long)key[1]);
+    return 0;
+}
+
+/* Build n blocks together: memo hits and blocks the in-process assembler accepts are resolved
+   directly, the rest are assembled in parallel on at most max_workers threads (<= 0 picks the
+   CPU count) and linked into one shared object. A block that fails to build is reported through
+   its rc/err_msg without affecting the others; if the combined link fails (for instance on
+   clashing global symbols) every object is linked separately instead. The combined object is
+   cached under a hash of all its block keys. Returns the number of blocks loaded, or -1 on
+   invalid arguments. */
+int tr_nasm_compile_batch(TrionNasmBlock *blocks, size_t n, int max_workers)
+{
+    if (!blocks && n) { tr_set_last_error_fmt("tr_nasm_compile_batch: invalid args"); return -1; }
+    pthread_once(&g_jit_once, jit_init);
+    JitBatchJob *jobs = (JitBatchJob*)calloc(n ? n : 1, sizeof(JitBatchJob));
+    size_t *dup = (size_t*)malloc((n ? n : 1) * sizeof(size_t));
+    if (!jobs || !dup) {
+        free(jobs); free(dup);
+        tr_set_last_error_fmt("tr_nasm_compile_batch: OOM");
+        return -1;
+    }
+
+    /* 1. memo hits, in-process assembly, and de-duplication of identical blocks */
+    size_t njobs = 0;
+    for (size_t i = 0; i < n; ++i) {
+        TrionNasmBlock *b = &blocks[i];
+        b->fn = NULL; b->rc = 0; b->err_msg = NULL;
+        dup[i] = SIZE_MAX;
+        if (!b->src || !b->symbol) { b->rc = -1; b->err_msg = strdup("invalid arguments"); continue; }
+        uint64_t key[2];
+        jit_key_hash(b->src, b->symbol, key);
+        if ((b->fn = jit_memo_lookup(key)) != NULL) { tr_metric_add(TR_M_JIT_CACHE_HITS, 1); continue; }
+        size_t k = 0;
+        while (k < njobs && (jobs[k].key[0] != key[0] || jobs[k].key[1] != key[1])) k++;
+        if (k < njobs) { dup[i] = k; continue; }
+#if defined(__x86_64__)
+        if (g_jit_inproc) {
+            uint64_t t0 = tr_metric_clock();
+            TrionJitModule *m = NULL;
+            if (jit_assemble(b->src, &m, NULL) == 0) {
+                void *sym = tr_jit_module_symbol(m, b->symbol);
+                if (sym) { b->fn = jit_memo_insert(key, NULL, m, sym); jit_note_build(t0, 1); continue; }
+                tr_jit_module_unload(m);
+            }
+        }
+#endif
+        jobs[njobs].blk = b;
+        jobs[njobs].key[0] = key[0]; jobs[njobs].key[1] = key[1];
+        njobs++;
+    }
+
+    /* 2. the combined object: cache probe, then a parallel assemble and a single link */
+    char cached[1200];
+    if (njobs && jit_batch_cache_path(jobs, njobs, cached, sizeof(cached)) == 0 &&
+        access(cached, R_OK) == 0 && jit_batch_bind(jobs, njobs, cached, 1) == njobs) {
+        tr_audit_log("jit_load: batch cache hit %s (%zu blocks)", cached, njobs);
+        tr_metric_add(TR_M_JIT_CACHE_HITS, (int64_t)njobs);
+        njobs = 0;
+    }
+    if (njobs) {
+        uint64_t t0 = tr_metric_clock();
+        char tmpl[1200];
+        if (g_jit_cache_dir[0]) snprintf(tmpl, sizeof(tmpl), "%s/build.XXXXXX", g_jit_cache_dir);
+        else snprintf(tmpl, sizeof(tmpl), "/tmp/trion_nasm_XXXXXX");
+        char *tmpdir = mkdtemp(tmpl);
+        for (size_t k = 0; k < njobs; ++k) {
+            JitBatchJob *j = &jobs[k];
+            if (!tmpdir) { j->blk->rc = -1; j->blk->err_msg = strdup("mkdtemp failed"); continue; }
+            snprintf(j->asm_path, sizeof(j->asm_path), "%s/block%zu.asm", tmpdir, k);
+            snprintf(j->obj_path, sizeof(j->obj_path), "%s/block%zu.o", tmpdir, k);
+            snprintf(j->so_path, sizeof(j->so_path), "%s/block%zu.so", tmpdir, k);
+            snprintf(j->log_path, sizeof(j->log_path), "%s/block%zu.log", tmpdir, k);
+            FILE *f = fopen(j->asm_path, "wb");
+            if (!f) { j->blk->rc = -1; j->blk->err_msg = strdup("fopen asm failed"); continue; }
+            fwrite(j->blk->src, 1, strlen(j->blk->src), f); fclose(f);
+        }
+        size_t nworkers = max_workers > 0 ? (size_t)max_workers : tr_cpu_count();
+        if (nworkers > TR_JIT_MAX_WORKERS) nworkers = TR_JIT_MAX_WORKERS;
+        if (nworkers > njobs) nworkers = njobs;
+        JitBatchPool pool;
+        pool.jobs = jobs;
+        pool.njobs = njobs;
+        pool.link_each = 0;
+        if (tmpdir) jit_batch_run(&pool, nworkers);
+
+        const char **objs = (const char**)malloc(njobs * sizeof(char*));
+        size_t nobj = 0;
+        for (size_t k = 0; k < njobs; ++k) {
+            if (jobs[k].blk->rc != 0) continue;
+            if (objs) { objs[nobj++] = jobs[k].obj_path; continue; }
+            jobs[k].blk->rc = -1;
+            jobs[k].blk->err_msg = strdup("out of memory");
+        }
+        if (nobj) {
+            char so_path[1300], log_path[1300];
+            snprintf(so_path, sizeof(so_path), "%s/batch.so", tmpdir);
+            snprintf(log_path, sizeof(log_path), "%s/link.log", tmpdir);
+            if (jit_toolchain_link(objs, nobj, so_path, log_path, NULL) == 0) {
+                /* only a batch where every block built is cached: the key covers all of them */
+                const char *load_path = so_path;
+                if (nobj == njobs && jit_batch_cache_path(jobs, njobs, cached, sizeof(cached)) == 0 && rename(so_path, cached) == 0) {
+                    load_path = cached;
+                }
+                jit_batch_bind(jobs, njobs, load_path, 0);
+                tr_audit_log("jit_load: batch linked %s (%zu of %zu blocks)", load_path, nobj, njobs);
+            } else {
+                /* one bad object (e.g. a duplicate global) must not sink the rest */
+                pool.link_each = 1;
+                jit_batch_run(&pool, nworkers);
+                for (size_t k = 0; k < njobs; ++k) if (jobs[k].blk->rc == 0) jit_batch_bind(&jobs[k], 1, jobs[k].so_path, 0);
+                tr_audit_log("jit_load: batch link failed; linked %zu blocks separately", nobj);
+            }
+        }
+        free(objs);
+        /* every block is bound (or has its log copied into err_msg) by now, whichever way it went */
+        if (tmpdir) jit_remove_build_dir(tmpdir);
+        /* the histogram gets one sample for the whole toolchain batch */
+        size_t built = 0;
+        for (size_t k = 0; k < njobs; ++k) if (jobs[k].blk->rc == 0) built++;
+        tr_metric_add(TR_M_JIT_BUILDS, (int64_t)built);
+        tr_metric_add(TR_M_JIT_BUILD_FAILURES, (int64_t)(njobs - built));
+        if (built && t0) tr_hist_record(TR_H_JIT_COMPILE, tr_metric_elapsed(t0));
+    }
+
+    /* 3. identical blocks share the first copy's result */
+    size_t loaded = 0;
+    for (size_t i = 0; i < n; ++i) {
+        TrionNasmBlock *b = &blocks[i];
+        if (dup[i] != SIZE_MAX) {
+            TrionNasmBlock *o = jobs[dup[i]].blk;
+            b->rc = o->rc;
+            if (o->rc == 0 && (b->fn = jit_memo_lookup(jobs[dup[i]].key)) == NULL) b->rc = -1;
+            if (b->rc != 0) b->err_msg = strdup(o->err_msg ? o->err_msg : "build failed");
+        }
+        if (b->rc == 0 && b->fn) loaded++;
+    }
+    free(dup);
+    free(jobs);
+    if (loaded < n) tr_set_last_error_fmt("tr_nasm_compile_batch: %zu of %zu blocks failed; see err_msg", n - loaded, n);
+    return (int)loaded;
+}
+#else
+int tr_nasm_compile_and_load(const char *nasm_src, const char *entry_symbol, void **fn_ptr, char **err_msg)
+{
+    (void)nasm_src; (void)entry_symbol; (void)fn_ptr;
+    if (err_msg) *err_msg = strdup("tr_nasm_compile_and_load: Not implemented on Windows in this runtime");
+    tr_set_last_error_fmt("tr_nasm_compile_and_load: Not implemented on Windows");
+    return -1;
+}
+int tr_nasm_unload(void *fn_ptr)
+{
+    (void)fn_ptr;
+    tr_set_last_error_fmt("tr_nasm_unload: Not implemented on Windows");
+    return -1;
 }
-
-int tr_packet_drop_if_src_ip(TrionPacket *p, uint32_t ip)
+int tr_nasm_compile_batch(TrionNasmBlock *blocks, size_t n, int max_workers)
 {
-    if (!p) return 0;
-    return p->src_ip == ip;
+    (void)max_workers;
+    for (size_t i = 0; i < n && blocks; ++i) {
+        blocks[i].fn = NULL;
+        blocks[i].rc = -1;
+        blocks[i].err_msg = strdup("tr_nasm_compile_batch: Not implemented on Windows in this runtime");
+    }
+    tr_set_last_error_fmt("tr_nasm_compile_batch: Not implemented on Windows");
+    return blocks || !n ? 0 : -1;
 }
+#endif
 
 /* ---------------------------
-   Capsule lifecycle, messaging and callbacks
+   Precompiled module images (mmap-able program container)
+   - one file holds a program's native code sections, its capsule table, its syscall table and
+     its prebuilt NASM blocks; tr_module_open maps the whole file with a single mmap and only
+     validates the tables, so opening costs one open/fstat/mmap however large the program is
+   - sections start on page boundaries, so code runs in place: the first use of a symbol readies
+     its section and every section it references (relocations are patched into copy-on-write
+     pages, imports are resolved with dlsym, then the pages get their final protection).
+     Nothing is touched for code that is never called.
+   - tr_module_add_object converts an x86-64 ELF relocatable object (`llc -relocation-model=pic
+     -filetype=obj`, `clang -c -fPIC`) into sections, symbols and relocations. Calls and GOT
+     loads that leave the image go through a per-image slot table (jmp stub + address), so
+     the image never needs the dynamic linker; imports that another object in the same image
+     defines are bound at write time.
+   - NASM blocks are assembled at build time by the in-process assembler; a block outside its
+     subset is stored as source and built by tr_nasm_compile_and_load on first use (which hits
+     the on-disk JIT cache after the first run)
+   - capsule and syscall tables name entry symbols; syscalls are registered with thunks that
+     resolve their handler on first invocation
+   - tables are in host byte order (every supported host is little-endian); all offsets are
+     file offsets, names are offsets into the string table
    --------------------------- */
 
-typedef struct Capsule {
-    char *name;
-    Quarantine *q;
-    Channel *inbox;            /* message channel for capsule */
-    tr_thread_t thread;
-    int running;
-    void *user_ctx;
-    int (*entry)(struct Capsule*, void*); /* entry procedure supplied by embedder */
-} Capsule;
+/* section kinds */
+#define TR_MOD_SECTION_CODE   1     /* mapped read + execute */
+#define TR_MOD_SECTION_RODATA 2     /* read-only */
+#define TR_MOD_SECTION_DATA   3     /* read + write (private copy) */
+#define TR_MOD_SECTION_NASM   4     /* NUL-terminated NASM source, built on first use */
 
-/* Event callback: capsule lifecycle or message events */
-typedef void (*tr_event_callback_t)(Capsule *capsule, const char *event, void *ctx);
+/* relocation kinds for tr_module_add_reloc / tr_module_add_import_reloc */
+#define TR_MOD_RELOC_ABS64    1     /* u64 at place = target + addend */
+#define TR_MOD_RELOC_REL32    2     /* i32 at place = target + addend - place */
+#define TR_MOD_RELOC_GOTREL32 3     /* i32 at place = slot holding target + addend - place */
+#define TR_MOD_RELOC_IMPORT64 4     /* on disk only: u64 at place = address of import + addend */
+
+/* syscall calling conventions in the syscall table */
+#define TR_MOD_SYSCALL_JSON   0     /* tr_syscall_handler_t */
+#define TR_MOD_SYSCALL_BIN    1     /* tr_syscall_bin_handler_t, registered without a schema */
+
+#define TR_MOD_MAGIC   "TRIONMOD"
+#define TR_MOD_VERSION 1
+#define TR_MOD_SLOT    16           /* jmp qword [rip + 2]; int3 x2; .quad target */
 
-/* Callback registry impl */
 typedef struct {
-    tr_event_callback_t *callbacks;
-    void **cb_ctx;
-    size_t count;
-    size_t capacity;
-    tr_mutex_t lock;
-} CallbackRegistry;
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;             /* section alignment in the file */
+    uint32_t nsections, nsymbols, ncapsules, nsyscalls, nrelocs, nimports;
+    uint64_t file_len;
+    uint64_t sections_off, symbols_off, capsules_off, syscalls_off, relocs_off, imports_off;
+    uint64_t strtab_off, strtab_len;
+} TrModHeader;
 
-static CallbackRegistry *g_callback_registry = NULL;
+typedef struct {
+    uint32_t kind;                  /* TR_MOD_SECTION_* */
+    uint32_t name;
+    uint64_t off, size;
+    uint32_t first_reloc, nrelocs;  /* this section's slice of the relocation table */
+} TrModSection;
 
-static CallbackRegistry *callback_registry_create(void)
+typedef struct {
+    uint32_t name;                  /* the symbol table is sorted by name */
+    uint32_t section;
+    uint64_t value;                 /* offset in the section */
+} TrModSymbol;
+
+typedef struct {
+    uint64_t offset;                /* place, relative to the section start */
+    int64_t addend;
+    uint32_t type;                  /* TR_MOD_RELOC_ABS64, _REL32 or _IMPORT64 */
+    uint32_t target;                /* section index, or import index for _IMPORT64 */
+} TrModReloc;
+
+typedef struct { uint32_t name, symbol, mode, flags; } TrModCapsule;
+typedef struct { uint32_t name, symbol, abi; int32_t flags; uint32_t description, pad; } TrModSyscall;
+typedef struct { uint32_t name, weak; } TrModImport;
+
+#ifndef _WIN32
+
+/* ---- builder ---- */
+
+typedef struct {
+    uint32_t kind;
+    char *name;
+    uint8_t *data;
+    size_t len, cap;
+    TrModReloc *relocs;             /* _IMPORT64 targets index b->imports */
+    size_t nrelocs, cap_relocs;
+} ModBuildSection;
+
+typedef struct { char *name; uint32_t section; uint64_t value; } ModBuildSymbol;
+typedef struct { char *name, *symbol; uint32_t mode; } ModBuildCapsule;
+typedef struct { char *name, *symbol, *description; uint32_t abi; int32_t flags; } ModBuildSyscall;
+typedef struct { char *name; uint32_t weak; uint32_t stub; uint32_t has_stub; } ModBuildImport;
+typedef struct { uint32_t section; uint64_t value; uint32_t slot; } ModBuildLocalSlot;
+
+struct TrionModuleBuilder {
+    ModBuildSection *sections;
+    size_t nsections, cap_sections;
+    ModBuildSymbol *symbols;
+    size_t nsymbols, cap_symbols;
+    ModBuildCapsule *capsules;
+    size_t ncapsules, cap_capsules;
+    ModBuildSyscall *syscalls;
+    size_t nsyscalls, cap_syscalls;
+    ModBuildImport *imports;
+    size_t nimports, cap_imports;
+    ModBuildLocalSlot *local_slots;  /* GOT slots for symbols defined in the image */
+    size_t nlocal_slots, cap_local_slots;
+    int slot_section;               /* -1 until something needs a slot */
+    int oom;
+};
+typedef struct TrionModuleBuilder TrionModuleBuilder;
+
+TrionModuleBuilder *tr_module_builder_create(void)
 {
-    CallbackRegistry *r = (CallbackRegistry*)malloc(sizeof(CallbackRegistry));
-    if (!r) return NULL;
-    r->count = 0; r->capacity = 4;
-    r->callbacks = (tr_event_callback_t*)malloc(r->capacity * sizeof(tr_event_callback_t));
-    r->cb_ctx = (void**)malloc(r->capacity * sizeof(void*));
-    tr_mutex_init(&r->lock);
-    return r;
+    TrionModuleBuilder *b = (TrionModuleBuilder*)calloc(1, sizeof(TrionModuleBuilder));
+    if (!b) { tr_set_last_error_fmt("tr_module_builder_create: OOM"); return NULL; }
+    b->slot_section = -1;
+    return b;
 }
 
-static void callback_registry_destroy(CallbackRegistry *r)
+void tr_module_builder_destroy(TrionModuleBuilder *b)
 {
-    if (!r) return;
-    tr_mutex_destroy(&r->lock);
-    free(r->callbacks);
-    free(r->cb_ctx);
-    free(r);
+    if (!b) return;
+    for (size_t i = 0; i < b->nsections; ++i) { free(b->sections[i].name); free(b->sections[i].data); free(b->sections[i].relocs); }
+    for (size_t i = 0; i < b->nsymbols; ++i) free(b->symbols[i].name);
+    for (size_t i = 0; i < b->ncapsules; ++i) { free(b->capsules[i].name); free(b->capsules[i].symbol); }
+    for (size_t i = 0; i < b->nsyscalls; ++i) { free(b->syscalls[i].name); free(b->syscalls[i].symbol); free(b->syscalls[i].description); }
+    for (size_t i = 0; i < b->nimports; ++i) free(b->imports[i].name);
+    free(b->sections); free(b->symbols); free(b->capsules); free(b->syscalls); free(b->imports); free(b->local_slots);
+    free(b);
 }
 
-int tr_register_event_callback(tr_event_callback_t cb, void *ctx)
+static int mod_oom(TrionModuleBuilder *b, const char *fn)
 {
-    if (!cb) { tr_set_last_error_fmt("tr_register_event_callback: invalid cb"); return -1; }
-    if (!g_callback_registry) g_callback_registry = callback_registry_create();
-    CallbackRegistry *r = g_callback_registry;
-    tr_mutex_lock(&r->lock);
-    if (r->count == r->capacity) {
-        size_t nc = r->capacity * 2;
-        tr_event_callback_t *ncbs = (tr_event_callback_t*)realloc(r->callbacks, nc * sizeof(tr_event_callback_t));
-        void **nctx = (void**)realloc(r->cb_ctx, nc * sizeof(void*));
-        if (!ncbs || !nctx) { tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("tr_register_event_callback: realloc failed"); return -1; }
-        r->callbacks = ncbs; r->cb_ctx = nctx; r->capacity = nc;
-    }
-    r->callbacks[r->count] = cb;
-    r->cb_ctx[r->count] = ctx;
-    r->count++;
-    tr_mutex_unlock(&r->lock);
+    b->oom = 1;
+    tr_set_last_error_fmt("%s: OOM", fn);
+    return -1;
+}
+
+/* Add a section holding a copy of data (len bytes; data may be NULL for a zero-filled section).
+   Returns the section index or -1. */
+int tr_module_add_section(TrionModuleBuilder *b, int kind, const char *name, const void *data, size_t len)
+{
+    if (!b || kind < TR_MOD_SECTION_CODE || kind > TR_MOD_SECTION_NASM) { tr_set_last_error_fmt("tr_module_add_section: invalid args"); return -1; }
+    if (b->nsections + 1 > b->cap_sections) {
+        void *grown = jit_grow(b->sections, &b->cap_sections, b->nsections + 1, sizeof(ModBuildSection), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_section");
+        b->sections = (ModBuildSection*)grown;
+    }
+    ModBuildSection *s = &b->sections[b->nsections];
+    memset(s, 0, sizeof(*s));
+    s->kind = (uint32_t)kind;
+    s->name = strdup(name ? name : "");
+    s->data = (uint8_t*)malloc(len ? len : 1);
+    if (!s->name || !s->data) { free(s->name); free(s->data); return mod_oom(b, "tr_module_add_section"); }
+    if (data) memcpy(s->data, data, len); else memset(s->data, 0, len);
+    s->len = s->cap = len;
+    return (int)b->nsections++;
+}
+
+/* Export `name` at offset value of a section. Names must be unique within the image. */
+int tr_module_add_symbol(TrionModuleBuilder *b, const char *name, int section, uint64_t value)
+{
+    if (!b || !name || !*name || section < 0 || (size_t)section >= b->nsections || value > b->sections[section].len) {
+        tr_set_last_error_fmt("tr_module_add_symbol: invalid args");
+        return -1;
+    }
+    if (b->nsymbols + 1 > b->cap_symbols) {
+        void *grown = jit_grow(b->symbols, &b->cap_symbols, b->nsymbols + 1, sizeof(ModBuildSymbol), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_symbol");
+        b->symbols = (ModBuildSymbol*)grown;
+    }
+    char *n = strdup(name);
+    if (!n) return mod_oom(b, "tr_module_add_symbol");
+    b->symbols[b->nsymbols].name = n;
+    b->symbols[b->nsymbols].section = (uint32_t)section;
+    b->symbols[b->nsymbols].value = value;
+    b->nsymbols++;
     return 0;
 }
 
-static void callback_registry_emit(CallbackRegistry *r, Capsule *c, const char *evt)
+static int mod_push_reloc(TrionModuleBuilder *b, int section, uint64_t offset, uint32_t type, uint32_t target, int64_t addend, const char *fn)
 {
-    if (!r || !c || !evt) return;
-    tr_mutex_lock(&r->lock);
-    size_t count = r->count;
-    tr_event_callback_t *cbs = (tr_event_callback_t*)malloc(count * sizeof(tr_event_callback_t));
-    void **cctx = (void**)malloc(count * sizeof(void*));
-    for (size_t i = 0; i < count; ++i) { cbs[i] = r->callbacks[i]; cctx[i] = r->cb_ctx[i]; }
-    tr_mutex_unlock(&r->lock);
-    for (size_t i = 0; i < count; ++i) {
-        if (cbs[i]) cbs[i](c, evt, cctx[i]);
+    ModBuildSection *s = &b->sections[section];
+    size_t width = type == TR_MOD_RELOC_REL32 ? 4 : 8;
+    if (offset > s->len || s->len - offset < width) { tr_set_last_error_fmt("%s: relocation at %llu is outside section %d", fn, (unsigned long long)offset, section); return -1; }
+    if (s->nrelocs + 1 > s->cap_relocs) {
+        void *grown = jit_grow(s->relocs, &s->cap_relocs, s->nrelocs + 1, sizeof(TrModReloc), &b->oom);
+        if (!grown) return mod_oom(b, fn);
+        s->relocs = (TrModReloc*)grown;
     }
-    free(cbs); free(cctx);
+    TrModReloc *r = &s->relocs[s->nrelocs++];
+    r->offset = offset;
+    r->addend = addend;
+    r->type = type;
+    r->target = target;
+    return 0;
 }
 
-/* Thread entry wrapper for capsule */
-static void *capsule_thread_start(void *arg)
+/* the slot table: one TR_MOD_SLOT entry per import or GOT-referenced local symbol */
+static int mod_new_slot(TrionModuleBuilder *b, uint32_t *slot_out)
 {
-    Capsule *c = (Capsule*)arg;
-    if (!c) return NULL;
-    c->running = 1;
-    if (g_callback_registry) callback_registry_emit(g_callback_registry, c, "capsule_start");
-    int rc = 0;
-    if (c->entry) rc = c->entry(c, c->user_ctx);
-    /* drain inbox if present */
-    if (c->inbox) {
-        void *msg;
-        while (channel_recv(c->inbox, &msg, 0, 0) == 1) {
-            (void)msg;
-        }
+    static const uint8_t stub[8] = { 0xFF, 0x25, 0x02, 0x00, 0x00, 0x00, 0xCC, 0xCC };
+    if (b->slot_section < 0) {
+        b->slot_section = tr_module_add_section(b, TR_MOD_SECTION_CODE, ".trion.slots", NULL, 0);
+        if (b->slot_section < 0) return -1;
     }
-    c->running = 0;
-    if (g_callback_registry) callback_registry_emit(g_callback_registry, c, "capsule_stop");
-    return (void*)(intptr_t)rc;
+    ModBuildSection *s = &b->sections[b->slot_section];
+    if (s->len + TR_MOD_SLOT > s->cap) {
+        void *grown = jit_grow(s->data, &s->cap, s->len + TR_MOD_SLOT, 1, &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_builder");
+        s->data = (uint8_t*)grown;
+    }
+    memcpy(s->data + s->len, stub, sizeof(stub));
+    memset(s->data + s->len + sizeof(stub), 0, TR_MOD_SLOT - sizeof(stub));
+    *slot_out = (uint32_t)s->len;
+    s->len += TR_MOD_SLOT;
+    return 0;
 }
 
-/* Create capsule: name owned by caller, will be copied into quarantine */
-Capsule *tr_capsule_create(const char *name, int (*entry)(Capsule*, void*), void *user_ctx)
+static int mod_local_slot(TrionModuleBuilder *b, int section, uint64_t value, uint32_t *slot_out)
 {
-    if (!name) { tr_set_last_error_fmt("tr_capsule_create: invalid name"); return NULL; }
-    Capsule *c = (Capsule*)malloc(sizeof(Capsule));
-    if (!c) { tr_set_last_error_fmt("tr_capsule_create: OOM"); return NULL; }
-    c->q = quarantine_create(16);
-    if (!c->q) { free(c); tr_set_last_error_fmt("tr_capsule_create: quarantine_create failed"); return NULL; }
-    // store name in quarantine-owned memory
-    size_t nl = strlen(name) + 1;
-    char *nn = (char*)quarantine_alloc(c->q, nl);
-    if (!nn) { quarantine_destroy(c->q); free(c); tr_set_last_error_fmt("tr_capsule_create: name alloc failed"); return NULL; }
-    memcpy(nn, name, nl);
-    c->name = nn;
-    c->inbox = channel_create(32); /* default inbox size */
-    c->thread = 0;
-    c->running = 0;
-    c->user_ctx = user_ctx;
-    c->entry = entry;
-    return c;
+    for (size_t i = 0; i < b->nlocal_slots; ++i) {
+        if (b->local_slots[i].section == (uint32_t)section && b->local_slots[i].value == value) { *slot_out = b->local_slots[i].slot; return 0; }
+    }
+    if (b->nlocal_slots + 1 > b->cap_local_slots) {
+        void *grown = jit_grow(b->local_slots, &b->cap_local_slots, b->nlocal_slots + 1, sizeof(ModBuildLocalSlot), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_reloc");
+        b->local_slots = (ModBuildLocalSlot*)grown;
+    }
+    uint32_t slot;
+    if (mod_new_slot(b, &slot) != 0) return -1;
+    if (mod_push_reloc(b, b->slot_section, slot + 8, TR_MOD_RELOC_ABS64, (uint32_t)section, (int64_t)value, "tr_module_add_reloc") != 0) return -1;
+    ModBuildLocalSlot *ls = &b->local_slots[b->nlocal_slots++];
+    ls->section = (uint32_t)section;
+    ls->value = value;
+    ls->slot = slot;
+    *slot_out = slot;
+    return 0;
 }
 
-void tr_capsule_destroy(Capsule *c)
+/* Relocate `offset` in `section` against offset target_value of target_section. For
+   TR_MOD_RELOC_GOTREL32 the place gets the pc-relative address of a slot holding the target. */
+int tr_module_add_reloc(TrionModuleBuilder *b, int section, uint64_t offset, int type, int target_section, uint64_t target_value, int64_t addend)
 {
-    if (!c) return;
-    if (c->running) {
-        if (c->inbox) channel_close(c->inbox);
-        tr_thread_join(c->thread);
+    if (!b || section < 0 || (size_t)section >= b->nsections || target_section < 0 || (size_t)target_section >= b->nsections
+        || type < TR_MOD_RELOC_ABS64 || type > TR_MOD_RELOC_GOTREL32
+        || b->sections[section].kind == TR_MOD_SECTION_NASM || b->sections[target_section].kind == TR_MOD_SECTION_NASM) {
+        tr_set_last_error_fmt("tr_module_add_reloc: invalid args");
+        return -1;
     }
-    if (c->inbox) channel_destroy(c->inbox);
-    quarantine_destroy(c->q);
-    free(c);
+    if (type == TR_MOD_RELOC_GOTREL32) {
+        uint32_t slot;
+        if (mod_local_slot(b, target_section, target_value, &slot) != 0) return -1;
+        return mod_push_reloc(b, section, offset, TR_MOD_RELOC_REL32, (uint32_t)b->slot_section, (int64_t)slot + 8 + addend, "tr_module_add_reloc");
+    }
+    return mod_push_reloc(b, section, offset, (uint32_t)type, (uint32_t)target_section, (int64_t)target_value + addend, "tr_module_add_reloc");
 }
 
-int tr_capsule_start(Capsule *c)
+static int mod_import(TrionModuleBuilder *b, const char *name, int weak, size_t *idx_out)
 {
-    if (!c) { tr_set_last_error_fmt("tr_capsule_start: invalid capsule"); return -1; }
-    if (c->running) { tr_set_last_error_fmt("tr_capsule_start: already running"); return -1; }
-    if (tr_thread_create(&c->thread, capsule_thread_start, (void*)c) != 0) { tr_set_last_error_fmt("tr_capsule_start: thread create failed"); return -1; }
+    for (size_t i = 0; i < b->nimports; ++i) {
+        if (strcmp(b->imports[i].name, name) == 0) {
+            if (!weak) b->imports[i].weak = 0;
+            *idx_out = i;
+            return 0;
+        }
+    }
+    if (b->nimports + 1 > b->cap_imports) {
+        void *grown = jit_grow(b->imports, &b->cap_imports, b->nimports + 1, sizeof(ModBuildImport), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_import_reloc");
+        b->imports = (ModBuildImport*)grown;
+    }
+    char *n = strdup(name);
+    if (!n) return mod_oom(b, "tr_module_add_import_reloc");
+    ModBuildImport *im = &b->imports[b->nimports];
+    im->name = n;
+    im->weak = weak ? 1 : 0;
+    im->stub = 0;
+    im->has_stub = 0;
+    *idx_out = b->nimports++;
     return 0;
 }
 
-int tr_capsule_join(Capsule *c)
+/* Relocate `offset` in `section` against a symbol outside the image (resolved with dlsym when the
+   section is first used; a weak import that is not found resolves to 0). REL32 references (calls,
+   jumps) and GOTREL32 references go through the import's slot. */
+int tr_module_add_import_reloc(TrionModuleBuilder *b, int section, uint64_t offset, int type, const char *name, int weak, int64_t addend)
 {
-    if (!c) { tr_set_last_error_fmt("tr_capsule_join: invalid capsule"); return -1; }
-    if (!c->running) return 0;
-    return tr_thread_join(c->thread);
+    if (!b || !name || !*name || section < 0 || (size_t)section >= b->nsections
+        || type < TR_MOD_RELOC_ABS64 || type > TR_MOD_RELOC_GOTREL32 || b->sections[section].kind == TR_MOD_SECTION_NASM) {
+        tr_set_last_error_fmt("tr_module_add_import_reloc: invalid args");
+        return -1;
+    }
+    size_t idx;
+    if (mod_import(b, name, weak, &idx) != 0) return -1;
+    if (type == TR_MOD_RELOC_ABS64) return mod_push_reloc(b, section, offset, TR_MOD_RELOC_IMPORT64, (uint32_t)idx, addend, "tr_module_add_import_reloc");
+    ModBuildImport *im = &b->imports[idx];
+    if (!im->has_stub) {
+        uint32_t slot;
+        if (mod_new_slot(b, &slot) != 0) return -1;
+        im = &b->imports[idx];
+        if (mod_push_reloc(b, b->slot_section, slot + 8, TR_MOD_RELOC_IMPORT64, (uint32_t)idx, 0, "tr_module_add_import_reloc") != 0) return -1;
+        im->stub = slot;
+        im->has_stub = 1;
+    }
+    int64_t at = (int64_t)im->stub + (type == TR_MOD_RELOC_GOTREL32 ? 8 : 0);
+    return mod_push_reloc(b, section, offset, TR_MOD_RELOC_REL32, (uint32_t)b->slot_section, at + addend, "tr_module_add_import_reloc");
 }
 
-int tr_capsule_send(Capsule *c, void *msg)
+/* ELF64 fields are read with memcpy: the object buffer carries no alignment guarantee */
+static uint16_t mod_rd16(const uint8_t *p) { uint16_t v; memcpy(&v, p, 2); return v; }
+static uint32_t mod_rd32(const uint8_t *p) { uint32_t v; memcpy(&v, p, 4); return v; }
+static uint64_t mod_rd64(const uint8_t *p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+/* Add every allocated section of an x86-64 ELF relocatable object, its global symbols and its
+   relocations. Objects must be position independent (absolute 32-bit relocations are rejected);
+   unwind tables are dropped. Returns 0 or -1. */
+int tr_module_add_object(TrionModuleBuilder *b, const void *elf, size_t len)
 {
-    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_send: invalid args"); return -1; }
-    return channel_send(c->inbox, msg, 1, 0);
+    const uint8_t *e = (const uint8_t*)elf;
+    if (!b || !e || len < 64) { tr_set_last_error_fmt("tr_module_add_object: invalid args"); return -1; }
+    if (memcmp(e, "\x7f" "ELF", 4) != 0 || e[4] != 2 || e[5] != 1 || mod_rd16(e + 16) != 1 /* ET_REL */ || mod_rd16(e + 18) != 62 /* EM_X86_64 */) {
+        tr_set_last_error_fmt("tr_module_add_object: not an x86-64 ELF64 relocatable object");
+        return -1;
+    }
+    uint64_t shoff = mod_rd64(e + 40);
+    uint16_t shentsize = mod_rd16(e + 58), shnum = mod_rd16(e + 60), shstrndx = mod_rd16(e + 62);
+    if (shentsize != 64 || shnum == 0 || shoff > len || (len - shoff) / 64 < shnum || shstrndx >= shnum) {
+        tr_set_last_error_fmt("tr_module_add_object: bad section header table");
+        return -1;
+    }
+#define MOD_SH(i) (e + shoff + (size_t)(i) * 64)
+    /* every section's file range, checked once */
+    for (uint16_t i = 1; i < shnum; ++i) {
+        uint64_t off = mod_rd64(MOD_SH(i) + 24), size = mod_rd64(MOD_SH(i) + 32);
+        if (mod_rd32(MOD_SH(i) + 4) != 8 /* NOBITS */ && (off > len || size > len - off)) {
+            tr_set_last_error_fmt("tr_module_add_object: section %u is outside the object", (unsigned)i);
+            return -1;
+        }
+    }
+    const char *shstr = (const char*)e + mod_rd64(MOD_SH(shstrndx) + 24);
+    uint64_t shstr_len = mod_rd64(MOD_SH(shstrndx) + 32);
+
+    int *map = (int*)malloc(shnum * sizeof(int));
+    if (!map) return mod_oom(b, "tr_module_add_object");
+    int rc = -1;
+    int symtab = -1;
+    for (uint16_t i = 0; i < shnum; ++i) {
+        const uint8_t *sh = MOD_SH(i);
+        uint32_t type = mod_rd32(sh + 4);
+        uint64_t flags = mod_rd64(sh + 8), size = mod_rd64(sh + 32);
+        uint32_t nm = mod_rd32(sh + 0);
+        const char *name = nm < shstr_len ? shstr + nm : "";
+        map[i] = -1;
+        if (type == 2 /* SYMTAB */) { symtab = i; continue; }
+        if (i == 0 || !(flags & 0x2 /* SHF_ALLOC */)) continue;
+        if (type == 0x70000001 /* X86_64_UNWIND */ || strncmp(name, ".eh_frame", 9) == 0) continue;
+        if (flags & 0x400 /* SHF_TLS */) { tr_set_last_error_fmt("tr_module_add_object: thread-local section %s is not supported", name); goto out; }
+        if (type >= 14 && type <= 16 /* INIT/FINI/PREINIT_ARRAY */) {
+            if (size) { tr_set_last_error_fmt("tr_module_add_object: constructors (%s) are not supported", name); goto out; }
+            continue;
+        }
+        if (type != 1 /* PROGBITS */ && type != 8 /* NOBITS */) continue;
+        int kind = (flags & 0x4) ? TR_MOD_SECTION_CODE : (flags & 0x1) ? TR_MOD_SECTION_DATA : TR_MOD_SECTION_RODATA;
+        if (size == 0 && kind != TR_MOD_SECTION_CODE) continue;
+        map[i] = tr_module_add_section(b, kind, name, type == 8 ? NULL : e + mod_rd64(sh + 24), (size_t)size);
+        if (map[i] < 0) goto out;
+    }
+    if (symtab < 0) { rc = 0; goto out; }
+
+    {
+        const uint8_t *st = MOD_SH(symtab);
+        uint32_t strndx = mod_rd32(st + 40);
+        uint64_t symoff = mod_rd64(st + 24), nsyms = mod_rd64(st + 32) / 24;
+        if (strndx >= shnum) { tr_set_last_error_fmt("tr_module_add_object: bad symbol string table"); goto out; }
+        const char *strs = (const char*)e + mod_rd64(MOD_SH(strndx) + 24);
+        uint64_t strs_len = mod_rd64(MOD_SH(strndx) + 32);
+#define MOD_SYM(i) (e + symoff + (size_t)(i) * 24)
+#define MOD_SYMNAME(p) (mod_rd32(p) < strs_len ? strs + mod_rd32(p) : "")
+        for (uint64_t i = 1; i < nsyms; ++i) {
+            const uint8_t *sy = MOD_SYM(i);
+            uint8_t bind = sy[4] >> 4, stype = sy[4] & 0xf;
+            uint16_t shndx = mod_rd16(sy + 6);
+            if ((bind != 1 && bind != 2) || shndx == 0 || stype == 3 || stype == 4) continue;
+            if (stype == 6 || shndx == 0xfff2 /* COMMON */ || shndx >= shnum || map[shndx] < 0) {
+                tr_set_last_error_fmt("tr_module_add_object: symbol %s is %s", MOD_SYMNAME(sy),
+                                      shndx == 0xfff2 ? "a common symbol (build with -fno-common)" : "not in a loadable section");
+                goto out;
+            }
+            if (tr_module_add_symbol(b, MOD_SYMNAME(sy), map[shndx], mod_rd64(sy + 8)) != 0) goto out;
+        }
+
+        for (uint16_t i = 1; i < shnum; ++i) {
+            const uint8_t *sh = MOD_SH(i);
+            if (mod_rd32(sh + 4) != 4 /* RELA */ || mod_rd32(sh + 40) != (uint32_t)symtab) continue;
+            uint32_t target = mod_rd32(sh + 44);
+            if (target >= shnum || map[target] < 0) continue;     /* relocations of a dropped section */
+            uint64_t roff = mod_rd64(sh + 24), nrel = mod_rd64(sh + 32) / 24;
+            for (uint64_t r = 0; r < nrel; ++r) {
+                const uint8_t *re = e + roff + (size_t)r * 24;
+                uint64_t place = mod_rd64(re), info = mod_rd64(re + 8);
+                int64_t addend = (int64_t)mod_rd64(re + 16);
+                uint32_t rtype = (uint32_t)info, rsym = (uint32_t)(info >> 32);
+                int type;
+                switch (rtype) {
+                case 0: continue;                               /* R_X86_64_NONE */
+                case 1: type = TR_MOD_RELOC_ABS64; break;       /* R_X86_64_64 */
+                case 2: case 4: type = TR_MOD_RELOC_REL32; break;    /* PC32, PLT32 */
+                case 9: case 41: case 42: type = TR_MOD_RELOC_GOTREL32; break;  /* GOTPCREL, GOTPCRELX, REX_GOTPCRELX */
+                case 10: case 11:
+                    tr_set_last_error_fmt("tr_module_add_object: absolute 32-bit relocation; build with -fPIC");
+                    goto out;
+                default:
+                    tr_set_last_error_fmt("tr_module_add_object: unsupported relocation type %u", rtype);
+                    goto out;
+                }
+                if (rsym >= nsyms) { tr_set_last_error_fmt("tr_module_add_object: bad relocation symbol"); goto out; }
+                const uint8_t *sy = MOD_SYM(rsym);
+                uint16_t shndx = mod_rd16(sy + 6);
+                int ok;
+                if (shndx == 0) {
+                    ok = tr_module_add_import_reloc(b, map[target], place, type, MOD_SYMNAME(sy), (sy[4] >> 4) == 2, addend);
+                } else if (shndx < shnum && map[shndx] >= 0) {
+                    ok = tr_module_add_reloc(b, map[target], place, type, map[shndx], mod_rd64(sy + 8), addend);
+                } else {
+                    tr_set_last_error_fmt("tr_module_add_object: relocation against %s, which is not loaded", MOD_SYMNAME(sy));
+                    goto out;
+                }
+                if (ok != 0) goto out;
+            }
+        }
+#undef MOD_SYMNAME
+#undef MOD_SYM
+    }
+    rc = 0;
+out:
+#undef MOD_SH
+    free(map);
+    return rc;
 }
 
-int tr_capsule_try_send(Capsule *c, void *msg)
+/* Add a NASM block exporting entry_symbol: prebuilt machine code when the in-process assembler
+   accepts it, else the source for tr_nasm_compile_and_load at first use. Returns the section index. */
+int tr_module_add_nasm(TrionModuleBuilder *b, const char *nasm_src, const char *entry_symbol)
 {
-    if (!c || !c->inbox) { tr_set_last_error_fmt("tr_capsule_try_send: invalid args"); return -1; }
-    return channel_send(c->inbox, msg, 0, 0);
+    if (!b || !nasm_src || !entry_symbol || !*entry_symbol) { tr_set_last_error_fmt("tr_module_add_nasm: invalid args"); return -1; }
+    int sec = -1;
+    uint64_t value = 0;
+    TrionJitModule *jm = NULL;
+    if (tr_jit_assemble(nasm_src, &jm, NULL) == 0) {
+        void *entry = tr_jit_module_symbol(jm, entry_symbol);
+        if (entry) {
+            sec = tr_module_add_section(b, TR_MOD_SECTION_CODE, entry_symbol, jm->mem, jm->code_len);
+            value = (uint64_t)((uint8_t*)entry - jm->mem);
+        }
+        tr_jit_module_unload(jm);
+        if (!entry) { tr_set_last_error_fmt("tr_module_add_nasm: block does not define %s", entry_symbol); return -1; }
+    } else {
+        /* outside the in-process subset (or not x86-64): keep the source */
+        sec = tr_module_add_section(b, TR_MOD_SECTION_NASM, entry_symbol, nasm_src, strlen(nasm_src) + 1);
+    }
+    if (sec < 0 || tr_module_add_symbol(b, entry_symbol, sec, value) != 0) return -1;
+    return sec;
 }
 
-/* ---------------------------
-   Timer helpers (simple single-shot)
-   --------------------------- */
+/* Add a capsule table entry; mode is TR_CAPSULE_MODE_THREAD (entry_symbol is the thread entry)
+   or TR_CAPSULE_MODE_TASK (entry_symbol is the step function). */
+int tr_module_add_capsule(TrionModuleBuilder *b, const char *name, const char *entry_symbol, int mode)
+{
+    if (!b || !name || !entry_symbol || (mode != TR_CAPSULE_MODE_THREAD && mode != TR_CAPSULE_MODE_TASK)) {
+        tr_set_last_error_fmt("tr_module_add_capsule: invalid args");
+        return -1;
+    }
+    if (b->ncapsules + 1 > b->cap_capsules) {
+        void *grown = jit_grow(b->capsules, &b->cap_capsules, b->ncapsules + 1, sizeof(ModBuildCapsule), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_capsule");
+        b->capsules = (ModBuildCapsule*)grown;
+    }
+    ModBuildCapsule *c = &b->capsules[b->ncapsules];
+    c->name = strdup(name);
+    c->symbol = strdup(entry_symbol);
+    c->mode = (uint32_t)mode;
+    if (!c->name || !c->symbol) { free(c->name); free(c->symbol); return mod_oom(b, "tr_module_add_capsule"); }
+    b->ncapsules++;
+    return 0;
+}
 
-typedef struct {
-    uint32_t ms;
-    void (*cb)(void*);
-    void *ctx;
-} TimerCtx;
+/* Add a syscall table entry (abi TR_MOD_SYSCALL_JSON or TR_MOD_SYSCALL_BIN); flags and
+   description are passed to the registry by tr_module_register_syscalls. */
+int tr_module_add_syscall(TrionModuleBuilder *b, const char *name, const char *handler_symbol, int abi, int flags, const char *description)
+{
+    if (!b || !name || !handler_symbol || (abi != TR_MOD_SYSCALL_JSON && abi != TR_MOD_SYSCALL_BIN)) {
+        tr_set_last_error_fmt("tr_module_add_syscall: invalid args");
+        return -1;
+    }
+    if (b->nsyscalls + 1 > b->cap_syscalls) {
+        void *grown = jit_grow(b->syscalls, &b->cap_syscalls, b->nsyscalls + 1, sizeof(ModBuildSyscall), &b->oom);
+        if (!grown) return mod_oom(b, "tr_module_add_syscall");
+        b->syscalls = (ModBuildSyscall*)grown;
+    }
+    ModBuildSyscall *s = &b->syscalls[b->nsyscalls];
+    s->name = strdup(name);
+    s->symbol = strdup(handler_symbol);
+    s->description = strdup(description ? description : "");
+    s->abi = (uint32_t)abi;
+    s->flags = flags;
+    if (!s->name || !s->symbol || !s->description) {
+        free(s->name); free(s->symbol); free(s->description);
+        return mod_oom(b, "tr_module_add_syscall");
+    }
+    b->nsyscalls++;
+    return 0;
+}
 
-static void *timer_thread_fn(void *arg)
+static int mod_symbol_cmp(const void *x, const void *y)
 {
-    TimerCtx *t = (TimerCtx*)arg;
-    if (!t) return NULL;
-#ifdef _WIN32
-    Sleep(t->ms);
-#else
-    struct timespec ts; ts.tv_sec = t->ms / 1000; ts.tv_nsec = (t->ms % 1000) * 1000000;
-    nanosleep(&ts, NULL);
-#endif
-    t->cb(t->ctx);
-    free(t);
+    return strcmp(((const ModBuildSymbol*)x)->name, ((const ModBuildSymbol*)y)->name);
+}
+
+static const ModBuildSymbol *mod_build_find(const TrionModuleBuilder *b, const char *name)
+{
+    size_t lo = 0, hi = b->nsymbols;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(b->symbols[mid].name, name);
+        if (c == 0) return &b->symbols[mid];
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
     return NULL;
 }
 
-int tr_timer_start(uint32_t ms, void (*cb)(void*), void *ctx)
+typedef struct { char *buf; size_t len, cap; int oom; } ModStrtab;
+
+static uint32_t mod_strtab_add(ModStrtab *t, const char *s)
 {
-    if (!cb) { tr_set_last_error_fmt("tr_timer_start: invalid callback"); return -1; }
-    TimerCtx *t = (TimerCtx*)malloc(sizeof(TimerCtx));
-    if (!t) { tr_set_last_error_fmt("tr_timer_start: OOM"); return -1; }
-    t->ms = ms; t->cb = cb; t->ctx = ctx;
-    tr_thread_t th;
-    if (tr_thread_create(&th, (tr_thread_fn_t)timer_thread_fn, t) != 0) { free(t); tr_set_last_error_fmt("tr_timer_start: thread create failed"); return -1; }
-#ifdef _WIN32
-    CloseHandle(th);
-#else
-    pthread_detach(th);
-#endif
-    return 0;
+    size_t n = strlen(s) + 1;
+    if (!*s) return 0;      /* offset 0 is always the empty string */
+    char *grown = (char*)jit_grow(t->buf, &t->cap, t->len + n, 1, &t->oom);
+    if (!grown) return 0;
+    t->buf = grown;
+    memcpy(t->buf + t->len, s, n);
+    t->len += n;
+    return (uint32_t)(t->len - n);
 }
 
-/* ---------------------------
-   Syscall registry (maximized)
-   - register syscall handler functions by name with metadata, permissions, and audit flags
-   - tr_invoke_syscall does validation and produces structured error messages
-   --------------------------- */
+static size_t mod_page_size(void)
+{
+    long pg = sysconf(_SC_PAGESIZE);
+    return pg > 4096 ? (size_t)pg : 4096;
+}
 
-typedef struct {
-    char *name;
-    tr_syscall_handler_t handler;
+/* Write the image to path (via a temporary file and rename, so a loader never maps a partial
+   image). Symbols are sorted and capsule/syscall entries bound to them here. Returns 0 or -1. */
+int tr_module_write(TrionModuleBuilder *b, const char *path)
+{
+    if (!b || !path) { tr_set_last_error_fmt("tr_module_write: invalid args"); return -1; }
+    if (b->oom) { tr_set_last_error_fmt("tr_module_write: builder ran out of memory"); return -1; }
+    qsort(b->symbols, b->nsymbols, sizeof(ModBuildSymbol), mod_symbol_cmp);
+    for (size_t i = 1; i < b->nsymbols; ++i) {
+        if (strcmp(b->symbols[i - 1].name, b->symbols[i].name) == 0) { tr_set_last_error_fmt("tr_module_write: duplicate symbol %s", b->symbols[i].name); return -1; }
+    }
+    if (b->nsections > 0xFFFFFFFFu || b->nsymbols > 0xFFFFFFFFu) { tr_set_last_error_fmt("tr_module_write: too many sections or symbols"); return -1; }
+
+    /* imports defined by the image itself are bound now; the rest get dense indices */
+    uint32_t *import_index = (uint32_t*)calloc(b->nimports + 1, sizeof(uint32_t));
+    const ModBuildSymbol **import_def = (const ModBuildSymbol**)calloc(b->nimports + 1, sizeof(*import_def));
+    ModStrtab st;
+    memset(&st, 0, sizeof(st));
+    st.buf = (char*)malloc(1);
+    st.cap = st.len = 1;
+    uint8_t *img = NULL;
+    int rc = -1;
+    if (!import_index || !import_def || !st.buf) { tr_set_last_error_fmt("tr_module_write: OOM"); goto out; }
+    st.buf[0] = '\0';
+
+    {
+        size_t nimports = 0, nrelocs = 0;
+        for (size_t i = 0; i < b->nimports; ++i) {
+            import_def[i] = mod_build_find(b, b->imports[i].name);
+            if (!import_def[i]) import_index[i] = (uint32_t)nimports++;
+        }
+        for (size_t i = 0; i < b->nsections; ++i) nrelocs += b->sections[i].nrelocs;
+
+        size_t page = mod_page_size();
+        TrModHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, TR_MOD_MAGIC, 8);
+        h.version = TR_MOD_VERSION;
+        h.page_size = (uint32_t)page;
+        h.nsections = (uint32_t)b->nsections;
+        h.nsymbols = (uint32_t)b->nsymbols;
+        h.ncapsules = (uint32_t)b->ncapsules;
+        h.nsyscalls = (uint32_t)b->nsyscalls;
+        h.nrelocs = (uint32_t)nrelocs;
+        h.nimports = (uint32_t)nimports;
+
+        /* the string table is built first so the tables can be sized */
+        uint32_t *sec_names = (uint32_t*)malloc((b->nsections + 1) * sizeof(uint32_t));
+        uint32_t *sym_names = (uint32_t*)malloc((b->nsymbols + 1) * sizeof(uint32_t));
+        uint32_t *imp_names = (uint32_t*)malloc((b->nimports + 1) * sizeof(uint32_t));
+        uint32_t *cap_names = (uint32_t*)malloc((b->ncapsules * 2 + 1) * sizeof(uint32_t));
+        uint32_t *sys_names = (uint32_t*)malloc((b->nsyscalls * 2 + 1) * sizeof(uint32_t));
+        if (!sec_names || !sym_names || !imp_names || !cap_names || !sys_names) {
+            free(sec_names); free(sym_names); free(imp_names); free(cap_names); free(sys_names);
+            tr_set_last_error_fmt("tr_module_write: OOM");
+            goto out;
+        }
+        for (size_t i = 0; i < b->nsections; ++i) sec_names[i] = mod_strtab_add(&st, b->sections[i].name);
+        for (size_t i = 0; i < b->nsymbols; ++i) sym_names[i] = mod_strtab_add(&st, b->symbols[i].name);
+        for (size_t i = 0; i < b->nimports; ++i) imp_names[i] = import_def[i] ? 0 : mod_strtab_add(&st, b->imports[i].name);
+        for (size_t i = 0; i < b->ncapsules; ++i) cap_names[i] = mod_strtab_add(&st, b->capsules[i].name);
+        for (size_t i = 0; i < b->nsyscalls; ++i) {
+            sys_names[2 * i] = mod_strtab_add(&st, b->syscalls[i].name);
+            sys_names[2 * i + 1] = mod_strtab_add(&st, b->syscalls[i].description);
+        }
+
+        size_t off = sizeof(TrModHeader);
+        h.sections_off = off; off += b->nsections * sizeof(TrModSection);
+        h.symbols_off = off;  off += b->nsymbols * sizeof(TrModSymbol);
+        h.capsules_off = off; off += b->ncapsules * sizeof(TrModCapsule);
+        h.syscalls_off = off; off += b->nsyscalls * sizeof(TrModSyscall);
+        h.relocs_off = off;   off += nrelocs * sizeof(TrModReloc);
+        h.imports_off = off;  off += nimports * sizeof(TrModImport);
+        h.strtab_off = off;   off += st.len;
+        h.strtab_len = st.len;
+        size_t *sec_off = (size_t*)malloc((b->nsections + 1) * sizeof(size_t));
+        if (!sec_off || st.oom) {
+            free(sec_off); free(sec_names); free(sym_names); free(imp_names); free(cap_names); free(sys_names);
+            tr_set_last_error_fmt("tr_module_write: OOM");
+            goto out;
+        }
+        for (size_t i = 0; i < b->nsections; ++i) {
+            off = (off + page - 1) & ~(page - 1);
+            sec_off[i] = off;
+            off += b->sections[i].len;
+        }
+        h.file_len = off;
+
+        img = (uint8_t*)calloc(1, off ? off : 1);
+        const char *err = img ? NULL : "OOM";
+        for (size_t i = 0; i < b->ncapsules && !err; ++i) if (!mod_build_find(b, b->capsules[i].symbol)) err = b->capsules[i].symbol;
+        for (size_t i = 0; i < b->nsyscalls && !err; ++i) if (!mod_build_find(b, b->syscalls[i].symbol)) err = b->syscalls[i].symbol;
+        if (!err) {
+            memcpy(img, &h, sizeof(h));
+            TrModSection *secs = (TrModSection*)(img + h.sections_off);
+            TrModReloc *rels = (TrModReloc*)(img + h.relocs_off);
+            size_t r = 0;
+            for (size_t i = 0; i < b->nsections; ++i) {
+                const ModBuildSection *s = &b->sections[i];
+                secs[i].kind = s->kind;
+                secs[i].name = sec_names[i];
+                secs[i].off = sec_off[i];
+                secs[i].size = s->len;
+                secs[i].first_reloc = (uint32_t)r;
+                secs[i].nrelocs = (uint32_t)s->nrelocs;
+                memcpy(img + sec_off[i], s->data, s->len);
+                for (size_t k = 0; k < s->nrelocs; ++k, ++r) {
+                    rels[r] = s->relocs[k];
+                    if (rels[r].type != TR_MOD_RELOC_IMPORT64) continue;
+                    const ModBuildSymbol *def = import_def[rels[r].target];
+                    if (def) {
+                        rels[r].type = TR_MOD_RELOC_ABS64;
+                        rels[r].addend += (int64_t)def->value;
+                        rels[r].target = def->section;
+                    } else {
+                        rels[r].target = import_index[rels[r].target];
+                    }
+                }
+            }
+            TrModSymbol *syms = (TrModSymbol*)(img + h.symbols_off);
+            for (size_t i = 0; i < b->nsymbols; ++i) {
+                syms[i].name = sym_names[i];
+                syms[i].section = b->symbols[i].section;
+                syms[i].value = b->symbols[i].value;
+            }
+            TrModCapsule *caps = (TrModCapsule*)(img + h.capsules_off);
+            for (size_t i = 0; i < b->ncapsules; ++i) {
+                caps[i].name = cap_names[i];
+                caps[i].symbol = (uint32_t)(mod_build_find(b, b->capsules[i].symbol) - b->symbols);
+                caps[i].mode = b->capsules[i].mode;
+            }
+            TrModSyscall *sys = (TrModSyscall*)(img + h.syscalls_off);
+            for (size_t i = 0; i < b->nsyscalls; ++i) {
+                sys[i].name = sys_names[2 * i];
+                sys[i].description = sys_names[2 * i + 1];
+                sys[i].symbol = (uint32_t)(mod_build_find(b, b->syscalls[i].symbol) - b->symbols);
+                sys[i].abi = b->syscalls[i].abi;
+                sys[i].flags = b->syscalls[i].flags;
+            }
+            TrModImport *imps = (TrModImport*)(img + h.imports_off);
+            for (size_t i = 0; i < b->nimports; ++i) {
+                if (import_def[i]) continue;
+                imps[import_index[i]].name = imp_names[i];
+                imps[import_index[i]].weak = b->imports[i].weak;
+            }
+            memcpy(img + h.strtab_off, st.buf, st.len);
+        }
+        free(sec_off); free(sec_names); free(sym_names); free(imp_names); free(cap_names); free(sys_names);
+        if (err) {
+            if (img) tr_set_last_error_fmt("tr_module_write: undefined symbol %s", err);
+            else tr_set_last_error_fmt("tr_module_write: OOM");
+            goto out;
+        }
+
+        char tmp[1200];
+        if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) { tr_set_last_error_fmt("tr_module_write: path too long"); goto out; }
+        int fd = mkstemp(tmp);
+        if (fd < 0) { tr_set_last_error_fmt("tr_module_write: cannot create %s: %s", tmp, strerror(errno)); goto out; }
+        size_t done = 0;
+        while (done < h.file_len) {
+            ssize_t w = write(fd, img + done, (size_t)h.file_len - done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) break;
+            done += (size_t)w;
+        }
+        if (close(fd) != 0 || done != h.file_len || rename(tmp, path) != 0) {
+            tr_set_last_error_fmt("tr_module_write: writing %s failed: %s", path, strerror(errno));
+            unlink(tmp);
+            goto out;
+        }
+        tr_audit_log("module_write: %s sections=%u symbols=%u imports=%u bytes=%llu", path, h.nsections, h.nsymbols, h.nimports, (unsigned long long)h.file_len);
+        rc = 0;
+    }
+out:
+    free(img);
+    free(st.buf);
+    free(import_index);
+    free((void*)import_def);
+    return rc;
+}
+
+/* ---- loader ---- */
+
+/* handler thunk for one registered syscall: the handler symbol is resolved on first invocation */
+typedef struct ModSyscallThunk {
+    struct TrionModule *m;
+    uint32_t entry;         /* index into the syscall table */
     void *ctx;
-    int flags;              /* bitfield for permissions, e.g. 1=audit, 2=trusted-only */
-    char *auth_token;       /* optional token required to invoke */
-    char *description;      /* human-friendly description */
-} SyscallEntry;
+} ModSyscallThunk;
 
-typedef struct {
-    SyscallEntry *entries;
-    size_t count;
-    size_t capacity;
-    tr_mutex_t lock;
-} SyscallRegistry;
+struct TrionModule {
+    uint8_t *base;
+    size_t len;
+    const TrModHeader *h;
+    const TrModSection *sections;
+    const TrModSymbol *symbols;
+    const TrModCapsule *capsules;
+    const TrModSyscall *syscalls;
+    const TrModReloc *relocs;
+    const TrModImport *imports;
+    const char *strtab;
+    uint32_t *ready;        /* per section: 0 = untouched, 1 = part of the closure being readied, 2 = ready */
+    uint32_t *work;         /* per section worklist for module_ready (under lock) */
+    void **nasm;            /* per symbol: built NASM entry (NASM sections only) */
+    void *self;             /* dlopen(NULL) handle for imports */
+    ModSyscallThunk *thunks;
+    size_t nregistered;     /* syscall table entries [0, nregistered) are registered */
+    tr_mutex_t lock;        /* readying sections, building NASM blocks, loading imports */
+};
+typedef struct TrionModule TrionModule;
 
-static SyscallRegistry *g_syscall_registry = NULL;
+static const char *mod_str(const TrionModule *m, uint32_t off) { return m->strtab + off; }
 
-static SyscallRegistry *syscall_registry_create(void)
+/* true when [off, off + n * elem) lies in a file of len bytes */
+static int mod_table_ok(uint64_t off, uint64_t n, size_t elem, size_t len)
 {
-    SyscallRegistry *r = (SyscallRegistry*)malloc(sizeof(SyscallRegistry));
-    if (!r) return NULL;
-    r->entries = (SyscallEntry*)malloc(sizeof(SyscallEntry) * 8);
-    if (!r->entries) { free(r); return NULL; }
-    r->count = 0; r->capacity = 8;
-    tr_mutex_init(&r->lock);
-    return r;
+    return off <= len && (off & 7) == 0 && n <= (len - off) / elem;
+}
+
+static int mod_validate(const TrionModule *m, size_t page, const char **why)
+{
+    const TrModHeader *h = m->h;
+    size_t len = m->len;
+    if (h->version != TR_MOD_VERSION) { *why = "unsupported version"; return -1; }
+    if (h->page_size < page || (h->page_size & (h->page_size - 1)) || h->page_size % page) { *why = "section alignment is smaller than this host's page size"; return -1; }
+    if (h->file_len != len) { *why = "truncated image"; return -1; }
+    if (!mod_table_ok(h->sections_off, h->nsections, sizeof(TrModSection), len) || !mod_table_ok(h->symbols_off, h->nsymbols, sizeof(TrModSymbol), len)
+        || !mod_table_ok(h->capsules_off, h->ncapsules, sizeof(TrModCapsule), len) || !mod_table_ok(h->syscalls_off, h->nsyscalls, sizeof(TrModSyscall), len)
+        || !mod_table_ok(h->relocs_off, h->nrelocs, sizeof(TrModReloc), len) || !mod_table_ok(h->imports_off, h->nimports, sizeof(TrModImport), len)
+        || h->strtab_off > len || h->strtab_len == 0 || h->strtab_len > len - h->strtab_off || h->strtab_len > 0xFFFFFFFFu) {
+        *why = "table outside the image"; return -1;
+    }
+    if (m->strtab[0] != '\0' || m->strtab[h->strtab_len - 1] != '\0') { *why = "bad string table"; return -1; }
+#define MOD_NAME_OK(off) ((off) < h->strtab_len)
+    /* sections start on the first page past every table, so patching one can never touch the
+       metadata that is still being read; the writer puts the string table last */
+    uint64_t prev_end = sizeof(TrModHeader);
+    const uint64_t table_end[] = {
+        h->sections_off + (uint64_t)h->nsections * sizeof(TrModSection), h->symbols_off + (uint64_t)h->nsymbols * sizeof(TrModSymbol),
+        h->capsules_off + (uint64_t)h->ncapsules * sizeof(TrModCapsule), h->syscalls_off + (uint64_t)h->nsyscalls * sizeof(TrModSyscall),
+        h->relocs_off + (uint64_t)h->nrelocs * sizeof(TrModReloc), h->imports_off + (uint64_t)h->nimports * sizeof(TrModImport),
+        h->strtab_off + h->strtab_len,
+    };
+    for (size_t i = 0; i < sizeof(table_end) / sizeof(table_end[0]); ++i) if (table_end[i] > prev_end) prev_end = table_end[i];
+    prev_end = (prev_end + h->page_size - 1) & ~((uint64_t)h->page_size - 1);
+    for (uint32_t i = 0; i < h->nsections; ++i) {
+        const TrModSection *s = &m->sections[i];
+        if (s->kind < TR_MOD_SECTION_CODE || s->kind > TR_MOD_SECTION_NASM || !MOD_NAME_OK(s->name)) { *why = "bad section"; return -1; }
+        /* page aligned and on pages of their own, so each section gets its own protection */
+        if (s->off % h->page_size || s->off < prev_end || s->off > len || s->size > len - s->off) { *why = "section outside the image"; return -1; }
+        if (s->first_reloc > h->nrelocs || s->nrelocs > h->nrelocs - s->first_reloc) { *why = "bad relocation slice"; return -1; }
+        if (s->kind == TR_MOD_SECTION_NASM && (s->nrelocs || s->size == 0 || m->base[s->off + s->size - 1] != '\0')) { *why = "bad NASM section"; return -1; }
+        prev_end = (s->off + s->size + h->page_size - 1) & ~((uint64_t)h->page_size - 1);
+    }
+    for (uint32_t i = 0; i < h->nsymbols; ++i) {
+        const TrModSymbol *s = &m->symbols[i];
+        if (!MOD_NAME_OK(s->name) || s->section >= h->nsections || s->value > m->sections[s->section].size) { *why = "bad symbol"; return -1; }
+        if (i && strcmp(mod_str(m, m->symbols[i - 1].name), mod_str(m, s->name)) >= 0) { *why = "symbol table not sorted"; return -1; }
+    }
+    for (uint32_t i = 0; i < h->ncapsules; ++i) {
+        const TrModCapsule *c = &m->capsules[i];
+        if (!MOD_NAME_OK(c->name) || c->symbol >= h->nsymbols || (c->mode != TR_CAPSULE_MODE_THREAD && c->mode != TR_CAPSULE_MODE_TASK)) { *why = "bad capsule entry"; return -1; }
+    }
+    for (uint32_t i = 0; i < h->nsyscalls; ++i) {
+        const TrModSyscall *s = &m->syscalls[i];
+        if (!MOD_NAME_OK(s->name) || !MOD_NAME_OK(s->description) || s->symbol >= h->nsymbols || s->abi > TR_MOD_SYSCALL_BIN) { *why = "bad syscall entry"; return -1; }
+    }
+    for (uint32_t i = 0; i < h->nimports; ++i) if (!MOD_NAME_OK(m->imports[i].name)) { *why = "bad import"; return -1; }
+#undef MOD_NAME_OK
+    /* relocations are checked when applied, so opening stays proportional to the tables above */
+    return 0;
+}
+
+/* Map a module image. Only the tables are validated; no code is touched until first use. */
+TrionModule *tr_module_open(const char *path)
+{
+    if (!path) { tr_set_last_error_fmt("tr_module_open: invalid args"); return NULL; }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { tr_set_last_error_fmt("tr_module_open: cannot open %s: %s", path, strerror(errno)); return NULL; }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || sb.st_size < (off_t)sizeof(TrModHeader)) {
+        close(fd);
+        tr_set_last_error_fmt("tr_module_open: %s is not a module image", path);
+        return NULL;
+    }
+    size_t len = (size_t)sb.st_size;
+    void *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { tr_set_last_error_fmt("tr_module_open: mmap %s failed: %s", path, strerror(errno)); return NULL; }
+    TrionModule *m = (TrionModule*)calloc(1, sizeof(TrionModule));
+    if (!m) { munmap(base, len); tr_set_last_error_fmt("tr_module_open: OOM"); return NULL; }
+    m->base = (uint8_t*)base;
+    m->len = len;
+    m->h = (const TrModHeader*)base;
+    const char *why = NULL;
+    if (memcmp(m->h->magic, TR_MOD_MAGIC, 8) != 0) {
+        why = "bad magic";
+    } else {
+        m->sections = (const TrModSection*)(m->base + m->h->sections_off);
+        m->symbols = (const TrModSymbol*)(m->base + m->h->symbols_off);
+        m->capsules = (const TrModCapsule*)(m->base + m->h->capsules_off);
+        m->syscalls = (const TrModSyscall*)(m->base + m->h->syscalls_off);
+        m->relocs = (const TrModReloc*)(m->base + m->h->relocs_off);
+        m->imports = (const TrModImport*)(m->base + m->h->imports_off);
+        m->strtab = (const char*)m->base + (m->h->strtab_off <= len ? m->h->strtab_off : 0);
+        mod_validate(m, (size_t)sysconf(_SC_PAGESIZE), &why);
+    }
+    if (!why) {
+        m->ready = (uint32_t*)calloc(m->h->nsections + 1, sizeof(uint32_t));
+        m->work = (uint32_t*)calloc(m->h->nsections + 1, sizeof(uint32_t));
+        m->nasm = (void**)calloc(m->h->nsymbols + 1, sizeof(void*));
+        if (!m->ready || !m->work || !m->nasm) why = "OOM";
+    }
+    if (why) {
+        free(m->ready); free(m->work); free(m->nasm);
+        munmap(base, len);
+        free(m);
+        tr_set_last_error_fmt("tr_module_open: %s: %s", path, why);
+        return NULL;
+    }
+    tr_mutex_init(&m->lock);
+    tr_metric_add(TR_M_MODULE_OPENS, 1);
+    return m;
 }
 
-int tr_register_syscall_ex(const char *name, tr_syscall_handler_t handler, void *ctx, int flags, const char *auth_token, const char *description)
+static int mod_import_address(TrionModule *m, uint32_t idx, uint64_t *out)
 {
-    if (!name || !handler) { tr_set_last_error_fmt("tr_register_syscall_ex: invalid args"); return -1; }
-    if (!g_syscall_registry) g_syscall_registry = syscall_registry_create();
-    SyscallRegistry *r = g_syscall_registry;
-    tr_mutex_lock(&r->lock);
-    if (r->count == r->capacity) {
-        size_t nc = r->capacity * 2;
-        SyscallEntry *ne = (SyscallEntry*)realloc(r->entries, sizeof(SyscallEntry) * nc);
-        if (!ne) { tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("tr_register_syscall_ex: realloc failed"); return -1; }
-        r->entries = ne; r->capacity = nc;
-    }
-    size_t nl = strlen(name) + 1;
-    char *ncopy = (char*)malloc(nl);
-    if (!ncopy) { tr_mutex_unlock(&r->lock); tr_set_last_error_fmt("tr_register_syscall_ex: OOM name copy"); return -1; }
-    memcpy(ncopy, name, nl);
-    r->entries[r->count].name = ncopy;
-    r->entries[r->count].handler = handler;
-    r->entries[r->count].ctx = ctx;
-    r->entries[r->count].flags = flags;
-    r->entries[r->count].auth_token = auth_token ? strdup(auth_token) : NULL;
-    r->entries[r->count].description = description ? strdup(description) : NULL;
-    r->count++;
-    tr_mutex_unlock(&r->lock);
-    tr_audit_log("syscall_registered: %s flags=%d desc=%s", name, flags, description ? description : "");
+    const TrModImport *im = &m->imports[idx];
+    if (!m->self) m->self = dlopen(NULL, RTLD_NOW);
+    void *p = m->self ? dlsym(m->self, mod_str(m, im->name)) : NULL;
+    if (!p && !im->weak) { tr_set_last_error_fmt("tr_module_symbol: unresolved import %s", mod_str(m, im->name)); return -1; }
+    *out = (uint64_t)(uintptr_t)p;
     return 0;
 }
 
-int tr_unregister_syscall(const char *name)
+/* patch one section's relocations (its pages are writable here) */
+static int mod_relocate(TrionModule *m, uint32_t sec)
 {
-    if (!name) { tr_set_last_error_fmt("tr_unregister_syscall: invalid name"); return -1; }
-    if (!g_syscall_registry) { tr_set_last_error_fmt("tr_unregister_syscall: no registry"); return -1; }
-    SyscallRegistry *r = g_syscall_registry;
-    tr_mutex_lock(&r->lock);
-    for (size_t i = 0; i < r->count; ++i) {
-        if (strcmp(r->entries[i].name, name) == 0) {
-            free(r->entries[i].name);
-            if (r->entries[i].auth_token) free(r->entries[i].auth_token);
-            if (r->entries[i].description) free(r->entries[i].description);
-            r->entries[i] = r->entries[r->count - 1];
-            r->count--;
-            tr_mutex_unlock(&r->lock);
-            tr_audit_log("syscall_unregistered: %s", name);
-            return 0;
+    const TrModSection *s = &m->sections[sec];
+    uint8_t *start = m->base + s->off;
+    for (uint32_t k = 0; k < s->nrelocs; ++k) {
+        const TrModReloc *r = &m->relocs[s->first_reloc + k];
+        size_t width = r->type == TR_MOD_RELOC_REL32 ? 4 : 8;
+        if (r->offset > s->size || s->size - r->offset < width) { tr_set_last_error_fmt("tr_module_symbol: relocation outside section %u", sec); return -1; }
+        uint64_t target;
+        if (r->type == TR_MOD_RELOC_IMPORT64) {
+            if (r->target >= m->h->nimports) { tr_set_last_error_fmt("tr_module_symbol: bad import index"); return -1; }
+            if (mod_import_address(m, r->target, &target) != 0) return -1;
+        } else if (r->type == TR_MOD_RELOC_ABS64 || r->type == TR_MOD_RELOC_REL32) {
+            if (r->target >= m->h->nsections || m->sections[r->target].kind == TR_MOD_SECTION_NASM) { tr_set_last_error_fmt("tr_module_symbol: bad relocation target"); return -1; }
+            target = (uint64_t)(uintptr_t)(m->base + m->sections[r->target].off);
+        } else {
+            tr_set_last_error_fmt("tr_module_symbol: bad relocation type %u", r->type);
+            return -1;
+        }
+        uint8_t *place = start + r->offset;
+        uint64_t v = target + (uint64_t)r->addend;
+        if (r->type == TR_MOD_RELOC_REL32) {
+            int64_t rel = (int64_t)(v - (uint64_t)(uintptr_t)place);
+            if (rel < INT32_MIN || rel > INT32_MAX) { tr_set_last_error_fmt("tr_module_symbol: relocation out of range"); return -1; }
+            int32_t v32 = (int32_t)rel;
+            memcpy(place, &v32, 4);
+        } else {
+            memcpy(place, &v, 8);
         }
     }
-    tr_mutex_unlock(&r->lock);
-    tr_set_last_error_fmt("tr_unregister_syscall: not found");
+    return 0;
+}
+
+static int mod_protect(TrionModule *m, uint32_t sec, int prot)
+{
+    const TrModSection *s = &m->sections[sec];
+    size_t span = (size_t)((s->size + m->h->page_size - 1) & ~((uint64_t)m->h->page_size - 1));
+    if (span == 0 || mprotect(m->base + s->off, span, prot) == 0) return 0;
+    tr_set_last_error_fmt("tr_module_symbol: mprotect failed: %s", strerror(errno));
     return -1;
 }
 
-/* invoke syscall by name; returns handler return code, out_json is allocated by handler and must be freed by caller
-   For extended validation, caller may pass auth_token (NULL if none).
-*/
-int tr_invoke_syscall_ex(const char *name, const char *args_json, const char *auth_token, char **out_json)
+/* Make section sec usable together with every section its relocations reach (code may jump or
+   load into any of them); the whole closure is published at once so another thread never runs
+   code whose targets are not ready yet. */
+static int mod_ready(TrionModule *m, uint32_t sec)
 {
-    if (!name) { tr_set_last_error_fmt("tr_invoke_syscall_ex: invalid name"); return -1; }
-    if (!g_syscall_registry) { tr_set_last_error_fmt("tr_invoke_syscall_ex: no registry"); return -2; }
-    SyscallRegistry *r = g_syscall_registry;
-    tr_mutex_lock(&r->lock);
-    for (size_t i = 0; i < r->count; ++i) {
-        if (strcmp(r->entries[i].name, name) == 0) {
-            SyscallEntry *e = &r->entries[i];
-            if (e->auth_token) {
-                if (!auth_token || strcmp(auth_token, e->auth_token) != 0) {
-                    tr_mutex_unlock(&r->lock);
-                    tr_set_last_error_fmt("tr_invoke_syscall_ex: auth failed for %s", name);
-                    tr_audit_log("syscall_invoke_failed_auth: %s", name);
-                    return -4;
-                }
-            }
-            int audit = (e->flags & 1) != 0;
-            tr_syscall_handler_t h = e->handler;
-            void *ctx = e->ctx;
-            tr_mutex_unlock(&r->lock);
-            if (audit) tr_audit_log("syscall_invoke: %s args=%s", name, args_json ? args_json : "null");
-            int rc = h(args_json, out_json, ctx);
-            if (audit) tr_audit_log("syscall_invoke_result: %s rc=%d out=%s", name, rc, out_json ? (*out_json ? *out_json : "null") : "null");
-            if (rc != 0 && !tr_get_last_error()[0]) tr_set_last_error_fmt("syscall handler %s returned %d", name, rc);
-            return rc;
+    if (tr_atomic_load_acquire(&m->ready[sec]) == 2) return 0;
+    tr_mutex_lock(&m->lock);
+    if (m->ready[sec] == 2) { tr_mutex_unlock(&m->lock); return 0; }
+    size_t n = 0;
+    m->work[n++] = sec;
+    m->ready[sec] = 1;
+    for (size_t i = 0; i < n; ++i) {
+        const TrModSection *s = &m->sections[m->work[i]];
+        for (uint32_t k = 0; k < s->nrelocs; ++k) {
+            const TrModReloc *r = &m->relocs[s->first_reloc + k];
+            if (r->type == TR_MOD_RELOC_IMPORT64 || r->target >= m->h->nsections || m->ready[r->target]) continue;
+            m->ready[r->target] = 1;
+            m->work[n++] = r->target;
         }
     }
-    tr_mutex_unlock(&r->lock);
-    tr_set_last_error_fmt("tr_invoke_syscall_ex: not found");
-    return -3;
+    int rc = 0;
+    uint64_t t0 = tr_metric_clock();
+    for (size_t i = 0; i < n && rc == 0; ++i) {
+        uint32_t s = m->work[i];
+        uint32_t kind = m->sections[s].kind;
+        int prot = kind == TR_MOD_SECTION_CODE ? PROT_READ | PROT_EXEC : kind == TR_MOD_SECTION_DATA ? PROT_READ | PROT_WRITE : PROT_READ;
+        if (m->sections[s].nrelocs) {
+            rc = mod_protect(m, s, PROT_READ | PROT_WRITE);
+            if (rc == 0) rc = mod_relocate(m, s);
+            if (rc == 0 && prot != (PROT_READ | PROT_WRITE)) rc = mod_protect(m, s, prot);
+        } else if (prot != PROT_READ) {
+            rc = mod_protect(m, s, prot);
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (rc == 0) tr_atomic_store_release(&m->ready[m->work[i]], 2);
+        else m->ready[m->work[i]] = 0;     /* relocation is idempotent: a later call starts over */
+    }
+    tr_mutex_unlock(&m->lock);
+    if (rc == 0) {
+        tr_metric_add(TR_M_MODULE_SECTIONS_READY, (int64_t)n);
+        if (t0) tr_hist_record(TR_H_MODULE_READY, tr_metric_elapsed(t0));
+    }
+    return rc;
 }
 
-/* Backwards compatibility wrappers */
-int tr_register_syscall(const char *name, tr_syscall_handler_t handler, void *ctx)
+static void *mod_address(TrionModule *m, uint32_t symidx)
 {
-    return tr_register_syscall_ex(name, handler, ctx, 0, NULL, NULL);
+    const TrModSymbol *sym = &m->symbols[symidx];
+    const TrModSection *s = &m->sections[sym->section];
+    if (s->kind != TR_MOD_SECTION_NASM) {
+        if (mod_ready(m, sym->section) != 0) return NULL;
+        return m->base + s->off + sym->value;
+    }
+    void *fn = tr_atomic_load_acquire(&m->nasm[symidx]);
+    if (fn) return fn;
+    tr_mutex_lock(&m->lock);
+    if (!m->nasm[symidx]) {
+        char *err = NULL;
+        if (tr_nasm_compile_and_load((const char*)m->base + s->off, mod_str(m, sym->name), &fn, &err) == 0) {
+            tr_atomic_store_release(&m->nasm[symidx], fn);
+        } else {
+            tr_set_last_error_fmt("tr_module_symbol: NASM block %s failed: %s", mod_str(m, sym->name), err ? err : "?");
+        }
+        free(err);
+    }
+    fn = m->nasm[symidx];
+    tr_mutex_unlock(&m->lock);
+    return fn;
 }
-int tr_invoke_syscall(const char *name, const char *args_json, char **out_json)
+
+static int mod_find(const TrionModule *m, const char *name, uint32_t *out)
 {
-    return tr_invoke_syscall_ex(name, args_json, NULL, out_json);
+    uint32_t lo = 0, hi = m->h->nsymbols;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(mod_str(m, m->symbols[mid].name), name);
+        if (c == 0) { *out = mid; return 0; }
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
+    return -1;
 }
 
-/* ---------------------------
-   Process sandbox runner (maximized)
-   - If running on Linux: attempt unshare(CLONE_NEWPID|CLONE_NEWNS|CLONE_NEWNET) and seccomp when available.
-   - Always set rlimits, optionally chroot (requires root), optionally drop uid/gid.
-   - Returns detailed error codes and sets tr_last_error with diagnostic.
-   --------------------------- */
+/* Address of an exported symbol; readies its section (and what that references) on first use. */
+void *tr_module_symbol(TrionModule *m, const char *name)
+{
+    if (!m || !name) { tr_set_last_error_fmt("tr_module_symbol: invalid args"); return NULL; }
+    uint32_t idx;
+    if (mod_find(m, name, &idx) != 0) { tr_set_last_error_fmt("tr_module_symbol: no symbol %s", name); return NULL; }
+    return mod_address(m, idx);
+}
 
-#ifndef _WIN32
+size_t tr_module_capsule_count(const TrionModule *m) { return m ? m->h->ncapsules : 0; }
 
-#include <sys/stat.h>
-#include <sys/mman.h>
-#ifdef __linux__
-#include <sched.h>
-#ifdef __has_include
-#if __has_include(<linux/seccomp.h>) && __has_include(<seccomp.h>)
-#define HAVE_LIBSECCOMP 1
-#include <seccomp.h>
-#endif
-#endif
-#endif
+const char *tr_module_capsule_name(const TrionModule *m, size_t i)
+{
+    return m && i < m->h->ncapsules ? mod_str(m, m->capsules[i].name) : NULL;
+}
 
-/* Try applying optional strong isolation: namespaces + seccomp if available
-   This function is best-effort and logs warnings in tr_last_error when a step cannot be applied.
-*/
-static void tr_try_harden_child(uid_t run_uid, gid_t run_gid)
+/* Create the capsule `name` from the capsule table (not started, as with tr_capsule_create). */
+Capsule *tr_module_capsule_create(TrionModule *m, const char *name, void *user_ctx)
 {
-#ifdef __linux__
-    // Unshare PID, mount, and network namespaces if available
-    int flags = 0;
-#ifdef CLONE_NEWPID
-    flags |= CLONE_NEWPID;
-#endif
-#ifdef CLONE_NEWNS
-    flags |= CLONE_NEWNS;
-#endif
-#ifdef CLONE_NEWNET
-    flags |= CLONE_NEWNET;
-#endif
-    if (flags) {
-        if (unshare(flags) != 0) {
-            tr_audit_log("sandbox: unshare failed: %s", strerror(errno));
-        } else {
-            tr_audit_log("sandbox: unshare succeeded flags=%d", flags);
-        }
-    }
-    // attempt to set no_new_privs (pre-req for seccomp)
-    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
-        tr_audit_log("sandbox: PR_SET_NO_NEW_PRIVS failed: %s", strerror(errno));
+    if (!m || !name) { tr_set_last_error_fmt("tr_module_capsule_create: invalid args"); return NULL; }
+    for (uint32_t i = 0; i < m->h->ncapsules; ++i) {
+        const TrModCapsule *c = &m->capsules[i];
+        if (strcmp(mod_str(m, c->name), name) != 0) continue;
+        void *fn = mod_address(m, c->symbol);
+        if (!fn) return NULL;
+        int (*entry)(Capsule*, void*) = (int (*)(Capsule*, void*))fn;
+        return c->mode == TR_CAPSULE_MODE_TASK ? tr_capsule_create_task(name, entry, user_ctx) : tr_capsule_create(name, entry, user_ctx);
     }
+    tr_set_last_error_fmt("tr_module_capsule_create: no capsule %s", name);
+    return NULL;
+}
 
-#ifdef HAVE_LIBSECCOMP
-    // minimal seccomp filter: allow read, write, exit, sigreturn, rt_sigreturn; block execve by default
-    scmp_filter_ctx ctx = seccomp_init(SCMP_ACT_KILL); // deny by kill
-    if (!ctx) {
-        tr_audit_log("sandbox: seccomp_init failed");
-    } else {
-        // allow some syscalls commonly required for normal process operation; this is conservative skeleton
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(read), 0);
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(write), 0);
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit), 0);
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(exit_group), 0);
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(sigreturn), 0);
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(rt_sigreturn), 0);
-        // allow futex for threads
-        seccomp_rule_add(ctx, SCMP_ACT_ALLOW, SCMP_SYS(futex), 0);
-        // load filter
-        if (seccomp_load(ctx) != 0) {
-            tr_audit_log("sandbox: seccomp_load failed");
-        } else {
-            tr_audit_log("sandbox: seccomp loaded");
-        }
-        seccomp_release(ctx);
-    }
-#endif // HAVE_LIBSECCOMP
+static int mod_syscall_json(const char *args_json, char **out_json, void *ctx)
+{
+    ModSyscallThunk *t = (ModSyscallThunk*)ctx;
+    void *fn = mod_address(t->m, t->m->syscalls[t->entry].symbol);
+    if (!fn) return -1;
+    return ((int (*)(const char*, char**, void*))fn)(args_json, out_json, t->ctx);
+}
 
-    // optionally drop credentials if requested; caller should have set them
-    if (run_gid != (gid_t)-1) setgid(run_gid);
-    if (run_uid != (uid_t)-1) setuid(run_uid);
-#endif // __linux__
+static int mod_syscall_bin(const void *args, size_t args_len, void *out, size_t *out_len, void *ctx)
+{
+    ModSyscallThunk *t = (ModSyscallThunk*)ctx;
+    void *fn = mod_address(t->m, t->m->syscalls[t->entry].symbol);
+    if (!fn) return -1;
+    return ((tr_syscall_bin_handler_t)fn)(args, args_len, out, out_len, t->ctx);
 }
 
-int tr_sandbox_run(const char *path, char *const argv[], char *const envp[],
-                   const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
-                   uid_t run_uid, gid_t run_gid, int *out_exitcode)
+/* Register every syscall in the table; handlers receive ctx. Nothing is resolved until a syscall
+   is invoked. Returns the number registered, or -1 (with nothing left registered). */
+int tr_module_register_syscalls(TrionModule *m, void *ctx)
 {
-    if (!path) { tr_set_last_error_fmt("tr_sandbox_run: path is NULL"); return -1; }
-    pid_t pid = fork();
-    if (pid < 0) { tr_set_last_error_fmt("tr_sandbox_run: fork failed: %s", strerror(errno)); return -1; }
-    if (pid == 0) {
-        /* child */
-        // make session to isolate signals
-        setsid();
-        if (working_dir) chdir(working_dir);
-        // set resource limits
-        if (memory_limit_bytes > 0) {
-            struct rlimit rl;
-            rl.rlim_cur = rl.rlim_max = memory_limit_bytes;
-            setrlimit(RLIMIT_AS, &rl);
-        }
-        if (time_ms > 0) {
-            struct rlimit rl;
-            rl.rlim_cur = rl.rlim_max = (time_ms + 999) / 1000;
-            setrlimit(RLIMIT_CPU, &rl);
-        }
-        // try to further harden child process (namespaces, seccomp) - best-effort
-        tr_try_harden_child(run_uid, run_gid);
-        // exec
-        execve(path, argv, envp);
-        // if exec fails
-        _exit(127);
-    } else {
-        /* parent: wait with timeout */
-        int status = 0;
-        uint64_t waited = 0;
-        const uint32_t sleep_ms = 50;
-        while (1) {
-            pid_t w = waitpid(pid, &status, WNOHANG);
-            if (w == pid) break;
-            if (w == -1) { tr_set_last_error_fmt("tr_sandbox_run: waitpid error: %s", strerror(errno)); break; }
-            if (time_ms > 0 && waited >= time_ms) {
-                kill(pid, SIGKILL);
-                waitpid(pid, &status, 0);
-                if (out_exitcode) *out_exitcode = -1;
-                tr_set_last_error_fmt("tr_sandbox_run: timeout, killed child");
-                tr_audit_log("sandbox_run: timeout pid=%d path=%s", pid, path);
-                return -2; /* timeout */
-            }
-            usleep(sleep_ms * 1000);
-            waited += sleep_ms;
-        }
-        if (WIFEXITED(status)) {
-            if (out_exitcode) *out_exitcode = WEXITSTATUS(status);
-            return 0;
-        } else if (WIFSIGNALED(status)) {
-            if (out_exitcode) *out_exitcode = -WTERMSIG(status);
-            return -3;
+    if (!m) { tr_set_last_error_fmt("tr_module_register_syscalls: invalid args"); return -1; }
+    if (m->thunks) { tr_set_last_error_fmt("tr_module_register_syscalls: already registered"); return -1; }
+    uint32_t n = m->h->nsyscalls;
+    m->thunks = (ModSyscallThunk*)calloc(n + 1, sizeof(ModSyscallThunk));
+    if (!m->thunks) { tr_set_last_error_fmt("tr_module_register_syscalls: OOM"); return -1; }
+    for (uint32_t i = 0; i < n; ++i) {
+        const TrModSyscall *s = &m->syscalls[i];
+        ModSyscallThunk *t = &m->thunks[i];
+        t->m = m;
+        t->entry = i;
+        t->ctx = ctx;
+        int rc = s->abi == TR_MOD_SYSCALL_BIN
+            ? tr_register_syscall_bin_ex(mod_str(m, s->name), mod_syscall_bin, NULL, t, s->flags, NULL, mod_str(m, s->description))
+            : tr_register_syscall_ex(mod_str(m, s->name), mod_syscall_json, t, s->flags, NULL, mod_str(m, s->description));
+        if (rc != 0) {
+            while (m->nregistered) tr_unregister_syscall(mod_str(m, m->syscalls[--m->nregistered].name));
+            free(m->thunks);
+            m->thunks = NULL;
+            return -1;
         }
-        return 0;
+        m->nregistered = i + 1;
     }
+    return (int)n;
 }
 
-#else // _WIN32
-
-int tr_sandbox_run(const char *path, char *const argv[], char *const envp[],
-                   const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
-                   unsigned int run_uid, unsigned int run_gid, int *out_exitcode)
+/* Register the module's syscalls (when that has not been done) and call its `main`. */
+int tr_module_run(TrionModule *m, int argc, char **argv)
 {
-    (void)argv; (void)envp; (void)run_uid; (void)run_gid; (void)memory_limit_bytes;
-    if (!path) { tr_set_last_error_fmt("tr_sandbox_run: path is NULL"); return -1; }
-    STARTUPINFOA si; PROCESS_INFORMATION pi;
-    ZeroMemory(&si, sizeof(si)); si.cb = sizeof(si);
-    ZeroMemory(&pi, sizeof(pi));
-    char cmdline[MAX_PATH];
-    strncpy(cmdline, path, MAX_PATH-1);
-    if (!CreateProcessA(NULL, cmdline, NULL, NULL, FALSE, CREATE_SUSPENDED, NULL, working_dir, &si, &pi)) {
-        tr_set_last_error_fmt("tr_sandbox_run: CreateProcess failed: %lu", GetLastError());
-        return -1;
-    }
-    ResumeThread(pi.hThread);
-    uint32_t wait_ms = (time_ms == 0) ? INFINITE : (DWORD)time_ms;
-    DWORD w = WaitForSingleObject(pi.hProcess, wait_ms);
-    if (w == WAIT_TIMEOUT) {
-        TerminateProcess(pi.hProcess, 1);
-        CloseHandle(pi.hThread); CloseHandle(pi.hProcess);
-        if (out_exitcode) *out_exitcode = -1;
-        tr_set_last_error_fmt("tr_sandbox_run: timeout");
-        return -2;
-    }
-    DWORD exitcode = 0;
-    GetExitCodeProcess(pi.hProcess, &exitcode);
-    if (out_exitcode) *out_exitcode = (int)exitcode;
-    CloseHandle(pi.hThread); CloseHandle(pi.hProcess);
-    return 0;
+    if (!m) { tr_set_last_error_fmt("tr_module_run: invalid args"); return -1; }
+    void *fn = tr_module_symbol(m, "main");
+    if (!fn) return -1;
+    if (!m->thunks && m->h->nsyscalls && tr_module_register_syscalls(m, NULL) < 0) return -1;
+    return ((int (*)(int, char**))fn)(argc, argv);
 }
 
-#endif // sandbox
+/* Unregister the module's syscalls, release NASM blocks built from it and unmap it. Capsules
+   created from it must be destroyed first. */
+void tr_module_close(TrionModule *m)
+{
+    if (!m) return;
+    while (m->nregistered) tr_unregister_syscall(mod_str(m, m->syscalls[--m->nregistered].name));
+    for (uint32_t i = 0; i < m->h->nsymbols; ++i) if (m->nasm[i]) tr_nasm_unload(m->nasm[i]);
+    if (m->self) dlclose(m->self);
+    munmap(m->base, m->len);
+    tr_mutex_destroy(&m->lock);
+    free(m->thunks);
+    free(m->ready);
+    free(m->work);
+    free(m->nasm);
+    free(m);
+}
+#else
+typedef struct TrionModuleBuilder TrionModuleBuilder;
+typedef struct TrionModule TrionModule;
+TrionModuleBuilder *tr_module_builder_create(void) { tr_set_last_error_fmt("tr_module_builder_create: Not implemented on Windows"); return NULL; }
+void tr_module_builder_destroy(TrionModuleBuilder *b) { (void)b; }
+int tr_module_write(TrionModuleBuilder *b, const char *path) { (void)b; (void)path; tr_set_last_error_fmt("tr_module_write: Not implemented on Windows"); return -1; }
+TrionModule *tr_module_open(const char *path) { (void)path; tr_set_last_error_fmt("tr_module_open: Not implemented on Windows"); return NULL; }
+int tr_module_add_section(TrionModuleBuilder *b, int kind, const char *name, const void *data, size_t len) { (void)b; (void)kind; (void)name; (void)data; (void)len; tr_set_last_error_fmt("tr_module_add_section: Not implemented on Windows"); return -1; }
+int tr_module_add_symbol(TrionModuleBuilder *b, const char *name, int section, uint64_t value) { (void)b; (void)name; (void)section; (void)value; tr_set_last_error_fmt("tr_module_add_symbol: Not implemented on Windows"); return -1; }
+int tr_module_add_reloc(TrionModuleBuilder *b, int section, uint64_t offset, int type, int target_section, uint64_t target_value, int64_t addend) { (void)b; (void)section; (void)offset; (void)type; (void)target_section; (void)target_value; (void)addend; tr_set_last_error_fmt("tr_module_add_reloc: Not implemented on Windows"); return -1; }
+int tr_module_add_import_reloc(TrionModuleBuilder *b, int section, uint64_t offset, int type, const char *name, int weak, int64_t addend) { (void)b; (void)section; (void)offset; (void)type; (void)name; (void)weak; (void)addend; tr_set_last_error_fmt("tr_module_add_import_reloc: Not implemented on Windows"); return -1; }
+int tr_module_add_object(TrionModuleBuilder *b, const void *elf, size_t len) { (void)b; (void)elf; (void)len; tr_set_last_error_fmt("tr_module_add_object: Not implemented on Windows"); return -1; }
+int tr_module_add_nasm(TrionModuleBuilder *b, const char *nasm_src, const char *entry_symbol) { (void)b; (void)nasm_src; (void)entry_symbol; tr_set_last_error_fmt("tr_module_add_nasm: Not implemented on Windows"); return -1; }
+int tr_module_add_capsule(TrionModuleBuilder *b, const char *name, const char *entry_symbol, int mode) { (void)b; (void)name; (void)entry_symbol; (void)mode; tr_set_last_error_fmt("tr_module_add_capsule: Not implemented on Windows"); return -1; }
+int tr_module_add_syscall(TrionModuleBuilder *b, const char *name, const char *handler_symbol, int abi, int flags, const char *description) { (void)b; (void)name; (void)handler_symbol; (void)abi; (void)flags; (void)description; tr_set_last_error_fmt("tr_module_add_syscall: Not implemented on Windows"); return -1; }
+void *tr_module_symbol(TrionModule *m, const char *name) { (void)m; (void)name; tr_set_last_error_fmt("tr_module_symbol: Not implemented on Windows"); return NULL; }
+size_t tr_module_capsule_count(const TrionModule *m) { (void)m; return 0; }
+const char *tr_module_capsule_name(const TrionModule *m, size_t i) { (void)m; (void)i; return NULL; }
+Capsule *tr_module_capsule_create(TrionModule *m, const char *name, void *user_ctx) { (void)m; (void)name; (void)user_ctx; tr_set_last_error_fmt("tr_module_capsule_create: Not implemented on Windows"); return NULL; }
+int tr_module_register_syscalls(TrionModule *m, void *ctx) { (void)m; (void)ctx; tr_set_last_error_fmt("tr_module_register_syscalls: Not implemented on Windows"); return -1; }
+int tr_module_run(TrionModule *m, int argc, char **argv) { (void)m; (void)argc; (void)argv; tr_set_last_error_fmt("tr_module_run: Not implemented on Windows"); return -1; }
+void tr_module_close(TrionModule *m) { (void)m; }
+#endif
 
 /* ---------------------------
-   JIT / NASM bridging (switch to clang+LLVM with fallback)
-   - tr_nasm_compile_and_load: attempts clang first (preferred), falls back to nasm+clang/gcc, then to "no-compile" safe mode.
-   - Produces detailed logs written to tmpdir/build.log and returns err_msg containing diagnostics.
-   - On success returns pointer to symbol via dlopen/dlsym (POSIX).
+   Trion source lexer
+   - tr_lex: the token rules and kind codes of lexer.py, for hosts embedding the front-end
+   - table-driven: a 256-entry class table picks the token class from the first byte and a
+     per-class loop finishes the token; the result is an array of (kind, start, len) with
+     offsets into the caller's buffer, no allocation and no copies
+   - ASCII rules: a non-ASCII UTF-8 sequence is one TR_TOK_MISMATCH token and counts as a word
+     character for the \b checks on keywords and numbers (lexer.py decides those per code
+     point, so the two agree on all ASCII input)
    --------------------------- */
 
-#ifndef _WIN32
-#include <unistd.h>
-int tr_nasm_compile_and_load(const char *nasm_src, const char *entry_symbol, void **fn_ptr, char **err_msg)
+#define TR_TOK_IDENT    1
+#define TR_TOK_NUMBER   2
+#define TR_TOK_STRING   3
+#define TR_TOK_OP       4
+#define TR_TOK_MISMATCH 5
+#define TR_TOK_KEYWORD  16   /* TR_TOK_KEYWORD + keyword index (lexer.KEYWORDS order); any kind >= it is a keyword */
+
+typedef struct TrToken {
+    uint32_t start;          /* byte offset into the source */
+    uint32_t len;            /* byte length */
+    uint8_t kind;            /* TR_TOK_* */
+} TrToken;
+
+static const char *const g_lex_keywords[] = {
+    "Main", "Capsule", "If", "Then", "Else", "Elseif", "While", "For", "EndCapsule",
+    "Print", "Isolate", "Try", "Execute", "Fail", "True", "False", "Send", "Receive"
+};
+#define TR_LEX_NKEYWORDS (sizeof(g_lex_keywords) / sizeof(g_lex_keywords[0]))
+
+enum { LX_OTHER = 0, LX_SPACE, LX_NEWLINE, LX_DASH, LX_ALPHA, LX_DIGIT, LX_QUOTE, LX_OP, LX_HIGH };
+
+static unsigned char g_lex_class[256];
+static uint32_t g_lex_state = 0;      /* 0 = unbuilt, 1 = building, 2 = ready */
+
+static void lex_build_tables(void)
 {
-    if (!nasm_src || !entry_symbol || !fn_ptr) {
-        if (err_msg) *err_msg = strdup("invalid arguments");
-        tr_set_last_error_fmt("tr_nasm_compile_and_load: invalid args");
-        return -1;
+    for (int c = 0; c < 256; ++c) {
+        unsigned char k = LX_OTHER;
+        if (c >= 0x80) k = LX_HIGH;
+        else if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '_') k = LX_ALPHA;
+        else if (c >= '0' && c <= '9') k = LX_DIGIT;
+        else if (c == ' ' || c == '\t' || c == '\r') k = LX_SPACE;
+        else if (c == '\n') k = LX_NEWLINE;
+        else if (c == '-') k = LX_DASH;
+        else if (c == '"') k = LX_QUOTE;
+        else if (c && strchr("+*/<>=,:", c)) k = LX_OP;
+        g_lex_class[c] = k;
     }
-    // create tmpdir
-    char tmpl[] = "/tmp/trion_nasm_XXXXXX";
-    char *tmpdir = mkdtemp(tmpl);
-    if (!tmpdir) {
-        if (err_msg) *err_msg = strdup("mkdtemp failed");
-        tr_set_last_error_fmt("tr_nasm_compile_and_load: mkdtemp failed");
-        return -1;
+}
+
+static const unsigned char *lex_tables(void)
+{
+    uint32_t st = tr_atomic_load_acquire(&g_lex_state);
+    if (st != 2) {
+        st = 0;
+        if (tr_atomic_cas(&g_lex_state, &st, 1u)) {
+            lex_build_tables();
+            tr_atomic_store_release(&g_lex_state, 2u);
+        } else {
+            while (tr_atomic_load_acquire(&g_lex_state) != 2) tr_cpu_relax();
+        }
     }
-    char asm_path[1024], obj_path[1024], so_path[1024], log_path[1024];
-    snprintf(asm_path, sizeof(asm_path), "%s/module.asm", tmpdir);
-    snprintf(obj_path, sizeof(obj_path), "%s/module.o", tmpdir);
-    snprintf(so_path, sizeof(so_path), "%s/module.so", tmpdir);
-    snprintf(log_path, sizeof(log_path), "%s/build.log", tmpdir);
+    return g_lex_class;
+}
 
-    FILE *f = fopen(asm_path, "wb");
-    if (!f) { if (err_msg) *err_msg = strdup("fopen asm failed"); tr_set_last_error_fmt("fopen asm failed"); return -1; }
-    fwrite(nasm_src, 1, strlen(nasm_src), f); fclose(f);
+/* \w as the lexer sees it: ASCII alphanumerics, '_' and any non-ASCII byte */
+static inline int lex_is_word(const unsigned char *cls, unsigned char c)
+{
+    return cls[c] == LX_ALPHA || cls[c] == LX_DIGIT || cls[c] == LX_HIGH;
+}
 
-    // Try to use clang to compile assembly/object -> shared object
-    int used_clang = 0;
-    int r = -1;
-    {
-        // clang command: clang -c -x assembler -o module.o module.asm
-        char cmd[4096];
-        snprintf(cmd, sizeof(cmd), "clang -c -x assembler \"%s\" -o \"%s\" 2> \"%s\"", asm_path, obj_path, log_path);
-        r = system(cmd);
-        if (r == 0) {
-            used_clang = 1;
-            snprintf(cmd, sizeof(cmd), "clang -shared -fPIC -o \"%s\" \"%s\" 2>> \"%s\"", so_path, obj_path, log_path);
-            r = system(cmd);
-        }
-    }
-    if (r != 0) {
-        // fallback: try nasm + clang/gcc
-        char cmd[4096];
-        snprintf(cmd, sizeof(cmd), "nasm -f elf64 \"%s\" -o \"%s\" 2>> \"%s\"", asm_path, obj_path, log_path);
-        r = system(cmd);
-        if (r == 0) {
-            // link with clang if available, else gcc
-            if (system("which clang > /dev/null 2>&1") == 0) {
-                snprintf(cmd, sizeof(cmd), "clang -shared -fPIC -o \"%s\" \"%s\" 2>> \"%s\"", so_path, obj_path, log_path);
-            } else {
-                snprintf(cmd, sizeof(cmd), "gcc -shared -fPIC -o \"%s\" \"%s\" 2>> \"%s\"", so_path, obj_path, log_path);
-            }
-            r = system(cmd);
-        }
+static uint8_t lex_keyword_kind(const char *s, size_t n)
+{
+    for (size_t i = 0; i < TR_LEX_NKEYWORDS; ++i) {
+        const char *w = g_lex_keywords[i];
+        if (w[0] == s[0] && strlen(w) == n && memcmp(w, s, n) == 0) return (uint8_t)(TR_TOK_KEYWORD + i);
     }
+    return TR_TOK_IDENT;
+}
 
-    if (r != 0) {
-        if (err_msg) {
-            FILE *lf = fopen(log_path, "rb");
-            if (lf) {
-                fseek(lf, 0, SEEK_END); long sz = ftell(lf); fseek(lf, 0, SEEK_SET);
-                char *buf = (char*)malloc(sz + 256);
-                if (buf) {
-                    fread(buf, 1, sz, lf);
-                    buf[sz] = '\0';
-                    snprintf(buf + sz, 256, "\nCommand failed. Clang used=%d", used_clang);
-                    *err_msg = buf;
+/* Tokenize src[0..len). Up to max tokens go to out (which may be NULL when max is 0) and
+   *out_count receives the total number of tokens. Whitespace, comments and newlines are
+   dropped. Returns 0, -1 on invalid args, or -2 when out is too small (call again with
+   *out_count slots). */
+int tr_lex(const char *src, size_t len, TrToken *out, size_t max, size_t *out_count)
+{
+    if ((!src && len) || (!out && max) || !out_count) { tr_set_last_error_fmt("tr_lex: invalid args"); return -1; }
+    if (len > UINT32_MAX) { tr_set_last_error_fmt("tr_lex: source larger than 4 GiB"); return -1; }
+    const unsigned char *cls = lex_tables();
+    const unsigned char *s = (const unsigned char*)src;
+    size_t pos = 0, count = 0;
+    while (pos < len) {
+        unsigned char c = s[pos];
+        size_t end = pos + 1;
+        uint8_t kind = TR_TOK_MISMATCH;
+        switch (cls[c]) {
+        case LX_SPACE:
+            while (end < len && cls[s[end]] == LX_SPACE) ++end;
+            pos = end;
+            continue;
+        case LX_NEWLINE:
+            pos = end;
+            continue;
+        case LX_DASH:
+            if (end < len && s[end] == '-') {
+                const void *nl = memchr(s + end, '\n', len - end);
+                pos = nl ? (size_t)((const unsigned char*)nl - s) : len;
+                continue;
+            }
+            kind = TR_TOK_OP;
+            break;
+        case LX_ALPHA:
+            while (end < len && (cls[s[end]] == LX_ALPHA || cls[s[end]] == LX_DIGIT)) ++end;
+            kind = TR_TOK_IDENT;
+            if ((pos == 0 || !lex_is_word(cls, s[pos - 1])) && (end == len || !lex_is_word(cls, s[end])))
+                kind = lex_keyword_kind(src + pos, end - pos);
+            break;
+        case LX_DIGIT: {
+            /* \b\d+\b: the whole digit run, and only when neither side touches a word char */
+            size_t run = end;
+            while (run < len && cls[s[run]] == LX_DIGIT) ++run;
+            if ((pos == 0 || !lex_is_word(cls, s[pos - 1])) && (run == len || !lex_is_word(cls, s[run]))) {
+                kind = TR_TOK_NUMBER;
+                end = run;
+            }
+            break;
+        }
+        case LX_QUOTE: {
+            /* "(?:\\.|[^"\\])*" -- a backslash escapes anything but a newline */
+            size_t i = end;
+            while (i < len && s[i] != '"') {
+                if (s[i] == '\\') {
+                    if (i + 1 >= len || s[i + 1] == '\n') { i = len; break; }
+                    ++i;
                 }
-                fclose(lf);
-            } else {
-                *err_msg = strdup("build failed and no log available");
+                ++i;
             }
+            if (i < len) { kind = TR_TOK_STRING; end = i + 1; }
+            break;
         }
-        tr_set_last_error_fmt("tr_nasm_compile_and_load: build failed; see err_msg");
-        return -2;
-    }
-
-    // dlopen and dlsym
-    void *handle = dlopen(so_path, RTLD_NOW);
-    if (!handle) {
-        if (err_msg) *err_msg = strdup(dlerror());
-        tr_set_last_error_fmt("tr_nasm_compile_and_load: dlopen failed: %s", dlerror());
-        return -4;
-    }
-    void *sym = dlsym(handle, entry_symbol);
-    if (!sym) {
-        if (err_msg) *err_msg = strdup(dlerror());
-        dlclose(handle);
-        tr_set_last_error_fmt("tr_nasm_compile_and_load: dlsym failed: %s", dlerror());
-        return -5;
+        case LX_OP:
+            kind = TR_TOK_OP;
+            break;
+        case LX_HIGH:
+            while (end < len && (s[end] & 0xC0) == 0x80) ++end;   /* one token per UTF-8 sequence */
+            break;
+        default:
+            break;
+        }
+        if (count < max) {
+            out[count].start = (uint32_t)pos;
+            out[count].len = (uint32_t)(end - pos);
+            out[count].kind = kind;
+        }
+        ++count;
+        pos = end;
     }
-    *fn_ptr = sym;
-    tr_audit_log("jit_load: compiled and loaded %s entry=%s", asm_path, entry_symbol);
+    *out_count = count;
+    if (count > max) { tr_set_last_error_fmt("tr_lex: %zu tokens do not fit in %zu slots", count, max); return -2; }
     return 0;
 }
-#else
-int tr_nasm_compile_and_load(const char *nasm_src, const char *entry_symbol, void **fn_ptr, char **err_msg)
+
+const char *tr_lex_kind_name(int kind)
 {
-    (void)nasm_src; (void)entry_symbol; (void)fn_ptr;
-    if (err_msg) *err_msg = strdup("tr_nasm_compile_and_load: Not implemented on Windows in this runtime");
-    tr_set_last_error_fmt("tr_nasm_compile_and_load: Not implemented on Windows");
-    return -1;
+    switch (kind) {
+    case TR_TOK_IDENT: return "IDENT";
+    case TR_TOK_NUMBER: return "NUMBER";
+    case TR_TOK_STRING: return "STRING";
+    case TR_TOK_OP: return "OP";
+    case TR_TOK_MISMATCH: return "MISMATCH";
+    default: return kind >= TR_TOK_KEYWORD && kind < TR_TOK_KEYWORD + (int)TR_LEX_NKEYWORDS ? "KEYWORD" : NULL;
+    }
 }
-#endif
 
 /* ---------------------------
    Utility debug helpers
@@ -1444,13 +10642,20 @@ extern "C" {
 
 /* Error / audit */
 const char *tr_get_last_error_c(void) { return tr_get_last_error(); }
+int tr_get_last_error_code_c(void) { return tr_get_last_error_code(); }
+void tr_clear_last_error_c(void) { tr_clear_last_error(); }
 int tr_audit_open_c(const char *path) { return tr_audit_open(path); }
 void tr_audit_close_c(void) { tr_audit_close(); }
+int tr_audit_async_start_c(int full_policy, int fsync_policy, uint32_t fsync_param) { return tr_audit_async_start(full_policy, fsync_policy, fsync_param); }
+void tr_audit_async_stop_c(void) { tr_audit_async_stop(); }
 
 /* Quarantine API */
 Quarantine *tr_quarantine_create(size_t initial_capacity) { return quarantine_create(initial_capacity); }
+Quarantine *tr_quarantine_create_arena(size_t chunk_size) { return quarantine_create_arena(chunk_size); }
+Quarantine *tr_quarantine_create_slab(void) { return quarantine_create_slab(); }
 void *tr_quarantine_alloc(Quarantine *q, size_t size) { return quarantine_alloc(q, size); }
 int tr_quarantine_free(Quarantine *q, void *ptr) { return quarantine_free(q, ptr); }
+void tr_quarantine_reset(Quarantine *q) { quarantine_reset(q); }
 void tr_quarantine_seal(Quarantine *q) { quarantine_seal(q); }
 void tr_quarantine_destroy(Quarantine *q) { quarantine_destroy(q); }
 char *tr_quarantine_strdup(Quarantine *q, const char *s)
@@ -1465,14 +10670,31 @@ char *tr_quarantine_strdup(Quarantine *q, const char *s)
 
 /* Channel API */
 Channel *tr_channel_create(size_t capacity) { return channel_create(capacity); }
+Channel *tr_channel_create_ex(size_t capacity, int kind) { return channel_create_ex(capacity, kind); }
 int tr_channel_send(Channel *c, void *item) { return channel_send(c, item, 1, 0); } /* blocking */
 int tr_channel_try_send(Channel *c, void *item) { return channel_send(c, item, 0, 0); } /* non-blocking */
 int tr_channel_send_timed(Channel *c, void *item, uint32_t ms) { return channel_send(c, item, 1, ms); }
 int tr_channel_recv(Channel *c, void **out) { return channel_recv(c, out, 1, 0); }
 int tr_channel_try_recv(Channel *c, void **out) { return channel_recv(c, out, 0, 0); }
 int tr_channel_recv_timed(Channel *c, void **out, uint32_t ms) { return channel_recv(c, out, 1, ms); }
+int tr_channel_send_many(Channel *c, void *const *items, size_t n) { return channel_send_many(c, items, n, 1, 0); }
+int tr_channel_try_send_many(Channel *c, void *const *items, size_t n) { return channel_send_many(c, items, n, 0, 0); }
+int tr_channel_send_many_timed(Channel *c, void *const *items, size_t n, uint32_t ms) { return channel_send_many(c, items, n, 1, ms); }
+int tr_channel_recv_many(Channel *c, void **out, size_t max) { return channel_recv_many(c, out, max, 1, 0); }
+int tr_channel_try_recv_many(Channel *c, void **out, size_t max) { return channel_recv_many(c, out, max, 0, 0); }
+int tr_channel_recv_many_timed(Channel *c, void **out, size_t max, uint32_t ms) { return channel_recv_many(c, out, max, 1, ms); }
 void tr_channel_close(Channel *c) { channel_close(c); }
 void tr_channel_destroy(Channel *c) { channel_destroy(c); }
+void tr_channel_set_name(Channel *c, const char *name) { channel_set_name(c, name); }
+
+/* Metrics API */
+char *tr_metrics_snapshot_c(int format) { return tr_metrics_snapshot(format); }
+void tr_metrics_set_timing_c(int on) { tr_metrics_set_timing(on); }
+
+/* Trace API */
+int tr_trace_start_c(size_t events_per_thread) { return tr_trace_start(events_per_thread); }
+void tr_trace_stop_c(void) { tr_trace_stop(); }
+int tr_trace_dump_c(const char *path, int format) { return tr_trace_dump(path, format); }
 
 /* Thread API */
 int tr_thread_start(tr_thread_t *out, tr_thread_fn_t fn, void *arg) { return tr_thread_create(out, fn, arg); }
@@ -1481,37 +10703,84 @@ int tr_thread_wait(tr_thread_t t) { return tr_thread_join(t); }
 /* Dodecagram API (uint64) */
 int tr_dodecagram_to_base12(uint64_t n, char *out, size_t outlen) { return tr_to_base12_u64(n, out, outlen); }
 int tr_dodecagram_from_base12(const char *s, uint64_t *out) { return tr_from_base12_u64(s, out); }
+int tr_base12_encode_u64_array(const uint64_t *vals, size_t n, char sep, char *out, size_t outlen, size_t *out_written) { return b12_encode_u64_array(vals, n, sep, out, outlen, out_written); }
+int tr_base12_decode_u64_array(const char *buf, size_t len, char sep, uint64_t *out, size_t max, size_t *out_count) { return b12_decode_u64_array(buf, len, sep, out, max, out_count); }
 
 /* Bytes <-> base12 API (arbitrary length) */
 int tr_bytes_to_base12(const uint8_t *bytes, size_t len, char *out, size_t outlen) { return bytes_to_base12(bytes, len, out, outlen); }
 int tr_bytes_to_base12_scaled(const uint8_t *bytes, size_t len, int scale, char *out, size_t outlen) { return bytes_to_base12_scaled(bytes, len, scale, out, outlen); }
 int tr_base12_to_bytes(const char *s, uint8_t **out_bytes, size_t *out_len) { return base12_to_bytes(s, out_bytes, out_len); }
 int tr_base12_to_bytes_with_scale(const char *s, uint8_t **out_bytes, size_t *out_len, int *out_scale) { return base12_to_bytes_with_scale(s, out_bytes, out_len, out_scale); }
+int tr_base12_to_bytes_signed(const char *s, uint8_t **out_bytes, size_t *out_len, int *out_scale, int *out_neg) { return base12_to_bytes_ex(s, out_bytes, out_len, out_scale, out_neg); }
 
 /* Packet API */
 TrionPacket *tr_packet_create_owned(Quarantine *q, const void *payload, size_t len) { return tr_packet_create(q, payload, len); }
 void tr_packet_destroy_owned(TrionPacket *p) { tr_packet_destroy(p); }
 int tr_packet_drop_if_srcip(TrionPacket *p, uint32_t ip) { return tr_packet_drop_if_src_ip(p, ip); }
+TrionPacketPool *tr_packet_pool_create_c(Quarantine *q, size_t buf_size, size_t max_cached) { return tr_packet_pool_create(q, buf_size, max_cached); }
+void tr_packet_pool_destroy_c(TrionPacketPool *pool) { tr_packet_pool_destroy(pool); }
+TrionPacketBuf *tr_packet_buf_acquire_c(TrionPacketPool *pool) { return tr_packet_buf_acquire(pool); }
+void tr_packet_buf_retain_c(TrionPacketBuf *b) { tr_packet_buf_retain(b); }
+void tr_packet_buf_release_c(TrionPacketBuf *b) { tr_packet_buf_release(b); }
+void *tr_packet_buf_data_c(TrionPacketBuf *b) { return tr_packet_buf_data(b); }
+size_t tr_packet_buf_capacity_c(const TrionPacketBuf *b) { return tr_packet_buf_capacity(b); }
+TrionPacket *tr_packet_wrap_c(TrionPacketBuf *b, size_t off, size_t len) { return tr_packet_wrap(b, off, len); }
+TrionPacket *tr_packet_slice_c(const TrionPacket *p, size_t off, size_t len) { return tr_packet_slice(p, off, len); }
+TrionPacketFilter *tr_packet_filter_create_c(int default_action) { return tr_packet_filter_create(default_action); }
+void tr_packet_filter_destroy_c(TrionPacketFilter *f) { tr_packet_filter_destroy(f); }
+int tr_packet_filter_add_rule_c(TrionPacketFilter *f, uint32_t src_net, int src_prefix, uint32_t dst_net, int dst_prefix, uint16_t sport_lo, uint16_t sport_hi, uint16_t dport_lo, uint16_t dport_hi, int action) { return tr_packet_filter_add_rule(f, src_net, src_prefix, dst_net, dst_prefix, sport_lo, sport_hi, dport_lo, dport_hi, action); }
+int tr_packet_filter_block_c(TrionPacketFilter *f, uint32_t net, int prefix, int which) { return tr_packet_filter_block(f, net, prefix, which); }
+int tr_packet_filter_run_c(const TrionPacketFilter *f, TrionPacket *const *pkts, size_t n, uint64_t *drop_bitmap) { return tr_packet_filter_run(f, pkts, n, drop_bitmap); }
+TrionPacketIngest *tr_packet_ingest_create_c(int fd, int mode, int l2, TrionPacketPool *pool, Capsule **targets, size_t ntargets, size_t batch) { return tr_packet_ingest_create(fd, mode, l2, pool, targets, ntargets, batch); }
+int tr_packet_ingest_poll_c(TrionPacketIngest *g, uint32_t timeout_ms) { return tr_packet_ingest_poll(g, timeout_ms); }
+int tr_packet_ingest_start_c(TrionPacketIngest *g) { return tr_packet_ingest_start(g); }
+void tr_packet_ingest_stop_c(TrionPacketIngest *g) { tr_packet_ingest_stop(g); }
+void tr_packet_ingest_stats_c(const TrionPacketIngest *g, TrionIngestStats *out) { tr_packet_ingest_stats(g, out); }
+void tr_packet_ingest_destroy_c(TrionPacketIngest *g) { tr_packet_ingest_destroy(g); }
+int tr_packet_send_batch_c(int fd, TrionPacket *const *pkts, size_t n) { return tr_packet_send_batch(fd, pkts, n); }
 
 /* Capsule API */
-Capsule *tr_capsule_create(const char *name, int (*entry)(Capsule*, void*), void *user_ctx) { return tr_capsule_create(name, entry, user_ctx); }
-void tr_capsule_destroy(Capsule *c) { tr_capsule_destroy(c); }
-int tr_capsule_start(Capsule *c) { return tr_capsule_start(c); }
-int tr_capsule_join(Capsule *c) { return tr_capsule_join(c); }
-int tr_capsule_send(Capsule *c, void *msg) { return tr_capsule_send(c, msg); }
-int tr_capsule_try_send(Capsule *c, void *msg) { return tr_capsule_try_send(c, msg); }
+Capsule *tr_capsule_create_c(const char *name, int (*entry)(Capsule*, void*), void *user_ctx) { return tr_capsule_create(name, entry, user_ctx); }
+void tr_capsule_destroy_c(Capsule *c) { tr_capsule_destroy(c); }
+int tr_capsule_start_c(Capsule *c) { return tr_capsule_start(c); }
+int tr_capsule_join_c(Capsule *c) { return tr_capsule_join(c); }
+int tr_capsule_send_c(Capsule *c, void *msg) { return tr_capsule_send(c, msg); }
+int tr_capsule_try_send_c(Capsule *c, void *msg) { return tr_capsule_try_send(c, msg); }
+int tr_capsule_try_send_batch_c(Capsule *c, void *const *msgs, size_t n) { return tr_capsule_try_send_batch(c, msgs, n); }
+Capsule *tr_capsule_create_placed_c(const char *name, int (*entry)(Capsule*, void*), void *user_ctx, const TrCapsulePlacement *placement) { return tr_capsule_create_placed(name, entry, user_ctx, placement); }
+Capsule *tr_capsule_create_task_placed_c(const char *name, int (*step)(Capsule*, void*), void *user_ctx, const TrCapsulePlacement *placement) { return tr_capsule_create_task_placed(name, step, user_ctx, placement); }
+int tr_capsule_node_c(const Capsule *c) { return tr_capsule_node(c); }
+
+/* NUMA topology */
+int tr_numa_node_count_c(void) { return tr_numa_node_count(); }
+int tr_numa_node_of_cpu_c(int cpu) { return tr_numa_node_of_cpu(cpu); }
+int tr_numa_current_node_c(void) { return tr_numa_current_node(); }
 
 /* Event callbacks */
-int tr_register_event_callback(tr_event_callback_t cb, void *ctx) { return tr_register_event_callback(cb, ctx); }
+int tr_register_event_callback_c(tr_event_callback_t cb, void *ctx) { return tr_register_event_callback(cb, ctx); }
+int tr_register_event_callback_filtered(tr_event_callback_t cb, void *ctx, uint32_t event_mask) { return tr_register_event_callback_ex(cb, ctx, event_mask); }
 
 /* Timers */
 int tr_timer_start_ms(uint32_t ms, void (*cb)(void*), void *ctx) { return tr_timer_start(ms, cb, ctx); }
+int tr_timer_service_start(size_t dispatch_threads) { return timer_service_start(dispatch_threads); }
+void tr_timer_service_shutdown(void) { timer_service_shutdown(); }
+tr_timer_handle_t tr_timer_arm(uint32_t ms, uint32_t period_ms, void (*cb)(void*), void *ctx) { return timer_arm(ms, period_ms, cb, ctx); }
+int tr_timer_cancel(tr_timer_handle_t h) { return timer_cancel(h); }
 
 /* Syscall registry */
-int tr_register_syscall(const char *name, tr_syscall_handler_t handler, void *ctx) { return tr_register_syscall(name, handler, ctx); }
+int tr_register_syscall_c(const char *name, tr_syscall_handler_t handler, void *ctx) { return tr_register_syscall(name, handler, ctx); }
 int tr_register_syscall_ex_c(const char *name, tr_syscall_handler_t handler, void *ctx, int flags, const char *auth_token, const char *description) { return tr_register_syscall_ex(name, handler, ctx, flags, auth_token, description); }
-int tr_invoke_syscall(const char *name, const char *args_json, char **out_json) { return tr_invoke_syscall(name, args_json, out_json); }
+int tr_invoke_syscall_c(const char *name, const char *args_json, char **out_json) { return tr_invoke_syscall(name, args_json, out_json); }
 int tr_invoke_syscall_ex_c(const char *name, const char *args_json, const char *auth_token, char **out_json) { return tr_invoke_syscall_ex(name, args_json, auth_token, out_json); }
+tr_syscall_handle_t tr_resolve_syscall_c(const char *name) { return tr_resolve_syscall(name); }
+int tr_invoke_syscall_handle_c(tr_syscall_handle_t handle, const char *args_json, const char *auth_token, char **out_json) { return tr_invoke_syscall_handle(handle, args_json, auth_token, out_json); }
+int tr_register_syscall_bin_ex_c(const char *name, tr_syscall_bin_handler_t handler, const TrSyscallSchema *schema, void *ctx, int flags, const char *auth_token, const char *description) { return tr_register_syscall_bin_ex(name, handler, schema, ctx, flags, auth_token, description); }
+int tr_invoke_syscall_bin_c(const char *name, const void *args, size_t args_len, const char *auth_token, void *out, size_t *out_len) { return tr_invoke_syscall_bin(name, args, args_len, auth_token, out, out_len); }
+int tr_invoke_syscall_handle_bin_c(tr_syscall_handle_t handle, const void *args, size_t args_len, const char *auth_token, void *out, size_t *out_len) { return tr_invoke_syscall_handle_bin(handle, args, args_len, auth_token, out, out_len); }
+int tr_syscall_submit_c(TrSyscallReq *const *reqs, size_t n) { return tr_syscall_submit(reqs, n); }
+int tr_syscall_req_done_c(const TrSyscallReq *r) { return tr_syscall_req_done(r); }
+int tr_syscall_pool_start_c(size_t nthreads) { return tr_syscall_pool_start(nthreads); }
+void tr_syscall_pool_shutdown_c(void) { tr_syscall_pool_shutdown(); }
 
 /* Sandbox runner */
 int tr_sandbox_run_wrapper(const char *path, char *const argv[], char *const envp[],
@@ -1525,12 +10794,70 @@ int tr_sandbox_run_wrapper(const char *path, char *const argv[], char *const env
 {
     return tr_sandbox_run(path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid, out_exitcode);
 }
+int tr_sandbox_spawn_c(const char *path, char *const argv[], char *const envp[],
+                       const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+#ifdef _WIN32
+                       unsigned int run_uid, unsigned int run_gid,
+#else
+                       uid_t run_uid, gid_t run_gid,
+#endif
+                       TrionSandboxResult *res)
+{
+    return tr_sandbox_spawn(path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid, res);
+}
+TrionSandboxPool *tr_sandbox_pool_create_c(size_t nworkers) { return tr_sandbox_pool_create(nworkers); }
+int tr_sandbox_pool_run_c(TrionSandboxPool *p, const char *path, char *const argv[], char *const envp[],
+                          const char *working_dir, uint64_t time_ms, size_t memory_limit_bytes,
+#ifdef _WIN32
+                          unsigned int run_uid, unsigned int run_gid,
+#else
+                          uid_t run_uid, gid_t run_gid,
+#endif
+                          TrionSandboxResult *res)
+{
+    return tr_sandbox_pool_run(p, path, argv, envp, working_dir, time_ms, memory_limit_bytes, run_uid, run_gid, res);
+}
+void tr_sandbox_pool_destroy_c(TrionSandboxPool *p) { tr_sandbox_pool_destroy(p); }
 
 /* JIT/NASM compile & load */
 int tr_nasm_compile_and_load_wrapper(const char *nasm_src, const char *entry_symbol, void **fn_ptr, char **err_msg)
 {
     return tr_nasm_compile_and_load(nasm_src, entry_symbol, fn_ptr, err_msg);
 }
+int tr_nasm_unload_wrapper(void *fn_ptr) { return tr_nasm_unload(fn_ptr); }
+int tr_nasm_compile_batch_c(TrionNasmBlock *blocks, size_t n, int max_workers) { return tr_nasm_compile_batch(blocks, n, max_workers); }
+#ifndef _WIN32
+int tr_jit_assemble_c(const char *nasm_src, TrionJitModule **out, char **err_msg) { return tr_jit_assemble(nasm_src, out, err_msg); }
+void *tr_jit_module_symbol_c(const TrionJitModule *m, const char *name) { return tr_jit_module_symbol(m, name); }
+void tr_jit_module_unload_c(TrionJitModule *m) { tr_jit_module_unload(m); }
+#endif
+
+/* Precompiled module images */
+TrionModuleBuilder *tr_module_builder_create_c(void) { return tr_module_builder_create(); }
+void tr_module_builder_destroy_c(TrionModuleBuilder *b) { tr_module_builder_destroy(b); }
+int tr_module_write_c(TrionModuleBuilder *b, const char *path) { return tr_module_write(b, path); }
+TrionModule *tr_module_open_c(const char *path) { return tr_module_open(path); }
+void *tr_module_symbol_c(TrionModule *m, const char *name) { return tr_module_symbol(m, name); }
+void tr_module_close_c(TrionModule *m) { tr_module_close(m); }
+#ifndef _WIN32
+int tr_module_add_section_c(TrionModuleBuilder *b, int kind, const char *name, const void *data, size_t len) { return tr_module_add_section(b, kind, name, data, len); }
+int tr_module_add_symbol_c(TrionModuleBuilder *b, const char *name, int section, uint64_t value) { return tr_module_add_symbol(b, name, section, value); }
+int tr_module_add_reloc_c(TrionModuleBuilder *b, int section, uint64_t offset, int type, int target_section, uint64_t target_value, int64_t addend) { return tr_module_add_reloc(b, section, offset, type, target_section, target_value, addend); }
+int tr_module_add_import_reloc_c(TrionModuleBuilder *b, int section, uint64_t offset, int type, const char *name, int weak, int64_t addend) { return tr_module_add_import_reloc(b, section, offset, type, name, weak, addend); }
+int tr_module_add_object_c(TrionModuleBuilder *b, const void *elf, size_t len) { return tr_module_add_object(b, elf, len); }
+int tr_module_add_nasm_c(TrionModuleBuilder *b, const char *nasm_src, const char *entry_symbol) { return tr_module_add_nasm(b, nasm_src, entry_symbol); }
+int tr_module_add_capsule_c(TrionModuleBuilder *b, const char *name, const char *entry_symbol, int mode) { return tr_module_add_capsule(b, name, entry_symbol, mode); }
+int tr_module_add_syscall_c(TrionModuleBuilder *b, const char *name, const char *handler_symbol, int abi, int flags, const char *description) { return tr_module_add_syscall(b, name, handler_symbol, abi, flags, description); }
+size_t tr_module_capsule_count_c(const TrionModule *m) { return tr_module_capsule_count(m); }
+const char *tr_module_capsule_name_c(const TrionModule *m, size_t i) { return tr_module_capsule_name(m, i); }
+Capsule *tr_module_capsule_create_c(TrionModule *m, const char *name, void *user_ctx) { return tr_module_capsule_create(m, name, user_ctx); }
+int tr_module_register_syscalls_c(TrionModule *m, void *ctx) { return tr_module_register_syscalls(m, ctx); }
+int tr_module_run_c(TrionModule *m, int argc, char **argv) { return tr_module_run(m, argc, argv); }
+#endif
+
+/* Source lexer */
+int tr_lex_c(const char *src, size_t len, TrToken *out, size_t max, size_t *out_count) { return tr_lex(src, len, out, max, out_count); }
+const char *tr_lex_kind_name_c(int kind) { return tr_lex_kind_name(kind); }
 
 /* Logging */
 void tr_log_printf(const char *fmt, ...)